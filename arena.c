@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include "arena.h"
+
+/* Most allocations are a handful of words (a Syntax node and its
+ * payload), so we grab memory from malloc in large blocks and hand it
+ * out by bumping a pointer.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT sizeof(void *)
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+Arena *arena_new(void) {
+    Arena *arena = malloc(sizeof(Arena));
+    arena->blocks = NULL;
+    arena->bytes_allocated = 0;
+    arena->block_count = 0;
+    arena->node_count = 0;
+
+    return arena;
+}
+
+static ArenaBlock *arena_block_new(Arena *arena, size_t capacity) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL) {
+        err(1, "Could not allocate %zu bytes for arena", capacity);
+    }
+
+    block->used = 0;
+    block->capacity = capacity;
+    arena->block_count++;
+
+    return block;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size);
+
+    ArenaBlock *block = arena->blocks;
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // Large allocations get a block of their own. We put it
+        // behind the current block, so we don't waste the space left
+        // in the current block.
+        block = arena_block_new(arena, size);
+        if (arena->blocks == NULL) {
+            block->next = NULL;
+            arena->blocks = block;
+        } else {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+    } else if (block == NULL || block->capacity - block->used < size) {
+        block = arena_block_new(arena, ARENA_BLOCK_SIZE);
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->bytes_allocated += size;
+
+    return ptr;
+}
+
+/* Resize PTR, which was allocated in ARENA with OLD_SIZE bytes. If
+ * PTR was the most recent allocation we grow it in place, otherwise
+ * we copy it.
+ */
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size,
+                    size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    size_t old_aligned = align_up(old_size);
+    size_t new_aligned = align_up(new_size);
+
+    ArenaBlock *block = arena->blocks;
+    char *start = ptr;
+    if (start + old_aligned == block->data + block->used &&
+        (size_t)(start - block->data) + new_aligned <= block->capacity) {
+        block->used = (start - block->data) + new_aligned;
+        arena->bytes_allocated += new_aligned - old_aligned;
+        return ptr;
+    }
+
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+char *arena_strdup(Arena *arena, char *s) {
+    size_t length = strlen(s) + 1;
+    char *copy = arena_alloc(arena, length);
+    memcpy(copy, s, length);
+
+    return copy;
+}
+
+/* Release everything allocated in ARENA. This is proportional to the
+ * number of blocks, not the number of allocations.
+ */
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
@@ -0,0 +1,34 @@
+#include <stddef.h>
+
+#ifndef BABYC_ARENA_HEADER
+#define BABYC_ARENA_HEADER
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} ArenaBlock;
+
+/* A bump allocator. Everything allocated in an arena is released
+ * together by arena_free, so individual allocations are never freed.
+ */
+typedef struct Arena {
+    ArenaBlock *blocks;
+    // Statistics, so we can see how much memory a compilation uses.
+    size_t bytes_allocated;
+    size_t block_count;
+    size_t node_count;
+} Arena;
+
+Arena *arena_new(void);
+
+void *arena_alloc(Arena *arena, size_t size);
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+char *arena_strdup(Arena *arena, char *s);
+
+void arena_free(Arena *arena);
+
+#endif
@@ -5,264 +5,1507 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <err.h>
+#include "assembly.h"
 #include "syntax.h"
 #include "environment.h"
 #include "context.h"
+#include "flat_syntax.h"
+#include "emitter.h"
+#include "regalloc.h"
+#include "ir.h"
+#include "peephole.h"
+#include "target.h"
+#include "errors.h"
 
 static const int WORD_SIZE = 4;
+// Every value is a 32-bit int, so spill slots are this size on every
+// target.
+static const int SLOT_SIZE = 4;
 const int MAX_MNEMONIC_LENGTH = 7;
 
-void emit_header(FILE *out, char *name) { fprintf(out, "%s\n", name); }
+void emit_header(Emitter *out, char *name) {
+    emit_string(out, name);
+    emit_bytes(out, "\n", 1);
+}
 
-/* Write instruction INSTR with OPERANDS to OUT.
- *
- * Example:
- * emit_instr(out, "MOV", "%eax, 1");
+/* Write the indentation and mnemonic INSTR, padded so operands are
+ * aligned regardless of the mnemonic length.
  */
-void emit_instr(FILE *out, char *instr, char *operands) {
-    // TODO: fix duplication with emit_instr_format.
+void emit_mnemonic(Emitter *out, char *instr) {
     // The assembler requires at least 4 spaces for indentation.
-    fprintf(out, "    %s", instr);
+    emit_bytes(out, "    ", 4);
+
+    size_t length = strlen(instr);
+    emit_bytes(out, instr, length);
 
-    // Ensure our argument are aligned, regardless of the assembly
-    // mnemonic length.
-    int argument_offset = MAX_MNEMONIC_LENGTH - strlen(instr) + 4;
-    while (argument_offset > 0) {
-        fprintf(out, " ");
-        argument_offset--;
+    static char padding[] = "                ";
+    int argument_offset = MAX_MNEMONIC_LENGTH - length + 4;
+    if (argument_offset > 0) {
+        emit_bytes(out, padding, argument_offset);
     }
+}
 
-    fprintf(out, "%s\n", operands);
+/* Write instruction INSTR with OPERANDS to OUT.
+ *
+ * Example:
+ * emit_instr(out, "MOV", "%eax, 1");
+ */
+void emit_instr(Emitter *out, char *instr, char *operands) {
+    emit_mnemonic(out, instr);
+    emit_string(out, operands);
+    emit_bytes(out, "\n", 1);
 }
 
 /* Write instruction INSTR with formatted operands OPERANDS_FORMAT to
- * OUT.
+ * OUT. See emit_format for the directives supported.
  *
  * Example:
- * emit_instr_format(out, "MOV", "%%eax, %s", 5);
+ * emit_instr_format(out, "MOV", "%%eax, %d", 5);
  */
-void emit_instr_format(FILE *out, char *instr, char *operands_format, ...) {
-    // The assembler requires at least 4 spaces for indentation.
-    fprintf(out, "    %s", instr);
-
-    // Ensure our argument are aligned, regardless of the assembly
-    // mnemonic length.
-    int argument_offset = MAX_MNEMONIC_LENGTH - strlen(instr) + 4;
-    while (argument_offset > 0) {
-        fprintf(out, " ");
-        argument_offset--;
-    }
+void emit_instr_format(Emitter *out, char *instr, char *operands_format,
+                       ...) {
+    emit_mnemonic(out, instr);
 
     va_list argptr;
     va_start(argptr, operands_format);
-    vfprintf(out, operands_format, argptr);
+    emit_vformat(out, operands_format, argptr);
     va_end(argptr);
 
-    fputs("\n", out);
+    emit_bytes(out, "\n", 1);
 }
 
-char *fresh_local_label(char *prefix, Context *ctx) {
-    // We assume we never write more than 6 chars of digits, plus a '.' and '_'.
-    size_t buffer_size = strlen(prefix) + 8;
-    char *buffer = malloc(buffer_size);
-
-    snprintf(buffer, buffer_size, ".%s_%d", prefix, ctx->label_count);
+Label fresh_local_label(char *prefix, Context *ctx) {
+    Label label = {prefix, ctx->label_count};
     ctx->label_count++;
 
-    return buffer;
+    return label;
+}
+
+void emit_label(Emitter *out, Label label) {
+    emit_label_name(out, label);
+    emit_bytes(out, ":\n", 2);
 }
 
-void emit_label(FILE *out, char *label) { fprintf(out, "%s:\n", label); }
+void emit_function_declaration(Emitter *out, char *name) {
+    emit_format(out, "    .global %s\n", name);
+    emit_format(out, "%s:\n", name);
+}
 
-void emit_function_declaration(FILE *out, char *name) {
-    fprintf(out, "    .global %s\n", name);
-    fprintf(out, "%s:\n", name);
+void emit_function_prologue(Emitter *out, Target *target) {
+    emit_instr(out, target->push, target->frame_pointer);
+    emit_instr_format(out, "mov", "%s, %s", target->stack_pointer,
+                      target->frame_pointer);
+    emit_bytes(out, "\n", 1);
 }
 
-void emit_function_prologue(FILE *out) {
-    emit_instr(out, "pushl", "%ebp");
-    emit_instr(out, "mov", "%esp, %ebp");
-    fprintf(out, "\n");
+/* Return from the current function, tearing down the frame that
+ * emit_function_prologue set up if there is one.
+ */
+void emit_return(Emitter *out, Context *ctx) {
+    if (ctx->has_frame) {
+        emit_string(out, "    leave\n");
+    }
+    emit_string(out, "    ret\n");
 }
 
-void emit_return(FILE *out) {
-    fprintf(out, "    leave\n");
-    fprintf(out, "    ret\n");
+/* Tear down the current frame, as emit_return does, and jump to
+ * FUNCTION_NAME. It returns straight to our caller.
+ */
+void emit_tail_call(Emitter *out, Context *ctx, char *function_name) {
+    if (ctx->has_frame) {
+        emit_string(out, "    leave\n");
+    }
+    emit_instr(out, "jmp", function_name);
 }
 
-void emit_function_epilogue(FILE *out) {
-    emit_return(out);
-    fprintf(out, "\n");
+void emit_function_epilogue(Emitter *out, Context *ctx) {
+    emit_return(out, ctx);
+    emit_bytes(out, "\n", 1);
 }
 
-void write_header(FILE *out) { emit_header(out, "    .text"); }
+/* Decide whether the function we're about to write needs a frame,
+ * and write the prologue if so.
+ */
+static void begin_function_frame(Emitter *out, bool needs_frame,
+                                 Context *ctx) {
+    ctx->frame_stats.function_count++;
+    ctx->has_frame = needs_frame;
 
-void write_footer(FILE *out) {
+    if (needs_frame) {
+        emit_function_prologue(out, ctx->target);
+    } else {
+        ctx->frame_stats.frames_eliminated++;
+    }
+}
+
+void print_frame_stats(FrameStats *stats) {
+    printf("Frames eliminated: %d of %d functions.\n",
+           stats->frames_eliminated, stats->function_count);
+}
+
+void write_header(Emitter *out) { emit_header(out, "    .text"); }
+
+/* Write _start, which calls main and exits with its result. */
+void write_footer(Emitter *out, Target *target) {
     // TODO: this will break if a user defines a function called '_start'.
     emit_function_declaration(out, "_start");
-    emit_function_prologue(out);
+    if (target->word_size == 8) {
+        // The kernel aligns the stack, so the call leaves main with it
+        // exactly as System V expects.
+        emit_instr(out, "call", "main");
+        emit_instr(out, "mov", "%eax, %edi");
+        emit_instr(out, "mov", "$60, %eax");
+        emit_string(out, "    syscall\n");
+        return;
+    }
+
+    emit_function_prologue(out, target);
     emit_instr(out, "call", "main");
     emit_instr(out, "mov", "%eax, %ebx");
     emit_instr(out, "mov", "$1, %eax");
     emit_instr(out, "int", "$0x80");
 }
 
-void write_syntax(FILE *out, Syntax *syntax, Context *ctx) {
-    // Note stack_offset is the next unused memory address in the
-    // stack, so we can use it directly but must adjust it for the next caller.
-    if (syntax->type == UNARY_OPERATOR) {
-        UnaryExpression *unary_syntax = syntax->unary_expression;
+// %eax is never allocated. It holds return values, and we use it as
+// a scratch register when an x86 instruction can't take the operands
+// we have, e.g. two memory operands.
+static const Register SCRATCH_REGISTER = REG_EAX;
+
+/* An x86 operand. */
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_MEMORY,
+    // Memory relative to %esp, for incoming arguments in functions
+    // without a frame.
+    OPERAND_STACK,
+    OPERAND_IMMEDIATE,
+} OperandKind;
+
+typedef struct Operand {
+    OperandKind kind;
+    // A Register, an offset from BASE, or an immediate value.
+    int value;
+    // The frame or stack pointer, for memory operands.
+    char *base;
+} Operand;
+
+static bool operand_in_memory(Operand operand) {
+    return operand.kind == OPERAND_MEMORY || operand.kind == OPERAND_STACK;
+}
+
+static Operand register_operand(Register reg) {
+    Operand operand = {OPERAND_REGISTER, reg, NULL};
+    return operand;
+}
+
+/* Where the value of IR_OPERAND lives, according to the register
+ * allocation in ctx->intervals.
+ */
+static Operand operand_for(IrOperand ir_operand, Context *ctx) {
+    Operand operand = {OPERAND_IMMEDIATE, 0, NULL};
+
+    if (ir_operand.kind == IR_OPERAND_CONSTANT) {
+        operand.kind = OPERAND_IMMEDIATE;
+        operand.value = ir_operand.value;
+    } else {
+        LiveInterval *interval = list_get(ctx->intervals, ir_operand.value);
+        if (interval->reg != NO_REGISTER) {
+            operand.kind = OPERAND_REGISTER;
+            operand.value = interval->reg;
+        } else {
+            operand.kind = OPERAND_MEMORY;
+            operand.value = interval->stack_offset;
+            operand.base = ctx->target->frame_pointer;
+        }
+    }
+
+    return operand;
+}
+
+static Operand dest_operand(IrInstruction *instruction, Context *ctx) {
+    return operand_for(ir_vreg_operand(instruction->dest), ctx);
+}
+
+static bool operands_equal(Operand left, Operand right) {
+    return left.kind == right.kind && left.value == right.value;
+}
+
+static void emit_operand(Emitter *out, Operand operand) {
+    if (operand.kind == OPERAND_REGISTER) {
+        emit_string(out, register_name(operand.value));
+    } else if (operand_in_memory(operand)) {
+        emit_format(out, "%d(%s)", operand.value, operand.base);
+    } else {
+        emit_format(out, "$%d", operand.value);
+    }
+}
+
+/* Write `INSTR SOURCE, DEST`. */
+static void emit_operands_instr(Emitter *out, char *instr, Operand source,
+                                Operand dest) {
+    if (source.kind == OPERAND_IMMEDIATE && operand_in_memory(dest)) {
+        // The assembler can't infer the operand size, so say it's a
+        // long.
+        char sized_instr[MAX_MNEMONIC_LENGTH + 2];
+        snprintf(sized_instr, sizeof(sized_instr), "%sl", instr);
+        emit_mnemonic(out, sized_instr);
+    } else {
+        emit_mnemonic(out, instr);
+    }
+
+    emit_operand(out, source);
+    emit_bytes(out, ", ", 2);
+    emit_operand(out, dest);
+    emit_bytes(out, "\n", 1);
+}
+
+static void emit_move(Emitter *out, Operand source, Operand dest) {
+    if (operands_equal(source, dest)) {
+        return;
+    }
+
+    if (operand_in_memory(source) && operand_in_memory(dest)) {
+        Operand scratch = register_operand(SCRATCH_REGISTER);
+        emit_operands_instr(out, "mov", source, scratch);
+        source = scratch;
+    }
+    emit_operands_instr(out, "mov", source, dest);
+}
+
+/* Is OPERAND the source of any of the COUNT moves? */
+static bool is_move_source(Operand operand, Operand *sources, int count) {
+    for (int i = 0; i < count; i++) {
+        if (operands_equal(operand, sources[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Move SOURCES[i] to DESTS[i], as if all the moves happened at once.
+ * A source may be another move's destination, e.g. when passing
+ * arguments in registers. SOURCES and DESTS are overwritten.
+ *
+ * We write a move once nothing else needs its destination. If every
+ * remaining destination is needed, they form cycles, and we break one
+ * by saving a destination in the scratch register. That register is
+ * also used for memory to memory moves, so no move may be one.
+ */
+static void emit_parallel_move(Emitter *out, Operand *sources, Operand *dests,
+                               int count) {
+    // Only the last move to a destination is visible afterwards, and
+    // moves to themselves do nothing.
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        bool overwritten = false;
+        for (int j = i + 1; j < count; j++) {
+            if (operands_equal(dests[i], dests[j])) {
+                overwritten = true;
+            }
+        }
+        assert(!operand_in_memory(sources[i]) || !operand_in_memory(dests[i]));
+        if (!overwritten && !operands_equal(sources[i], dests[i])) {
+            sources[pending] = sources[i];
+            dests[pending] = dests[i];
+            pending++;
+        }
+    }
+
+    while (pending > 0) {
+        int ready = -1;
+        for (int i = 0; i < pending && ready == -1; i++) {
+            if (!is_move_source(dests[i], sources, pending)) {
+                ready = i;
+            }
+        }
+
+        if (ready == -1) {
+            Operand saved = dests[0];
+            Operand scratch = register_operand(SCRATCH_REGISTER);
+            emit_move(out, saved, scratch);
+            for (int i = 0; i < pending; i++) {
+                if (operands_equal(sources[i], saved)) {
+                    sources[i] = scratch;
+                }
+            }
+            ready = 0;
+        }
+
+        emit_move(out, sources[ready], dests[ready]);
+        pending--;
+        sources[ready] = sources[pending];
+        dests[ready] = dests[pending];
+    }
+}
+
+/* CMP can't take an immediate on the left. Rather than loading it into
+ * a register, emit_compare compares the other way round, and the
+ * caller must swap its condition (e.g. setg instead of setl).
+ */
+static bool compare_reversed(Operand left, Operand right) {
+    return left.kind == OPERAND_IMMEDIATE && right.kind != OPERAND_IMMEDIATE;
+}
+
+/* Compare LEFT with RIGHT, setting the flags for LEFT - RIGHT, or for
+ * RIGHT - LEFT if compare_reversed.
+ */
+static void emit_compare(Emitter *out, Operand left, Operand right) {
+    if (compare_reversed(left, right)) {
+        Operand swap = left;
+        left = right;
+        right = swap;
+    }
+
+    // CMP can't take an immediate or two memory operands on the left.
+    if (left.kind == OPERAND_IMMEDIATE ||
+        (left.kind == OPERAND_MEMORY && right.kind == OPERAND_MEMORY)) {
+        Operand scratch = register_operand(SCRATCH_REGISTER);
+        emit_move(out, left, scratch);
+        left = scratch;
+    }
+
+    // To compare x < y in AT&T syntax, we write CMP y,x.
+    // http://stackoverflow.com/q/25493255/509706
+    emit_operands_instr(out, "cmp", right, left);
+}
+
+/* After a comparison, set DEST to 0 or 1 with SET_INSTR (e.g. setl). */
+static void emit_set_condition(Emitter *out, char *set_instr, Operand dest) {
+    Register reg = SCRATCH_REGISTER;
+    if (dest.kind == OPERAND_REGISTER && register_byte_name(dest.value)) {
+        reg = dest.value;
+    }
+
+    emit_instr(out, set_instr, register_byte_name(reg));
+    // Zero the rest of the register.
+    emit_instr_format(out, "movzbl", "%s, %s", register_byte_name(reg),
+                      register_name(reg));
+    emit_move(out, register_operand(reg), dest);
+}
+
+/* Write DEST = LEFT INSTR RIGHT, where INSTR is a two-operand x86
+ * instruction that computes dest = dest INSTR source.
+ */
+static void emit_arithmetic(Emitter *out, char *instr, bool commutative,
+                            Operand dest, Operand left, Operand right) {
+    if (commutative && operands_equal(dest, right) &&
+        !operands_equal(dest, left)) {
+        Operand swap = left;
+        left = right;
+        right = swap;
+    }
+
+    if (dest.kind == OPERAND_REGISTER && !operands_equal(dest, right)) {
+        emit_move(out, left, dest);
+        emit_operands_instr(out, instr, right, dest);
+
+    } else if (dest.kind == OPERAND_MEMORY && operands_equal(dest, left) &&
+               right.kind != OPERAND_MEMORY && strcmp(instr, "imul") != 0) {
+        // We can operate on the stack slot directly, e.g.
+        // addl $1, -8(%ebp).
+        emit_operands_instr(out, instr, right, dest);
+
+    } else {
+        Operand scratch = register_operand(SCRATCH_REGISTER);
+        emit_move(out, left, scratch);
+        emit_operands_instr(out, instr, right, scratch);
+        emit_move(out, scratch, dest);
+    }
+}
+
+/* If VALUE is a power of two, return its base 2 logarithm, otherwise
+ * -1.
+ */
+static int power_of_two(int value) {
+    if (value <= 0 || (value & (value - 1)) != 0) {
+        return -1;
+    }
+
+    int shift = 0;
+    while (value > 1) {
+        value >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+/* Write DEST = LEFT * RIGHT. Multiplying by a constant doesn't need a
+ * general imul: we shift for powers of two, and use lea for 3, 5 and 9
+ * (x + x * 2, x + x * 4 and x + x * 8). Other constants use the three
+ * operand imul, which takes an immediate and may read from memory.
+ */
+static void emit_multiply(Emitter *out, Target *target, Operand dest,
+                          Operand left, Operand right) {
+    if (left.kind == OPERAND_IMMEDIATE) {
+        Operand swap = left;
+        left = right;
+        right = swap;
+    }
+
+    if (right.kind != OPERAND_IMMEDIATE) {
+        emit_arithmetic(out, "imul", true, dest, left, right);
+        return;
+    }
+
+    int value = right.value;
+    if (left.kind == OPERAND_IMMEDIATE) {
+        // Unsigned, as signed overflow is undefined.
+        Operand product = {
+            OPERAND_IMMEDIATE,
+            (int)((unsigned int)left.value * (unsigned int)value), NULL};
+        emit_move(out, product, dest);
+        return;
+    }
+    if (value == 0 || value == 1) {
+        emit_move(out, value == 0 ? right : left, dest);
+        return;
+    }
+
+    int shift = power_of_two(value);
+    if (shift > 0) {
+        Operand amount = {OPERAND_IMMEDIATE, shift, NULL};
+        emit_arithmetic(out, "shl", false, dest, left, amount);
+        return;
+    }
+
+    // lea and imul can only write to a register.
+    Operand result = dest;
+    if (dest.kind != OPERAND_REGISTER) {
+        result = register_operand(SCRATCH_REGISTER);
+    }
+
+    if (value == 3 || value == 5 || value == 9) {
+        if (left.kind != OPERAND_REGISTER) {
+            emit_move(out, left, result);
+            left = result;
+        }
+        // Addresses are computed at the target's word size.
+        char *base = target_register_name(target, left.value);
+        emit_instr_format(out, "lea", "(%s,%s,%d), %s", base, base, value - 1,
+                          register_name(result.value));
+    } else {
+        emit_mnemonic(out, "imul");
+        emit_operand(out, right);
+        emit_bytes(out, ", ", 2);
+        emit_operand(out, left);
+        emit_bytes(out, ", ", 2);
+        emit_operand(out, result);
+        emit_bytes(out, "\n", 1);
+    }
+    emit_move(out, result, dest);
+}
+
+/* Write DEST = LEFT + RIGHT, or DEST = LEFT - RIGHT if SUBTRACT. Adding
+ * a constant to one register and writing the sum to another is a
+ * single lea, rather than a move and an add.
+ */
+static void emit_add(Emitter *out, Target *target, Operand dest, Operand left,
+                     Operand right, bool subtract) {
+    if (!subtract && left.kind == OPERAND_IMMEDIATE) {
+        Operand swap = left;
+        left = right;
+        right = swap;
+    }
+
+    if (right.kind == OPERAND_IMMEDIATE && left.kind == OPERAND_REGISTER &&
+        dest.kind == OPERAND_REGISTER && !operands_equal(dest, left)) {
+        unsigned int offset = right.value;
+        if (subtract) {
+            offset = -offset;
+        }
+        emit_instr_format(out, "lea", "%d(%s), %s", (int)offset,
+                          target_register_name(target, left.value),
+                          register_name(dest.value));
+        return;
+    }
+
+    emit_arithmetic(out, subtract ? "sub" : "add", !subtract, dest, left,
+                    right);
+}
+
+/* Save the callee-saved registers the current function uses, after
+ * the usual prologue (if any).
+ */
+static void emit_save_registers(Emitter *out, Context *ctx) {
+    Target *target = ctx->target;
+    for (int i = 0; i < target->callee_saved_register_count; i++) {
+        Register reg = target->callee_saved_registers[i];
+        if (ctx->callee_saved_used & REGISTER_BIT(reg)) {
+            emit_instr(out, "push", target_register_name(target, reg));
+            ctx->stack_offset -= target->word_size;
+        }
+    }
+}
+
+/* Restore the registers saved by emit_save_registers. With a frame
+ * we restore relative to %ebp, so this is correct regardless of what
+ * else is on the stack. Without one, nothing else is on the stack
+ * when we leave the function, so we can pop them.
+ */
+static void emit_restore_registers(Emitter *out, Context *ctx) {
+    Target *target = ctx->target;
+    if (!ctx->has_frame) {
+        for (int i = target->callee_saved_register_count - 1; i >= 0; i--) {
+            Register reg = target->callee_saved_registers[i];
+            if (ctx->callee_saved_used & REGISTER_BIT(reg)) {
+                emit_instr(out, "pop", target_register_name(target, reg));
+            }
+        }
+        return;
+    }
+
+    int offset = -1 * target->word_size;
+    for (int i = 0; i < target->callee_saved_register_count; i++) {
+        Register reg = target->callee_saved_registers[i];
+        if (ctx->callee_saved_used & REGISTER_BIT(reg)) {
+            emit_instr_format(out, "mov", "%d(%s), %s", offset,
+                              target->frame_pointer,
+                              target_register_name(target, reg));
+            offset -= target->word_size;
+        }
+    }
+}
+
+// The registers that CONVENTION passes the first arguments in, see
+// ir_register_argument_count.
+static Register fastcall_argument_registers[] = {REG_ECX, REG_EDX};
+static Register sysv_argument_registers[] = {REG_EDI, REG_ESI, REG_EDX,
+                                             REG_ECX, REG_R8,  REG_R9};
+
+static Register *argument_registers(CallingConvention convention) {
+    if (convention == CALLING_CONVENTION_SYSV) {
+        return sysv_argument_registers;
+    }
+    return fastcall_argument_registers;
+}
+
+/* Where our caller put the stack argument at STACK_INDEX. Without a
+ * frame, this is only correct when nothing has been pushed since we
+ * saved registers, i.e. at the start of the function or a tail call.
+ */
+static Operand incoming_argument(int stack_index, Context *ctx) {
+    int word_size = ctx->target->word_size;
+    Operand operand;
+    if (ctx->has_frame) {
+        // Above the saved %ebp and the return address.
+        operand.kind = OPERAND_MEMORY;
+        operand.value = 2 * word_size + stack_index * word_size;
+        operand.base = ctx->target->frame_pointer;
+    } else {
+        // Above the saved registers and the return address.
+        int saved_size = __builtin_popcount(ctx->callee_saved_used) * word_size;
+        operand.kind = OPERAND_STACK;
+        operand.value = word_size + saved_size + stack_index * word_size;
+        operand.base = ctx->target->stack_pointer;
+    }
+    return operand;
+}
 
-        write_syntax(out, unary_syntax->expression, ctx);
+/* Copy FUNCTION's parameters into the vregs that hold them, as given
+ * by the IR_PARAMETER instructions at the start of ENTRY.
+ */
+static void write_ir_parameters(Emitter *out, IrFunction *function,
+                                IrBlock *entry, Context *ctx) {
+    Operand sources[SYSV_REGISTER_ARGUMENTS];
+    Operand dests[SYSV_REGISTER_ARGUMENTS];
+    int register_count = 0;
+    int stack_start = ir_register_argument_count(function->convention);
+    Register *registers = argument_registers(function->convention);
+
+    // Registers first, as loading the other parameters may overwrite
+    // them.
+    for (int i = 0; i < entry->instruction_count; i++) {
+        IrInstruction *instruction = &entry->instructions[i];
+        if (instruction->opcode == IR_PARAMETER &&
+            instruction->parameter < stack_start) {
+            sources[register_count] =
+                register_operand(registers[instruction->parameter]);
+            dests[register_count] = dest_operand(instruction, ctx);
+            register_count++;
+        }
+    }
+    emit_parallel_move(out, sources, dests, register_count);
+
+    for (int i = 0; i < entry->instruction_count; i++) {
+        IrInstruction *instruction = &entry->instructions[i];
+        if (instruction->opcode == IR_PARAMETER &&
+            instruction->parameter >= stack_start) {
+            emit_move(out,
+                      incoming_argument(instruction->parameter - stack_start,
+                                        ctx),
+                      dest_operand(instruction, ctx));
+        }
+    }
+}
+
+/* Put the first arguments of INSTRUCTION in registers, if its
+ * callee's convention says so.
+ */
+static void emit_register_arguments(Emitter *out, IrInstruction *instruction,
+                                    CallingConvention convention,
+                                    Context *ctx) {
+    Operand sources[SYSV_REGISTER_ARGUMENTS];
+    Operand dests[SYSV_REGISTER_ARGUMENTS];
+    int count = 0;
+    for (int i = 0; i < instruction->argument_count &&
+                    i < ir_register_argument_count(convention);
+         i++) {
+        sources[count] = operand_for(instruction->arguments[i], ctx);
+        dests[count] = register_operand(argument_registers(convention)[i]);
+        count++;
+    }
+    emit_parallel_move(out, sources, dests, count);
+}
+
+static Label block_label(IrBlock *block, Context *ctx) {
+    Label label = {"block", ctx->label_count + block->index};
+    return label;
+}
+
+/* How many bytes of padding we need so the stack is aligned at a
+ * call, once we've pushed PUSHED bytes for it. We're aligned if our
+ * caller was, and everything below its stack pointer (our return
+ * address, our frame and these pushes) is a multiple of the
+ * alignment. On i386 that's always true.
+ */
+static int call_padding(int pushed, Context *ctx) {
+    Target *target = ctx->target;
+    int depth = target->word_size + ctx->stack_depth + pushed;
+    return (target->stack_alignment - depth % target->stack_alignment) %
+           target->stack_alignment;
+}
+
+static void write_ir_call(Emitter *out, IrInstruction *instruction,
+                          int index, Context *ctx) {
+    Target *target = ctx->target;
+
+    // The callee may clobber the caller-saved registers, so save any
+    // that hold values we need afterwards.
+    Register saved[NO_REGISTER];
+    int saved_count = 0;
+    for (int i = 0; i < target->caller_saved_register_count; i++) {
+        Register reg = target->caller_saved_registers[i];
+
+        for (int j = 0; j < list_length(ctx->call_crossing_intervals); j++) {
+            LiveInterval *interval = list_get(ctx->call_crossing_intervals, j);
+            if (interval->reg == reg && interval_live_across(interval, index)) {
+                emit_instr(out, "push", target_register_name(target, reg));
+                saved[saved_count++] = reg;
+                break;
+            }
+        }
+    }
+
+    // Stack arguments are pushed right to left, and we remove them
+    // afterwards. We push them before filling the argument registers,
+    // as they may be in those registers now.
+    CallingConvention convention =
+        ir_callee_convention(ctx->program, instruction->function_name);
+    int stack_count =
+        ir_stack_argument_count(convention, instruction->argument_count);
+    int first_stack_argument = instruction->argument_count - stack_count;
+
+    int padding = call_padding(
+        (saved_count + stack_count) * target->word_size, ctx);
+    if (padding > 0) {
+        emit_instr_format(out, "sub", "$%d, %s", padding,
+                          target->stack_pointer);
+    }
+
+    for (int i = instruction->argument_count - 1; i >= first_stack_argument;
+         i--) {
+        Operand argument = operand_for(instruction->arguments[i], ctx);
+        if (argument.kind == OPERAND_REGISTER) {
+            emit_instr(out, "push",
+                       target_register_name(target, argument.value));
+        } else {
+            emit_mnemonic(out, target->push);
+            emit_operand(out, argument);
+            emit_bytes(out, "\n", 1);
+        }
+    }
+    emit_register_arguments(out, instruction, convention, ctx);
 
-        if (unary_syntax->unary_type == BITWISE_NEGATION) {
+    emit_instr(out, "call", instruction->function_name);
+
+    int pushed = stack_count * target->word_size + padding;
+    if (pushed > 0) {
+        emit_instr_format(out, "add", "$%d, %s", pushed,
+                          target->stack_pointer);
+    }
+
+    emit_move(out, register_operand(REG_EAX), dest_operand(instruction, ctx));
+
+    for (int i = saved_count - 1; i >= 0; i--) {
+        emit_instr(out, "pop", target_register_name(target, saved[i]));
+    }
+}
+
+/* If BLOCK ends by branching on the result of a comparison in the
+ * same block that nothing else uses, return the comparison. We then
+ * only need to set the flags, and the branch can use them directly
+ * instead of testing a 0 or 1 value.
+ *
+ * Copies may come between the comparison and the branch (e.g. from
+ * SSA destruction), as moves don't change the flags.
+ */
+static IrInstruction *fused_comparison(IrBlock *block, int *use_counts) {
+    IrInstruction *terminator = ir_terminator(block);
+    if (terminator == NULL || terminator->opcode != IR_BRANCH ||
+        terminator->operands[0].kind != IR_OPERAND_VREG) {
+        return NULL;
+    }
+
+    IrVreg condition = terminator->operands[0].value;
+    if (use_counts[condition] != 1) {
+        return NULL;
+    }
+
+    for (int i = block->instruction_count - 2; i >= 0; i--) {
+        IrInstruction *instruction = &block->instructions[i];
+        if (instruction->dest == condition) {
+            IrOpcode opcode = instruction->opcode;
+            if (opcode == IR_LESS_THAN || opcode == IR_LESS_OR_EQUAL ||
+                opcode == IR_LOGICAL_NOT) {
+                return instruction;
+            }
+            return NULL;
+        }
+
+        if (instruction->opcode != IR_COPY) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Set the flags for COMPARISON, without storing its result. */
+static void emit_fused_comparison(Emitter *out, IrInstruction *comparison,
+                                  Context *ctx) {
+    Operand left = operand_for(comparison->operands[0], ctx);
+    if (comparison->opcode == IR_LOGICAL_NOT) {
+        if (left.kind == OPERAND_REGISTER) {
+            emit_operands_instr(out, "test", left, left);
+        } else {
+            Operand zero = {OPERAND_IMMEDIATE, 0, NULL};
+            emit_compare(out, left, zero);
+        }
+    } else {
+        emit_compare(out, left, operand_for(comparison->operands[1], ctx));
+    }
+}
+
+/* Write the terminator INSTRUCTION of BLOCK. NEXT is the block laid
+ * out after BLOCK, which we can fall through to, or NULL. If FUSED
+ * is set, it's the comparison the branch depends on, and the flags
+ * are already set.
+ */
+static void write_ir_terminator(Emitter *out, IrBlock *block,
+                                IrInstruction *instruction, IrBlock *next,
+                                IrInstruction *fused, Context *ctx) {
+    if (instruction->opcode == IR_RETURN) {
+        emit_move(out, operand_for(instruction->operands[0], ctx),
+                  register_operand(REG_EAX));
+        emit_restore_registers(out, ctx);
+        emit_return(out, ctx);
+        return;
+    }
+
+    if (instruction->opcode == IR_TAIL_CALL) {
+        // Our own stack arguments are dead by now, so the callee's
+        // replace them. See ends_in_tail_call for why they fit.
+        CallingConvention convention =
+            ir_callee_convention(ctx->program, instruction->function_name);
+        int stack_count =
+            ir_stack_argument_count(convention, instruction->argument_count);
+        int first_stack_argument = instruction->argument_count - stack_count;
+
+        for (int i = first_stack_argument; i < instruction->argument_count;
+             i++) {
+            emit_move(out, operand_for(instruction->arguments[i], ctx),
+                      incoming_argument(i - first_stack_argument, ctx));
+        }
+        emit_register_arguments(out, instruction, convention, ctx);
+
+        emit_restore_registers(out, ctx);
+        emit_tail_call(out, ctx, instruction->function_name);
+        return;
+    }
+
+    IrBlock *if_true = block->successors[0];
+    if (instruction->opcode == IR_JUMP) {
+        if (if_true != next) {
+            emit_instr_format(out, "jmp", "%L", block_label(if_true, ctx));
+        }
+        return;
+    }
+
+    IrBlock *if_false = block->successors[1];
+    Operand condition = operand_for(instruction->operands[0], ctx);
+
+    // The conditional jumps to take when the condition is true or false.
+    char *jump_if_true = "jnz";
+    char *jump_if_false = "jz";
+
+    if (fused != NULL) {
+        bool reversed = fused->opcode != IR_LOGICAL_NOT &&
+                        compare_reversed(operand_for(fused->operands[0], ctx),
+                                         operand_for(fused->operands[1], ctx));
+        if (fused->opcode == IR_LESS_THAN) {
+            jump_if_true = reversed ? "jg" : "jl";
+            jump_if_false = reversed ? "jle" : "jge";
+        } else if (fused->opcode == IR_LESS_OR_EQUAL) {
+            jump_if_true = reversed ? "jge" : "jle";
+            jump_if_false = reversed ? "jl" : "jg";
+        } else {
+            // We compared the operand of the ! with zero.
+            jump_if_true = "jz";
+            jump_if_false = "jnz";
+        }
+    } else if (condition.kind == OPERAND_IMMEDIATE) {
+        IrBlock *target = condition.value ? if_true : if_false;
+        if (target != next) {
+            emit_instr_format(out, "jmp", "%L", block_label(target, ctx));
+        }
+        return;
+    } else if (condition.kind == OPERAND_REGISTER) {
+        emit_operands_instr(out, "test", condition, condition);
+    } else {
+        Operand zero = {OPERAND_IMMEDIATE, 0, NULL};
+        emit_operands_instr(out, "cmp", zero, condition);
+    }
+
+    if (if_true == next) {
+        emit_instr_format(out, jump_if_false, "%L", block_label(if_false, ctx));
+    } else {
+        emit_instr_format(out, jump_if_true, "%L", block_label(if_true, ctx));
+        if (if_false != next) {
+            emit_instr_format(out, "jmp", "%L", block_label(if_false, ctx));
+        }
+    }
+}
+
+/* Write INSTRUCTION, which is the INDEXth instruction of the function
+ * in layout order.
+ */
+static void write_ir_instruction(Emitter *out, IrInstruction *instruction,
+                                 int index, Context *ctx) {
+    IrOpcode opcode = instruction->opcode;
+
+    if (opcode == IR_CALL) {
+        write_ir_call(out, instruction, index, ctx);
+        return;
+    }
+
+    Operand dest = dest_operand(instruction, ctx);
+    Operand left = operand_for(instruction->operands[0], ctx);
+
+    if (opcode == IR_COPY) {
+        emit_move(out, left, dest);
+
+    } else if (opcode == IR_BITWISE_NOT) {
+        Operand target = dest;
+        if (dest.kind != OPERAND_REGISTER) {
+            target = register_operand(SCRATCH_REGISTER);
+        }
+        emit_move(out, left, target);
+        emit_mnemonic(out, "not");
+        emit_operand(out, target);
+        emit_bytes(out, "\n", 1);
+        emit_move(out, target, dest);
+
+    } else if (opcode == IR_LOGICAL_NOT) {
+        Operand zero = {OPERAND_IMMEDIATE, 0, NULL};
+        emit_compare(out, left, zero);
+        emit_set_condition(out, "sete", dest);
+
+    } else {
+        Operand right = operand_for(instruction->operands[1], ctx);
+
+        bool reversed = compare_reversed(left, right);
+
+        if (opcode == IR_ADD || opcode == IR_SUB) {
+            emit_add(out, ctx->target, dest, left, right, opcode == IR_SUB);
+        } else if (opcode == IR_MUL) {
+            emit_multiply(out, ctx->target, dest, left, right);
+        } else if (opcode == IR_LESS_THAN) {
+            emit_compare(out, left, right);
+            emit_set_condition(out, reversed ? "setg" : "setl", dest);
+        } else if (opcode == IR_LESS_OR_EQUAL) {
+            emit_compare(out, left, right);
+            emit_set_condition(out, reversed ? "setge" : "setle", dest);
+        } else {
+            errx(1, "Unknown IR opcode %s", ir_opcode_name(opcode));
+        }
+    }
+}
+
+static void write_ir_function(Emitter *out, IrFunction *function,
+                              Context *ctx) {
+    new_scope(ctx);
+
+    ctx->intervals = ir_live_intervals(function);
+    Target *target = ctx->target;
+    unsigned int callee_saved = 0;
+    for (int i = 0; i < target->callee_saved_register_count; i++) {
+        callee_saved |= REGISTER_BIT(target->callee_saved_registers[i]);
+    }
+    linear_scan(ctx->intervals, target->allocatable_registers,
+                target->allocatable_register_count, callee_saved);
+
+    ctx->callee_saved_used = 0;
+    ctx->call_crossing_intervals = list_new();
+    for (int i = 0; i < list_length(ctx->intervals); i++) {
+        LiveInterval *interval = list_get(ctx->intervals, i);
+        if (interval->reg != NO_REGISTER) {
+            ctx->callee_saved_used |=
+                REGISTER_BIT(interval->reg) & callee_saved;
+        }
+        if (interval->crosses_call) {
+            list_append(ctx->call_crossing_intervals, interval);
+        }
+    }
+
+    // Spilled vregs share stack slots where their intervals don't
+    // overlap, and we reserve them all at once, below the saved
+    // registers.
+    int saved_size =
+        __builtin_popcount(ctx->callee_saved_used) * target->word_size;
+    int frame_size = allocate_stack_slots(
+        ctx->intervals, ctx->stack_offset - saved_size, SLOT_SIZE);
+
+    // Stack slots are addressed relative to %ebp, so we only need a
+    // frame if there are any.
+    emit_function_declaration(out, function->name);
+    begin_function_frame(out, frame_size > 0, ctx);
+    emit_save_registers(out, ctx);
+
+    ctx->stack_offset -= frame_size;
+    if (frame_size > 0) {
+        emit_instr_format(out, "sub", "$%d, %s", frame_size,
+                          target->stack_pointer);
+    }
+    ctx->stack_depth =
+        (ctx->has_frame ? target->word_size : 0) + saved_size + frame_size;
+
+    write_ir_parameters(out, function, list_get(function->blocks, 0), ctx);
+
+    int *use_counts = calloc(function->vreg_count, sizeof(int));
+    int block_count = list_length(function->blocks);
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                if (operand->kind == IR_OPERAND_VREG) {
+                    use_counts[operand->value]++;
+                }
+            }
+        }
+    }
+
+    int index = 0;
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        IrBlock *next = i + 1 < block_count ? list_get(function->blocks, i + 1)
+                                            : NULL;
+        IrInstruction *fused =
+            ctx->fuse_branches ? fused_comparison(block, use_counts) : NULL;
+
+        if (list_length(block->predecessors) > 0) {
+            emit_label(out, block_label(block, ctx));
+        }
+
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            if (instruction->opcode == IR_PARAMETER) {
+                // Already handled by write_ir_parameters.
+            } else if (ir_is_terminator(instruction->opcode)) {
+                write_ir_terminator(out, block, instruction, next, fused, ctx);
+            } else if (instruction == fused) {
+                emit_fused_comparison(out, instruction, ctx);
+            } else {
+                write_ir_instruction(out, instruction, index, ctx);
+            }
+            index++;
+        }
+    }
+    emit_bytes(out, "\n", 1);
+
+    free(use_counts);
+    ctx->label_count += block_count;
+    list_free(ctx->call_crossing_intervals);
+    live_intervals_free(ctx->intervals);
+    ctx->intervals = NULL;
+}
+
+/* Write x86 assembly for every function in PROGRAM. */
+void write_ir_program(Emitter *out, IrProgram *program, Context *ctx) {
+    ctx->program = program;
+    for (int i = 0; i < list_length(program->functions); i++) {
+        write_ir_function(out, list_get(program->functions, i), ctx);
+    }
+}
+
+/* Open the Emitter for OUTPUT's path. If it wants the peephole
+ * optimiser, we keep the text in memory so close_output can optimise
+ * it first.
+ */
+static Emitter *open_output(AssemblyOutput *output) {
+    if (output->peephole) {
+        return emitter_new_buffer();
+    }
+    return emitter_open(output->path);
+}
+
+static void close_output(Emitter *out, AssemblyOutput *output,
+                         Context *ctx) {
+    if (output->peephole) {
+        Emitter *file = emitter_open(output->path);
+        peephole_optimise(out->buffer, out->size, file,
+                          &output->peephole_stats);
+        emitter_close(file);
+    }
+    emitter_close(out);
+
+    output->frame_stats.function_count += ctx->frame_stats.function_count;
+    output->frame_stats.frames_eliminated +=
+        ctx->frame_stats.frames_eliminated;
+}
+
+void write_assembly(IrProgram *program, Target *target,
+                    AssemblyOutput *output) {
+    Emitter *out = open_output(output);
+
+    write_header(out);
+
+    Context *ctx = new_context();
+    ctx->target = target;
+
+    write_ir_program(out, program, ctx);
+    write_footer(out, target);
+
+    close_output(out, output, ctx);
+    context_free(ctx);
+}
+
+/* Can we compile `return CALL` as a jump, reusing our frame? The
+ * callee's arguments must fit where our caller put ours.
+ */
+static bool flat_is_tail_call(FlatSyntax *flat, FlatIndex call,
+                              Context *ctx) {
+    FlatNode *node = &flat->nodes[call];
+    return node->type == FUNCTION_CALL &&
+           (int)flat->nodes[node->first].second <= ctx->parameter_count;
+}
+
+/* Does the statement at INDEX contain a tail call to the function
+ * we're writing?
+ */
+static bool flat_calls_self_in_tail(FlatSyntax *flat, FlatIndex index,
+                                    Context *ctx) {
+    FlatNode *node = &flat->nodes[index];
+
+    if (node->type == RETURN_STATEMENT) {
+        FlatNode *value = &flat->nodes[node->first];
+        return flat_is_tail_call(flat, node->first, ctx) &&
+               strcmp(flat_name(flat, value), ctx->function_name) == 0;
+
+    } else if (node->type == IF_STATEMENT || node->type == WHILE_SYNTAX) {
+        return flat_calls_self_in_tail(flat, node->second, ctx);
+
+    } else if (node->type == BLOCK) {
+        for (uint32_t i = 0; i < node->second; i++) {
+            if (flat_calls_self_in_tail(flat, flat_child(flat, node, i),
+                                        ctx)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/* The stack offset of the variable that NODE reads or assigns. */
+static int flat_variable_offset(FlatSyntax *flat, FlatNode *node,
+                                Context *ctx) {
+    char *name = flat_name(flat, node);
+    int offset = environment_get(ctx->env, name);
+    if (offset == -1) {
+        compile_error("%s: undefined variable %s", ctx->source_path, name);
+    }
+    return offset;
+}
+
+/* If an operand of the binary operator NODE is an immediate, set
+ * VALUE to it and OTHER to the remaining operand, and return true. We
+ * then compute the operator with an immediate operand instead of
+ * saving the other side in a temporary slot. We prefer the right
+ * operand, and set ON_LEFT if we took the left one.
+ */
+static bool flat_immediate_operand(FlatSyntax *flat, FlatNode *node,
+                                   int *value, FlatIndex *other,
+                                   bool *on_left) {
+    FlatNode *left = &flat->nodes[node->first];
+    FlatNode *right = &flat->nodes[node->second];
+
+    if (right->type == IMMEDIATE) {
+        *value = right->value;
+        *other = node->first;
+        *on_left = false;
+        return true;
+    }
+    if (left->type == IMMEDIATE) {
+        *value = left->value;
+        *other = node->second;
+        *on_left = true;
+        return true;
+    }
+    return false;
+}
+
+/* Write %eax = %eax OPERATOR VALUE, or VALUE OPERATOR %eax if ON_LEFT. */
+static void write_flat_immediate_operator(Emitter *out,
+                                          BinaryExpressionType operator_type,
+                                          int value, bool on_left,
+                                          Context *ctx) {
+    Operand eax = register_operand(REG_EAX);
+    Operand immediate = {OPERAND_IMMEDIATE, value, NULL};
+
+    if (operator_type == MULTIPLICATION) {
+        emit_multiply(out, ctx->target, eax, eax, immediate);
+
+    } else if (operator_type == ADDITION) {
+        emit_operands_instr(out, "add", immediate, eax);
+
+    } else if (operator_type == SUBTRACTION) {
+        if (on_left) {
+            emit_instr(out, "neg", "%eax");
+            emit_operands_instr(out, "add", immediate, eax);
+        } else {
+            emit_operands_instr(out, "sub", immediate, eax);
+        }
+
+    } else {
+        emit_operands_instr(out, "cmp", immediate, eax);
+        // We compared the other way round if the immediate was on the
+        // left, so swap the condition.
+        if (operator_type == LESS_THAN) {
+            emit_instr(out, on_left ? "setg" : "setl", "%al");
+        } else {
+            emit_instr(out, on_left ? "setge" : "setle", "%al");
+        }
+        emit_instr(out, "movzbl", "%al, %eax");
+    }
+}
+
+/* The number of stack slots that the node at INDEX needs at once,
+ * for local variables and the temporaries of binary operators. This
+ * mirrors how write_flat_syntax hands out slots: a temporary is held
+ * while the right operand is evaluated, and a variable until the end
+ * of its block.
+ */
+static int flat_frame_words(FlatSyntax *flat, FlatIndex index) {
+    FlatNode *node = &flat->nodes[index];
+
+    if (node->type == UNARY_OPERATOR || node->type == ASSIGNMENT ||
+        node->type == RETURN_STATEMENT) {
+        return flat_frame_words(flat, node->first);
+
+    } else if (node->type == BINARY_OPERATOR) {
+        int value;
+        FlatIndex other;
+        bool on_left;
+        if (flat_immediate_operand(flat, node, &value, &other, &on_left)) {
+            return flat_frame_words(flat, other);
+        }
+
+        int left = flat_frame_words(flat, node->first);
+        int right = flat_frame_words(flat, node->second);
+        return 1 + (left > right ? left : right);
+
+    } else if (node->type == IF_STATEMENT || node->type == WHILE_SYNTAX) {
+        int condition = flat_frame_words(flat, node->first);
+        int body = flat_frame_words(flat, node->second);
+        return condition > body ? condition : body;
+
+    } else if (node->type == DEFINE_VAR) {
+        return 1 + flat_frame_words(flat, node->first);
+
+    } else if (node->type == FUNCTION_CALL) {
+        // Each argument is pushed once it's evaluated, so they don't
+        // need slots while the others are evaluated.
+        FlatNode *arguments = &flat->nodes[node->first];
+        int words = 0;
+        for (uint32_t i = 0; i < arguments->second; i++) {
+            int argument =
+                flat_frame_words(flat, flat_child(flat, arguments, i));
+            if (argument > words) {
+                words = argument;
+            }
+        }
+        return words;
+
+    } else if (node->type == BLOCK) {
+        int variables = 0, words = 0;
+        for (uint32_t i = 0; i < node->second; i++) {
+            FlatIndex child = flat_child(flat, node, i);
+            int child_words = variables + flat_frame_words(flat, child);
+            if (child_words > words) {
+                words = child_words;
+            }
+
+            if (flat->nodes[child].type == DEFINE_VAR) {
+                variables++;
+            }
+        }
+        return words;
+    }
+
+    // Immediates and variables.
+    return 0;
+}
+
+/* Write the node at INDEX in FLAT directly, without going through the
+ * IR. This doesn't allocate registers: every local and every
+ * intermediate value lives on the stack. It's kept as a simple
+ * baseline.
+ */
+void write_flat_syntax(Emitter *out, FlatSyntax *flat, FlatIndex index,
+                       Context *ctx) {
+    FlatNode *node = &flat->nodes[index];
+
+    if (node->type == UNARY_OPERATOR) {
+        write_flat_syntax(out, flat, node->first, ctx);
+
+        if (node->operator_type == BITWISE_NEGATION) {
             emit_instr(out, "not", "%eax");
         } else {
-            emit_instr(out, "test", "$0xFFFFFFFF, %eax");
+            emit_instr(out, "test", "%eax, %eax");
             emit_instr(out, "setz", "%al");
+            emit_instr(out, "movzbl", "%al, %eax");
         }
-    } else if (syntax->type == IMMEDIATE) {
-        emit_instr_format(out, "mov", "$%d, %%eax", syntax->immediate->value);
+    } else if (node->type == IMMEDIATE) {
+        emit_instr_format(out, "mov", "$%d, %%eax", node->value);
 
-    } else if (syntax->type == VARIABLE) {
-        emit_instr_format(
-            out, "mov", "%d(%%ebp), %%eax",
-            environment_get_offset(ctx->env, syntax->variable->var_name));
+    } else if (node->type == VARIABLE) {
+        emit_instr_format(out, "mov", "%d(%%ebp), %%eax",
+                          flat_variable_offset(flat, node, ctx));
+
+    } else if (node->type == BINARY_OPERATOR) {
+        int value;
+        FlatIndex other;
+        bool on_left;
+        if (flat_immediate_operand(flat, node, &value, &other, &on_left)) {
+            write_flat_syntax(out, flat, other, ctx);
+            write_flat_immediate_operator(out, node->operator_type, value,
+                                          on_left, ctx);
+            return;
+        }
 
-    } else if (syntax->type == BINARY_OPERATOR) {
-        BinaryExpression *binary_syntax = syntax->binary_expression;
+        // The left operand needs a temporary slot while we evaluate
+        // the right. It's free again once we're done.
         int stack_offset = ctx->stack_offset;
         ctx->stack_offset -= WORD_SIZE;
 
-        emit_instr(out, "sub", "$4, %esp");
-        write_syntax(out, binary_syntax->left, ctx);
+        write_flat_syntax(out, flat, node->first, ctx);
         emit_instr_format(out, "mov", "%%eax, %d(%%ebp)", stack_offset);
 
-        write_syntax(out, binary_syntax->right, ctx);
+        write_flat_syntax(out, flat, node->second, ctx);
 
-        if (binary_syntax->binary_type == MULTIPLICATION) {
-            emit_instr_format(out, "mull", "%d(%%ebp)", stack_offset);
+        if (node->operator_type == MULTIPLICATION) {
+            emit_instr_format(out, "imul", "%d(%%ebp), %%eax", stack_offset);
 
-        } else if (binary_syntax->binary_type == ADDITION) {
+        } else if (node->operator_type == ADDITION) {
             emit_instr_format(out, "add", "%d(%%ebp), %%eax", stack_offset);
 
-        } else if (binary_syntax->binary_type == SUBTRACTION) {
+        } else if (node->operator_type == SUBTRACTION) {
             emit_instr_format(out, "sub", "%%eax, %d(%%ebp)", stack_offset);
             emit_instr_format(out, "mov", "%d(%%ebp), %%eax", stack_offset);
 
-        } else if (binary_syntax->binary_type == LESS_THAN) {
-            // To compare x < y in AT&T syntax, we write CMP y,x.
-            // http://stackoverflow.com/q/25493255/509706
+        } else if (node->operator_type == LESS_THAN) {
             emit_instr_format(out, "cmp", "%%eax, %d(%%ebp)", stack_offset);
-            // Set the low byte of %eax to 0 or 1 depending on whether
-            // it was less than.
             emit_instr(out, "setl", "%al");
-            // Zero the rest of %eax.
             emit_instr(out, "movzbl", "%al, %eax");
 
-        } else if (binary_syntax->binary_type == LESS_THAN_OR_EQUAL) {
-            // To compare x < y in AT&T syntax, we write CMP y,x.
-            // http://stackoverflow.com/q/25493255/509706
+        } else if (node->operator_type == LESS_THAN_OR_EQUAL) {
             emit_instr_format(out, "cmp", "%%eax, %d(%%ebp)", stack_offset);
-            // Set the low byte of %eax to 0 or 1 depending on whether
-            // it was less than or equal.
             emit_instr(out, "setle", "%al");
-            // Zero the rest of %eax.
             emit_instr(out, "movzbl", "%al, %eax");
         }
 
-    } else if (syntax->type == ASSIGNMENT) {
-        write_syntax(out, syntax->assignment->expression, ctx);
+        ctx->stack_offset = stack_offset;
 
-        emit_instr_format(
-            out, "mov", "%%eax, %d(%%ebp)",
-            environment_get_offset(ctx->env, syntax->variable->var_name));
+    } else if (node->type == ASSIGNMENT) {
+        write_flat_syntax(out, flat, node->first, ctx);
 
-    } else if (syntax->type == RETURN_STATEMENT) {
-        ReturnStatement *return_statement = syntax->return_statement;
-        write_syntax(out, return_statement->expression, ctx);
+        emit_instr_format(out, "mov", "%%eax, %d(%%ebp)",
+                          flat_variable_offset(flat, node, ctx));
 
-        emit_return(out);
+    } else if (node->type == RETURN_STATEMENT) {
+        FlatIndex value = node->first;
 
-    } else if (syntax->type == FUNCTION_CALL) {
-        emit_instr_format(out, "call", syntax->function_call->function_name);
+        if (flat_is_tail_call(flat, value, ctx)) {
+            // Replace our own arguments with the callee's. We evaluate
+            // them all first, as they may refer to our parameters.
+            FlatNode *arguments = &flat->nodes[flat->nodes[value].first];
+            uint32_t count = arguments->second;
+            for (uint32_t i = count; i > 0; i--) {
+                write_flat_syntax(out, flat, flat_child(flat, arguments, i - 1),
+                                  ctx);
+                emit_instr(out, "pushl", "%eax");
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                emit_instr_format(out, "popl", "%d(%%ebp)",
+                                  (int)(2 + i) * WORD_SIZE);
+            }
 
-    } else if (syntax->type == IF_STATEMENT) {
-        IfStatement *if_statement = syntax->if_statement;
-        write_syntax(out, if_statement->condition, ctx);
+            char *callee = flat_name(flat, &flat->nodes[value]);
+            if (strcmp(callee, ctx->function_name) == 0) {
+                // Tail recursion: our frame is already set up, so go
+                // round again.
+                emit_instr_format(out, "jmp", "%L", ctx->function_start);
+            } else {
+                emit_tail_call(out, ctx, callee);
+            }
+        } else {
+            write_flat_syntax(out, flat, value, ctx);
+            emit_return(out, ctx);
+        }
+
+    } else if (node->type == FUNCTION_CALL) {
+        // cdecl: push the arguments right to left, and remove them
+        // afterwards.
+        FlatNode *arguments = &flat->nodes[node->first];
+        uint32_t count = arguments->second;
+        for (uint32_t i = count; i > 0; i--) {
+            write_flat_syntax(out, flat, flat_child(flat, arguments, i - 1),
+                              ctx);
+            emit_instr(out, "pushl", "%eax");
+        }
+
+        emit_instr(out, "call", flat_name(flat, node));
+
+        if (count > 0) {
+            emit_instr_format(out, "add", "$%d, %%esp", (int)count * WORD_SIZE);
+        }
+
+    } else if (node->type == IF_STATEMENT) {
+        write_flat_syntax(out, flat, node->first, ctx);
 
-        char *label = fresh_local_label("if_end", ctx);
+        Label label = fresh_local_label("if_end", ctx);
 
         emit_instr(out, "test", "%eax, %eax");
-        emit_instr_format(out, "jz", "%s", label);
+        emit_instr_format(out, "jz", "%L", label);
 
-        write_syntax(out, if_statement->then, ctx);
+        write_flat_syntax(out, flat, node->second, ctx);
         emit_label(out, label);
 
-    } else if (syntax->type == WHILE_SYNTAX) {
-        WhileStatement *while_statement = syntax->while_statement;
-
-        char *start_label = fresh_local_label("while_start", ctx);
-        char *end_label = fresh_local_label("while_end", ctx);
+    } else if (node->type == WHILE_SYNTAX) {
+        Label start_label = fresh_local_label("while_start", ctx);
+        Label end_label = fresh_local_label("while_end", ctx);
 
         emit_label(out, start_label);
-        write_syntax(out, while_statement->condition, ctx);
+        write_flat_syntax(out, flat, node->first, ctx);
 
         emit_instr(out, "test", "%eax, %eax");
-        emit_instr_format(out, "jz", "%s", end_label);
+        emit_instr_format(out, "jz", "%L", end_label);
 
-        write_syntax(out, while_statement->body, ctx);
-        emit_instr_format(out, "jmp", "%s", start_label);
+        write_flat_syntax(out, flat, node->second, ctx);
+        emit_instr_format(out, "jmp", "%L", start_label);
         emit_label(out, end_label);
 
-    } else if (syntax->type == DEFINE_VAR) {
-        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+    } else if (node->type == DEFINE_VAR) {
         int stack_offset = ctx->stack_offset;
 
-        environment_set_offset(ctx->env, define_var_statement->var_name,
-                               stack_offset);
-        emit_instr(out, "sub", "$4, %esp");
+        environment_set(ctx->env, flat_name(flat, node), stack_offset);
 
         ctx->stack_offset -= WORD_SIZE;
-        write_syntax(out, define_var_statement->init_value, ctx);
+        write_flat_syntax(out, flat, node->first, ctx);
         emit_instr_format(out, "mov", "%%eax, %d(%%ebp)\n", stack_offset);
 
-    } else if (syntax->type == BLOCK) {
-        List *statements = syntax->block->statements;
-        for (int i = 0; i < list_length(statements); i++) {
-            write_syntax(out, list_get(statements, i), ctx);
+    } else if (node->type == BLOCK) {
+        // Variables defined in the block go out of scope at the end,
+        // so later blocks can reuse their slots.
+        int stack_offset = ctx->stack_offset;
+        environment_push_scope(ctx->env);
+
+        uint32_t count = node->second;
+        for (uint32_t i = 0; i < count; i++) {
+            write_flat_syntax(out, flat, flat_child(flat, node, i), ctx);
         }
-    } else if (syntax->type == FUNCTION) {
+
+        environment_pop_scope(ctx->env);
+        ctx->stack_offset = stack_offset;
+
+    } else if (node->type == TOP_LEVEL) {
+        uint32_t count = node->second;
+        for (uint32_t i = 0; i < count; i++) {
+            write_flat_syntax(out, flat, flat_child(flat, node, i), ctx);
+        }
+
+    } else if (node->type == FUNCTION) {
         new_scope(ctx);
 
-        emit_function_declaration(out, syntax->function->name);
-        emit_function_prologue(out);
-        write_syntax(out, syntax->function->root_block, ctx);
-        emit_function_epilogue(out);
+        // Parameters are above the return address and saved %ebp.
+        ctx->parameter_count = node->second;
+        for (uint32_t i = 0; i < node->second; i++) {
+            FlatNode *parameter = &flat->nodes[index + 1 + i];
+            environment_set(ctx->env, flat_name(flat, parameter),
+                            (int)(2 + i) * WORD_SIZE);
+        }
+
+        // Reserve the whole frame up front, so loops run in constant
+        // stack space. Locals, temporaries and parameters are the only
+        // things we address relative to %ebp, so without them we don't
+        // need a frame at all.
+        int frame_size = flat_frame_words(flat, node->first) * WORD_SIZE;
 
-    } else if (syntax->type == TOP_LEVEL) {
-        // TODO: treat the 'main' function specially.
-        List *declarations = syntax->top_level->declarations;
-        for (int i = 0; i < list_length(declarations); i++) {
-            write_syntax(out, list_get(declarations, i), ctx);
+        emit_function_declaration(out, flat_name(flat, node));
+        begin_function_frame(out, frame_size > 0 || node->second > 0, ctx);
+        if (frame_size > 0) {
+            emit_instr_format(out, "sub", "$%d, %%esp", frame_size);
+        }
+
+        ctx->function_name = flat_name(flat, node);
+        if (flat_calls_self_in_tail(flat, node->first, ctx)) {
+            ctx->function_start = fresh_local_label("function_start", ctx);
+            emit_label(out, ctx->function_start);
+        }
+
+        write_flat_syntax(out, flat, node->first, ctx);
+
+        // There's no need for an epilogue if the function ends with
+        // an explicit return.
+        FlatNode *body = &flat->nodes[node->first];
+        uint32_t statement_count = body->second;
+        if (statement_count == 0 ||
+            flat->nodes[flat_child(flat, body, statement_count - 1)].type !=
+                RETURN_STATEMENT) {
+            emit_function_epilogue(out, ctx);
+        } else {
+            emit_bytes(out, "\n", 1);
         }
 
     } else {
-        warnx("Unknown syntax %s", syntax_type_name(syntax));
+        warnx("Unknown syntax %s",
+              syntax_kind_name(node->type, node->operator_type));
         assert(false);
     }
 }
 
-void write_assembly(Syntax *syntax) {
-    FILE *out = fopen("out.s", "wb");
+void write_flat_assembly(FlatSyntax *flat, AssemblyOutput *output) {
+    Emitter *out = open_output(output);
 
     write_header(out);
 
     Context *ctx = new_context();
+    ctx->source_path = output->source_path;
 
-    write_syntax(out, syntax, ctx);
-    write_footer(out);
+    write_flat_syntax(out, flat, flat->root, ctx);
+    write_footer(out, ctx->target);
 
+    close_output(out, output, ctx);
     context_free(ctx);
-    fclose(out);
 }
@@ -1,19 +1,44 @@
-#include <stdio.h>
+#include <stdbool.h>
 #include "syntax.h"
+#include "flat_syntax.h"
+#include "context.h"
+#include "emitter.h"
+#include "ir.h"
+#include "target.h"
+#include "peephole.h"
 
 #ifndef BABYC_ASSEMBLY_HEADER
 #define BABYC_ASSEMBLY_HEADER
 
-void emit_header(FILE *out, char *name);
+void emit_header(Emitter *out, char *name);
 
-void emit_insn(FILE *out, char *insn);
+void emit_mnemonic(Emitter *out, char *instr);
 
-void write_header(FILE *out);
+void write_header(Emitter *out);
 
-void write_footer(FILE *out);
+void write_footer(Emitter *out, Target *target);
 
-void write_syntax(FILE *out, Syntax *syntax);
+void write_ir_program(Emitter *out, IrProgram *program, Context *ctx);
 
-void write_assembly(Syntax *syntax);
+void write_flat_syntax(Emitter *out, FlatSyntax *flat, FlatIndex index,
+                       Context *ctx);
+
+/* Where write_assembly writes, and what it counts along the way. */
+typedef struct AssemblyOutput {
+    char *path;
+    // The file we're compiling, for error messages.
+    char *source_path;
+    // Run the peephole optimiser before writing PATH.
+    bool peephole;
+    FrameStats frame_stats;
+    PeepholeStats peephole_stats;
+} AssemblyOutput;
+
+void write_assembly(IrProgram *program, Target *target,
+                    AssemblyOutput *output);
+
+void print_frame_stats(FrameStats *stats);
+
+void write_flat_assembly(FlatSyntax *flat, AssemblyOutput *output);
 
 #endif
@@ -4,30 +4,53 @@
 #include <assert.h>
 #include "../syntax.h"
 #include "../stack.h"
+#include "../intern.h"
+%}
 
-#define YYSTYPE char*
+%code requires {
+#include "../list.h"
+#include "../source.h"
+#include "../lexer.h"
+#include "../compilation.h"
+}
 
-int yyparse(void);
-int yylex();
+%code {
+int yylex(YYSTYPE *value, Lexer *lexer);
 
-void yyerror(const char *str)
+void yyerror(Lexer *lexer, Compilation *compilation, const char *str)
 {
-	fprintf(stderr,"error: %s\n",str);
+	(void)lexer;
+	fprintf(stderr,"%s: error: %s\n",compilation->file_name,str);
 }
 
-int yywrap()
-{
-	return 1;
+/* The name of the identifier TOKEN, interned. */
+static char *token_name(Compilation *compilation, TokenSlice token) {
+    return slice_name(compilation->source, compilation->names, token);
 }
 
-extern FILE *yyin;
+static int token_value(Compilation *compilation, TokenSlice token) {
+    return slice_value(compilation->source, token);
+}
+}
 
-Stack *syntax_stack;
+/* The parser and lexer keep all their state in their arguments, so
+ * several files can be parsed at once on different threads.
+ */
+%define api.pure full
+%parse-param {Lexer *lexer} {Compilation *compilation}
+%lex-param {Lexer *lexer}
 
-%}
+/* Identifiers and numbers are slices of the source, which we only
+ * copy (by interning) when a syntax node needs the name.
+ */
+%union {
+    TokenSlice token;
+    List *list;
+}
 
 %token INCLUDE HEADER_NAME
-%token TYPE IDENTIFIER RETURN NUMBER
+%token <token> IDENTIFIER NUMBER
+%token TYPE RETURN
 %token OPEN_BRACE CLOSE_BRACE
 %token IF WHILE
 %token LESS_OR_EQUAL
@@ -43,64 +66,82 @@ Stack *syntax_stack;
 %nonassoc '!'
 %nonassoc '~'
 
+%type <list> parameter_list nonempty_parameter_list
+
 %%
 
 program:
-        function program
+        program function
         {
-            Syntax *top_level_syntax;
-            if (stack_empty(syntax_stack)) {
-                top_level_syntax = top_level_new();
-            } else if (((Syntax *)stack_peek(syntax_stack))->type != TOP_LEVEL) {
-                top_level_syntax = top_level_new();
-            } else {
-                top_level_syntax = stack_pop(syntax_stack);
-            }
-
-            list_push(top_level_syntax->top_level->declarations,
-                      stack_pop(syntax_stack));
-            stack_push(syntax_stack, top_level_syntax);
+            Syntax *function = stack_pop(compilation->syntax_stack);
+            Syntax *top_level_syntax = stack_peek(compilation->syntax_stack);
+            list_append(top_level_syntax->top_level->declarations, function);
         }
         |
+        {
+            stack_push(compilation->syntax_stack,
+                       top_level_new(compilation->syntax_arena));
+        }
         ;
 
 function:
 	TYPE IDENTIFIER '(' parameter_list ')' OPEN_BRACE block CLOSE_BRACE
         {
-            Syntax *current_syntax = stack_pop(syntax_stack);
+            Syntax *current_syntax = stack_pop(compilation->syntax_stack);
             // TODO: assert current_syntax has type BLOCK.
-            stack_push(syntax_stack, function_new((char*)$2, current_syntax));
+            stack_push(compilation->syntax_stack,
+                       function_new(compilation->syntax_arena,
+                                    token_name(compilation, $2), $4,
+                                    current_syntax));
         }
         ;
 
+/* Parameter lists are the value of the rule rather than living on
+ * the syntax stack, as they aren't Syntax.
+ */
 parameter_list:
         nonempty_parameter_list
         |
+        {
+            $$ = list_new_in(compilation->syntax_arena);
+        }
         ;
 
 nonempty_parameter_list:
-        TYPE IDENTIFIER ',' parameter_list
+        nonempty_parameter_list ',' TYPE IDENTIFIER
+        {
+            list_append($1, parameter_new(compilation->syntax_arena,
+                                          token_name(compilation, $4)));
+            $$ = $1;
+        }
         |
         TYPE IDENTIFIER
+        {
+            List *parameters = list_new_in(compilation->syntax_arena);
+            list_append(parameters,
+                        parameter_new(compilation->syntax_arena,
+                                      token_name(compilation, $2)));
+            $$ = parameters;
+        }
         ;
 
+/* Lists of statements, declarations and arguments are left recursive,
+ * so we append each item as it's parsed and yacc's own stack doesn't
+ * grow with the length of the list.
+ */
 block:
-        statement block
+        block statement
         {
-            /* Append to the current block, or start a new block. */
-            Syntax *block_syntax;
-            if (stack_empty(syntax_stack)) {
-                block_syntax = block_new(list_new());
-            } else if (((Syntax *)stack_peek(syntax_stack))->type != BLOCK) {
-                block_syntax = block_new(list_new());
-            } else {
-                block_syntax = stack_pop(syntax_stack);
-            }
-
-            list_push(block_syntax->block->statements, stack_pop(syntax_stack));
-            stack_push(syntax_stack, block_syntax);
+            Syntax *statement = stack_pop(compilation->syntax_stack);
+            Syntax *block_syntax = stack_peek(compilation->syntax_stack);
+            list_append(block_syntax->block->statements, statement);
         }
         |
+        {
+            Arena *arena = compilation->syntax_arena;
+            stack_push(compilation->syntax_stack,
+                       block_new(arena, list_new_in(arena)));
+        }
         ;
 
 argument_list:
@@ -108,70 +149,64 @@ argument_list:
         |
         {
             // Empty argument list.
-            stack_push(syntax_stack, function_arguments_new());
+            stack_push(compilation->syntax_stack,
+                       function_arguments_new(compilation->syntax_arena));
         }
         ;
 
 nonempty_argument_list:
-        expression ',' nonempty_argument_list
+        nonempty_argument_list ',' expression
         {
-            Syntax *arguments_syntax;
-            if (stack_empty(syntax_stack)) {
-                // This should be impossible, we shouldn't be able to
-                // parse this on its own.
-                assert(false);
-            } else if (((Syntax *)stack_peek(syntax_stack))->type != FUNCTION_ARGUMENTS) {
-                arguments_syntax = function_arguments_new();
-            } else {
-                arguments_syntax = stack_pop(syntax_stack);
-            }
-
-            list_push(arguments_syntax->function_arguments->arguments, stack_pop(syntax_stack));
-            stack_push(syntax_stack, arguments_syntax);
+            Syntax *argument = stack_pop(compilation->syntax_stack);
+            Syntax *arguments_syntax = stack_peek(compilation->syntax_stack);
+            list_append(arguments_syntax->function_arguments->arguments,
+                        argument);
         }
         |
         expression
         {
-            // TODO: find a way to factor out the duplication with the above.
-            if (stack_empty(syntax_stack)) {
-                // This should be impossible, we shouldn't be able to
-                // parse this on its own.
-                assert(false);
-            }
-
-            Syntax *arguments_syntax = function_arguments_new();
-            list_push(arguments_syntax->function_arguments->arguments, stack_pop(syntax_stack));
+            Syntax *arguments_syntax =
+                function_arguments_new(compilation->syntax_arena);
+            list_append(arguments_syntax->function_arguments->arguments,
+                        stack_pop(compilation->syntax_stack));
 
-            stack_push(syntax_stack, arguments_syntax);
+            stack_push(compilation->syntax_stack, arguments_syntax);
         }
         ;
 
 statement:
         RETURN expression ';'
         {
-            Syntax *current_syntax = stack_pop(syntax_stack);
-            stack_push(syntax_stack, return_statement_new(current_syntax));
+            Syntax *current_syntax = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       return_statement_new(compilation->syntax_arena,
+                                            current_syntax));
         }
         |
         IF '(' expression ')' OPEN_BRACE block CLOSE_BRACE
         {
             // TODO: else statements.
-            Syntax *then = stack_pop(syntax_stack);
-            Syntax *condition = stack_pop(syntax_stack);
-            stack_push(syntax_stack, if_new(condition, then));
+            Syntax *then = stack_pop(compilation->syntax_stack);
+            Syntax *condition = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       if_new(compilation->syntax_arena, condition, then));
         }
         |
         WHILE '(' expression ')' OPEN_BRACE block CLOSE_BRACE
         {
-            Syntax *body = stack_pop(syntax_stack);
-            Syntax *condition = stack_pop(syntax_stack);
-            stack_push(syntax_stack, while_new(condition, body));
+            Syntax *body = stack_pop(compilation->syntax_stack);
+            Syntax *condition = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       while_new(compilation->syntax_arena, condition, body));
         }
         |
         TYPE IDENTIFIER '=' expression ';'
         {
-            Syntax *init_value = stack_pop(syntax_stack);
-            stack_push(syntax_stack, define_var_new((char*)$2, init_value));
+            Syntax *init_value = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       define_var_new(compilation->syntax_arena,
+                                      token_name(compilation, $2),
+                                      init_value));
         }
         |
         expression ';'
@@ -183,71 +218,92 @@ statement:
 expression:
 	NUMBER
         {
-            stack_push(syntax_stack, immediate_new(atoi((char*)$1)));
-            free($1);
+            stack_push(compilation->syntax_stack,
+                       immediate_new(compilation->syntax_arena,
+                                     token_value(compilation, $1)));
         }
         |
 	IDENTIFIER
         {
-            stack_push(syntax_stack, variable_new((char*)$1));
+            stack_push(compilation->syntax_stack,
+                       variable_new(compilation->syntax_arena,
+                                    token_name(compilation, $1)));
         }
         |
 	IDENTIFIER '=' expression
         {
-            Syntax *expression = stack_pop(syntax_stack);
-            stack_push(syntax_stack, assignment_new((char*)$1, expression));
+            Syntax *expression = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       assignment_new(compilation->syntax_arena,
+                                      token_name(compilation, $1),
+                                      expression));
         }
         |
         '~' expression
         {
-            Syntax *current_syntax = stack_pop(syntax_stack);
-            stack_push(syntax_stack, bitwise_negation_new(current_syntax));
+            Syntax *current_syntax = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       bitwise_negation_new(compilation->syntax_arena,
+                                            current_syntax));
         }
         |
         '!' expression
         {
-            Syntax *current_syntax = stack_pop(syntax_stack);
-            stack_push(syntax_stack, logical_negation_new(current_syntax));
+            Syntax *current_syntax = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       logical_negation_new(compilation->syntax_arena,
+                                            current_syntax));
         }
         |
         expression '+' expression
         {
-            Syntax *right = stack_pop(syntax_stack);
-            Syntax *left = stack_pop(syntax_stack);
-            stack_push(syntax_stack, addition_new(left, right));
+            Syntax *right = stack_pop(compilation->syntax_stack);
+            Syntax *left = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       addition_new(compilation->syntax_arena, left, right));
         }
         |
         expression '-' expression
         {
-            Syntax *right = stack_pop(syntax_stack);
-            Syntax *left = stack_pop(syntax_stack);
-            stack_push(syntax_stack, subtraction_new(left, right));
+            Syntax *right = stack_pop(compilation->syntax_stack);
+            Syntax *left = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       subtraction_new(compilation->syntax_arena, left,
+                                       right));
         }
         |
         expression '*' expression
         {
-            Syntax *right = stack_pop(syntax_stack);
-            Syntax *left = stack_pop(syntax_stack);
-            stack_push(syntax_stack, multiplication_new(left, right));
+            Syntax *right = stack_pop(compilation->syntax_stack);
+            Syntax *left = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       multiplication_new(compilation->syntax_arena, left,
+                                          right));
         }
         |
         expression '<' expression
         {
-            Syntax *right = stack_pop(syntax_stack);
-            Syntax *left = stack_pop(syntax_stack);
-            stack_push(syntax_stack, less_than_new(left, right));
+            Syntax *right = stack_pop(compilation->syntax_stack);
+            Syntax *left = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       less_than_new(compilation->syntax_arena, left, right));
         }
         |
         expression LESS_OR_EQUAL expression
         {
-            Syntax *right = stack_pop(syntax_stack);
-            Syntax *left = stack_pop(syntax_stack);
-            stack_push(syntax_stack, less_or_equal_new(left, right));
+            Syntax *right = stack_pop(compilation->syntax_stack);
+            Syntax *left = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       less_or_equal_new(compilation->syntax_arena, left,
+                                         right));
         }
         |
         IDENTIFIER '(' argument_list ')'
         {
-            Syntax *arguments = stack_pop(syntax_stack);
-            stack_push(syntax_stack, function_call_new((char*)$1, arguments));
+            Syntax *arguments = stack_pop(compilation->syntax_stack);
+            stack_push(compilation->syntax_stack,
+                       function_call_new(compilation->syntax_arena,
+                                         token_name(compilation, $1),
+                                         arguments));
         }
         ;
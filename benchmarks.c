@@ -0,0 +1,966 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "syntax.h"
+#include "flat_syntax.h"
+#include "assembly.h"
+#include "context.h"
+#include "arena.h"
+#include "list.h"
+#include "intern.h"
+#include "environment.h"
+#include "stack.h"
+#include "ir.h"
+#include "lower.h"
+#include "tail_calls.h"
+#include "preprocessor.h"
+#include "source.h"
+#include "lexer.h"
+#include "compilation.h"
+#include "build/y.tab.h"
+
+/* Micro-benchmarks for the compiler's internals. Run them all with
+ * `make bench`, or pass benchmark names to run a subset:
+ *
+ *     $ build/benchmarks flat-syntax
+ */
+
+// Defined in lexer.c.
+extern int yylex(YYSTYPE *value, Lexer *lexer);
+
+/* Copy LENGTH bytes of TEXT into a buffer that we can lex. */
+static SourceBuffer *source_copy(const char *text, size_t length) {
+    char *copy = malloc(length + 2);
+    memcpy(copy, text, length);
+    return source_from_memory(copy, length);
+}
+
+/* A Compilation with the default options, for parsing programs in
+ * memory with compilation_parse.
+ */
+static Compilation *memory_compilation(void) {
+    static CompileOptions options;
+    compile_options_init(&options);
+    return compilation_new("<memory>", NULL, &options);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Cache misses are counted with perf_event_open where the kernel
+ * allows it. Otherwise we just report times.
+ */
+static int cache_miss_counter_start(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd != -1) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return fd;
+}
+
+static void print_cache_misses(int fd) {
+    if (fd == -1) {
+        printf("%12s", "n/a");
+        return;
+    }
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long misses = 0;
+    if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+        misses = -1;
+    }
+    close(fd);
+
+    printf("%12lld", misses);
+}
+
+/* Build `int main() { int x = 0; x = x + (i * 3); ... return x; }`
+ * with STATEMENT_COUNT assignments.
+ */
+static Syntax *long_function_new(Arena *arena, Interner *names,
+                                 int statement_count) {
+    char *x = intern_string(names, "x");
+
+    List *statements = list_new_in(arena);
+    list_append(statements,
+                define_var_new(arena, x, immediate_new(arena, 0)));
+
+    for (int i = 0; i < statement_count; i++) {
+        Syntax *product = multiplication_new(
+            arena, immediate_new(arena, i % 7), immediate_new(arena, 3));
+        list_append(statements,
+                    assignment_new(arena, x,
+                                   addition_new(arena, variable_new(arena, x),
+                                                product)));
+    }
+    list_append(statements,
+                return_statement_new(arena, variable_new(arena, x)));
+
+    Syntax *top_level = top_level_new(arena);
+    Syntax *function =
+        function_new(arena, intern_string(names, "main"), list_new_in(arena),
+                     block_new(arena, statements));
+    list_append(top_level->top_level->declarations, function);
+
+    return top_level;
+}
+
+static long syntax_tree_sum(Syntax *syntax) {
+    if (syntax->type == IMMEDIATE) {
+        return syntax->immediate->value;
+    } else if (syntax->type == VARIABLE) {
+        return 1;
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return syntax_tree_sum(syntax->binary_expression->left) +
+               syntax_tree_sum(syntax->binary_expression->right);
+    } else if (syntax->type == ASSIGNMENT) {
+        return syntax_tree_sum(syntax->assignment->expression);
+    } else if (syntax->type == DEFINE_VAR) {
+        return syntax_tree_sum(syntax->define_var_statement->init_value);
+    } else if (syntax->type == RETURN_STATEMENT) {
+        return syntax_tree_sum(syntax->return_statement->expression);
+    } else if (syntax->type == FUNCTION) {
+        return syntax_tree_sum(syntax->function->root_block);
+    } else if (syntax->type == BLOCK || syntax->type == TOP_LEVEL) {
+        List *children = syntax->type == BLOCK
+                             ? syntax->block->statements
+                             : syntax->top_level->declarations;
+        long sum = 0;
+        for (int i = 0; i < list_length(children); i++) {
+            sum += syntax_tree_sum(list_get(children, i));
+        }
+        return sum;
+    }
+    return 0;
+}
+
+static long flat_sum(FlatSyntax *flat, FlatIndex index) {
+    FlatNode *node = &flat->nodes[index];
+
+    if (node->type == IMMEDIATE) {
+        return node->value;
+    } else if (node->type == VARIABLE) {
+        return 1;
+    } else if (node->type == BINARY_OPERATOR) {
+        return flat_sum(flat, node->first) + flat_sum(flat, node->second);
+    } else if (node->type == ASSIGNMENT || node->type == DEFINE_VAR ||
+               node->type == RETURN_STATEMENT || node->type == FUNCTION) {
+        return flat_sum(flat, node->first);
+    } else if (node->type == BLOCK || node->type == TOP_LEVEL) {
+        long sum = 0;
+        for (uint32_t i = 0; i < node->second; i++) {
+            sum += flat_sum(flat, flat_child(flat, node, i));
+        }
+        return sum;
+    }
+    return 0;
+}
+
+static void bench_flat_syntax(void) {
+    const int statement_count = 100000;
+    const int repetitions = 20;
+
+    Arena *arena = arena_new();
+    Interner *names = interner_new();
+    Syntax *syntax = long_function_new(arena, names, statement_count);
+    FlatSyntax *flat = flatten_syntax(syntax);
+
+    printf("%d statements, %zu tree bytes, %zu flat bytes\n",
+           statement_count, arena->bytes_allocated,
+           flat->node_count * sizeof(FlatNode) +
+               flat->child_count * sizeof(FlatIndex));
+    printf("%-20s %12s %12s\n", "", "seconds", "cache misses");
+
+    long tree_total = 0, flat_total = 0;
+
+    int counter = cache_miss_counter_start();
+    double start = now_seconds();
+    for (int i = 0; i < repetitions; i++) {
+        tree_total += syntax_tree_sum(syntax);
+    }
+    printf("%-20s %12.4f", "tree traversal", now_seconds() - start);
+    print_cache_misses(counter);
+    printf("\n");
+
+    counter = cache_miss_counter_start();
+    start = now_seconds();
+    for (int i = 0; i < repetitions; i++) {
+        flat_total += flat_sum(flat, flat->root);
+    }
+    printf("%-20s %12.4f", "flat traversal", now_seconds() - start);
+    print_cache_misses(counter);
+    printf("\n");
+
+    if (tree_total != flat_total) {
+        printf("Traversals disagree: %ld vs %ld\n", tree_total, flat_total);
+    }
+
+    Emitter *out = emitter_open("/dev/null");
+
+    Context *ctx = new_context();
+    counter = cache_miss_counter_start();
+    start = now_seconds();
+    IrProgram *program = lower_syntax(syntax, "<benchmark>");
+    write_ir_program(out, program, ctx);
+    printf("%-20s %12.4f", "tree via IR", now_seconds() - start);
+    print_cache_misses(counter);
+    printf("\n");
+    ir_program_free(program);
+    context_free(ctx);
+
+    ctx = new_context();
+    counter = cache_miss_counter_start();
+    start = now_seconds();
+    write_flat_syntax(out, flat, flat->root, ctx);
+    printf("%-20s %12.4f", "flat write_syntax", now_seconds() - start);
+    print_cache_misses(counter);
+    printf("\n");
+    context_free(ctx);
+
+    emitter_close(out);
+    flat_syntax_free(flat);
+    interner_free(names);
+    arena_free(arena);
+}
+
+/* Define N variables, half of them in a nested block scope, look them
+ * all up, then leave the scope and reset for the next function.
+ */
+static void bench_environment_size(int n) {
+    Interner *interner = interner_new();
+    char **names = malloc(n * sizeof(char *));
+    char buffer[32];
+    for (int i = 0; i < n; i++) {
+        snprintf(buffer, sizeof(buffer), "v%d", i);
+        names[i] = intern_string(interner, buffer);
+    }
+
+    Environment *env = environment_new();
+
+    double start = now_seconds();
+    for (int i = 0; i < n; i++) {
+        if (i == n / 2) {
+            environment_push_scope(env);
+        }
+        environment_set(env, names[i], -4 * (i + 1));
+    }
+    double insert_time = now_seconds() - start;
+
+    start = now_seconds();
+    long total = 0;
+    for (int i = 0; i < n; i++) {
+        total += environment_get(env, names[i]);
+    }
+    double lookup_time = now_seconds() - start;
+
+    start = now_seconds();
+    environment_pop_scope(env);
+    environment_reset(env);
+    double reset_time = now_seconds() - start;
+
+    printf("%10d %12.1f %12.1f %12.4f\n", n, insert_time * 1e9 / n,
+           lookup_time * 1e9 / n, reset_time);
+
+    if (total != -2L * n * ((long)n + 1)) {
+        printf("Lookups returned the wrong offsets!\n");
+    }
+
+    environment_free(env);
+    free(names);
+    interner_free(interner);
+}
+
+static void bench_environment(void) {
+    printf("%10s %12s %12s %12s\n", "variables", "ns/insert", "ns/lookup",
+           "pop+reset s");
+    bench_environment_size(10000);
+    bench_environment_size(100000);
+    bench_environment_size(1000000);
+}
+
+/* Parse a function body of STATEMENT_COUNT statements. Block parsing
+ * should be linear, so the time per statement should stay constant.
+ */
+static void bench_parser_size(int statement_count) {
+    char *text;
+    size_t length;
+    FILE *out = open_memstream(&text, &length);
+    fprintf(out, "int main() {\n    int x = 0;\n");
+    for (int i = 0; i < statement_count; i++) {
+        fprintf(out, "    x = x + %d;\n", i % 100);
+    }
+    fprintf(out, "    return x;\n}\n");
+    fclose(out);
+
+    SourceBuffer *source = source_copy(text, length);
+    free(text);
+
+    Compilation *compilation = memory_compilation();
+
+    double start = now_seconds();
+    Syntax *syntax = compilation_parse(compilation, source);
+    double elapsed = now_seconds() - start;
+
+    if (syntax == NULL) {
+        printf("Parsing %d statements failed!\n", statement_count);
+    } else {
+        printf("%10d %12.4f %14.1f %12zu\n", statement_count, elapsed,
+               elapsed * 1e9 / statement_count,
+               compilation->syntax_arena->bytes_allocated);
+    }
+
+    compilation_free(compilation);
+}
+
+static void bench_parser(void) {
+    printf("%10s %12s %14s %12s\n", "statements", "seconds", "ns/statement",
+           "arena bytes");
+    bench_parser_size(10000);
+    bench_parser_size(100000);
+    bench_parser_size(1000000);
+}
+
+/* How we used to write instructions: stdio, one fprintf per space of
+ * padding and vfprintf for operands.
+ */
+static void stdio_emit_instr(FILE *out, char *instr, int offset) {
+    fprintf(out, "    %s", instr);
+    int argument_offset = 7 - strlen(instr) + 4;
+    while (argument_offset > 0) {
+        fprintf(out, " ");
+        argument_offset--;
+    }
+    fprintf(out, "%%eax, %d(%%ebp)", offset);
+    fputs("\n", out);
+}
+
+static void bench_emitter(void) {
+    const int instruction_count = 2000000;
+
+    FILE *file = fopen("/dev/null", "wb");
+    double start = now_seconds();
+    for (int i = 0; i < instruction_count; i++) {
+        stdio_emit_instr(file, "mov", -4 * (i % 1000));
+    }
+    fclose(file);
+    double stdio_time = now_seconds() - start;
+
+    Emitter *out = emitter_open("/dev/null");
+    start = now_seconds();
+    for (int i = 0; i < instruction_count; i++) {
+        emit_mnemonic(out, "mov");
+        emit_format(out, "%%eax, %d(%%ebp)\n", -4 * (i % 1000));
+    }
+    emitter_flush(out);
+    double emitter_time = now_seconds() - start;
+    double megabytes = out->bytes_written / 1e6;
+    emitter_close(out);
+
+    printf("%-10s %12s %12s\n", "", "seconds", "MB/s");
+    printf("%-10s %12.4f %12.1f\n", "stdio", stdio_time,
+           megabytes / stdio_time);
+    printf("%-10s %12.4f %12.1f\n", "emitter", emitter_time,
+           megabytes / emitter_time);
+}
+
+/* Count the instructions in the assembly at PATH that access memory,
+ * i.e. have an operand like -4(%ebp) or (%esp). Pushes and pops are
+ * counted too.
+ */
+static int count_memory_operations(char *path) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int count = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, "(%") != NULL || strstr(line, "push") != NULL ||
+            strstr(line, "pop") != NULL) {
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+/* Compile every program in test_programs via the IR, with register
+ * allocation, and with the flat codegen, which keeps every value on
+ * the stack, and compare how many instructions touch memory.
+ */
+static void bench_memory_operations(void) {
+    struct dirent **entries;
+    int entry_count = scandir("test_programs", &entries, NULL, alphasort);
+    if (entry_count < 0) {
+        printf("Could not open test_programs directory!\n");
+        return;
+    }
+
+    char assembly_path[] = "/tmp/babyc_bench_XXXXXX";
+    int fd = mkstemp(assembly_path);
+    close(fd);
+
+    printf("%-45s %8s %8s\n", "program", "IR", "flat");
+
+    int tree_total = 0, flat_total = 0;
+    for (int i = 0; i < entry_count; i++) {
+        struct dirent *entry = entries[i];
+        if (strstr(entry->d_name, ".c") == NULL) {
+            free(entry);
+            continue;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "test_programs/%s", entry->d_name);
+        Compilation *compilation = memory_compilation();
+        List *include_paths = list_new();
+        SourceBuffer *source =
+            preprocess(path, include_paths, compilation->names);
+        list_free(include_paths);
+
+        Syntax *syntax = compilation_parse(compilation, source);
+        if (syntax == NULL) {
+            printf("%-45s parsing failed!\n", entry->d_name);
+        } else {
+
+            Emitter *out = emitter_open(assembly_path);
+            Context *ctx = new_context();
+            IrProgram *program = lower_syntax(syntax, "<benchmark>");
+            write_ir_program(out, program, ctx);
+            ir_program_free(program);
+            context_free(ctx);
+            emitter_close(out);
+            int tree_count = count_memory_operations(assembly_path);
+
+            FlatSyntax *flat = flatten_syntax(syntax);
+            out = emitter_open(assembly_path);
+            ctx = new_context();
+            write_flat_syntax(out, flat, flat->root, ctx);
+            context_free(ctx);
+            emitter_close(out);
+            flat_syntax_free(flat);
+            int flat_count = count_memory_operations(assembly_path);
+
+            printf("%-45s %8d %8d\n", entry->d_name, tree_count, flat_count);
+            tree_total += tree_count;
+            flat_total += flat_count;
+        }
+
+        compilation_free(compilation);
+        free(entry);
+    }
+
+    printf("%-45s %8d %8d (%.1fx fewer)\n", "total", tree_total, flat_total,
+           (double)flat_total / tree_total);
+
+    unlink(assembly_path);
+    free(entries);
+}
+
+static const char loop_program[] =
+    "int main() {\n"
+    "    int i = 0;\n"
+    "    int total = 0;\n"
+    "    while (i < 300000000) {\n"
+    "        if (!total <= i) {\n"
+    "            total = total + 3;\n"
+    "        }\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    return total < 0;\n"
+    "}\n";
+
+// How many times we run each binary. We report the fastest, as the
+// slower runs are mostly noise from the rest of the machine.
+static const int TIMING_RUNS = 5;
+
+/* Compile SYNTAX to a binary at BINARY_PATH, then run it and return
+ * how long it took, or -1 if it couldn't be built.
+ */
+static double time_binary(Syntax *syntax, bool fuse_branches, bool fastcall,
+                          char *binary_path) {
+    char assembly_path[256], command[1024];
+    snprintf(assembly_path, sizeof(assembly_path), "%s.s", binary_path);
+
+    Emitter *out = emitter_open(assembly_path);
+    Context *ctx = new_context();
+    ctx->fuse_branches = fuse_branches;
+    IrProgram *program = lower_syntax(syntax, "<benchmark>");
+    if (fastcall) {
+        ir_use_fastcall(program);
+    }
+    eliminate_tail_calls(program);
+    write_header(out);
+    write_ir_program(out, program, ctx);
+    write_footer(out, ctx->target);
+    ir_program_free(program);
+    context_free(ctx);
+    emitter_close(out);
+
+    snprintf(command, sizeof(command),
+             "as --32 %s -o %s.o && ld -m elf_i386 -s -o %s %s.o",
+             assembly_path, binary_path, binary_path, binary_path);
+    int result = system(command);
+
+    snprintf(command, sizeof(command), "%s.o", binary_path);
+    unlink(command);
+    unlink(assembly_path);
+    if (result != 0) {
+        return -1;
+    }
+
+    double fastest = -1;
+    for (int i = 0; i < TIMING_RUNS; i++) {
+        double start = now_seconds();
+        system(binary_path);
+        double elapsed = now_seconds() - start;
+        if (fastest < 0 || elapsed < fastest) {
+            fastest = elapsed;
+        }
+    }
+
+    unlink(binary_path);
+    return fastest;
+}
+
+/* Parse the program TEXT with COMPILATION, returning NULL if it
+ * doesn't parse. The syntax tree lives until the compilation is
+ * freed.
+ */
+static Syntax *parse_program(Compilation *compilation, const char *text,
+                             size_t length) {
+    return compilation_parse(compilation, source_copy(text, length));
+}
+
+/* Build SYNTAX once for each configuration and time it. Each run
+ * does ITERATIONS iterations of its hot loop.
+ */
+static void time_configurations(Syntax *syntax, char **names,
+                                bool *fuse_branches, bool *fastcall,
+                                int count, long iterations) {
+    char binary_path[] = "/tmp/babyc_bin_XXXXXX";
+    close(mkstemp(binary_path));
+
+    printf("%-20s %12s %16s\n", "", "seconds", "ns per iteration");
+    for (int i = 0; i < count; i++) {
+        double elapsed =
+            time_binary(syntax, fuse_branches[i], fastcall[i], binary_path);
+        if (elapsed < 0) {
+            printf("%-20s could not assemble, is binutils installed?\n",
+                   names[i]);
+            break;
+        }
+        printf("%-20s %12.4f %16.3f\n", names[i], elapsed,
+               elapsed * 1e9 / iterations);
+    }
+}
+
+/* Run a tight while loop compiled with and without fusing comparisons
+ * into conditional jumps.
+ */
+static void bench_loop(void) {
+    Compilation *compilation = memory_compilation();
+    Syntax *syntax = parse_program(compilation, loop_program,
+                                   sizeof(loop_program) - 1);
+
+    if (syntax == NULL) {
+        printf("Parsing the loop program failed!\n");
+    } else {
+        char *names[] = {"setcc and test", "fused cmp and jcc"};
+        bool fuse[] = {false, true};
+        bool fastcall[] = {false, false};
+        time_configurations(syntax, names, fuse, fastcall, 2, 300000000);
+    }
+
+    compilation_free(compilation);
+}
+
+// A hot loop through a chain of small internal calls, which we don't
+// inline as we don't optimise here.
+static const char calls_program[] =
+    "int scale(int value, int factor) {\n"
+    "    return value * factor + 1;\n"
+    "}\n"
+    "int mix(int total, int i, int factor) {\n"
+    "    int scaled = scale(i, factor);\n"
+    "    return scaled - total;\n"
+    "}\n"
+    "int main() {\n"
+    "    int i = 0;\n"
+    "    int total = 0;\n"
+    "    while (i < 100000000) {\n"
+    "        total = mix(total, i, 3);\n"
+    "        i = i + 1;\n"
+    "    }\n"
+    "    return total < 0;\n"
+    "}\n";
+
+/* Run a call-heavy loop with every argument on the stack (cdecl), and
+ * with the first two in registers (fastcall).
+ */
+static void bench_calls(void) {
+    Compilation *compilation = memory_compilation();
+    Syntax *syntax = parse_program(compilation, calls_program,
+                                   sizeof(calls_program) - 1);
+
+    if (syntax == NULL) {
+        printf("Parsing the calls program failed!\n");
+    } else {
+        char *names[] = {"cdecl", "fastcall"};
+        bool fuse[] = {true, true};
+        bool fastcall[] = {false, true};
+        time_configurations(syntax, names, fuse, fastcall, 2, 100000000);
+    }
+
+    compilation_free(compilation);
+}
+
+/* The best of RUNS wall clock times, in microseconds, to expand PATH
+ * with `gcc -E` or with our own preprocessor.
+ */
+static double time_preprocessing(char *path, bool use_gcc, int runs) {
+    List *include_paths = list_new();
+    Interner *names = interner_new();
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        double start = now_seconds();
+        if (use_gcc) {
+            char command[1024];
+            snprintf(command, sizeof(command), "gcc -E %s > /dev/null", path);
+            if (system(command) != 0) {
+                best = -1;
+                break;
+            }
+        } else {
+            source_free(preprocess(path, include_paths, names));
+        }
+        double elapsed = (now_seconds() - start) * 1e6;
+
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    list_free(include_paths);
+    interner_free(names);
+    return best;
+}
+
+/* Expanding a small program and a large, macro heavy one in process,
+ * compared with running gcc -E as we used to.
+ */
+static void bench_preprocessor(void) {
+    char directory[] = "/tmp/babyc_preprocess_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        printf("Could not create a temporary directory!\n");
+        return;
+    }
+
+    char header_path[1024], large_path[1024];
+    snprintf(header_path, sizeof(header_path), "%s/macros.h", directory);
+    snprintf(large_path, sizeof(large_path), "%s/large.c", directory);
+
+    FILE *header = fopen(header_path, "w");
+    fprintf(header, "#ifndef MACROS_H\n#define MACROS_H\n"
+                    "#define SCALE 3\n"
+                    "#define TWICE(x) ((x) + (x))\n"
+                    "#define STEP(x, y) TWICE(x) * SCALE + y\n"
+                    "#endif\n");
+    fclose(header);
+
+    FILE *large = fopen(large_path, "w");
+    fprintf(large, "int main() {\n    int x = 0;\n");
+    for (int i = 0; i < 100000; i++) {
+        if (i % 100 == 0) {
+            fprintf(large, "#include \"macros.h\"\n");
+        }
+        fprintf(large, "    x = STEP(x, %d); // step %d\n", i % 10, i);
+    }
+    fprintf(large, "    return x;\n}\n");
+    fclose(large);
+
+    char *names[] = {"test_programs/preprocessor__return_2.c", large_path};
+    char *labels[] = {"small program", "100,000 lines"};
+    printf("%-15s %14s %14s %10s\n", "input", "gcc -E (us)", "babyc (us)",
+           "speedup");
+    for (int i = 0; i < 2; i++) {
+        double gcc_time = time_preprocessing(names[i], true, 5);
+        double babyc_time = time_preprocessing(names[i], false, 5);
+        if (gcc_time < 0) {
+            printf("%-15s gcc -E failed!\n", labels[i]);
+            continue;
+        }
+        printf("%-15s %14.1f %14.1f %9.1fx\n", labels[i], gcc_time,
+               babyc_time, gcc_time / babyc_time);
+    }
+
+    unlink(header_path);
+    unlink(large_path);
+    rmdir(directory);
+}
+
+/* Write a program of about MEGABYTES MB to a temporary file, and
+ * store its path in PATH.
+ */
+static void write_lexer_input(char *path, int megabytes) {
+    int fd = mkstemp(path);
+    FILE *out = fdopen(fd, "w");
+
+    long size = 0;
+    for (int function = 0; size < megabytes * 1024L * 1024L; function++) {
+        size += fprintf(out, "int function_%d(int first, int second) {\n",
+                        function);
+        for (int i = 0; i < 20; i++) {
+            size += fprintf(out,
+                            "    int local_%d = first * %d + second;\n"
+                            "    while (local_%d <= %d) {\n"
+                            "        local_%d = local_%d + 1; // Count up.\n"
+                            "    }\n",
+                            i, i * 7, i, i * 1000, i, i);
+        }
+        size += fprintf(out, "    return first;\n}\n\n");
+    }
+    fclose(out);
+}
+
+/* Lex the whole of SOURCE with KIND, returning the number of
+ * tokens.
+ */
+static long lex_all(SourceBuffer *source, LexerKind kind) {
+    Lexer *lexer = lexer_new(source, kind, "<benchmark>");
+    YYSTYPE value;
+    long tokens = 0;
+    while (yylex(&value, lexer) != 0) {
+        tokens++;
+    }
+    lexer_free(lexer);
+    return tokens;
+}
+
+/* The best of three times to lex the file at PATH with KIND, storing
+ * how many tokens it had in TOKENS.
+ */
+static double time_lexer(char *path, LexerKind kind, long *tokens) {
+
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+        SourceBuffer *source = source_map(path);
+
+        double start = now_seconds();
+        *tokens = lex_all(source, kind);
+        double elapsed = now_seconds() - start;
+        source_free(source);
+
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return best;
+}
+
+/* Lexer throughput on generated programs, read straight from a
+ * mapped file, with the flex scanner and the hand-written lexer. The
+ * lexers only produce slices of the input, so this doesn't intern
+ * anything or allocate per token.
+ */
+static void bench_lexer(void) {
+    printf("%6s %10s %14s %14s %10s\n", "MB", "tokens", "flex (MB/s)",
+           "hand (MB/s)", "speedup");
+
+    int sizes[] = {1, 4, 16};
+    for (int i = 0; i < 3; i++) {
+        char path[] = "/tmp/babyc_lexer_XXXXXX";
+        write_lexer_input(path, sizes[i]);
+
+        long flex_tokens = 0;
+        long hand_tokens = 0;
+        double flex_time = time_lexer(path, LEXER_FLEX, &flex_tokens);
+        double hand_time = time_lexer(path, LEXER_HAND_WRITTEN, &hand_tokens);
+
+        SourceBuffer *source = source_map(path);
+        double megabytes = source->length / (1024.0 * 1024.0);
+        source_free(source);
+        unlink(path);
+
+        if (flex_tokens != hand_tokens) {
+            printf("%6.1f lexers disagree: %ld tokens from flex, %ld from "
+                   "the hand-written lexer!\n",
+                   megabytes, flex_tokens, hand_tokens);
+            continue;
+        }
+        printf("%6.1f %10ld %14.1f %14.1f %9.1fx\n", megabytes, flex_tokens,
+               megabytes / flex_time, megabytes / hand_time,
+               flex_time / hand_time);
+    }
+}
+
+/* Write COUNT small programs to DIRECTORY, storing their paths in
+ * PATHS.
+ */
+static void write_batch_inputs(char *directory, char **paths, int count) {
+    for (int i = 0; i < count; i++) {
+        paths[i] = malloc(1024);
+        snprintf(paths[i], 1024, "%s/program_%d.c", directory, i);
+
+        FILE *out = fopen(paths[i], "w");
+        for (int function = 0; function < 10; function++) {
+            fprintf(out, "int function_%d(int x) {\n", function);
+            fprintf(out, "    int total = %d;\n", i);
+            fprintf(out, "    while (0 < x) {\n"
+                         "        total = total + x * %d;\n"
+                         "        x = x - 1;\n"
+                         "    }\n",
+                    function + 1);
+            fprintf(out, "    return total;\n}\n\n");
+        }
+        fprintf(out, "int main() {\n    return function_9(%d) - %d;\n}\n",
+                i % 5, i);
+        fclose(out);
+    }
+}
+
+/* Compiling many small files in one process with -j, on 1, 2, 4 ...
+ * threads up to the number of CPUs, compared with starting babyc once
+ * per file.
+ */
+static void bench_batch(void) {
+    char directory[] = "/tmp/babyc_batch_XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        printf("Could not create a temporary directory!\n");
+        return;
+    }
+
+    int file_count = 500;
+    char **paths = malloc(sizeof(char *) * file_count);
+    write_batch_inputs(directory, paths, file_count);
+
+    CompileOptions options;
+    compile_options_init(&options);
+    options.include_paths = list_new();
+    options.optimisation_level = 2;
+
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    double start = now_seconds();
+    for (int i = 0; i < file_count; i++) {
+        char command[4096];
+        snprintf(command, sizeof(command),
+                 "cd %s && %s/build/babyc -O2 %s >/dev/null", directory, cwd,
+                 paths[i]);
+        if (system(command) != 0) {
+            printf("babyc failed on %s!\n", paths[i]);
+            break;
+        }
+    }
+    double process_time = now_seconds() - start;
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%d files, %ld CPUs\n", file_count, cpu_count);
+    printf("%-20s %12s %10s\n", "", "files/s", "speedup");
+    printf("%-20s %12.1f %10s\n", "process per file",
+           file_count / process_time, "");
+
+    // At least up to 4 threads, to show the pool's overhead when
+    // there are fewer CPUs.
+    int max_threads = cpu_count > 4 ? cpu_count : 4;
+    double one_thread_time = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            start = now_seconds();
+            int failures = compile_batch(paths, file_count, &options, threads);
+            double elapsed = now_seconds() - start;
+            if (failures > 0) {
+                printf("%d files failed to compile!\n", failures);
+            }
+            if (run == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        if (threads == 1) {
+            one_thread_time = best;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "-j %d", threads);
+        printf("%-20s %12.1f %9.1fx\n", label, file_count / best,
+               one_thread_time / best);
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        char *output_path = assembly_path(paths[i]);
+        unlink(output_path);
+        free(output_path);
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    char out_path[1024];
+    snprintf(out_path, sizeof(out_path), "%s/out.s", directory);
+    unlink(out_path);
+    rmdir(directory);
+    list_free(options.include_paths);
+}
+
+typedef struct Benchmark {
+    char *name;
+    void (*run)(void);
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+    {"flat-syntax", bench_flat_syntax},
+    {"environment", bench_environment},
+    {"parser", bench_parser},
+    {"lexer", bench_lexer},
+    {"emitter", bench_emitter},
+    {"memory-operations", bench_memory_operations},
+    {"loop", bench_loop},
+    {"calls", bench_calls},
+    {"preprocessor", bench_preprocessor},
+    {"batch", bench_batch},
+};
+
+static const int benchmark_count = sizeof(benchmarks) / sizeof(Benchmark);
+
+int main(int argc, char *argv[]) {
+    for (int i = 0; i < benchmark_count; i++) {
+        bool selected = argc == 1;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], benchmarks[i].name) == 0) {
+                selected = true;
+            }
+        }
+
+        if (selected) {
+            printf("== %s ==\n", benchmarks[i].name);
+            benchmarks[i].run();
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
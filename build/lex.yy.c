@@ -0,0 +1,38 @@
+/* Test-harness stand-in for the reentrant flex scanner (flex unavailable here).
+ * Mirrors babyc_lex.l: scans the Lexer's source in place, yields slices. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "y.tab.h"
+#include "../syntax.h"
+#include "../source.h"
+#include "../lexer.h"
+typedef struct Scanner { Lexer *lexer; char *pos; } Scanner;
+void *flex_scanner_new(Lexer *lexer){ Scanner *s=malloc(sizeof(Scanner)); s->lexer=lexer; s->pos=lexer->source->text; return s; }
+void flex_scanner_free(void *scanner){ free(scanner); }
+int flex_lex(YYSTYPE *yylval, void *scanner){
+  Scanner *sc=scanner; char *pos=sc->pos; char *base=sc->lexer->source->text;
+  char c; int tok;
+#define RET(t) do{ tok=(t); goto out; }while(0)
+again:
+  c=*pos;
+  if(c==0) RET(0);
+  pos++;
+  if(c==' '||c=='\t'||c=='\n') goto again;
+  if(c=='#'){ while(*pos&&*pos!='\n')pos++; goto again;}
+  if(c=='/'&&*pos=='/'){ while(*pos&&*pos!='\n')pos++; goto again;}
+  if(c=='/'&&*pos=='*'){ char *e=strstr(pos+1,"*/"); if(!e){lexer_error(sc->lexer,"unterminated comment"); pos+=strlen(pos); RET(0);} pos=e+2; goto again;}
+  if(c=='<'&&*pos=='='){pos++;RET(LESS_OR_EQUAL);}
+  if(c=='{')RET(OPEN_BRACE); if(c=='}')RET(CLOSE_BRACE);
+  if(strchr("()~!+-*<=;,",c))RET(c);
+  char *s=pos-1;
+  if(isdigit((unsigned char)c)){ while(isdigit((unsigned char)*pos))pos++; yylval->token.offset=s-base; yylval->token.length=pos-s; RET(NUMBER);}
+  if(isalpha((unsigned char)c)||c=='_'){ while(isalnum((unsigned char)*pos)||*pos=='_')pos++;
+    int n=pos-s;
+    if(n==2&&!strncmp(s,"if",2))RET(IF); if(n==5&&!strncmp(s,"while",5))RET(WHILE); if(n==6&&!strncmp(s,"return",6))RET(RETURN); if(n==3&&!strncmp(s,"int",3))RET(TYPE);
+    yylval->token.offset=s-base; yylval->token.length=pos-s; RET(IDENTIFIER);}
+  RET(c);
+out:
+  sc->pos=pos; return tok;
+}
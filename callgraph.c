@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include "callgraph.h"
+#include "ir.h"
+#include "list.h"
+
+/* Return the index of the function called FUNCTION_NAME, or -1 if the
+ * program doesn't define it.
+ */
+int call_graph_find(CallGraph *graph, char *function_name) {
+    List *functions = graph->program->functions;
+    for (int i = 0; i < list_length(functions); i++) {
+        IrFunction *function = list_get(functions, i);
+        if (strcmp(function->name, function_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void find_callees(CallGraph *graph, int caller) {
+    IrFunction *function = list_get(graph->program->functions, caller);
+    int *callees = malloc(graph->function_count * sizeof(int));
+    int count = 0;
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            if (instruction->opcode != IR_CALL) {
+                continue;
+            }
+
+            int callee = call_graph_find(graph, instruction->function_name);
+            if (callee == -1) {
+                continue;
+            }
+
+            bool seen = false;
+            for (int k = 0; k < count; k++) {
+                if (callees[k] == callee) {
+                    seen = true;
+                }
+            }
+            if (!seen) {
+                callees[count++] = callee;
+            }
+        }
+    }
+
+    graph->callees[caller] = callees;
+    graph->callee_counts[caller] = count;
+}
+
+typedef struct Tarjan {
+    CallGraph *graph;
+    int *numbers;
+    int *lowlinks;
+    bool *on_stack;
+    int *stack;
+    int stack_size;
+    int next_number;
+    int component_count;
+    int bottom_up_count;
+} Tarjan;
+
+/* Tarjan's strongly connected components algorithm. Components are
+ * completed callees first, which gives us the bottom-up order.
+ * Programs are small, so we recurse.
+ */
+static void strong_connect(Tarjan *tarjan, int function) {
+    CallGraph *graph = tarjan->graph;
+
+    tarjan->numbers[function] = tarjan->next_number;
+    tarjan->lowlinks[function] = tarjan->next_number;
+    tarjan->next_number++;
+    tarjan->stack[tarjan->stack_size++] = function;
+    tarjan->on_stack[function] = true;
+
+    for (int i = 0; i < graph->callee_counts[function]; i++) {
+        int callee = graph->callees[function][i];
+        if (callee == function) {
+            graph->recursive[function] = true;
+        }
+
+        if (tarjan->numbers[callee] == -1) {
+            strong_connect(tarjan, callee);
+            if (tarjan->lowlinks[callee] < tarjan->lowlinks[function]) {
+                tarjan->lowlinks[function] = tarjan->lowlinks[callee];
+            }
+        } else if (tarjan->on_stack[callee] &&
+                   tarjan->numbers[callee] < tarjan->lowlinks[function]) {
+            tarjan->lowlinks[function] = tarjan->numbers[callee];
+        }
+    }
+
+    if (tarjan->lowlinks[function] != tarjan->numbers[function]) {
+        return;
+    }
+
+    // FUNCTION is the root of a component: pop it off the stack.
+    int component = tarjan->component_count++;
+    int size = 0;
+    int member;
+    do {
+        member = tarjan->stack[--tarjan->stack_size];
+        tarjan->on_stack[member] = false;
+        graph->components[member] = component;
+        graph->bottom_up[tarjan->bottom_up_count++] = member;
+        size++;
+    } while (member != function);
+
+    if (size > 1) {
+        int end = tarjan->bottom_up_count;
+        for (int i = end - size; i < end; i++) {
+            graph->recursive[graph->bottom_up[i]] = true;
+        }
+    }
+}
+
+CallGraph *call_graph_new(IrProgram *program) {
+    int function_count = list_length(program->functions);
+
+    CallGraph *graph = malloc(sizeof(CallGraph));
+    graph->program = program;
+    graph->function_count = function_count;
+    graph->callees = malloc(function_count * sizeof(int *));
+    graph->callee_counts = malloc(function_count * sizeof(int));
+    graph->components = malloc(function_count * sizeof(int));
+    graph->recursive = calloc(function_count, sizeof(bool));
+    graph->bottom_up = malloc(function_count * sizeof(int));
+
+    for (int i = 0; i < function_count; i++) {
+        find_callees(graph, i);
+    }
+
+    Tarjan tarjan;
+    tarjan.graph = graph;
+    tarjan.numbers = malloc(function_count * sizeof(int));
+    tarjan.lowlinks = malloc(function_count * sizeof(int));
+    tarjan.on_stack = calloc(function_count, sizeof(bool));
+    tarjan.stack = malloc(function_count * sizeof(int));
+    tarjan.stack_size = 0;
+    tarjan.next_number = 0;
+    tarjan.component_count = 0;
+    tarjan.bottom_up_count = 0;
+
+    for (int i = 0; i < function_count; i++) {
+        tarjan.numbers[i] = -1;
+    }
+    for (int i = 0; i < function_count; i++) {
+        if (tarjan.numbers[i] == -1) {
+            strong_connect(&tarjan, i);
+        }
+    }
+
+    free(tarjan.numbers);
+    free(tarjan.lowlinks);
+    free(tarjan.on_stack);
+    free(tarjan.stack);
+
+    return graph;
+}
+
+void call_graph_free(CallGraph *graph) {
+    for (int i = 0; i < graph->function_count; i++) {
+        free(graph->callees[i]);
+    }
+    free(graph->callees);
+    free(graph->callee_counts);
+    free(graph->components);
+    free(graph->recursive);
+    free(graph->bottom_up);
+    free(graph);
+}
@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include "ir.h"
+#include "list.h"
+
+#ifndef BABYC_CALLGRAPH_HEADER
+#define BABYC_CALLGRAPH_HEADER
+
+/* Which functions in a program call which. Functions are identified
+ * by their position in IrProgram->functions.
+ */
+typedef struct CallGraph {
+    IrProgram *program;
+    int function_count;
+
+    // For each function, the indexes of the functions it calls,
+    // without duplicates. Calls to functions we don't have the
+    // definition of aren't included.
+    int **callees;
+    int *callee_counts;
+
+    // The strongly connected component of each function. Functions
+    // in the same component can call each other recursively.
+    int *components;
+    // Is the function part of a cycle, including calling itself?
+    bool *recursive;
+
+    // Function indexes with callees before their callers (except
+    // within a cycle, where the order is arbitrary).
+    int *bottom_up;
+} CallGraph;
+
+CallGraph *call_graph_new(IrProgram *program);
+
+int call_graph_find(CallGraph *graph, char *function_name);
+
+void call_graph_free(CallGraph *graph);
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <err.h>
+#include "compilation.h"
+#include "build/y.tab.h"
+#include "errors.h"
+#include "flat_syntax.h"
+#include "inliner.h"
+#include "ir_optimise.h"
+#include "lower.h"
+#include "optimise.h"
+#include "preprocessor.h"
+#include "tail_calls.h"
+#include "thread_pool.h"
+
+void compile_options_init(CompileOptions *options) {
+    options->terminate_at = EMIT_ASM;
+    options->print_arena_stats = false;
+    options->use_flat_syntax = false;
+    options->print_peephole = false;
+    options->print_frames = false;
+    options->use_fastcall = false;
+    options->target = &target_i386;
+    options->inline_threshold = DEFAULT_INLINE_THRESHOLD;
+    options->optimisation_level = 0;
+    options->lexer = LEXER_FLEX;
+    options->include_paths = NULL;
+    options->batch = false;
+}
+
+/* Prepare to compile FILE_NAME, writing assembly to OUTPUT_PATH. */
+Compilation *compilation_new(char *file_name, char *output_path,
+                             CompileOptions *options) {
+    Compilation *compilation = malloc(sizeof(Compilation));
+    compilation->options = options;
+    compilation->file_name = file_name;
+
+    compilation->output.path = output_path;
+    compilation->output.source_path = file_name;
+    compilation->output.peephole = options->optimisation_level >= 1;
+    compilation->output.frame_stats.function_count = 0;
+    compilation->output.frame_stats.frames_eliminated = 0;
+    for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+        compilation->output.peephole_stats.hits[i] = 0;
+    }
+
+    compilation->names = interner_new();
+    compilation->source = NULL;
+    compilation->syntax_stack = stack_new();
+    compilation->syntax_arena = arena_new();
+    return compilation;
+}
+
+/* Parse SOURCE, which the compilation takes ownership of. Returns
+ * NULL if it doesn't parse.
+ */
+Syntax *compilation_parse(Compilation *compilation, SourceBuffer *source) {
+    compilation->source = source;
+
+    Lexer *lexer = lexer_new(source, compilation->options->lexer,
+                             compilation->file_name);
+    int result = yyparse(lexer, compilation);
+    lexer_free(lexer);
+    if (result != 0) {
+        return NULL;
+    }
+
+    Stack *syntax_stack = compilation->syntax_stack;
+    Syntax *complete_syntax = stack_pop(syntax_stack);
+    if (syntax_stack->size > 0) {
+        warnx("Did not consume the whole syntax stack during parsing! "
+              "Remaining:");
+
+        while(syntax_stack->size > 0) {
+            fprintf(stderr, "%s", syntax_type_name(stack_pop(syntax_stack)));
+        }
+    }
+    return complete_syntax;
+}
+
+static int compile_stages(Compilation *compilation) {
+    CompileOptions *options = compilation->options;
+    int optimisation_level = options->optimisation_level;
+
+    SourceBuffer *expansion =
+        preprocess(compilation->file_name, options->include_paths,
+                   compilation->names);
+
+    if (options->terminate_at == MACRO_EXPAND) {
+        fwrite(expansion->text, 1, expansion->length, stdout);
+        source_free(expansion);
+        return 0;
+    }
+
+    Syntax *complete_syntax = compilation_parse(compilation, expansion);
+    if (complete_syntax == NULL) {
+        if (!options->batch) {
+            printf("\n");
+        }
+        return 1;
+    }
+
+    if (optimisation_level >= 1) {
+        complete_syntax =
+            fold_constants(complete_syntax, compilation->file_name);
+    }
+
+    if (options->use_flat_syntax) {
+        FlatSyntax *flat = flatten_syntax(complete_syntax);
+
+        if (options->terminate_at == PARSE) {
+            print_flat_syntax(flat);
+        } else {
+            write_flat_assembly(flat, &compilation->output);
+        }
+
+        flat_syntax_free(flat);
+    } else if (options->terminate_at == PARSE) {
+        print_syntax(complete_syntax);
+    } else {
+        IrProgram *program =
+            lower_syntax(complete_syntax, compilation->file_name);
+        ir_use_convention(program, options->target->convention);
+        if (options->use_fastcall) {
+            ir_use_fastcall(program);
+        }
+        if (optimisation_level >= 1 && options->inline_threshold > 0) {
+            inline_functions(program, options->inline_threshold);
+        }
+        // Always on: without it, deep tail recursion overflows the
+        // stack.
+        eliminate_tail_calls(program);
+        if (optimisation_level >= 2) {
+            optimise_ir(program);
+        }
+
+        if (options->terminate_at == LOWER) {
+            print_ir(program);
+        } else {
+            write_assembly(program, options->target, &compilation->output);
+        }
+
+        ir_program_free(program);
+    }
+
+    if (options->terminate_at == EMIT_ASM && !options->batch) {
+        Target *target = options->target;
+        printf("Written %s.\n", compilation->output.path);
+        printf("Build it with:\n");
+        printf("    $ as %s -o out.o %s\n", compilation->output.path,
+               target->assembler_flag);
+        printf("    $ ld -m %s -s -o out out.o\n", target->linker_emulation);
+    }
+
+    if (options->print_frames) {
+        print_frame_stats(&compilation->output.frame_stats);
+    }
+
+    if (options->print_peephole) {
+        print_peephole_stats(&compilation->output.peephole_stats);
+    }
+
+    if (options->print_arena_stats) {
+        Arena *arena = compilation->syntax_arena;
+        printf("Syntax arena: %zu bytes in %zu blocks, %zu nodes.\n",
+               arena->bytes_allocated, arena->block_count,
+               arena->node_count);
+    }
+
+    return 0;
+}
+
+/* Preprocess, parse and compile the file, stopping at the stage in
+ * the options. Returns 0 on success, and 1 if the program has an
+ * error, which we've reported. Anything the failed stage allocated
+ * outside the compilation is leaked.
+ */
+int compile(Compilation *compilation) {
+    jmp_buf failed;
+    if (setjmp(failed) != 0) {
+        compile_errors_trap(NULL);
+        return 1;
+    }
+
+    compile_errors_trap(&failed);
+    int result = compile_stages(compilation);
+    compile_errors_trap(NULL);
+    return result;
+}
+
+void compilation_free(Compilation *compilation) {
+    // Any Syntax left on the stack after a parse error is owned by
+    // the arena too.
+    arena_free(compilation->syntax_arena);
+    stack_free(compilation->syntax_stack);
+    interner_free(compilation->names);
+    if (compilation->source != NULL) {
+        source_free(compilation->source);
+    }
+    free(compilation);
+}
+
+/* Where we write the assembly for FILE_NAME: foo.c is compiled to
+ * foo.s, and anything else gets .s appended. The caller must free it.
+ */
+char *assembly_path(char *file_name) {
+    size_t length = strlen(file_name);
+    if (length > 2 && strcmp(file_name + length - 2, ".c") == 0) {
+        length -= 2;
+    }
+
+    char *path = malloc(length + 3);
+    memcpy(path, file_name, length);
+    strcpy(path + length, ".s");
+    return path;
+}
+
+typedef struct Batch {
+    char **file_names;
+    CompileOptions *options;
+    // Set by whichever thread compiles each file.
+    bool *failed;
+} Batch;
+
+static void compile_batch_file(void *argument, int index) {
+    Batch *batch = argument;
+    char *file_name = batch->file_names[index];
+    char *output_path = assembly_path(file_name);
+
+    Compilation *compilation =
+        compilation_new(file_name, output_path, batch->options);
+    batch->failed[index] = compile(compilation) != 0;
+    compilation_free(compilation);
+    free(output_path);
+}
+
+/* Compile each of FILE_NAMES to the assembly_path next to it, sharing
+ * the files between THREAD_COUNT threads. Each file is compiled
+ * separately, so an error in one doesn't stop the others. Returns how
+ * many failed, after listing them.
+ */
+int compile_batch(char **file_names, int file_count, CompileOptions *options,
+                  int thread_count) {
+    options->batch = true;
+    Batch batch = {file_names, options, calloc(file_count, sizeof(bool))};
+    thread_pool_run(thread_count, file_count, compile_batch_file, &batch);
+
+    int failures = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (batch.failed[i]) {
+            warnx("%s: compilation failed", file_names[i]);
+            failures++;
+        }
+    }
+    free(batch.failed);
+
+    if (failures > 0) {
+        warnx("%d of %d files failed to compile.", failures, file_count);
+    }
+    return failures;
+}
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include "arena.h"
+#include "assembly.h"
+#include "intern.h"
+#include "lexer.h"
+#include "list.h"
+#include "source.h"
+#include "stack.h"
+#include "syntax.h"
+#include "target.h"
+
+#ifndef BABYC_COMPILATION_HEADER
+#define BABYC_COMPILATION_HEADER
+
+typedef enum {
+    MACRO_EXPAND,
+    PARSE,
+    LOWER,
+    EMIT_ASM,
+} stage_t;
+
+/* How to compile, from the command line. Options are only read during
+ * compilation, so several compilations can share them.
+ */
+typedef struct CompileOptions {
+    stage_t terminate_at;
+    bool print_arena_stats;
+    bool use_flat_syntax;
+    bool print_peephole;
+    bool print_frames;
+    bool use_fastcall;
+    Target *target;
+    int inline_threshold;
+    // 0 for none, 1 for syntax tree folding, inlining and peephole
+    // optimisation, 2 to optimise the IR too.
+    int optimisation_level;
+    LexerKind lexer;
+    // Directories to search for #include files.
+    List *include_paths;
+    // Whether we're compiling several files at once, so shouldn't
+    // print anything for each one.
+    bool batch;
+} CompileOptions;
+
+void compile_options_init(CompileOptions *options);
+
+/* Everything we need to compile one file. Nothing in the pipeline is
+ * global, so separate Compilations can run at the same time.
+ */
+typedef struct Compilation {
+    CompileOptions *options;
+    char *file_name;
+    // Where we write the assembly, and the statistics we keep while
+    // writing it.
+    AssemblyOutput output;
+
+    Interner *names;
+    // The preprocessed source, which tokens point into.
+    SourceBuffer *source;
+    // The parser builds the syntax tree on this stack, allocating it
+    // in the arena.
+    Stack *syntax_stack;
+    Arena *syntax_arena;
+} Compilation;
+
+Compilation *compilation_new(char *file_name, char *output_path,
+                             CompileOptions *options);
+
+Syntax *compilation_parse(Compilation *compilation, SourceBuffer *source);
+
+int compile(Compilation *compilation);
+
+void compilation_free(Compilation *compilation);
+
+char *assembly_path(char *file_name);
+
+int compile_batch(char **file_names, int file_count, CompileOptions *options,
+                  int thread_count);
+
+#endif
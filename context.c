@@ -6,9 +6,9 @@ static const int WORD_SIZE = 4;
 
 void new_scope(Context *ctx) {
     // Each function needs a fresh set of local variables (we
-    // don't support globals yet).
-    environment_free(ctx->env);
-    ctx->env = environment_new();
+    // don't support globals yet). Resetting keeps the memory from the
+    // previous function.
+    environment_reset(ctx->env);
 
     ctx->stack_offset = -1 * WORD_SIZE;
 }
@@ -16,8 +16,21 @@ void new_scope(Context *ctx) {
 Context *new_context() {
     Context *ctx = malloc(sizeof(Context));
     ctx->stack_offset = 0;
-    ctx->env = NULL;
+    ctx->env = environment_new();
     ctx->label_count = 0;
+    ctx->program = NULL;
+    ctx->target = &target_i386;
+    ctx->intervals = NULL;
+    ctx->call_crossing_intervals = NULL;
+    ctx->callee_saved_used = 0;
+    ctx->has_frame = true;
+    ctx->stack_depth = 0;
+    ctx->frame_stats.function_count = 0;
+    ctx->frame_stats.frames_eliminated = 0;
+    ctx->function_name = NULL;
+    ctx->parameter_count = 0;
+    ctx->source_path = NULL;
+    ctx->fuse_branches = true;
 
     return ctx;
 }
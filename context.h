@@ -1,7 +1,61 @@
+#include <stdbool.h>
+#include "environment.h"
+#include "emitter.h"
+#include "ir.h"
+#include "list.h"
+#include "target.h"
+
+#ifndef BABYC_CONTEXT_HEADER
+#define BABYC_CONTEXT_HEADER
+
+/* How many functions we've written, and how many of those didn't
+ * need a frame pointer. See print_frame_stats.
+ */
+typedef struct FrameStats {
+    int function_count;
+    int frames_eliminated;
+} FrameStats;
+
 typedef struct Context {
     int stack_offset;
     Environment *env;
     int label_count;
+
+    // The program we're writing, so we can look up callees.
+    IrProgram *program;
+    // What we're writing assembly for. The flat backend only supports
+    // i386.
+    Target *target;
+
+    // The LiveInterval of each vreg in the current function.
+    List *intervals;
+    // The intervals that are live across at least one call.
+    List *call_crossing_intervals;
+    // A bitmask of REGISTER_BIT values.
+    unsigned int callee_saved_used;
+
+    // Does the current function set up %ebp? Functions without any
+    // stack slots don't need to.
+    bool has_frame;
+    // How many bytes the current function has pushed or reserved
+    // below its return address, before any call sequence. We use it
+    // to keep the stack aligned at calls.
+    int stack_depth;
+    FrameStats frame_stats;
+
+    // The function we're writing in the flat backend, how many
+    // parameters it has, and the label after its prologue that a self
+    // tail call jumps back to.
+    char *function_name;
+    int parameter_count;
+    Label function_start;
+    // The file we're compiling, for the flat backend's errors.
+    char *source_path;
+
+    // Compile comparisons that feed a branch straight into a
+    // conditional jump, see fused_comparison. Only turned off to
+    // measure the difference.
+    bool fuse_branches;
 } Context;
 
 void new_scope(Context *ctx);
@@ -9,3 +63,5 @@ void new_scope(Context *ctx);
 Context *new_context();
 
 void context_free(Context *ctx);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include "emitter.h"
+#include "errors.h"
+
+Emitter *emitter_open(char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        compile_error("Could not open %s: %s", path, strerror(errno));
+    }
+
+    Emitter *out = malloc(sizeof(Emitter));
+    out->fd = fd;
+    out->capacity = EMITTER_BUFFER_SIZE;
+    out->buffer = malloc(out->capacity);
+    out->size = 0;
+    out->bytes_written = 0;
+
+    return out;
+}
+
+/* Create an Emitter that keeps everything in memory, so we can
+ * post-process the text before writing it out.
+ */
+Emitter *emitter_new_buffer(void) {
+    Emitter *out = malloc(sizeof(Emitter));
+    out->fd = -1;
+    out->capacity = EMITTER_BUFFER_SIZE;
+    out->buffer = malloc(out->capacity);
+    out->size = 0;
+    out->bytes_written = 0;
+
+    return out;
+}
+
+static void write_all(Emitter *out, char *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(out->fd, bytes, length);
+        if (written == -1) {
+            err(1, "Could not write assembly");
+        }
+        bytes += written;
+        length -= written;
+    }
+}
+
+void emitter_flush(Emitter *out) {
+    if (out->fd == -1) {
+        return;
+    }
+
+    write_all(out, out->buffer, out->size);
+
+    out->bytes_written += out->size;
+    out->size = 0;
+}
+
+void emit_bytes(Emitter *out, char *bytes, size_t length) {
+    if (out->fd == -1) {
+        while (out->size + length > out->capacity) {
+            out->capacity *= 2;
+            out->buffer = realloc(out->buffer, out->capacity);
+        }
+    } else if (out->size + length > out->capacity) {
+        emitter_flush(out);
+
+        if (length > out->capacity) {
+            write_all(out, bytes, length);
+            out->bytes_written += length;
+            return;
+        }
+    }
+
+    memcpy(out->buffer + out->size, bytes, length);
+    out->size += length;
+}
+
+void emit_string(Emitter *out, char *string) {
+    emit_bytes(out, string, strlen(string));
+}
+
+void emit_int(Emitter *out, int value) {
+    // Enough for "-2147483648".
+    char digits[12];
+    int start = sizeof(digits);
+
+    // Work with the magnitude as unsigned, so INT_MIN doesn't overflow.
+    unsigned int magnitude =
+        value < 0 ? -(unsigned int)value : (unsigned int)value;
+    do {
+        digits[--start] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0) {
+        digits[--start] = '-';
+    }
+
+    emit_bytes(out, digits + start, sizeof(digits) - start);
+}
+
+void emit_label_name(Emitter *out, Label label) {
+    emit_bytes(out, ".", 1);
+    emit_string(out, label.prefix);
+    emit_bytes(out, "_", 1);
+    emit_int(out, label.number);
+}
+
+/* A minimal vprintf. We support %d (int), %s (char *), %L (Label)
+ * and %%, which is all our assembly needs.
+ */
+void emit_vformat(Emitter *out, char *format, va_list argptr) {
+    char *literal_start = format;
+    char *c = format;
+    while (*c != '\0') {
+        if (*c != '%') {
+            c++;
+            continue;
+        }
+
+        emit_bytes(out, literal_start, c - literal_start);
+        c++;
+
+        if (*c == 'd') {
+            emit_int(out, va_arg(argptr, int));
+        } else if (*c == 's') {
+            emit_string(out, va_arg(argptr, char *));
+        } else if (*c == 'L') {
+            emit_label_name(out, va_arg(argptr, Label));
+        } else if (*c == '%') {
+            emit_bytes(out, "%", 1);
+        } else {
+            errx(1, "Unsupported format directive '%%%c'", *c);
+        }
+
+        c++;
+        literal_start = c;
+    }
+    emit_bytes(out, literal_start, c - literal_start);
+}
+
+/* Example:
+ * emit_format(out, "%d(%%ebp)", -4);
+ */
+void emit_format(Emitter *out, char *format, ...) {
+    va_list argptr;
+    va_start(argptr, format);
+    emit_vformat(out, format, argptr);
+    va_end(argptr);
+}
+
+void emitter_close(Emitter *out) {
+    emitter_flush(out);
+    if (out->fd != -1) {
+        close(out->fd);
+    }
+
+    free(out->buffer);
+    free(out);
+}
@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifndef BABYC_EMITTER_HEADER
+#define BABYC_EMITTER_HEADER
+
+/* Buffered output for assembly. We accumulate text in a large buffer
+ * and write(2) it in big chunks, formatting numbers ourselves rather
+ * than going through stdio.
+ */
+typedef struct Emitter {
+    // The file we write to, or -1 if we keep all the text in the
+    // buffer (see emitter_new_buffer).
+    int fd;
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    size_t bytes_written;
+} Emitter;
+
+#define EMITTER_BUFFER_SIZE (1024 * 1024)
+
+/* A local label, written as .PREFIX_NUMBER. Labels are values, so
+ * creating one doesn't allocate.
+ */
+typedef struct Label {
+    char *prefix;
+    int number;
+} Label;
+
+Emitter *emitter_open(char *path);
+
+Emitter *emitter_new_buffer(void);
+
+void emit_bytes(Emitter *out, char *bytes, size_t length);
+
+void emit_string(Emitter *out, char *string);
+
+void emit_int(Emitter *out, int value);
+
+void emit_label_name(Emitter *out, Label label);
+
+void emit_vformat(Emitter *out, char *format, va_list argptr);
+
+void emit_format(Emitter *out, char *format, ...);
+
+void emitter_flush(Emitter *out);
+
+void emitter_close(Emitter *out);
+
+#endif
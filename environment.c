@@ -1,50 +1,218 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <err.h>
 #include "environment.h"
 
-/* A data structure that maps variable names (i.e. strings) to offsets
- * (integers) in the current stack frame.
+/* A data structure that maps variable names (i.e. strings) to
+ * integers, such as offsets in the current stack frame or indexes into
+ * a table of locals. Variable names are interned, so we compare them by
+ * pointer.
+ *
+ * This is an open addressing hash table with linear probing. Block
+ * scopes are handled by logging what each binding shadowed, and
+ * undoing those bindings when the scope is popped.
  */
 
+#define INITIAL_ENV_CAPACITY 64
+
 Environment *environment_new() {
     Environment *env = malloc(sizeof(Environment));
     env->size = 0;
-    env->items = NULL;
+    env->capacity = INITIAL_ENV_CAPACITY;
+    env->items = calloc(env->capacity, sizeof(Binding));
+    env->generation = 1;
+
+    env->shadowed = NULL;
+    env->shadowed_size = 0;
+    env->shadowed_capacity = 0;
+
+    env->scope_starts = NULL;
+    env->scope_depth = 0;
+    env->scope_capacity = 0;
 
     return env;
 }
 
-void environment_set_offset(Environment *env, char *var_name, int offset) {
-    env->size++;
-    env->items = realloc(env->items, env->size * sizeof(VarWithOffset));
+static size_t hash_var_name(char *var_name) {
+    uintptr_t hash = (uintptr_t)var_name;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static bool slot_empty(Environment *env, Binding *slot) {
+    return slot->var_name == NULL || slot->generation != env->generation;
+}
+
+/* Return the slot holding VAR_NAME, or the empty slot where it
+ * belongs.
+ */
+static Binding *environment_find(Environment *env, char *var_name) {
+    size_t mask = env->capacity - 1;
+    size_t i = hash_var_name(var_name) & mask;
+
+    while (!slot_empty(env, &env->items[i]) &&
+           env->items[i].var_name != var_name) {
+        i = (i + 1) & mask;
+    }
+
+    return &env->items[i];
+}
+
+static void environment_grow(Environment *env) {
+    Binding *old_items = env->items;
+    size_t old_capacity = env->capacity;
+
+    env->capacity *= 2;
+    env->items = calloc(env->capacity, sizeof(Binding));
 
-    VarWithOffset *vwo = &env->items[env->size - 1];
-    // TODO: use a copy of the string instead
-    vwo->var_name = var_name;
-    vwo->offset = offset;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!slot_empty(env, &old_items[i])) {
+            *environment_find(env, old_items[i].var_name) = old_items[i];
+        }
+    }
+
+    free(old_items);
 }
 
-/* Return the offset from %ebp of variable VAR_NAME.
+/* Remove VAR_NAME. To keep probe sequences intact, we shift any
+ * following entries in the same cluster back into the gap.
  */
-int environment_get_offset(Environment *env, char *var_name) {
-    VarWithOffset vwo;
-    for (size_t i = 0; i < env->size; i++) {
-        vwo = env->items[i];
+static void environment_remove(Environment *env, char *var_name) {
+    size_t mask = env->capacity - 1;
+    Binding *slot = environment_find(env, var_name);
+    if (slot_empty(env, slot)) {
+        return;
+    }
 
-        if (strcmp(vwo.var_name, var_name) == 0) {
-            return vwo.offset;
+    size_t gap = slot - env->items;
+    size_t i = gap;
+    while (true) {
+        i = (i + 1) & mask;
+        if (slot_empty(env, &env->items[i])) {
+            break;
         }
+
+        // Only move the entry if its home slot isn't cyclically in
+        // (gap, i].
+        size_t home = hash_var_name(env->items[i].var_name) & mask;
+        if (((i - home) & mask) >= ((i - gap) & mask)) {
+            env->items[gap] = env->items[i];
+            gap = i;
+        }
+    }
+
+    env->items[gap].var_name = NULL;
+    env->size--;
+}
+
+void environment_set(Environment *env, char *var_name, int value) {
+    if (2 * (env->size + 1) > env->capacity) {
+        environment_grow(env);
+    }
+
+    Binding *binding = environment_find(env, var_name);
+    bool was_bound = !slot_empty(env, binding);
+
+    // Bindings in the outermost scope are only discarded by
+    // environment_reset, so there's nothing to restore.
+    if (env->scope_depth > 0) {
+        if (env->shadowed_size == env->shadowed_capacity) {
+            env->shadowed_capacity = env->shadowed_capacity == 0
+                                         ? INITIAL_ENV_CAPACITY
+                                         : env->shadowed_capacity * 2;
+            env->shadowed = realloc(env->shadowed, env->shadowed_capacity *
+                                                       sizeof(ShadowedVar));
+        }
+
+        ShadowedVar *shadowed = &env->shadowed[env->shadowed_size++];
+        shadowed->var_name = var_name;
+        shadowed->was_bound = was_bound;
+        shadowed->previous_value = was_bound ? binding->value : 0;
+    }
+
+    if (!was_bound) {
+        env->size++;
+    }
+
+    binding->var_name = var_name;
+    binding->value = value;
+    binding->generation = env->generation;
+}
+
+/* Return the value bound to variable VAR_NAME, or -1 if it isn't
+ * bound. Callers report undefined variables themselves.
+ */
+int environment_get(Environment *env, char *var_name) {
+    Binding *binding = environment_find(env, var_name);
+    if (!slot_empty(env, binding)) {
+        return binding->value;
     }
 
-    warnx("Could not find %s in environment", var_name);
     return -1;
 }
 
+/* Start a new block scope. Variables defined until the matching
+ * environment_pop_scope will be forgotten, and any variables they
+ * shadowed restored.
+ */
+void environment_push_scope(Environment *env) {
+    if (env->scope_depth == env->scope_capacity) {
+        env->scope_capacity =
+            env->scope_capacity == 0 ? 16 : env->scope_capacity * 2;
+        env->scope_starts =
+            realloc(env->scope_starts, env->scope_capacity * sizeof(size_t));
+    }
+
+    env->scope_starts[env->scope_depth++] = env->shadowed_size;
+}
+
+void environment_pop_scope(Environment *env) {
+    if (env->scope_depth == 0) {
+        warnx("Tried to pop a scope, but no scope is open");
+        return;
+    }
+
+    size_t start = env->scope_starts[--env->scope_depth];
+
+    // Undo bindings in reverse order, so a variable defined twice in
+    // this scope gets its outer value back.
+    while (env->shadowed_size > start) {
+        ShadowedVar *shadowed = &env->shadowed[--env->shadowed_size];
+
+        if (shadowed->was_bound) {
+            environment_find(env, shadowed->var_name)->value =
+                shadowed->previous_value;
+        } else {
+            environment_remove(env, shadowed->var_name);
+        }
+    }
+}
+
+/* Forget all variables, but keep the memory we've allocated. This is
+ * constant time: slots from older generations are treated as empty.
+ */
+void environment_reset(Environment *env) {
+    env->generation++;
+    if (env->generation == 0) {
+        // We've wrapped around, so old slots could look current.
+        memset(env->items, 0, env->capacity * sizeof(Binding));
+        env->generation = 1;
+    }
+
+    env->size = 0;
+    env->shadowed_size = 0;
+    env->scope_depth = 0;
+}
+
 void environment_free(Environment *env) {
     if (env != NULL) {
         free(env->items);
+        free(env->shadowed);
+        free(env->scope_starts);
         free(env);
     }
 }
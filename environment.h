@@ -1,23 +1,53 @@
 #include <stdlib.h>
+#include <stdbool.h>
 
 #ifndef BABYC_ENV_HEADER
 #define BABYC_ENV_HEADER
 
-typedef struct VarWithOffset {
+typedef struct Binding {
     char *var_name;
-    int offset;
-} VarWithOffset;
+    int value;
+    // Slots from an older generation are empty, see environment_reset.
+    unsigned int generation;
+} Binding;
+
+/* When we bind a variable, we record what it shadowed, so we can
+ * restore it when the scope ends.
+ */
+typedef struct ShadowedVar {
+    char *var_name;
+    bool was_bound;
+    int previous_value;
+} ShadowedVar;
 
 typedef struct Environment {
+    // Open addressing hash table, keyed on the (interned) name.
     size_t size;
-    VarWithOffset *items;
+    size_t capacity;
+    Binding *items;
+    unsigned int generation;
+
+    ShadowedVar *shadowed;
+    size_t shadowed_size;
+    size_t shadowed_capacity;
+
+    // The value of shadowed_size when each enclosing scope started.
+    size_t *scope_starts;
+    size_t scope_depth;
+    size_t scope_capacity;
 } Environment;
 
 Environment *environment_new();
 
-void environment_set_offset(Environment *env, char *var_name, int offset);
+void environment_set(Environment *env, char *var_name, int value);
+
+int environment_get(Environment *env, char *var_name);
+
+void environment_push_scope(Environment *env);
+
+void environment_pop_scope(Environment *env);
 
-int environment_get_offset(Environment *env, char *var_name);
+void environment_reset(Environment *env);
 
 void environment_free(Environment *env);
 
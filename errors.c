@@ -0,0 +1,21 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <err.h>
+#include "errors.h"
+
+// Each thread compiles one file at a time, so has its own trap.
+static __thread jmp_buf *current_trap = NULL;
+
+void compile_errors_trap(jmp_buf *trap) { current_trap = trap; }
+
+void compile_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vwarnx(format, args);
+    va_end(args);
+
+    if (current_trap != NULL) {
+        longjmp(*current_trap, 1);
+    }
+    exit(1);
+}
@@ -0,0 +1,21 @@
+#include <setjmp.h>
+
+#ifndef BABYC_ERRORS_HEADER
+#define BABYC_ERRORS_HEADER
+
+/* Report an error in the program being compiled, like warnx, and give
+ * up on it. If this thread has set a trap with compile_errors_trap, we
+ * jump there, so that a batch can go on to its other files. Otherwise
+ * the error is fatal, like errx.
+ *
+ * Internal errors, where babyc itself is wrong, still use errx.
+ */
+void compile_error(const char *format, ...)
+    __attribute__((noreturn, format(printf, 1, 2)));
+
+/* Make compile_error on this thread longjmp to TRAP, or exit if TRAP
+ * is NULL.
+ */
+void compile_errors_trap(jmp_buf *trap);
+
+#endif
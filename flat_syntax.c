@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include "flat_syntax.h"
+#include "syntax.h"
+#include "list.h"
+
+#define INITIAL_FLAT_SIZE 64
+
+static FlatSyntax *flat_syntax_new(void) {
+    FlatSyntax *flat = malloc(sizeof(FlatSyntax));
+
+    flat->node_count = 0;
+    flat->node_capacity = INITIAL_FLAT_SIZE;
+    flat->nodes = malloc(flat->node_capacity * sizeof(FlatNode));
+
+    flat->child_count = 0;
+    flat->child_capacity = INITIAL_FLAT_SIZE;
+    flat->children = malloc(flat->child_capacity * sizeof(FlatIndex));
+
+    flat->name_count = 0;
+    flat->name_capacity = INITIAL_FLAT_SIZE;
+    flat->names = malloc(flat->name_capacity * sizeof(char *));
+
+    flat->root = FLAT_NONE;
+
+    return flat;
+}
+
+void flat_syntax_free(FlatSyntax *flat) {
+    free(flat->nodes);
+    free(flat->children);
+    free(flat->names);
+    free(flat);
+}
+
+/* Append a node of TYPE, returning its index. Note that this may move
+ * flat->nodes, so callers must not hold FlatNode pointers across it.
+ */
+static FlatIndex flat_node_new(FlatSyntax *flat, SyntaxType type) {
+    if (flat->node_count == flat->node_capacity) {
+        flat->node_capacity *= 2;
+        flat->nodes =
+            realloc(flat->nodes, flat->node_capacity * sizeof(FlatNode));
+    }
+
+    FlatIndex index = flat->node_count;
+    flat->node_count++;
+
+    FlatNode *node = &flat->nodes[index];
+    node->type = type;
+    node->operator_type = 0;
+    node->unused = 0;
+    node->value = 0;
+    node->first = FLAT_NONE;
+    node->second = FLAT_NONE;
+
+    return index;
+}
+
+/* Reserve COUNT consecutive child slots, returning the first. */
+static uint32_t flat_children_reserve(FlatSyntax *flat, uint32_t count) {
+    while (flat->child_count + count > flat->child_capacity) {
+        flat->child_capacity *= 2;
+        flat->children =
+            realloc(flat->children, flat->child_capacity * sizeof(FlatIndex));
+    }
+
+    uint32_t start = flat->child_count;
+    flat->child_count += count;
+
+    return start;
+}
+
+static uint32_t flat_name_new(FlatSyntax *flat, char *name) {
+    if (flat->name_count == flat->name_capacity) {
+        flat->name_capacity *= 2;
+        flat->names =
+            realloc(flat->names, flat->name_capacity * sizeof(char *));
+    }
+
+    flat->names[flat->name_count] = name;
+    return flat->name_count++;
+}
+
+static FlatIndex flatten(FlatSyntax *flat, Syntax *syntax);
+
+static FlatIndex flatten_list(FlatSyntax *flat, SyntaxType type,
+                              List *items) {
+    FlatIndex index = flat_node_new(flat, type);
+
+    uint32_t count = list_length(items);
+    uint32_t start = flat_children_reserve(flat, count);
+    flat->nodes[index].first = start;
+    flat->nodes[index].second = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        FlatIndex child = flatten(flat, list_get(items, i));
+        flat->children[start + i] = child;
+    }
+
+    return index;
+}
+
+static FlatIndex flatten(FlatSyntax *flat, Syntax *syntax) {
+    FlatIndex index;
+    FlatIndex child;
+
+    if (syntax->type == IMMEDIATE) {
+        index = flat_node_new(flat, IMMEDIATE);
+        flat->nodes[index].value = syntax->immediate->value;
+
+    } else if (syntax->type == VARIABLE) {
+        index = flat_node_new(flat, VARIABLE);
+        flat->nodes[index].name =
+            flat_name_new(flat, syntax->variable->var_name);
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        index = flat_node_new(flat, UNARY_OPERATOR);
+        flat->nodes[index].operator_type =
+            syntax->unary_expression->unary_type;
+
+        child = flatten(flat, syntax->unary_expression->expression);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        index = flat_node_new(flat, BINARY_OPERATOR);
+        flat->nodes[index].operator_type =
+            syntax->binary_expression->binary_type;
+
+        child = flatten(flat, syntax->binary_expression->left);
+        flat->nodes[index].first = child;
+        child = flatten(flat, syntax->binary_expression->right);
+        flat->nodes[index].second = child;
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        index = flat_node_new(flat, FUNCTION_CALL);
+        flat->nodes[index].name =
+            flat_name_new(flat, syntax->function_call->function_name);
+
+        child = flatten(flat, syntax->function_call->function_arguments);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == FUNCTION_ARGUMENTS) {
+        index = flatten_list(flat, FUNCTION_ARGUMENTS,
+                             syntax->function_arguments->arguments);
+
+    } else if (syntax->type == IF_STATEMENT) {
+        index = flat_node_new(flat, IF_STATEMENT);
+
+        child = flatten(flat, syntax->if_statement->condition);
+        flat->nodes[index].first = child;
+        child = flatten(flat, syntax->if_statement->then);
+        flat->nodes[index].second = child;
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        index = flat_node_new(flat, RETURN_STATEMENT);
+
+        child = flatten(flat, syntax->return_statement->expression);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == DEFINE_VAR) {
+        index = flat_node_new(flat, DEFINE_VAR);
+        flat->nodes[index].name =
+            flat_name_new(flat, syntax->define_var_statement->var_name);
+
+        child = flatten(flat, syntax->define_var_statement->init_value);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == BLOCK) {
+        index = flatten_list(flat, BLOCK, syntax->block->statements);
+
+    } else if (syntax->type == FUNCTION) {
+        index = flat_node_new(flat, FUNCTION);
+        flat->nodes[index].name = flat_name_new(flat, syntax->function->name);
+
+        List *parameters = syntax->function->parameters;
+        flat->nodes[index].second = list_length(parameters);
+        for (int i = 0; i < list_length(parameters); i++) {
+            Parameter *parameter = list_get(parameters, i);
+            child = flat_node_new(flat, VARIABLE);
+            flat->nodes[child].name = flat_name_new(flat, parameter->name);
+        }
+
+        child = flatten(flat, syntax->function->root_block);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == ASSIGNMENT) {
+        index = flat_node_new(flat, ASSIGNMENT);
+        flat->nodes[index].name =
+            flat_name_new(flat, syntax->assignment->var_name);
+
+        child = flatten(flat, syntax->assignment->expression);
+        flat->nodes[index].first = child;
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        index = flat_node_new(flat, WHILE_SYNTAX);
+
+        child = flatten(flat, syntax->while_statement->condition);
+        flat->nodes[index].first = child;
+        child = flatten(flat, syntax->while_statement->body);
+        flat->nodes[index].second = child;
+
+    } else if (syntax->type == TOP_LEVEL) {
+        index = flatten_list(flat, TOP_LEVEL,
+                             syntax->top_level->declarations);
+
+    } else {
+        errx(1, "Could not flatten syntax of type %s",
+             syntax_type_name(syntax));
+    }
+
+    return index;
+}
+
+/* Copy SYNTAX into a newly allocated FlatSyntax. Names are shared
+ * with SYNTAX, not copied.
+ */
+FlatSyntax *flatten_syntax(Syntax *syntax) {
+    FlatSyntax *flat = flat_syntax_new();
+    flat->root = flatten(flat, syntax);
+
+    return flat;
+}
+
+/* Return the index of the Ith child of a BLOCK, FUNCTION_ARGUMENTS or
+ * TOP_LEVEL node.
+ */
+FlatIndex flat_child(FlatSyntax *flat, FlatNode *node, uint32_t i) {
+    return flat->children[node->first + i];
+}
+
+char *flat_name(FlatSyntax *flat, FlatNode *node) {
+    return flat->names[node->name];
+}
+
+static void print_indent(int indent) {
+    for (int i = 0; i < indent; i++) {
+        printf(" ");
+    }
+}
+
+/* Print the node at INDEX. This produces the same output as
+ * print_syntax on the original tree.
+ */
+static void print_flat_indented(FlatSyntax *flat, FlatIndex index,
+                                int indent) {
+    print_indent(indent);
+
+    FlatNode *node = &flat->nodes[index];
+    char *syntax_type_string =
+        syntax_kind_name(node->type, node->operator_type);
+
+    if (node->type == IMMEDIATE) {
+        printf("%s %d\n", syntax_type_string, node->value);
+    } else if (node->type == VARIABLE) {
+        printf("%s '%s'\n", syntax_type_string, flat_name(flat, node));
+    } else if (node->type == UNARY_OPERATOR) {
+        printf("%s\n", syntax_type_string);
+        print_flat_indented(flat, node->first, indent + 4);
+
+    } else if (node->type == BINARY_OPERATOR) {
+        printf("%s LEFT\n", syntax_type_string);
+        print_flat_indented(flat, node->first, indent + 4);
+
+        print_indent(indent);
+        printf("%s RIGHT\n", syntax_type_string);
+        print_flat_indented(flat, node->second, indent + 4);
+
+    } else if (node->type == FUNCTION_CALL) {
+        printf("%s '%s'\n", syntax_type_string, flat_name(flat, node));
+        print_flat_indented(flat, node->first, indent);
+
+    } else if (node->type == IF_STATEMENT) {
+        printf("%s CONDITION\n", syntax_type_string);
+        print_flat_indented(flat, node->first, indent + 4);
+
+        print_indent(indent);
+        printf("%s THEN\n", syntax_type_string);
+        print_flat_indented(flat, node->second, indent + 4);
+
+    } else if (node->type == RETURN_STATEMENT) {
+        printf("%s\n", syntax_type_string);
+        print_flat_indented(flat, node->first, indent + 4);
+
+    } else if (node->type == DEFINE_VAR) {
+        printf("%s '%s'\n", syntax_type_string, flat_name(flat, node));
+
+        print_indent(indent);
+        printf("'%s' INITIAL VALUE\n", flat_name(flat, node));
+        print_flat_indented(flat, node->first, indent + 4);
+
+    } else if (node->type == FUNCTION) {
+        printf("%s '%s'\n", syntax_type_string, flat_name(flat, node));
+
+        for (uint32_t i = 0; i < node->second; i++) {
+            print_indent(indent + 4);
+            FlatNode *parameter = &flat->nodes[index + 1 + i];
+            printf("PARAMETER '%s'\n", flat_name(flat, parameter));
+        }
+
+        print_flat_indented(flat, node->first, indent + 4);
+
+    } else if (node->type == ASSIGNMENT) {
+        printf("%s '%s'\n", syntax_type_string, flat_name(flat, node));
+        print_flat_indented(flat, node->first, indent + 4);
+
+    } else if (node->type == WHILE_SYNTAX) {
+        printf("%s CONDITION\n", syntax_type_string);
+        print_flat_indented(flat, node->first, indent + 4);
+
+        print_indent(indent);
+        printf("%s BODY\n", syntax_type_string);
+        print_flat_indented(flat, node->second, indent + 4);
+
+    } else if (node->type == BLOCK || node->type == FUNCTION_ARGUMENTS ||
+               node->type == TOP_LEVEL) {
+        printf("%s\n", syntax_type_string);
+
+        uint32_t count = node->second;
+        for (uint32_t i = 0; i < count; i++) {
+            print_flat_indented(flat, flat_child(flat, node, i), indent + 4);
+        }
+
+    } else {
+        printf("??? UNKNOWN SYNTAX TYPE\n");
+    }
+}
+
+void print_flat_syntax(FlatSyntax *flat) {
+    print_flat_indented(flat, flat->root, 0);
+}
@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include "syntax.h"
+
+#ifndef BABYC_FLAT_SYNTAX_HEADER
+#define BABYC_FLAT_SYNTAX_HEADER
+
+/* An alternative representation of a Syntax tree: every node lives in
+ * one contiguous array, and children are referred to by their index
+ * in that array rather than by pointer. Nodes are stored in pre-order,
+ * so a traversal walks forwards through memory.
+ */
+typedef uint32_t FlatIndex;
+
+#define FLAT_NONE UINT32_MAX
+
+typedef struct FlatNode {
+    uint8_t type;          // SyntaxType
+    uint8_t operator_type; // UnaryExpressionType or BinaryExpressionType
+    uint16_t unused;
+    union {
+        int value;     // IMMEDIATE
+        uint32_t name; // Index into FlatSyntax->names.
+    };
+    // The meaning of these depends on the node type:
+    //
+    // UNARY_OPERATOR, ASSIGNMENT, RETURN_STATEMENT, DEFINE_VAR:
+    // first is the only child.
+    // FUNCTION: first is the body, and second is the number of
+    // parameters. They're the VARIABLE nodes straight after it.
+    // BINARY_OPERATOR, IF_STATEMENT, WHILE_SYNTAX, FUNCTION_CALL:
+    // first and second are children.
+    // BLOCK, FUNCTION_ARGUMENTS, TOP_LEVEL: first is an offset into
+    // FlatSyntax->children, second is the number of children.
+    FlatIndex first;
+    FlatIndex second;
+} FlatNode;
+
+typedef struct FlatSyntax {
+    FlatNode *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    // Child indexes of nodes with a variable number of children.
+    FlatIndex *children;
+    uint32_t child_count;
+    uint32_t child_capacity;
+
+    char **names;
+    uint32_t name_count;
+    uint32_t name_capacity;
+
+    FlatIndex root;
+} FlatSyntax;
+
+FlatSyntax *flatten_syntax(Syntax *syntax);
+
+void flat_syntax_free(FlatSyntax *flat);
+
+FlatIndex flat_child(FlatSyntax *flat, FlatNode *node, uint32_t i);
+
+char *flat_name(FlatSyntax *flat, FlatNode *node);
+
+void print_flat_syntax(FlatSyntax *flat);
+
+#endif
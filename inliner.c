@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "inliner.h"
+#include "callgraph.h"
+#include "ir.h"
+#include "list.h"
+
+/* Inline calls to small functions defined in the same program. Once
+ * the callee's body is part of the caller, its constants fold with
+ * the caller's and its values get registers without a call in the
+ * way.
+ */
+
+static int function_size(IrFunction *function) {
+    int size = 0;
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        size += block->instruction_count;
+    }
+    return size;
+}
+
+static IrOperand remap_operand(IrOperand operand, IrVreg *vreg_map) {
+    if (operand.kind == IR_OPERAND_VREG) {
+        return ir_vreg_operand(vreg_map[operand.value]);
+    }
+    return operand;
+}
+
+/* Move the blocks from FIRST_NEW onwards in FUNCTION so they come
+ * straight after the block at POSITION.
+ */
+static void move_blocks_after(IrFunction *function, int position,
+                              int first_new) {
+    List *blocks = function->blocks;
+    int moved = list_length(blocks) - first_new;
+    int shifted = first_new - (position + 1);
+
+    void **items = malloc(moved * sizeof(void *));
+    memcpy(items, &blocks->items[first_new], moved * sizeof(void *));
+    memmove(&blocks->items[position + 1 + moved], &blocks->items[position + 1],
+            shifted * sizeof(void *));
+    memcpy(&blocks->items[position + 1], items, moved * sizeof(void *));
+    free(items);
+
+    ir_renumber_blocks(function);
+}
+
+/* Replace the call at INDEX in the block at POSITION in CALLER with
+ * the body of CALLEE.
+ */
+static void inline_call(IrProgram *program, IrFunction *caller, int position,
+                        int index, IrFunction *callee) {
+    IrBlock *block = list_get(caller->blocks, position);
+    IrInstruction call = block->instructions[index];
+    int first_new = list_length(caller->blocks);
+
+    // Everything after the call continues in a new block.
+    IrBlock *after = ir_block_new(program, caller);
+    for (int i = index + 1; i < block->instruction_count; i++) {
+        IrInstruction *instruction = &block->instructions[i];
+        IrInstruction *moved =
+            ir_insert(program, after, after->instruction_count,
+                      instruction->opcode, instruction->dest);
+        *moved = *instruction;
+    }
+    after->successor_count = block->successor_count;
+    for (int i = 0; i < block->successor_count; i++) {
+        after->successors[i] = block->successors[i];
+    }
+    block->instruction_count = index;
+
+    // The callee's vregs and blocks get fresh copies in the caller.
+    // Its arguments were evaluated in the caller already, so we bind
+    // each parameter with a copy.
+    IrVreg *vreg_map = malloc(callee->vreg_count * sizeof(IrVreg));
+    for (IrVreg vreg = 0; vreg < callee->vreg_count; vreg++) {
+        vreg_map[vreg] = ir_vreg_new(program, caller, callee->vreg_names[vreg]);
+    }
+
+    int block_count = list_length(callee->blocks);
+    IrBlock **block_map = malloc(block_count * sizeof(IrBlock *));
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *callee_block = list_get(callee->blocks, i);
+        callee_block->index = i;
+        block_map[i] = ir_block_new(program, caller);
+    }
+
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *source = list_get(callee->blocks, i);
+        IrBlock *copy = block_map[i];
+
+        // A return replaces these with a jump to AFTER.
+        copy->successor_count = source->successor_count;
+        for (int j = 0; j < source->successor_count; j++) {
+            copy->successors[j] = block_map[source->successors[j]->index];
+        }
+
+        for (int j = 0; j < source->instruction_count; j++) {
+            IrInstruction *instruction = &source->instructions[j];
+
+            if (instruction->opcode == IR_RETURN) {
+                // Returning becomes setting the call's result and
+                // carrying on after the call.
+                if (call.dest != IR_NO_VREG) {
+                    IrInstruction *result =
+                        ir_append(program, copy, IR_COPY, call.dest);
+                    result->operands[0] =
+                        remap_operand(instruction->operands[0], vreg_map);
+                }
+                ir_jump(program, copy, after);
+                break;
+            }
+
+            if (instruction->opcode == IR_PARAMETER) {
+                IrInstruction *binding = ir_append(
+                    program, copy, IR_COPY, vreg_map[instruction->dest]);
+                binding->operands[0] =
+                    instruction->parameter < call.argument_count
+                        ? call.arguments[instruction->parameter]
+                        : ir_constant_operand(0);
+                continue;
+            }
+
+            IrVreg dest = instruction->dest == IR_NO_VREG
+                              ? IR_NO_VREG
+                              : vreg_map[instruction->dest];
+            IrInstruction *cloned =
+                ir_insert(program, copy, copy->instruction_count,
+                          instruction->opcode, dest);
+            cloned->function_name = instruction->function_name;
+            for (int k = 0; k < 2; k++) {
+                cloned->operands[k] =
+                    remap_operand(instruction->operands[k], vreg_map);
+            }
+
+            if (instruction->argument_count > 0) {
+                cloned->argument_count = instruction->argument_count;
+                cloned->arguments = arena_alloc(
+                    program->arena,
+                    instruction->argument_count * sizeof(IrOperand));
+                for (int k = 0; k < instruction->argument_count; k++) {
+                    cloned->arguments[k] =
+                        remap_operand(instruction->arguments[k], vreg_map);
+                }
+            }
+        }
+
+    }
+
+    ir_jump(program, block, block_map[0]);
+
+    // Lay out the callee's body straight after the call site, with
+    // the rest of the caller after that. The new blocks were created
+    // in that order, with AFTER first, so rotate it to the end.
+    move_blocks_after(caller, position, first_new + 1);
+    move_blocks_after(caller, position + block_count, first_new + block_count);
+
+    free(vreg_map);
+    free(block_map);
+}
+
+/* Inline every call to a non-recursive function in PROGRAM with at
+ * most THRESHOLD instructions. We work bottom-up through the call
+ * graph, so a callee has already had its own calls inlined, and its
+ * size includes them. Returns the number of calls inlined.
+ */
+int inline_functions(IrProgram *program, int threshold) {
+    CallGraph *graph = call_graph_new(program);
+    int inlined = 0;
+
+    for (int i = 0; i < graph->function_count; i++) {
+        int caller_index = graph->bottom_up[i];
+        IrFunction *caller = list_get(program->functions, caller_index);
+        bool changed = false;
+
+        for (int j = 0; j < list_length(caller->blocks); j++) {
+            IrBlock *block = list_get(caller->blocks, j);
+
+            for (int k = 0; k < block->instruction_count; k++) {
+                IrInstruction *instruction = &block->instructions[k];
+                if (instruction->opcode != IR_CALL) {
+                    continue;
+                }
+
+                int callee_index =
+                    call_graph_find(graph, instruction->function_name);
+                if (callee_index == -1 || graph->recursive[callee_index] ||
+                    graph->components[callee_index] ==
+                        graph->components[caller_index]) {
+                    continue;
+                }
+
+                IrFunction *callee = list_get(program->functions, callee_index);
+                if (function_size(callee) > threshold) {
+                    continue;
+                }
+
+                inline_call(program, caller, j, k, callee);
+                inlined++;
+                changed = true;
+
+                // The rest of this block is now in a later block.
+                break;
+            }
+        }
+
+        if (changed) {
+            ir_compute_predecessors(program, caller);
+        }
+    }
+
+    call_graph_free(graph);
+    return inlined;
+}
@@ -0,0 +1,11 @@
+#include "ir.h"
+
+#ifndef BABYC_INLINER_HEADER
+#define BABYC_INLINER_HEADER
+
+// The largest callee, in IR instructions, that we inline by default.
+#define DEFAULT_INLINE_THRESHOLD 20
+
+int inline_functions(IrProgram *program, int threshold);
+
+#endif
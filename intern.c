@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+#include "arena.h"
+
+#define INITIAL_INTERN_CAPACITY 256
+
+// FNV-1a.
+static uint32_t hash_name(char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Interner *interner_new(void) {
+    Interner *interner = malloc(sizeof(Interner));
+    interner->entries = NULL;
+    interner->capacity = 0;
+    interner->count = 0;
+    interner->names_arena = arena_new();
+    return interner;
+}
+
+static void intern_grow(Interner *interner) {
+    InternEntry *old_entries = interner->entries;
+    size_t old_capacity = interner->capacity;
+
+    size_t capacity =
+        old_capacity == 0 ? INITIAL_INTERN_CAPACITY : old_capacity * 2;
+    InternEntry *entries = calloc(capacity, sizeof(InternEntry));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].name == NULL) {
+            continue;
+        }
+
+        size_t slot = old_entries[i].hash & (capacity - 1);
+        while (entries[slot].name != NULL) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        entries[slot] = old_entries[i];
+    }
+
+    free(old_entries);
+    interner->entries = entries;
+    interner->capacity = capacity;
+}
+
+/* Return the canonical copy of the LENGTH bytes at NAME. NAME does
+ * not need to be null terminated, but the result always is.
+ */
+char *intern(Interner *interner, char *name, size_t length) {
+    if (2 * (interner->count + 1) > interner->capacity) {
+        intern_grow(interner);
+    }
+    InternEntry *entries = interner->entries;
+    size_t capacity = interner->capacity;
+
+    uint32_t hash = hash_name(name, length);
+    size_t slot = hash & (capacity - 1);
+
+    while (entries[slot].name != NULL) {
+        InternEntry *entry = &entries[slot];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->name, name, length) == 0) {
+            return entry->name;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+
+    char *copy = arena_alloc(interner->names_arena, length + 1);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    entries[slot].hash = hash;
+    entries[slot].length = length;
+    entries[slot].name = copy;
+    interner->count++;
+
+    return copy;
+}
+
+char *intern_string(Interner *interner, char *name) {
+    return intern(interner, name, strlen(name));
+}
+
+size_t intern_count(Interner *interner) { return interner->count; }
+
+void interner_free(Interner *interner) {
+    free(interner->entries);
+    arena_free(interner->names_arena);
+    free(interner);
+}
@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+#ifndef BABYC_INTERN_HEADER
+#define BABYC_INTERN_HEADER
+
+/* Identifiers are interned, so there is exactly one copy of each
+ * distinct name. Interned names can be compared with ==.
+ */
+typedef struct InternEntry {
+    uint32_t hash;
+    uint32_t length;
+    char *name;
+} InternEntry;
+
+/* An open addressing hash table with linear probing. CAPACITY is
+ * always a power of two, and we grow it when it's half full. Each
+ * compilation has its own, so they can run on different threads.
+ */
+typedef struct Interner {
+    InternEntry *entries;
+    size_t capacity;
+    size_t count;
+    // The interned strings themselves. These live until interner_free.
+    Arena *names_arena;
+} Interner;
+
+Interner *interner_new(void);
+
+char *intern(Interner *interner, char *name, size_t length);
+
+char *intern_string(Interner *interner, char *name);
+
+size_t intern_count(Interner *interner);
+
+void interner_free(Interner *interner);
+
+#endif
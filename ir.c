@@ -0,0 +1,499 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include "ir.h"
+#include "arena.h"
+#include "list.h"
+
+#define INITIAL_BLOCK_SIZE 8
+#define INITIAL_VREG_CAPACITY 16
+
+IrProgram *ir_program_new(void) {
+    Arena *arena = arena_new();
+
+    IrProgram *program = arena_alloc(arena, sizeof(IrProgram));
+    program->arena = arena;
+    program->functions = list_new_in(arena);
+    program->external_convention = CALLING_CONVENTION_CDECL;
+
+    return program;
+}
+
+void ir_program_free(IrProgram *program) { arena_free(program->arena); }
+
+IrFunction *ir_function_new(IrProgram *program, char *name) {
+    IrFunction *function = arena_alloc(program->arena, sizeof(IrFunction));
+    function->name = name;
+    function->parameter_count = 0;
+    function->convention = CALLING_CONVENTION_CDECL;
+    function->blocks = list_new_in(program->arena);
+
+    function->vreg_count = 0;
+    function->vreg_capacity = INITIAL_VREG_CAPACITY;
+    function->vreg_names = arena_alloc(
+        program->arena, function->vreg_capacity * sizeof(char *));
+
+    list_append(program->functions, function);
+    return function;
+}
+
+IrBlock *ir_block_new(IrProgram *program, IrFunction *function) {
+    IrBlock *block = arena_alloc(program->arena, sizeof(IrBlock));
+    block->index = list_length(function->blocks);
+
+    block->instruction_count = 0;
+    block->instruction_capacity = INITIAL_BLOCK_SIZE;
+    block->instructions = arena_alloc(
+        program->arena, block->instruction_capacity * sizeof(IrInstruction));
+
+    block->successor_count = 0;
+    block->predecessors = list_new_in(program->arena);
+
+    list_append(function->blocks, block);
+    return block;
+}
+
+/* Allocate a fresh vreg in FUNCTION. NAME is the variable it holds,
+ * or NULL for a temporary.
+ */
+IrVreg ir_vreg_new(IrProgram *program, IrFunction *function, char *name) {
+    if (function->vreg_count == function->vreg_capacity) {
+        int old_capacity = function->vreg_capacity;
+        function->vreg_capacity *= 2;
+        function->vreg_names = arena_realloc(
+            program->arena, function->vreg_names, old_capacity * sizeof(char *),
+            function->vreg_capacity * sizeof(char *));
+    }
+
+    function->vreg_names[function->vreg_count] = name;
+    return function->vreg_count++;
+}
+
+IrOperand ir_vreg_operand(IrVreg vreg) {
+    IrOperand operand = {IR_OPERAND_VREG, vreg};
+    return operand;
+}
+
+IrOperand ir_constant_operand(int value) {
+    IrOperand operand = {IR_OPERAND_CONSTANT, value};
+    return operand;
+}
+
+/* Append a new instruction to BLOCK, returning it so the caller can
+ * fill in its operands.
+ */
+IrInstruction *ir_append(IrProgram *program, IrBlock *block,
+                         IrOpcode opcode, IrVreg dest) {
+    if (ir_block_is_terminated(block)) {
+        errx(1, "Can't append %s after the terminator of block %d",
+             ir_opcode_name(opcode), block->index);
+    }
+
+    return ir_insert(program, block, block->instruction_count, opcode, dest);
+}
+
+/* Insert a new instruction in BLOCK before the instruction at
+ * POSITION. This invalidates pointers to later instructions.
+ */
+IrInstruction *ir_insert(IrProgram *program, IrBlock *block, int position,
+                         IrOpcode opcode, IrVreg dest) {
+    if (block->instruction_count == block->instruction_capacity) {
+        size_t old_size = block->instruction_capacity * sizeof(IrInstruction);
+        block->instruction_capacity *= 2;
+        block->instructions = arena_realloc(
+            program->arena, block->instructions, old_size,
+            block->instruction_capacity * sizeof(IrInstruction));
+    }
+
+    memmove(&block->instructions[position + 1], &block->instructions[position],
+            (block->instruction_count - position) * sizeof(IrInstruction));
+    IrInstruction *instruction = &block->instructions[position];
+    block->instruction_count++;
+
+    instruction->opcode = opcode;
+    instruction->dest = dest;
+    instruction->operands[0].kind = IR_OPERAND_NONE;
+    instruction->operands[1].kind = IR_OPERAND_NONE;
+    instruction->function_name = NULL;
+    instruction->arguments = NULL;
+    instruction->argument_count = 0;
+    instruction->parameter = 0;
+
+    return instruction;
+}
+
+bool ir_is_terminator(IrOpcode opcode) {
+    return opcode == IR_JUMP || opcode == IR_BRANCH || opcode == IR_RETURN ||
+           opcode == IR_TAIL_CALL;
+}
+
+/* Return the last instruction in BLOCK, or NULL if the block hasn't
+ * been terminated yet.
+ */
+IrInstruction *ir_terminator(IrBlock *block) {
+    if (block->instruction_count == 0) {
+        return NULL;
+    }
+
+    IrInstruction *last = &block->instructions[block->instruction_count - 1];
+    if (!ir_is_terminator(last->opcode)) {
+        return NULL;
+    }
+    return last;
+}
+
+bool ir_block_is_terminated(IrBlock *block) {
+    return ir_terminator(block) != NULL;
+}
+
+void ir_jump(IrProgram *program, IrBlock *block, IrBlock *target) {
+    ir_append(program, block, IR_JUMP, IR_NO_VREG);
+
+    block->successors[0] = target;
+    block->successor_count = 1;
+}
+
+void ir_branch(IrProgram *program, IrBlock *block, IrOperand condition,
+               IrBlock *if_true, IrBlock *if_false) {
+    IrInstruction *instruction =
+        ir_append(program, block, IR_BRANCH, IR_NO_VREG);
+    instruction->operands[0] = condition;
+
+    block->successors[0] = if_true;
+    block->successors[1] = if_false;
+    block->successor_count = 2;
+}
+
+void ir_return(IrProgram *program, IrBlock *block, IrOperand value) {
+    IrInstruction *instruction =
+        ir_append(program, block, IR_RETURN, IR_NO_VREG);
+    instruction->operands[0] = value;
+
+    block->successor_count = 0;
+}
+
+/* Fill in the predecessor lists of every block in FUNCTION from the
+ * successors. Passes that change the CFG should call this again.
+ */
+void ir_compute_predecessors(IrProgram *program, IrFunction *function) {
+    List *blocks = function->blocks;
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        block->predecessors = list_new_in(program->arena);
+    }
+
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->successor_count; j++) {
+            list_append(block->successors[j]->predecessors, block);
+        }
+    }
+}
+
+/* Recompute predecessors after the CFG has changed, keeping the
+ * arguments of each phi in step with its block's new predecessor
+ * list. Arguments for edges that no longer exist are dropped.
+ */
+void ir_update_predecessors(IrProgram *program, IrFunction *function) {
+    List *blocks = function->blocks;
+    int block_count = list_length(blocks);
+
+    List **old_predecessors = malloc(block_count * sizeof(List *));
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(blocks, i);
+        old_predecessors[i] = block->predecessors;
+    }
+
+    ir_compute_predecessors(program, function);
+
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(blocks, i);
+        List *old = old_predecessors[i];
+        List *new = block->predecessors;
+
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *phi = &block->instructions[j];
+            if (phi->opcode != IR_PHI) {
+                continue;
+            }
+
+            // Match each new predecessor with an argument from the same
+            // block. A block may be a predecessor more than once, so we
+            // mark arguments as we use them.
+            IrOperand *arguments = arena_alloc(
+                program->arena, list_length(new) * sizeof(IrOperand));
+            bool *used = calloc(list_length(old) + 1, sizeof(bool));
+
+            for (int k = 0; k < list_length(new); k++) {
+                arguments[k] = ir_constant_operand(0);
+                for (int m = 0; m < list_length(old); m++) {
+                    if (!used[m] && list_get(old, m) == list_get(new, k)) {
+                        arguments[k] = phi->arguments[m];
+                        used[m] = true;
+                        break;
+                    }
+                }
+            }
+
+            free(used);
+            phi->arguments = arguments;
+            phi->argument_count = list_length(new);
+        }
+    }
+
+    free(old_predecessors);
+}
+
+/* Set each block's index to its position in FUNCTION->blocks. */
+void ir_renumber_blocks(IrFunction *function) {
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        block->index = i;
+    }
+}
+
+/* Remove blocks that can't be reached from the entry block, such as
+ * code after a return. Returns the number of blocks removed.
+ */
+int ir_remove_unreachable_blocks(IrProgram *program, IrFunction *function) {
+    List *blocks = function->blocks;
+    int block_count = list_length(blocks);
+    ir_renumber_blocks(function);
+
+    bool *reachable = calloc(block_count, sizeof(bool));
+    IrBlock **worklist = malloc(block_count * sizeof(IrBlock *));
+    int worklist_size = 0;
+
+    IrBlock *entry = list_get(blocks, 0);
+    reachable[entry->index] = true;
+    worklist[worklist_size++] = entry;
+
+    while (worklist_size > 0) {
+        IrBlock *block = worklist[--worklist_size];
+        for (int i = 0; i < block->successor_count; i++) {
+            IrBlock *successor = block->successors[i];
+            if (!reachable[successor->index]) {
+                reachable[successor->index] = true;
+                worklist[worklist_size++] = successor;
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < block_count; i++) {
+        if (reachable[i]) {
+            blocks->items[kept++] = blocks->items[i];
+        }
+    }
+    blocks->size = kept;
+
+    free(reachable);
+    free(worklist);
+
+    ir_renumber_blocks(function);
+    ir_update_predecessors(program, function);
+
+    return block_count - kept;
+}
+
+static int fixed_operand_count(IrOpcode opcode) {
+    if (opcode == IR_ADD || opcode == IR_SUB || opcode == IR_MUL ||
+        opcode == IR_LESS_THAN || opcode == IR_LESS_OR_EQUAL) {
+        return 2;
+    } else if (opcode == IR_CALL || opcode == IR_TAIL_CALL ||
+               opcode == IR_PHI || opcode == IR_PARAMETER ||
+               opcode == IR_JUMP) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/* The number of operands INSTRUCTION reads, including call
+ * arguments. Use with ir_operand to visit every operand.
+ */
+int ir_operand_count(IrInstruction *instruction) {
+    return fixed_operand_count(instruction->opcode) +
+           instruction->argument_count;
+}
+
+IrOperand *ir_operand(IrInstruction *instruction, int i) {
+    int fixed_count = fixed_operand_count(instruction->opcode);
+    if (i < fixed_count) {
+        return &instruction->operands[i];
+    }
+    return &instruction->arguments[i - fixed_count];
+}
+
+char *ir_opcode_name(IrOpcode opcode) {
+    static char *names[] = {"copy",  "not",  "lnot",   "add",
+                            "sub",   "mul",  "lt",     "le",
+                            "call",  "phi",  "param",  "jump",
+                            "branch", "return", "tailcall"};
+    return names[opcode];
+}
+
+/* The function called NAME in PROGRAM, or NULL if it's defined
+ * elsewhere.
+ */
+IrFunction *ir_find_function(IrProgram *program, char *name) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        if (strcmp(function->name, name) == 0) {
+            return function;
+        }
+    }
+    return NULL;
+}
+
+/* How to call the function called NAME. Functions we don't define
+ * use the program's external convention.
+ */
+CallingConvention ir_callee_convention(IrProgram *program, char *name) {
+    IrFunction *callee = ir_find_function(program, name);
+    if (callee == NULL) {
+        return program->external_convention;
+    }
+    return callee->convention;
+}
+
+/* How many arguments CONVENTION passes in registers, at most. */
+int ir_register_argument_count(CallingConvention convention) {
+    if (convention == CALLING_CONVENTION_FASTCALL) {
+        return FASTCALL_REGISTER_ARGUMENTS;
+    } else if (convention == CALLING_CONVENTION_SYSV) {
+        return SYSV_REGISTER_ARGUMENTS;
+    }
+    return 0;
+}
+
+/* How many of ARGUMENT_COUNT arguments CONVENTION passes on the
+ * stack.
+ */
+int ir_stack_argument_count(CallingConvention convention,
+                            int argument_count) {
+    int stack_count = argument_count - ir_register_argument_count(convention);
+    return stack_count > 0 ? stack_count : 0;
+}
+
+/* Call every function in PROGRAM, including main and anything we
+ * don't define, with CONVENTION. This is how a target sets its
+ * platform convention.
+ */
+void ir_use_convention(IrProgram *program, CallingConvention convention) {
+    program->external_convention = convention;
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        function->convention = convention;
+    }
+}
+
+/* Pass the first arguments in registers for every function in
+ * PROGRAM, except main, which the startup code calls.
+ */
+void ir_use_fastcall(IrProgram *program) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        if (strcmp(function->name, "main") != 0) {
+            function->convention = CALLING_CONVENTION_FASTCALL;
+        }
+    }
+}
+
+static void print_vreg(IrFunction *function, IrVreg vreg) {
+    char *name = function->vreg_names[vreg];
+    if (name != NULL) {
+        printf("%s.%d", name, vreg);
+    } else {
+        printf("t%d", vreg);
+    }
+}
+
+static void print_operand(IrFunction *function, IrOperand operand) {
+    if (operand.kind == IR_OPERAND_VREG) {
+        print_vreg(function, operand.value);
+    } else if (operand.kind == IR_OPERAND_CONSTANT) {
+        printf("%d", operand.value);
+    } else {
+        printf("?");
+    }
+}
+
+static void print_instruction(IrFunction *function, IrBlock *block,
+                              IrInstruction *instruction) {
+    printf("    ");
+    if (instruction->dest != IR_NO_VREG) {
+        print_vreg(function, instruction->dest);
+        printf(" = ");
+    }
+    printf("%s", ir_opcode_name(instruction->opcode));
+
+    if (instruction->opcode == IR_CALL ||
+        instruction->opcode == IR_TAIL_CALL) {
+        printf(" %s(", instruction->function_name);
+        for (int i = 0; i < instruction->argument_count; i++) {
+            if (i > 0) {
+                printf(", ");
+            }
+            print_operand(function, instruction->arguments[i]);
+        }
+        printf(")");
+    } else if (instruction->opcode == IR_PARAMETER) {
+        printf(" %d", instruction->parameter);
+    } else if (instruction->opcode == IR_PHI) {
+        for (int i = 0; i < instruction->argument_count; i++) {
+            IrBlock *predecessor = list_get(block->predecessors, i);
+            printf(i == 0 ? " [" : ", [");
+            print_operand(function, instruction->arguments[i]);
+            printf(", block%d]", predecessor->index);
+        }
+    } else {
+        int count = ir_operand_count(instruction);
+        for (int i = 0; i < count; i++) {
+            printf(i == 0 ? " " : ", ");
+            print_operand(function, *ir_operand(instruction, i));
+        }
+    }
+
+    if (instruction->opcode == IR_JUMP || instruction->opcode == IR_BRANCH) {
+        for (int i = 0; i < block->successor_count; i++) {
+            printf(instruction->opcode == IR_JUMP && i == 0 ? " " : ", ");
+            printf("block%d", block->successors[i]->index);
+        }
+    }
+
+    printf("\n");
+}
+
+/* Print PROGRAM in a human readable form, for --dump-ir. */
+void print_ir(IrProgram *program) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        if (i > 0) {
+            printf("\n");
+        }
+        printf("function %s%s:\n", function->name,
+               function->convention == CALLING_CONVENTION_FASTCALL
+                   ? " (fastcall)"
+                   : "");
+
+        for (int j = 0; j < list_length(function->blocks); j++) {
+            IrBlock *block = list_get(function->blocks, j);
+            printf("  block%d:", block->index);
+
+            if (list_length(block->predecessors) > 0) {
+                printf("  ; preds:");
+                for (int k = 0; k < list_length(block->predecessors); k++) {
+                    IrBlock *predecessor = list_get(block->predecessors, k);
+                    printf(" block%d", predecessor->index);
+                }
+            }
+            printf("\n");
+
+            for (int k = 0; k < block->instruction_count; k++) {
+                print_instruction(function, block, &block->instructions[k]);
+            }
+        }
+    }
+}
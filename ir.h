@@ -0,0 +1,199 @@
+#include <stdbool.h>
+#include "arena.h"
+#include "list.h"
+
+#ifndef BABYC_IR_HEADER
+#define BABYC_IR_HEADER
+
+/* A three-address intermediate representation. Each function is a
+ * control-flow graph of basic blocks, and each block is a straight
+ * line of instructions ending in exactly one terminator (a jump,
+ * branch, return or tail call).
+ *
+ * Values live in an unlimited supply of virtual registers (vregs),
+ * which the backend maps onto machine registers or stack slots. Local
+ * variables are vregs too, so there are no loads or stores.
+ */
+
+typedef int IrVreg;
+
+#define IR_NO_VREG (-1)
+
+typedef enum {
+    IR_OPERAND_NONE,
+    IR_OPERAND_VREG,
+    IR_OPERAND_CONSTANT,
+} IrOperandKind;
+
+typedef struct IrOperand {
+    IrOperandKind kind;
+    // A vreg number or a constant value, depending on kind.
+    int value;
+} IrOperand;
+
+typedef enum {
+    // dest = operands[0]
+    IR_COPY,
+    // dest = ~operands[0] and dest = !operands[0]
+    IR_BITWISE_NOT,
+    IR_LOGICAL_NOT,
+    // dest = operands[0] OP operands[1]
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_LESS_THAN,
+    IR_LESS_OR_EQUAL,
+    // dest = function_name(arguments...)
+    IR_CALL,
+    // dest = arguments[i] when we arrived from predecessors[i]. Only
+    // present while the function is in SSA form, see ssa.h.
+    IR_PHI,
+    // dest = the parameter numbered `parameter`. These come first in
+    // the entry block.
+    IR_PARAMETER,
+
+    // Terminators.
+    // Jump to the block's only successor.
+    IR_JUMP,
+    // If operands[0] is non-zero jump to successors[0], otherwise
+    // successors[1].
+    IR_BRANCH,
+    // Return operands[0].
+    IR_RETURN,
+    // Return function_name(arguments...), reusing this function's
+    // frame. See tail_calls.h.
+    IR_TAIL_CALL,
+} IrOpcode;
+
+typedef struct IrInstruction {
+    IrOpcode opcode;
+    IrVreg dest;
+    IrOperand operands[2];
+
+    // IR_CALL and IR_TAIL_CALL.
+    char *function_name;
+    // IR_CALL, IR_TAIL_CALL and IR_PHI.
+    IrOperand *arguments;
+    int argument_count;
+
+    // IR_PARAMETER only.
+    int parameter;
+} IrInstruction;
+
+typedef struct IrBlock {
+    // The position of this block in IrFunction->blocks.
+    int index;
+
+    IrInstruction *instructions;
+    int instruction_count;
+    int instruction_capacity;
+
+    // Set by the terminator.
+    struct IrBlock *successors[2];
+    int successor_count;
+
+    // IrBlocks, see ir_compute_predecessors.
+    List *predecessors;
+} IrBlock;
+
+typedef enum {
+    // Every argument is pushed on the stack, right to left, and the
+    // caller removes them afterwards. We use this for anything we
+    // might share with other compilers.
+    CALLING_CONVENTION_CDECL,
+    // As cdecl, except the first FASTCALL_REGISTER_ARGUMENTS arguments
+    // are passed in %ecx and %edx. Only for calls within the program.
+    CALLING_CONVENTION_FASTCALL,
+    // The x86-64 System V convention: the first SYSV_REGISTER_ARGUMENTS
+    // arguments are passed in registers, and the rest as cdecl.
+    CALLING_CONVENTION_SYSV,
+} CallingConvention;
+
+#define FASTCALL_REGISTER_ARGUMENTS 2
+#define SYSV_REGISTER_ARGUMENTS 6
+
+typedef struct IrFunction {
+    char *name;
+    int parameter_count;
+    CallingConvention convention;
+    // IrBlocks, in the order we lay them out. The first is the entry.
+    List *blocks;
+
+    int vreg_count;
+    // The variable name of each vreg, or NULL for temporaries. Only
+    // used for printing.
+    char **vreg_names;
+    int vreg_capacity;
+} IrFunction;
+
+typedef struct IrProgram {
+    // IrFunctions, in the order they were defined.
+    List *functions;
+    // How to call functions we don't define.
+    CallingConvention external_convention;
+    // Everything in the program is allocated here.
+    Arena *arena;
+} IrProgram;
+
+IrProgram *ir_program_new(void);
+
+void ir_program_free(IrProgram *program);
+
+IrFunction *ir_function_new(IrProgram *program, char *name);
+
+IrBlock *ir_block_new(IrProgram *program, IrFunction *function);
+
+IrVreg ir_vreg_new(IrProgram *program, IrFunction *function, char *name);
+
+IrOperand ir_vreg_operand(IrVreg vreg);
+
+IrOperand ir_constant_operand(int value);
+
+IrInstruction *ir_append(IrProgram *program, IrBlock *block,
+                         IrOpcode opcode, IrVreg dest);
+
+IrInstruction *ir_insert(IrProgram *program, IrBlock *block, int position,
+                         IrOpcode opcode, IrVreg dest);
+
+IrInstruction *ir_terminator(IrBlock *block);
+
+bool ir_is_terminator(IrOpcode opcode);
+
+bool ir_block_is_terminated(IrBlock *block);
+
+void ir_jump(IrProgram *program, IrBlock *block, IrBlock *target);
+
+void ir_branch(IrProgram *program, IrBlock *block, IrOperand condition,
+               IrBlock *if_true, IrBlock *if_false);
+
+void ir_return(IrProgram *program, IrBlock *block, IrOperand value);
+
+void ir_compute_predecessors(IrProgram *program, IrFunction *function);
+
+void ir_update_predecessors(IrProgram *program, IrFunction *function);
+
+void ir_renumber_blocks(IrFunction *function);
+
+int ir_remove_unreachable_blocks(IrProgram *program, IrFunction *function);
+
+int ir_operand_count(IrInstruction *instruction);
+
+IrOperand *ir_operand(IrInstruction *instruction, int i);
+
+char *ir_opcode_name(IrOpcode opcode);
+
+IrFunction *ir_find_function(IrProgram *program, char *name);
+
+CallingConvention ir_callee_convention(IrProgram *program, char *name);
+
+int ir_register_argument_count(CallingConvention convention);
+
+int ir_stack_argument_count(CallingConvention convention, int argument_count);
+
+void ir_use_convention(IrProgram *program, CallingConvention convention);
+
+void ir_use_fastcall(IrProgram *program);
+
+void print_ir(IrProgram *program);
+
+#endif
@@ -0,0 +1,562 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <err.h>
+#include "ir_optimise.h"
+#include "ir.h"
+#include "ssa.h"
+#include "loops.h"
+#include "list.h"
+
+/* Optimisations on the IR. Most of these work on SSA form, where each
+ * vreg has exactly one definition, so facts about a vreg hold
+ * everywhere it's used.
+ */
+
+typedef enum {
+    // No definition has been seen to execute yet.
+    LATTICE_UNDEFINED,
+    LATTICE_CONSTANT,
+    // Not known at compile time.
+    LATTICE_VARYING,
+} LatticeKind;
+
+typedef struct LatticeValue {
+    LatticeKind kind;
+    int value;
+} LatticeValue;
+
+typedef struct Propagation {
+    IrFunction *function;
+    // Indexed by vreg.
+    LatticeValue *values;
+    // Indexed by block index.
+    bool *executable;
+    // For each block, whether the edge from each predecessor has
+    // executed, in the same order as block->predecessors.
+    bool **edge_executable;
+    bool changed;
+} Propagation;
+
+static LatticeValue operand_value(Propagation *propagation, IrOperand operand) {
+    if (operand.kind == IR_OPERAND_CONSTANT) {
+        LatticeValue constant = {LATTICE_CONSTANT, operand.value};
+        return constant;
+    }
+    return propagation->values[operand.value];
+}
+
+/* Compute the result of INSTRUCTION on constants, as the generated
+ * code would at runtime. See evaluate_binary in optimise.c.
+ */
+static int evaluate_instruction(IrOpcode opcode, int left, int right) {
+    unsigned int left_bits = left, right_bits = right;
+
+    if (opcode == IR_COPY) {
+        return left;
+    } else if (opcode == IR_BITWISE_NOT) {
+        return ~left;
+    } else if (opcode == IR_LOGICAL_NOT) {
+        return !left;
+    } else if (opcode == IR_ADD) {
+        return (int)(left_bits + right_bits);
+    } else if (opcode == IR_SUB) {
+        return (int)(left_bits - right_bits);
+    } else if (opcode == IR_MUL) {
+        return (int)(left_bits * right_bits);
+    } else if (opcode == IR_LESS_THAN) {
+        return left < right;
+    } else if (opcode == IR_LESS_OR_EQUAL) {
+        return left <= right;
+    }
+
+    errx(1, "Can't evaluate IR opcode %s", ir_opcode_name(opcode));
+}
+
+static LatticeValue evaluate(Propagation *propagation, IrBlock *block,
+                             IrInstruction *instruction) {
+    LatticeValue result = {LATTICE_UNDEFINED, 0};
+
+    if (instruction->opcode == IR_CALL ||
+        instruction->opcode == IR_PARAMETER) {
+        result.kind = LATTICE_VARYING;
+
+    } else if (instruction->opcode == IR_PHI) {
+        // Only arguments from edges that have executed count.
+        bool *edges = propagation->edge_executable[block->index];
+        for (int i = 0; i < instruction->argument_count; i++) {
+            if (!edges[i]) {
+                continue;
+            }
+
+            LatticeValue argument =
+                operand_value(propagation, instruction->arguments[i]);
+            if (argument.kind == LATTICE_UNDEFINED) {
+                continue;
+            } else if (argument.kind == LATTICE_VARYING ||
+                       (result.kind == LATTICE_CONSTANT &&
+                        result.value != argument.value)) {
+                result.kind = LATTICE_VARYING;
+                break;
+            }
+            result = argument;
+        }
+
+    } else {
+        int values[2] = {0, 0};
+        for (int i = 0; i < ir_operand_count(instruction); i++) {
+            LatticeValue operand =
+                operand_value(propagation, *ir_operand(instruction, i));
+            if (operand.kind != LATTICE_CONSTANT) {
+                return operand;
+            }
+            values[i] = operand.value;
+        }
+
+        result.kind = LATTICE_CONSTANT;
+        result.value =
+            evaluate_instruction(instruction->opcode, values[0], values[1]);
+    }
+
+    return result;
+}
+
+static void mark_edge_executable(Propagation *propagation, IrBlock *from,
+                                 IrBlock *to) {
+    bool *edges = propagation->edge_executable[to->index];
+    for (int i = 0; i < list_length(to->predecessors); i++) {
+        if (list_get(to->predecessors, i) == from && !edges[i]) {
+            edges[i] = true;
+            propagation->changed = true;
+        }
+    }
+
+    if (!propagation->executable[to->index]) {
+        propagation->executable[to->index] = true;
+        propagation->changed = true;
+    }
+}
+
+static void propagate_block(Propagation *propagation, IrBlock *block) {
+    for (int i = 0; i < block->instruction_count; i++) {
+        IrInstruction *instruction = &block->instructions[i];
+
+        if (instruction->opcode == IR_JUMP) {
+            mark_edge_executable(propagation, block, block->successors[0]);
+
+        } else if (instruction->opcode == IR_BRANCH) {
+            LatticeValue condition =
+                operand_value(propagation, instruction->operands[0]);
+            if (condition.kind == LATTICE_VARYING) {
+                mark_edge_executable(propagation, block, block->successors[0]);
+                mark_edge_executable(propagation, block, block->successors[1]);
+            } else if (condition.kind == LATTICE_CONSTANT) {
+                IrBlock *target = block->successors[condition.value ? 0 : 1];
+                mark_edge_executable(propagation, block, target);
+            }
+
+        } else if (instruction->dest != IR_NO_VREG) {
+            LatticeValue *current = &propagation->values[instruction->dest];
+            LatticeValue result = evaluate(propagation, block, instruction);
+
+            // Values only ever move down the lattice, which guarantees
+            // we terminate.
+            if (result.kind < current->kind) {
+                continue;
+            }
+            if (result.kind == LATTICE_CONSTANT &&
+                current->kind == LATTICE_CONSTANT &&
+                result.value != current->value) {
+                result.kind = LATTICE_VARYING;
+            }
+
+            if (result.kind != current->kind ||
+                result.value != current->value) {
+                *current = result;
+                propagation->changed = true;
+            }
+        }
+    }
+}
+
+/* Sparse conditional constant propagation (Wegman and Zadeck): find
+ * vregs with constant values, assuming branches only go where they
+ * can given the constants found so far. Replace constant vregs with
+ * their values and constant branches with jumps.
+ *
+ * Rather than keeping SSA and CFG worklists, we re-evaluate every
+ * executable block until nothing changes. Functions are small, and
+ * this converges in a few passes.
+ */
+static void propagate_constants(IrProgram *program, IrFunction *function) {
+    int block_count = list_length(function->blocks);
+
+    Propagation propagation;
+    propagation.function = function;
+    propagation.values = malloc(function->vreg_count * sizeof(LatticeValue));
+    propagation.executable = calloc(block_count, sizeof(bool));
+    propagation.edge_executable = malloc(block_count * sizeof(bool *));
+
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        propagation.edge_executable[i] =
+            calloc(list_length(block->predecessors) + 1, sizeof(bool));
+    }
+
+    // Vregs without a definition, such as parameters, could be
+    // anything.
+    for (IrVreg vreg = 0; vreg < function->vreg_count; vreg++) {
+        propagation.values[vreg].kind = LATTICE_VARYING;
+        propagation.values[vreg].value = 0;
+    }
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrVreg dest = block->instructions[j].dest;
+            if (dest != IR_NO_VREG) {
+                propagation.values[dest].kind = LATTICE_UNDEFINED;
+            }
+        }
+    }
+
+    propagation.executable[0] = true;
+    propagation.changed = true;
+    while (propagation.changed) {
+        propagation.changed = false;
+
+        for (int i = 0; i < block_count; i++) {
+            if (propagation.executable[i]) {
+                propagate_block(&propagation, list_get(function->blocks, i));
+            }
+        }
+    }
+
+    // Rewrite the function with what we've learnt.
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                if (operand->kind != IR_OPERAND_VREG) {
+                    continue;
+                }
+
+                LatticeValue value = propagation.values[operand->value];
+                if (value.kind == LATTICE_CONSTANT) {
+                    *operand = ir_constant_operand(value.value);
+                }
+            }
+
+            IrVreg dest = instruction->dest;
+            if (dest != IR_NO_VREG && instruction->opcode != IR_CALL &&
+                propagation.values[dest].kind == LATTICE_CONSTANT) {
+                instruction->opcode = IR_COPY;
+                instruction->operands[0] =
+                    ir_constant_operand(propagation.values[dest].value);
+                instruction->arguments = NULL;
+                instruction->argument_count = 0;
+            }
+
+            if (instruction->opcode == IR_BRANCH &&
+                instruction->operands[0].kind == IR_OPERAND_CONSTANT) {
+                int taken = instruction->operands[0].value ? 0 : 1;
+                block->successors[0] = block->successors[taken];
+                block->successor_count = 1;
+                instruction->opcode = IR_JUMP;
+                instruction->operands[0].kind = IR_OPERAND_NONE;
+            }
+        }
+    }
+
+    for (int i = 0; i < block_count; i++) {
+        free(propagation.edge_executable[i]);
+    }
+    free(propagation.edge_executable);
+    free(propagation.executable);
+    free(propagation.values);
+
+    // Blocks behind constant branches are now unreachable.
+    ir_update_predecessors(program, function);
+    ir_remove_unreachable_blocks(program, function);
+}
+
+static IrOperand resolve_copy(IrOperand *replacements, IrOperand operand) {
+    while (operand.kind == IR_OPERAND_VREG &&
+           replacements[operand.value].kind != IR_OPERAND_NONE) {
+        operand = replacements[operand.value];
+    }
+    return operand;
+}
+
+/* If every argument of PHI is the same value (ignoring the phi's own
+ * result, from loops that don't change it), return that value.
+ */
+static bool phi_single_value(IrOperand *replacements, IrInstruction *phi,
+                             IrOperand *value) {
+    bool found = false;
+    for (int i = 0; i < phi->argument_count; i++) {
+        IrOperand argument = resolve_copy(replacements, phi->arguments[i]);
+        if (argument.kind == IR_OPERAND_VREG && argument.value == phi->dest) {
+            continue;
+        }
+
+        if (found && (argument.kind != value->kind ||
+                      argument.value != value->value)) {
+            return false;
+        }
+        *value = argument;
+        found = true;
+    }
+    return found;
+}
+
+/* Copy propagation: replace uses of the result of a copy with its
+ * source. In SSA form the source can't change in between, so this is
+ * always safe. The copies themselves are left for dead code
+ * elimination.
+ */
+static void propagate_copies(IrFunction *function) {
+    // The operand to use instead of each vreg, or IR_OPERAND_NONE.
+    IrOperand *replacements = malloc(function->vreg_count * sizeof(IrOperand));
+    for (IrVreg vreg = 0; vreg < function->vreg_count; vreg++) {
+        replacements[vreg].kind = IR_OPERAND_NONE;
+    }
+
+    // Replacing one phi's arguments can make another phi redundant, so
+    // iterate.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < list_length(function->blocks); i++) {
+            IrBlock *block = list_get(function->blocks, i);
+            for (int j = 0; j < block->instruction_count; j++) {
+                IrInstruction *instruction = &block->instructions[j];
+                if (instruction->dest == IR_NO_VREG ||
+                    replacements[instruction->dest].kind != IR_OPERAND_NONE) {
+                    continue;
+                }
+
+                IrOperand source;
+                if (instruction->opcode == IR_COPY) {
+                    source =
+                        resolve_copy(replacements, instruction->operands[0]);
+                } else if (instruction->opcode == IR_PHI) {
+                    if (!phi_single_value(replacements, instruction, &source)) {
+                        continue;
+                    }
+                } else {
+                    continue;
+                }
+
+                if (source.kind == IR_OPERAND_VREG &&
+                    source.value == instruction->dest) {
+                    continue;
+                }
+                replacements[instruction->dest] = source;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                *operand = resolve_copy(replacements, *operand);
+            }
+        }
+    }
+
+    free(replacements);
+}
+
+static bool has_side_effects(IrInstruction *instruction) {
+    return instruction->opcode == IR_CALL ||
+           ir_is_terminator(instruction->opcode);
+}
+
+/* Dead code elimination: remove every instruction whose result is
+ * never used, directly or indirectly, by a call or terminator. This
+ * also removes dead stores, since a store to a local is just a
+ * definition of a vreg.
+ */
+static void eliminate_dead_code(IrFunction *function) {
+    int vreg_count = function->vreg_count;
+    List *blocks = function->blocks;
+
+    // The defining instruction of each vreg, which is unique in SSA.
+    IrInstruction **definitions = calloc(vreg_count, sizeof(IrInstruction *));
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            if (instruction->dest != IR_NO_VREG) {
+                definitions[instruction->dest] = instruction;
+            }
+        }
+    }
+
+    bool *live = calloc(vreg_count, sizeof(bool));
+    IrInstruction **worklist =
+        malloc((vreg_count + 1) * sizeof(IrInstruction *));
+    int worklist_size = 0;
+
+    // Mark.
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            if (!has_side_effects(instruction)) {
+                continue;
+            }
+
+            if (instruction->dest != IR_NO_VREG) {
+                live[instruction->dest] = true;
+            }
+
+            // Instructions without a result aren't on the worklist, so
+            // mark their operands here.
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                if (operand->kind == IR_OPERAND_VREG && !live[operand->value]) {
+                    live[operand->value] = true;
+                    if (definitions[operand->value] != NULL) {
+                        worklist[worklist_size++] = definitions[operand->value];
+                    }
+                }
+            }
+        }
+    }
+
+    while (worklist_size > 0) {
+        IrInstruction *instruction = worklist[--worklist_size];
+        for (int k = 0; k < ir_operand_count(instruction); k++) {
+            IrOperand *operand = ir_operand(instruction, k);
+            if (operand->kind == IR_OPERAND_VREG && !live[operand->value]) {
+                live[operand->value] = true;
+                if (definitions[operand->value] != NULL) {
+                    worklist[worklist_size++] = definitions[operand->value];
+                }
+            }
+        }
+    }
+
+    // Sweep.
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        int kept = 0;
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            if (has_side_effects(instruction) ||
+                (instruction->dest != IR_NO_VREG && live[instruction->dest])) {
+                block->instructions[kept++] = *instruction;
+            }
+        }
+        block->instruction_count = kept;
+    }
+
+    free(definitions);
+    free(live);
+    free(worklist);
+}
+
+/* Simplify the CFG once we're out of SSA form: jumps to blocks that
+ * only contain a jump go straight to the final target, and a block
+ * that is the only predecessor of its only successor absorbs it.
+ */
+static void simplify_cfg(IrProgram *program, IrFunction *function) {
+    List *blocks = function->blocks;
+
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->successor_count; j++) {
+            // Follow chains of empty blocks, stopping at empty loops.
+            IrBlock *target = block->successors[j];
+            int steps = 0;
+            while (target->instruction_count == 1 &&
+                   target->instructions[0].opcode == IR_JUMP &&
+                   target->successors[0] != target &&
+                   steps < list_length(blocks)) {
+                target = target->successors[0];
+                steps++;
+            }
+            block->successors[j] = target;
+        }
+    }
+
+    ir_remove_unreachable_blocks(program, function);
+
+    for (int i = 0; i < list_length(blocks); i++) {
+        IrBlock *block = list_get(blocks, i);
+
+        while (block->successor_count == 1) {
+            IrBlock *successor = block->successors[0];
+            if (successor == block || successor->index == 0 ||
+                list_length(successor->predecessors) != 1) {
+                break;
+            }
+
+            // Replace our jump with the successor's instructions.
+            block->instruction_count--;
+            for (int j = 0; j < successor->instruction_count; j++) {
+                IrInstruction *instruction = &successor->instructions[j];
+                IrInstruction *copy = ir_insert(program, block,
+                                                block->instruction_count,
+                                                instruction->opcode,
+                                                instruction->dest);
+                *copy = *instruction;
+            }
+
+            block->successor_count = successor->successor_count;
+            for (int j = 0; j < successor->successor_count; j++) {
+                block->successors[j] = successor->successors[j];
+            }
+
+            // The successor is now unreachable.
+            successor->successor_count = 0;
+            successor->predecessors->size = 0;
+            for (int j = 0; j < block->successor_count; j++) {
+                List *predecessors = block->successors[j]->predecessors;
+                for (int k = 0; k < list_length(predecessors); k++) {
+                    if (list_get(predecessors, k) == successor) {
+                        predecessors->items[k] = block;
+                    }
+                }
+            }
+        }
+    }
+
+    ir_remove_unreachable_blocks(program, function);
+}
+
+static void optimise_function(IrProgram *program, IrFunction *function) {
+    ir_remove_unreachable_blocks(program, function);
+    rotate_loops(program, function);
+
+    ssa_construct(program, function);
+    propagate_constants(program, function);
+    propagate_copies(function);
+    eliminate_dead_code(function);
+
+    // Loop optimisations leave copies and constant arithmetic in
+    // preheaders, so we propagate again.
+    optimise_loops(program, function);
+    propagate_constants(program, function);
+    propagate_copies(function);
+    eliminate_dead_code(function);
+    ssa_destruct(program, function);
+
+    simplify_cfg(program, function);
+}
+
+/* Optimise every function in PROGRAM in place. */
+void optimise_ir(IrProgram *program) {
+    for (int i = 0; i < list_length(program->functions); i++) {
+        optimise_function(program, list_get(program->functions, i));
+    }
+}
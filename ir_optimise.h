@@ -0,0 +1,8 @@
+#include "ir.h"
+
+#ifndef BABYC_IR_OPTIMISE_HEADER
+#define BABYC_IR_OPTIMISE_HEADER
+
+void optimise_ir(IrProgram *program);
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "lexer.h"
+#include "build/y.tab.h"
+
+Lexer *lexer_new(SourceBuffer *source, LexerKind kind, char *file_name) {
+    Lexer *lexer = malloc(sizeof(Lexer));
+    lexer->kind = kind;
+    lexer->source = source;
+    lexer->file_name = file_name;
+    lexer->position = source->text;
+    lexer->end = source->text + source->length;
+    lexer->flex_scanner = NULL;
+
+    if (kind == LEXER_FLEX) {
+        lexer->flex_scanner = flex_scanner_new(lexer);
+    }
+    return lexer;
+}
+
+void lexer_free(Lexer *lexer) {
+    if (lexer->flex_scanner != NULL) {
+        flex_scanner_free(lexer->flex_scanner);
+    }
+    free(lexer);
+}
+
+void lexer_error(Lexer *lexer, char *message) {
+    fprintf(stderr, "%s: error: %s\n", lexer->file_name, message);
+}
+
+// Defined in babyc_lex.l.
+int flex_lex(YYSTYPE *value, void *scanner);
+
+static int hand_written_lex(YYSTYPE *value, Lexer *lexer);
+
+/* The next token from LEXER, storing any identifier or number in
+ * VALUE. Returns 0 at the end of the source.
+ */
+int yylex(YYSTYPE *value, Lexer *lexer) {
+    if (lexer->kind == LEXER_FLEX) {
+        return flex_lex(value, lexer->flex_scanner);
+    }
+    return hand_written_lex(value, lexer);
+}
+
+/* The hand-written lexer is a switch on the first character of each
+ * token, with the same rules as babyc_lex.l. Instead of flex's
+ * transition tables, we skip runs of whitespace, identifier
+ * characters and digits eight bytes at a time (SWAR), and recognise
+ * keywords with a perfect hash.
+ */
+
+#define ONES 0x0101010101010101ULL
+#define HIGH_BITS 0x8080808080808080ULL
+
+/* Sets the high bit of each byte in WORD that is between LOW and HIGH
+ * inclusive. Every byte of WORD must be ASCII, so that the additions
+ * don't carry between bytes. It's a macro so that it's inlined even
+ * without optimisation.
+ */
+#define BYTES_IN_RANGE(word, low, high)                                        \
+    (((word) + ONES * (0x80 - (low))) & ~((word) + ONES * (0x7f - (high))) &  \
+     HIGH_BITS)
+
+static uint64_t whitespace_bytes(uint64_t word) {
+    return BYTES_IN_RANGE(word, ' ', ' ') | BYTES_IN_RANGE(word, '\t', '\n');
+}
+
+static uint64_t digit_bytes(uint64_t word) {
+    return BYTES_IN_RANGE(word, '0', '9');
+}
+
+static uint64_t identifier_bytes(uint64_t word) {
+    return BYTES_IN_RANGE(word, 'a', 'z') | BYTES_IN_RANGE(word, 'A', 'Z') |
+           BYTES_IN_RANGE(word, '0', '9') | BYTES_IN_RANGE(word, '_', '_');
+}
+
+static bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static bool is_identifier_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_identifier(char c) {
+    return is_identifier_start(c) || is_digit(c);
+}
+
+/* Skip from FROM to END over characters where MATCHING sets the high bit
+ * (or, past the last whole word, where IS_MATCH is true), returning
+ * the first character that doesn't match.
+ */
+static char *skip_while(char *from, char *end,
+                        uint64_t (*matching)(uint64_t),
+                        bool (*is_match)(char)) {
+    while (end - from >= 8) {
+        uint64_t word;
+        memcpy(&word, from, 8);
+        if (word & HIGH_BITS) {
+            break;
+        }
+
+        uint64_t mismatches = ~matching(word) & HIGH_BITS;
+        if (mismatches != 0) {
+            // Bytes are loaded little-endian, so the lowest set bit is
+            // the first mismatch.
+            return from + __builtin_ctzll(mismatches) / 8;
+        }
+        from += 8;
+    }
+
+    while (from < end && is_match(*from)) {
+        from++;
+    }
+    return from;
+}
+
+typedef struct Keyword {
+    char *name;
+    int token;
+} Keyword;
+
+/* Our keywords all have different lengths, so the length is a perfect
+ * hash. There's one string comparison per identifier of length 2, 3,
+ * 5 or 6, and none for the others.
+ */
+static Keyword keywords[] = {
+    {NULL, 0},      {NULL, 0},         {"if", IF},           {"int", TYPE},
+    {NULL, 0},      {"while", WHILE},  {"return", RETURN},
+};
+
+static int keyword_or_identifier(char *start, size_t length) {
+    if (length < sizeof(keywords) / sizeof(keywords[0])) {
+        Keyword *keyword = &keywords[length];
+        if (keyword->name != NULL &&
+            memcmp(start, keyword->name, length) == 0) {
+            return keyword->token;
+        }
+    }
+    return IDENTIFIER;
+}
+
+static int hand_written_lex(YYSTYPE *value, Lexer *lexer) {
+    char *position = lexer->position;
+    char *end = lexer->end;
+
+    // 0 until we've found a token, as none of them are 0.
+    int token = 0;
+    while (token == 0 && position < end) {
+        char *start = position;
+        char c = *position++;
+
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+            // Most runs are a single space, between tokens.
+            if (position < end && is_whitespace(*position)) {
+                position =
+                    skip_while(position, end, whitespace_bytes, is_whitespace);
+            }
+            continue;
+
+        case '#': {
+            char *line_end = memchr(position, '\n', end - position);
+            position = line_end ? line_end : end;
+            // Like flex, we only have an INCLUDE token when nothing
+            // follows it on the line, as otherwise the line is longer.
+            if (position - start == 8 && memcmp(start, "#include", 8) == 0) {
+                token = INCLUDE;
+            }
+            continue;
+        }
+
+        case '/':
+            if (position < end && *position == '/') {
+                char *line_end = memchr(position, '\n', end - position);
+                position = line_end ? line_end : end;
+                continue;
+            }
+            if (position < end && *position == '*') {
+                position++;
+                char *comment_end = NULL;
+                for (char *star = position; star < end;) {
+                    star = memchr(star, '*', end - star);
+                    if (star == NULL || star + 1 >= end) {
+                        break;
+                    }
+                    if (star[1] == '/') {
+                        comment_end = star + 2;
+                        break;
+                    }
+                    star++;
+                }
+
+                if (comment_end == NULL) {
+                    lexer_error(lexer, "unterminated comment");
+                    position = end;
+                } else {
+                    position = comment_end;
+                }
+                continue;
+            }
+            token = '/';
+            break;
+
+        case '{':
+            token = OPEN_BRACE;
+            break;
+        case '}':
+            token = CLOSE_BRACE;
+            break;
+
+        case '<': {
+            if (position < end && *position == '=') {
+                position++;
+                token = LESS_OR_EQUAL;
+                break;
+            }
+
+            char *name_end = position;
+            while (name_end < end &&
+                   ((*name_end >= 'a' && *name_end <= 'z') ||
+                    *name_end == '.')) {
+                name_end++;
+            }
+            if (name_end > position && name_end < end && *name_end == '>') {
+                position = name_end + 1;
+                token = HEADER_NAME;
+            } else {
+                token = '<';
+            }
+            break;
+        }
+
+        case '0' ... '9':
+            position = skip_while(position, end, digit_bytes, is_digit);
+            value->token.offset = start - lexer->source->text;
+            value->token.length = position - start;
+            token = NUMBER;
+            break;
+
+        case 'a' ... 'z':
+        case 'A' ... 'Z':
+        case '_':
+            position =
+                skip_while(position, end, identifier_bytes, is_identifier);
+            token = keyword_or_identifier(start, position - start);
+            if (token == IDENTIFIER) {
+                value->token.offset = start - lexer->source->text;
+                value->token.length = position - start;
+            }
+            break;
+
+        default:
+            // The single character tokens, '(', ')', '~', '!', '+',
+            // '-', '*', '=', ';' and ',', are their own token numbers.
+            // Anything else is too, for the parser to reject.
+            token = c;
+            break;
+        }
+    }
+
+    lexer->position = position;
+    return token;
+}
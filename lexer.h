@@ -0,0 +1,42 @@
+#include "source.h"
+
+#ifndef BABYC_LEXER_HEADER
+#define BABYC_LEXER_HEADER
+
+/* We have two lexers for the same tokens: the flex scanner in
+ * babyc_lex.l, and a hand-written one in lexer.c. yylex calls
+ * whichever the Lexer was created with.
+ */
+typedef enum {
+    LEXER_FLEX,
+    LEXER_HAND_WRITTEN,
+} LexerKind;
+
+/* The state of lexing one SourceBuffer. Neither lexer copies the
+ * source, so it must outlive the tokens. Nothing is global, so
+ * several Lexers can run at once on different threads.
+ */
+typedef struct Lexer {
+    LexerKind kind;
+    SourceBuffer *source;
+    // For error messages.
+    char *file_name;
+    // Where the hand-written lexer is up to.
+    char *position;
+    char *end;
+    // The flex scanner's own state, a yyscan_t.
+    void *flex_scanner;
+} Lexer;
+
+Lexer *lexer_new(SourceBuffer *source, LexerKind kind, char *file_name);
+
+void lexer_free(Lexer *lexer);
+
+void lexer_error(Lexer *lexer, char *message);
+
+// Defined in babyc_lex.l.
+void *flex_scanner_new(Lexer *lexer);
+
+void flex_scanner_free(void *scanner);
+
+#endif
@@ -7,12 +7,58 @@
 List *list_new(void) {
     List *list = malloc(sizeof(List));
     list->size = 0;
+    list->capacity = 0;
     list->items = NULL;
+    list->arena = NULL;
 
     return list;
 };
 
+/* Create a list whose memory is owned by ARENA. */
+List *list_new_in(Arena *arena) {
+    List *list = arena_alloc(arena, sizeof(List));
+    list->size = 0;
+    list->capacity = 0;
+    list->items = NULL;
+    list->arena = arena;
+
+    return list;
+}
+
+/* Ensure LIST has room for at least one more item. We double the
+ * capacity each time, so appending is amortised O(1).
+ */
+static void list_reserve(List *list) {
+    if (list->size < list->capacity) {
+        return;
+    }
+
+    int new_capacity;
+    if (list->capacity > 0) {
+        new_capacity = list->capacity * 2;
+    } else if (list->arena != NULL) {
+        // Arena lists are mostly small blocks and argument lists, and
+        // the arena can't reuse memory, so start small.
+        new_capacity = INITIAL_ARENA_LIST_SIZE;
+    } else {
+        new_capacity = INITIAL_LIST_SIZE;
+    }
+
+    if (list->arena != NULL) {
+        list->items = arena_realloc(list->arena, list->items,
+                                    list->capacity * sizeof(void *),
+                                    new_capacity * sizeof(void *));
+    } else {
+        list->items = realloc(list->items, new_capacity * sizeof(void *));
+    }
+    list->capacity = new_capacity;
+}
+
 void list_free(List *list) {
+    if (list->arena != NULL) {
+        // Freed along with the arena.
+        return;
+    }
     if (list->items != NULL) {
         free(list->items);
     }
@@ -22,34 +68,30 @@ void list_free(List *list) {
 int list_length(List *list) { return list->size; }
 
 void list_append(List *list, void *item) {
-    list->size++;
-    list->items = realloc(list->items, list->size * sizeof(item));
+    list_reserve(list);
 
-    list->items[list->size - 1] = item;
+    list->items[list->size] = item;
+    list->size++;
 }
 
-/* Insert item as the first element in list. */
+/* Insert item as the first element in list. This has to move every
+ * item, so prefer list_append where possible.
+ */
 void list_push(List *list, void *item) {
-    list->size++;
-
-    void **new_items = malloc(list->size * sizeof(item));
-    memcpy(new_items + 1, list->items, (list->size - 1) * sizeof(item));
-
-    if (list->items != NULL) {
-        free(list->items);
-    }
-    list->items = new_items;
+    list_reserve(list);
 
+    memmove(list->items + 1, list->items, list->size * sizeof(item));
     list->items[0] = item;
+    list->size++;
 }
 
-/* Remove the last item from the list, and return it.
+/* Remove the last item from the list, and return it. We keep the
+ * capacity, so a subsequent append doesn't need to allocate.
  */
 void *list_pop(List *list) {
     void *value = list_get(list, list->size - 1);
 
     list->size--;
-    list->items = realloc(list->items, list->size * sizeof(value));
 
     return value;
 }
@@ -1,15 +1,23 @@
+#include "arena.h"
+
 #ifndef BABYC_LIST_HEADER
 #define BABYC_LIST_HEADER
 
 typedef struct List {
     int size;
+    int capacity;
     void **items;
+    // If set, the list and its items are owned by this arena.
+    Arena *arena;
 } List;
 
 #define INITIAL_LIST_SIZE 32
+#define INITIAL_ARENA_LIST_SIZE 4
 
 List *list_new(void);
 
+List *list_new_in(Arena *arena);
+
 int list_length(List *list);
 
 void list_free(List *list);
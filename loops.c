@@ -0,0 +1,605 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "loops.h"
+#include "ir.h"
+#include "ssa.h"
+#include "list.h"
+
+/* Loop optimisations. A back edge is an edge to a block that
+ * dominates its source. The block it goes to is a loop header, and
+ * the natural loop is the header plus every block that can reach the
+ * back edge without going through the header.
+ *
+ * rotate_loops runs before we convert to SSA form, and copies each
+ * loop's condition to the bottom of its body. optimise_loops works on
+ * SSA form: it hoists invariant computations out of loops, and turns
+ * multiplications of induction variables into additions.
+ */
+
+typedef struct Loop {
+    IrBlock *header;
+    // Indexed by block index.
+    bool *contains;
+    // Blocks with an edge back to the header.
+    List *latches;
+    // The only block outside the loop that enters it, which jumps
+    // straight to the header. We put hoisted code here. See
+    // add_preheader.
+    IrBlock *preheader;
+} Loop;
+
+static void loop_free(Loop *loop) {
+    free(loop->contains);
+    list_free(loop->latches);
+    free(loop);
+}
+
+/* Find the loop headed by HEADER. Returns NULL if HEADER isn't the
+ * target of a back edge, or the loop doesn't have a preheader.
+ */
+static Loop *find_loop(IrFunction *function, Dominators *dominators,
+                       IrBlock *header) {
+    int block_count = list_length(function->blocks);
+    Loop *loop = malloc(sizeof(Loop));
+    loop->header = header;
+    loop->contains = calloc(block_count, sizeof(bool));
+    loop->contains[header->index] = true;
+    loop->latches = list_new();
+    loop->preheader = NULL;
+
+    // Walk backwards from each latch until we reach the header.
+    IrBlock **worklist = malloc(block_count * sizeof(IrBlock *));
+    for (int i = 0; i < list_length(header->predecessors); i++) {
+        IrBlock *latch = list_get(header->predecessors, i);
+        if (!dominates(dominators, header->index, latch->index)) {
+            continue;
+        }
+        list_append(loop->latches, latch);
+
+        int worklist_size = 0;
+        if (!loop->contains[latch->index]) {
+            loop->contains[latch->index] = true;
+            worklist[worklist_size++] = latch;
+        }
+        while (worklist_size > 0) {
+            IrBlock *block = worklist[--worklist_size];
+            for (int j = 0; j < list_length(block->predecessors); j++) {
+                IrBlock *predecessor = list_get(block->predecessors, j);
+                if (!loop->contains[predecessor->index]) {
+                    loop->contains[predecessor->index] = true;
+                    worklist[worklist_size++] = predecessor;
+                }
+            }
+        }
+    }
+    free(worklist);
+
+    // Every predecessor inside the loop is a latch, as the header
+    // dominates it.
+    int entries = 0;
+    for (int i = 0; i < list_length(header->predecessors); i++) {
+        IrBlock *predecessor = list_get(header->predecessors, i);
+        if (!loop->contains[predecessor->index]) {
+            loop->preheader = predecessor;
+            entries++;
+        }
+    }
+
+    if (list_length(loop->latches) == 0 || entries != 1 ||
+        loop->preheader->successor_count != 1) {
+        loop_free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+/* If HEADER starts a loop whose only way in is a branch, as in a
+ * rotated while loop, insert a block on that edge to be the loop's
+ * preheader. Code hoisted there then doesn't run when the loop
+ * doesn't, and doesn't separate the branch from its comparison.
+ * Returns true if we added a block.
+ */
+static bool add_preheader(IrProgram *program, IrFunction *function,
+                          Dominators *dominators, IrBlock *header) {
+    IrBlock *entry = NULL;
+    int entries = 0, latches = 0;
+    for (int i = 0; i < list_length(header->predecessors); i++) {
+        IrBlock *predecessor = list_get(header->predecessors, i);
+        if (dominates(dominators, header->index, predecessor->index)) {
+            latches++;
+        } else {
+            entry = predecessor;
+            entries++;
+        }
+    }
+
+    if (latches == 0 || entries != 1 || entry->successor_count == 1 ||
+        entry->successors[0] == entry->successors[1]) {
+        return false;
+    }
+
+    // Lay the preheader out just before the header, so it falls
+    // through. Phi arguments follow the position in the predecessor
+    // list, so the preheader takes the entry's place.
+    IrBlock *preheader = ir_block_new(program, function);
+    List *blocks = function->blocks;
+    int position = list_length(blocks) - 1;
+    while (list_get(blocks, position - 1) != header) {
+        list_set(blocks, position, list_get(blocks, position - 1));
+        position--;
+    }
+    list_set(blocks, position, header);
+    list_set(blocks, position - 1, preheader);
+
+    ir_jump(program, preheader, header);
+    list_append(preheader->predecessors, entry);
+    for (int i = 0; i < entry->successor_count; i++) {
+        if (entry->successors[i] == header) {
+            entry->successors[i] = preheader;
+        }
+    }
+    for (int i = 0; i < list_length(header->predecessors); i++) {
+        if (list_get(header->predecessors, i) == entry) {
+            list_set(header->predecessors, i, preheader);
+        }
+    }
+    return true;
+}
+
+/* Find every loop in FUNCTION that we can optimise, innermost first,
+ * so code hoisted out of an inner loop can then be hoisted out of the
+ * loops around it.
+ */
+static List *find_loops(IrFunction *function, Dominators *dominators) {
+    List *loops = list_new();
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        Loop *loop =
+            find_loop(function, dominators, list_get(function->blocks, i));
+        if (loop != NULL) {
+            list_append(loops, loop);
+        }
+    }
+
+    // An inner loop is contained in the loops around it, so it's the
+    // one whose header comes later in reverse postorder. Sort by that
+    // with an insertion sort, as there are few loops.
+    int *numbers = dominators->postorder_numbers;
+    for (int i = 1; i < list_length(loops); i++) {
+        Loop *loop = list_get(loops, i);
+        int j = i - 1;
+        while (j >= 0 &&
+               numbers[((Loop *)list_get(loops, j))->header->index] >
+                   numbers[loop->header->index]) {
+            list_set(loops, j + 1, list_get(loops, j));
+            j--;
+        }
+        list_set(loops, j + 1, loop);
+    }
+    return loops;
+}
+
+/* The index of the block defining each vreg in FUNCTION, or -1 for
+ * vregs without a definition.
+ */
+static int *definition_blocks(IrFunction *function) {
+    int *blocks = malloc(function->vreg_count * sizeof(int));
+    for (IrVreg vreg = 0; vreg < function->vreg_count; vreg++) {
+        blocks[vreg] = -1;
+    }
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrVreg dest = block->instructions[j].dest;
+            if (dest != IR_NO_VREG) {
+                blocks[dest] = block->index;
+            }
+        }
+    }
+    return blocks;
+}
+
+/* Does OPERAND have the same value on every iteration of LOOP? */
+static bool is_invariant(IrOperand operand, Loop *loop, int *definitions) {
+    return operand.kind != IR_OPERAND_VREG ||
+           definitions[operand.value] == -1 ||
+           !loop->contains[definitions[operand.value]];
+}
+
+/* Can INSTRUCTION run anywhere its operands are available? None of
+ * our arithmetic traps, so it's safe to run even if the loop doesn't.
+ */
+static bool is_pure(IrInstruction *instruction) {
+    IrOpcode opcode = instruction->opcode;
+    return opcode == IR_COPY || opcode == IR_BITWISE_NOT ||
+           opcode == IR_LOGICAL_NOT || opcode == IR_ADD || opcode == IR_SUB ||
+           opcode == IR_MUL || opcode == IR_LESS_THAN ||
+           opcode == IR_LESS_OR_EQUAL;
+}
+
+/* Add INSTRUCTION to the end of LOOP's preheader, before its jump. */
+static IrInstruction *append_to_preheader(IrProgram *program, Loop *loop,
+                                          IrOpcode opcode, IrVreg dest) {
+    IrBlock *preheader = loop->preheader;
+    return ir_insert(program, preheader, preheader->instruction_count - 1,
+                     opcode, dest);
+}
+
+/* Loop invariant code motion: move every pure instruction in LOOP
+ * whose operands are defined outside it to the preheader. In SSA form
+ * each vreg has one definition, which the preheader now dominates, so
+ * uses after the loop are still fine.
+ */
+static int hoist_invariants(IrProgram *program, IrFunction *function,
+                            Dominators *dominators, Loop *loop) {
+    int *definitions = definition_blocks(function);
+    int hoisted = 0;
+
+    // Visiting blocks in reverse postorder sees most definitions before
+    // their uses, so this rarely needs a second pass.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < dominators->block_count; i++) {
+            IrBlock *block = dominators->reverse_postorder[i];
+            if (!loop->contains[block->index]) {
+                continue;
+            }
+
+            int kept = 0;
+            for (int j = 0; j < block->instruction_count; j++) {
+                IrInstruction instruction = block->instructions[j];
+                if (is_pure(&instruction) &&
+                    is_invariant(instruction.operands[0], loop, definitions) &&
+                    is_invariant(instruction.operands[1], loop, definitions)) {
+                    IrInstruction *moved = append_to_preheader(
+                        program, loop, instruction.opcode, instruction.dest);
+                    *moved = instruction;
+                    definitions[instruction.dest] = loop->preheader->index;
+                    hoisted++;
+                    changed = true;
+                } else {
+                    block->instructions[kept++] = instruction;
+                }
+            }
+            block->instruction_count = kept;
+        }
+    }
+
+    free(definitions);
+    return hoisted;
+}
+
+/* The position of PREDECESSOR in BLOCK's predecessors, which is also
+ * the position of its argument to each phi in BLOCK.
+ */
+static int predecessor_position(IrBlock *block, IrBlock *predecessor) {
+    for (int i = 0; i < list_length(block->predecessors); i++) {
+        if (list_get(block->predecessors, i) == predecessor) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Find the instruction defining VREG, returning its block and setting
+ * *POSITION, or return NULL.
+ */
+static IrBlock *find_definition(IrFunction *function, IrVreg vreg,
+                                int *position) {
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            if (block->instructions[j].dest == vreg) {
+                *position = j;
+                return block;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* A basic induction variable i = phi(start, i + step), where the step
+ * is a constant. The increment is instructions[increment_position] in
+ * increment_block.
+ */
+typedef struct Induction {
+    IrVreg vreg;
+    IrOperand start;
+    int step;
+    IrBlock *increment_block;
+    int increment_position;
+} Induction;
+
+/* Is PHI, in LOOP's header, a basic induction variable? If so, fill
+ * in INDUCTION. LOOP must have a single latch.
+ */
+static bool find_induction(IrFunction *function, Loop *loop,
+                           IrInstruction *phi, Induction *induction) {
+    IrBlock *header = loop->header;
+    int entry = predecessor_position(header, loop->preheader);
+    int back = predecessor_position(header, list_get(loop->latches, 0));
+    IrOperand next = phi->arguments[back];
+    if (next.kind != IR_OPERAND_VREG) {
+        return false;
+    }
+
+    int position;
+    IrBlock *block = find_definition(function, next.value, &position);
+    if (block == NULL || !loop->contains[block->index]) {
+        return false;
+    }
+
+    IrInstruction *increment = &block->instructions[position];
+    IrOperand *operands = increment->operands;
+    unsigned int step;
+    if (increment->opcode == IR_ADD && operands[0].kind == IR_OPERAND_VREG &&
+        operands[0].value == phi->dest &&
+        operands[1].kind == IR_OPERAND_CONSTANT) {
+        step = operands[1].value;
+    } else if (increment->opcode == IR_ADD &&
+               operands[1].kind == IR_OPERAND_VREG &&
+               operands[1].value == phi->dest &&
+               operands[0].kind == IR_OPERAND_CONSTANT) {
+        step = operands[0].value;
+    } else if (increment->opcode == IR_SUB &&
+               operands[0].kind == IR_OPERAND_VREG &&
+               operands[0].value == phi->dest &&
+               operands[1].kind == IR_OPERAND_CONSTANT) {
+        step = 0u - (unsigned int)operands[1].value;
+    } else {
+        return false;
+    }
+
+    induction->vreg = phi->dest;
+    induction->start = phi->arguments[entry];
+    induction->step = (int)step;
+    induction->increment_block = block;
+    induction->increment_position = position;
+    return true;
+}
+
+/* If OPERANDS are the induction variable and a loop invariant, in
+ * either order, return the invariant.
+ */
+static bool scaled_induction(IrOperand *operands, IrVreg vreg, Loop *loop,
+                             int *definitions, IrOperand *scale) {
+    for (int i = 0; i < 2; i++) {
+        IrOperand other = operands[1 - i];
+        if (operands[i].kind == IR_OPERAND_VREG && operands[i].value == vreg &&
+            !(other.kind == IR_OPERAND_VREG && other.value == vreg) &&
+            is_invariant(other, loop, definitions)) {
+            *scale = other;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Add a new induction variable that always equals INDUCTION * SCALE,
+ * and return it. It starts at start * scale, and is incremented by
+ * step * scale alongside INDUCTION.
+ */
+static IrVreg add_scaled_induction(IrProgram *program, IrFunction *function,
+                                   Loop *loop, Induction *induction,
+                                   IrOperand scale) {
+    IrVreg scaled = ir_vreg_new(program, function, NULL);
+    IrVreg next = ir_vreg_new(program, function, NULL);
+    IrVreg start = ir_vreg_new(program, function, NULL);
+
+    IrInstruction *multiply;
+    if (induction->start.kind == IR_OPERAND_CONSTANT &&
+        induction->start.value == 0) {
+        multiply = append_to_preheader(program, loop, IR_COPY, start);
+        multiply->operands[0] = induction->start;
+    } else {
+        multiply = append_to_preheader(program, loop, IR_MUL, start);
+        multiply->operands[0] = induction->start;
+        multiply->operands[1] = scale;
+    }
+
+    // Induction variables usually count up from zero in ones, so
+    // avoid multiplying by zero or one. Constant propagation handles
+    // the rest.
+    IrOperand step;
+    if (induction->step == 1) {
+        step = scale;
+    } else if (scale.kind == IR_OPERAND_CONSTANT) {
+        // Multiply as the generated code would, wrapping on overflow.
+        unsigned int bits = (unsigned int)scale.value * induction->step;
+        step = ir_constant_operand((int)bits);
+    } else {
+        step = ir_vreg_operand(ir_vreg_new(program, function, NULL));
+        multiply = append_to_preheader(program, loop, IR_MUL, step.value);
+        multiply->operands[0] = scale;
+        multiply->operands[1] = ir_constant_operand(induction->step);
+    }
+
+    IrInstruction *increment =
+        ir_insert(program, induction->increment_block,
+                  induction->increment_position + 1, IR_ADD, next);
+    increment->operands[0] = ir_vreg_operand(scaled);
+    increment->operands[1] = step;
+
+    IrBlock *header = loop->header;
+    IrInstruction *phi = ir_insert(program, header, 0, IR_PHI, scaled);
+    int argument_count = list_length(header->predecessors);
+    phi->arguments =
+        arena_alloc(program->arena, argument_count * sizeof(IrOperand));
+    phi->argument_count = argument_count;
+    phi->arguments[predecessor_position(header, loop->preheader)] =
+        ir_vreg_operand(start);
+    phi->arguments[predecessor_position(
+        header, list_get(loop->latches, 0))] = ir_vreg_operand(next);
+
+    return scaled;
+}
+
+/* Find a multiplication of a basic induction variable by a loop
+ * invariant in LOOP, and replace it with a new induction variable
+ * that's incremented by the product of the step and the invariant.
+ * Returns false if there isn't one.
+ */
+static bool reduce_multiplication(IrProgram *program, IrFunction *function,
+                                  Loop *loop) {
+    IrBlock *header = loop->header;
+    int *definitions = definition_blocks(function);
+
+    for (int i = 0; i < header->instruction_count; i++) {
+        IrInstruction *phi = &header->instructions[i];
+        Induction induction;
+        if (phi->opcode != IR_PHI ||
+            !find_induction(function, loop, phi, &induction)) {
+            continue;
+        }
+
+        for (int j = 0; j < list_length(function->blocks); j++) {
+            IrBlock *block = list_get(function->blocks, j);
+            if (!loop->contains[block->index]) {
+                continue;
+            }
+
+            for (int k = 0; k < block->instruction_count; k++) {
+                IrInstruction *multiply = &block->instructions[k];
+                IrOperand scale;
+                if (multiply->opcode != IR_MUL ||
+                    !scaled_induction(multiply->operands, induction.vreg,
+                                      loop, definitions, &scale)) {
+                    continue;
+                }
+
+                // Turn the multiplication into a copy before adding
+                // instructions, which moves it.
+                multiply->opcode = IR_COPY;
+                multiply->operands[1].kind = IR_OPERAND_NONE;
+                IrVreg scaled = add_scaled_induction(program, function, loop,
+                                                     &induction, scale);
+                IrBlock *copy_block = block;
+                int position = k;
+                if (copy_block == induction.increment_block &&
+                    position > induction.increment_position) {
+                    position++;
+                }
+                if (copy_block == header) {
+                    position++;
+                }
+                copy_block->instructions[position].operands[0] =
+                    ir_vreg_operand(scaled);
+
+                free(definitions);
+                return true;
+            }
+        }
+    }
+
+    free(definitions);
+    return false;
+}
+
+/* Hoist invariant code out of every loop in FUNCTION, which must be
+ * in SSA form, and strength reduce multiplications by induction
+ * variables. Constant and copy propagation should run afterwards, to
+ * clean up what this leaves behind.
+ */
+void optimise_loops(IrProgram *program, IrFunction *function) {
+    Dominators *dominators = compute_dominators(function);
+
+    // Adding blocks moves the others, so we add every preheader
+    // before looking at loops.
+    bool added = false;
+    for (int i = 0; i < dominators->block_count; i++) {
+        if (add_preheader(program, function, dominators,
+                          dominators->reverse_postorder[i])) {
+            added = true;
+        }
+    }
+    if (added) {
+        dominators_free(dominators);
+        dominators = compute_dominators(function);
+    }
+
+    List *loops = find_loops(function, dominators);
+
+    for (int i = 0; i < list_length(loops); i++) {
+        Loop *loop = list_get(loops, i);
+        hoist_invariants(program, function, dominators, loop);
+
+        // Each reduction removes a multiplication from the loop, so
+        // this terminates.
+        if (list_length(loop->latches) == 1 &&
+            list_length(loop->header->predecessors) == 2) {
+            while (reduce_multiplication(program, function, loop)) {
+            }
+        }
+    }
+
+    for (int i = 0; i < list_length(loops); i++) {
+        loop_free(list_get(loops, i));
+    }
+    list_free(loops);
+    dominators_free(dominators);
+}
+
+// Loop headers with more instructions than this aren't rotated, so we
+// don't copy much code.
+static const int ROTATION_LIMIT = 8;
+
+/* Loop rotation: where a loop body ends by jumping back to a small
+ * header that decides whether to go round again, copy the header to
+ * the end of the body. Each iteration then ends with a single
+ * conditional jump, and the original header only runs on entry.
+ *
+ * FUNCTION must not be in SSA form yet, as the copy assigns the
+ * header's vregs a second time.
+ */
+void rotate_loops(IrProgram *program, IrFunction *function) {
+    Dominators *dominators = compute_dominators(function);
+    bool rotated = false;
+
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *latch = list_get(function->blocks, i);
+        IrInstruction *jump = ir_terminator(latch);
+        if (jump == NULL || jump->opcode != IR_JUMP) {
+            continue;
+        }
+
+        IrBlock *header = latch->successors[0];
+        IrInstruction *branch = ir_terminator(header);
+        if (header->index == 0 || header == latch || branch == NULL ||
+            branch->opcode != IR_BRANCH ||
+            header->instruction_count > ROTATION_LIMIT ||
+            !dominates(dominators, header->index, latch->index)) {
+            continue;
+        }
+
+        latch->instruction_count--;
+        for (int j = 0; j < header->instruction_count; j++) {
+            IrInstruction *instruction = &header->instructions[j];
+            IrInstruction *copy =
+                ir_insert(program, latch, latch->instruction_count,
+                          instruction->opcode, instruction->dest);
+            *copy = *instruction;
+
+            // SSA renaming rewrites arguments in place, so each call
+            // needs its own.
+            if (instruction->argument_count > 0) {
+                size_t size = instruction->argument_count * sizeof(IrOperand);
+                copy->arguments = arena_alloc(program->arena, size);
+                memcpy(copy->arguments, instruction->arguments, size);
+            }
+        }
+
+        latch->successor_count = header->successor_count;
+        for (int j = 0; j < header->successor_count; j++) {
+            latch->successors[j] = header->successors[j];
+        }
+        rotated = true;
+    }
+
+    dominators_free(dominators);
+    if (rotated) {
+        ir_update_predecessors(program, function);
+    }
+}
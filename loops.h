@@ -0,0 +1,10 @@
+#include "ir.h"
+
+#ifndef BABYC_LOOPS_HEADER
+#define BABYC_LOOPS_HEADER
+
+void optimise_loops(IrProgram *program, IrFunction *function);
+
+void rotate_loops(IrProgram *program, IrFunction *function);
+
+#endif
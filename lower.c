@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+#include "lower.h"
+#include "syntax.h"
+#include "ir.h"
+#include "environment.h"
+#include "regalloc.h"
+#include "errors.h"
+
+typedef struct Lowering {
+    IrProgram *program;
+    IrFunction *function;
+    // The block we're currently appending to.
+    IrBlock *block;
+    // Maps variable names to the vreg holding them.
+    Environment *env;
+    // The file we're compiling, for error messages.
+    char *file_name;
+} Lowering;
+
+static IrVreg temporary_new(Lowering *lowering) {
+    return ir_vreg_new(lowering->program, lowering->function, NULL);
+}
+
+static IrVreg variable_vreg(Lowering *lowering, char *var_name) {
+    IrVreg vreg = environment_get(lowering->env, var_name);
+    if (vreg < 0) {
+        compile_error("%s: undefined variable %s", lowering->file_name,
+                      var_name);
+    }
+    return vreg;
+}
+
+/* Start appending to BLOCK. */
+static void switch_to_block(Lowering *lowering, IrBlock *block) {
+    lowering->block = block;
+}
+
+static IrOpcode binary_opcode(BinaryExpressionType binary_type) {
+    if (binary_type == ADDITION) {
+        return IR_ADD;
+    } else if (binary_type == SUBTRACTION) {
+        return IR_SUB;
+    } else if (binary_type == MULTIPLICATION) {
+        return IR_MUL;
+    } else if (binary_type == LESS_THAN) {
+        return IR_LESS_THAN;
+    } else {
+        return IR_LESS_OR_EQUAL;
+    }
+}
+
+// Only used to pick an evaluation order, so the exact number of
+// registers doesn't matter much.
+static const int SETHI_ULLMAN_REGISTERS = 4;
+
+/* Append the instructions to evaluate SYNTAX, returning the operand
+ * that holds its value. Immediates and variables don't need any
+ * instructions.
+ */
+static IrOperand lower_expression(Lowering *lowering, Syntax *syntax) {
+    IrProgram *program = lowering->program;
+
+    if (syntax->type == IMMEDIATE) {
+        return ir_constant_operand(syntax->immediate->value);
+
+    } else if (syntax->type == VARIABLE) {
+        return ir_vreg_operand(
+            variable_vreg(lowering, syntax->variable->var_name));
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        IrOperand operand =
+            lower_expression(lowering, unary_syntax->expression);
+
+        IrOpcode opcode = unary_syntax->unary_type == BITWISE_NEGATION
+                              ? IR_BITWISE_NOT
+                              : IR_LOGICAL_NOT;
+        IrVreg dest = temporary_new(lowering);
+        IrInstruction *instruction =
+            ir_append(program, lowering->block, opcode, dest);
+        instruction->operands[0] = operand;
+
+        return ir_vreg_operand(dest);
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+
+        // Evaluate whichever side needs more registers first, so fewer
+        // temporaries are live at once.
+        IrOperand left, right;
+        if (sethi_ullman_number(binary_syntax->right, SETHI_ULLMAN_REGISTERS) >
+            sethi_ullman_number(binary_syntax->left, SETHI_ULLMAN_REGISTERS)) {
+            right = lower_expression(lowering, binary_syntax->right);
+            left = lower_expression(lowering, binary_syntax->left);
+        } else {
+            left = lower_expression(lowering, binary_syntax->left);
+            right = lower_expression(lowering, binary_syntax->right);
+        }
+
+        IrVreg dest = temporary_new(lowering);
+        IrInstruction *instruction =
+            ir_append(program, lowering->block,
+                      binary_opcode(binary_syntax->binary_type), dest);
+        instruction->operands[0] = left;
+        instruction->operands[1] = right;
+
+        return ir_vreg_operand(dest);
+
+    } else if (syntax->type == ASSIGNMENT) {
+        IrOperand value =
+            lower_expression(lowering, syntax->assignment->expression);
+        IrVreg variable = variable_vreg(lowering, syntax->assignment->var_name);
+
+        IrInstruction *instruction =
+            ir_append(program, lowering->block, IR_COPY, variable);
+        instruction->operands[0] = value;
+
+        return ir_vreg_operand(variable);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        FunctionCall *function_call = syntax->function_call;
+        List *arguments =
+            function_call->function_arguments->function_arguments->arguments;
+
+        int argument_count = list_length(arguments);
+        IrOperand *argument_operands =
+            arena_alloc(program->arena, argument_count * sizeof(IrOperand));
+        for (int i = 0; i < argument_count; i++) {
+            argument_operands[i] =
+                lower_expression(lowering, list_get(arguments, i));
+        }
+
+        IrVreg dest = temporary_new(lowering);
+        IrInstruction *instruction =
+            ir_append(program, lowering->block, IR_CALL, dest);
+        instruction->function_name = function_call->function_name;
+        instruction->arguments = argument_operands;
+        instruction->argument_count = argument_count;
+
+        return ir_vreg_operand(dest);
+    }
+
+    errx(1, "Can't lower expression %s", syntax_type_name(syntax));
+}
+
+/* Branch to IF_TRUE or IF_FALSE depending on CONDITION. Constant
+ * conditions become unconditional jumps, and a negated condition
+ * swaps the targets rather than computing the negation.
+ */
+static void lower_branch(Lowering *lowering, Syntax *condition,
+                         IrBlock *if_true, IrBlock *if_false) {
+    if (condition->type == UNARY_OPERATOR &&
+        condition->unary_expression->unary_type == LOGICAL_NEGATION) {
+        lower_branch(lowering, condition->unary_expression->expression,
+                     if_false, if_true);
+        return;
+    }
+
+    IrOperand operand = lower_expression(lowering, condition);
+
+    if (operand.kind == IR_OPERAND_CONSTANT) {
+        ir_jump(lowering->program, lowering->block,
+                operand.value ? if_true : if_false);
+    } else {
+        ir_branch(lowering->program, lowering->block, operand, if_true,
+                  if_false);
+    }
+}
+
+static void lower_statement(Lowering *lowering, Syntax *syntax) {
+    IrProgram *program = lowering->program;
+    IrFunction *function = lowering->function;
+
+    if (syntax->type == RETURN_STATEMENT) {
+        IrOperand value =
+            lower_expression(lowering, syntax->return_statement->expression);
+        ir_return(program, lowering->block, value);
+
+        // Anything after a return is unreachable, but it still needs
+        // a block to live in.
+        switch_to_block(lowering, ir_block_new(program, function));
+
+    } else if (syntax->type == IF_STATEMENT) {
+        IfStatement *if_statement = syntax->if_statement;
+        IrBlock *then_block = ir_block_new(program, function);
+        IrBlock *end_block = ir_block_new(program, function);
+
+        lower_branch(lowering, if_statement->condition, then_block, end_block);
+
+        switch_to_block(lowering, then_block);
+        lower_statement(lowering, if_statement->then);
+        ir_jump(program, lowering->block, end_block);
+
+        switch_to_block(lowering, end_block);
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        WhileStatement *while_statement = syntax->while_statement;
+        IrBlock *condition_block = ir_block_new(program, function);
+        IrBlock *body_block = ir_block_new(program, function);
+        IrBlock *end_block = ir_block_new(program, function);
+
+        ir_jump(program, lowering->block, condition_block);
+
+        switch_to_block(lowering, condition_block);
+        lower_branch(lowering, while_statement->condition, body_block,
+                     end_block);
+
+        switch_to_block(lowering, body_block);
+        lower_statement(lowering, while_statement->body);
+        ir_jump(program, lowering->block, condition_block);
+
+        switch_to_block(lowering, end_block);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+
+        IrOperand value =
+            lower_expression(lowering, define_var_statement->init_value);
+        IrVreg variable =
+            ir_vreg_new(program, function, define_var_statement->var_name);
+        environment_set(lowering->env, define_var_statement->var_name,
+                        variable);
+
+        IrInstruction *instruction =
+            ir_append(program, lowering->block, IR_COPY, variable);
+        instruction->operands[0] = value;
+
+    } else if (syntax->type == BLOCK) {
+        environment_push_scope(lowering->env);
+
+        List *statements = syntax->block->statements;
+        for (int i = 0; i < list_length(statements); i++) {
+            lower_statement(lowering, list_get(statements, i));
+        }
+
+        environment_pop_scope(lowering->env);
+
+    } else {
+        // An expression statement, evaluated for its side effects.
+        lower_expression(lowering, syntax);
+    }
+}
+
+static void lower_function(Lowering *lowering, Syntax *syntax) {
+    IrProgram *program = lowering->program;
+
+    lowering->function = ir_function_new(program, syntax->function->name);
+    switch_to_block(lowering, ir_block_new(program, lowering->function));
+    environment_reset(lowering->env);
+
+    // Parameters are variables like any other, whose initial values
+    // the caller provides.
+    List *parameters = syntax->function->parameters;
+    lowering->function->parameter_count = list_length(parameters);
+    for (int i = 0; i < list_length(parameters); i++) {
+        Parameter *parameter = list_get(parameters, i);
+        IrVreg variable =
+            ir_vreg_new(program, lowering->function, parameter->name);
+        environment_set(lowering->env, parameter->name, variable);
+
+        IrInstruction *instruction =
+            ir_append(program, lowering->block, IR_PARAMETER, variable);
+        instruction->parameter = i;
+    }
+
+    lower_statement(lowering, syntax->function->root_block);
+
+    // Falling off the end of a function returns 0, as main does in
+    // C99.
+    ir_return(program, lowering->block, ir_constant_operand(0));
+
+    ir_compute_predecessors(program, lowering->function);
+
+    // Drop the blocks we started after each return, along with the
+    // final return if it can't be reached.
+    ir_remove_unreachable_blocks(program, lowering->function);
+}
+
+/* Translate TOP_LEVEL, parsed from FILE_NAME, into a new IrProgram. */
+IrProgram *lower_syntax(Syntax *top_level, char *file_name) {
+    Lowering lowering;
+    lowering.program = ir_program_new();
+    lowering.function = NULL;
+    lowering.block = NULL;
+    lowering.env = environment_new();
+    lowering.file_name = file_name;
+
+    List *declarations = top_level->top_level->declarations;
+    for (int i = 0; i < list_length(declarations); i++) {
+        lower_function(&lowering, list_get(declarations, i));
+    }
+
+    environment_free(lowering.env);
+    return lowering.program;
+}
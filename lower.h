@@ -0,0 +1,9 @@
+#include "syntax.h"
+#include "ir.h"
+
+#ifndef BABYC_LOWER_HEADER
+#define BABYC_LOWER_HEADER
+
+IrProgram *lower_syntax(Syntax *top_level, char *file_name);
+
+#endif
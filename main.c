@@ -1,14 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
-#include <assert.h>
 #include <err.h>
+#include <stdbool.h>
 
-#include "stack.h"
-#include "build/y.tab.h"
-#include "syntax.h"
-#include "assembly.h"
+#include "compilation.h"
+#include "list.h"
+#include "target.h"
 
 void print_help() {
     printf("Babyc is a very basic C compiler.\n\n");
@@ -16,115 +14,143 @@ void print_help() {
     printf("    $ babyc foo.c\n");
     printf("To output the AST without compiling:\n");
     printf("    $ babyc --dump-ast foo.c\n");
+    printf("To output the intermediate representation without compiling:\n");
+    printf("    $ babyc --dump-ir foo.c\n");
     printf("To output the preprocessed code without parsing:\n");
     printf("    $ babyc --dump-expansion foo.c\n");
+    printf("To also look for #include files in DIR:\n");
+    printf("    $ babyc -IDIR foo.c\n");
+    printf("To report how much memory the syntax tree used:\n");
+    printf("    $ babyc --arena-stats foo.c\n");
+    printf("To compile via the flat, index-based syntax table:\n");
+    printf("    $ babyc --flat foo.c\n");
+    printf("To fold constants and simplify expressions before compiling:\n");
+    printf("    $ babyc -O foo.c\n");
+    printf("To also optimise the intermediate representation in SSA form:\n");
+    printf("    $ babyc -O2 foo.c\n");
+    printf("To only inline functions up to N IR instructions (0 to "
+           "disable):\n");
+    printf("    $ babyc -O --inline-threshold=N foo.c\n");
+    printf("To pass the first two arguments of internal calls in registers:\n");
+    printf("    $ babyc --fastcall foo.c\n");
+    printf("To write x86-64 assembly instead of i386:\n");
+    printf("    $ babyc --target=x86_64 foo.c\n");
+    printf("To lex with the hand-written lexer instead of flex's:\n");
+    printf("    $ babyc --lexer=hand-written foo.c\n");
+    printf("To report how many functions didn't need a stack frame:\n");
+    printf("    $ babyc --frame-stats foo.c\n");
+    printf("To report how often each peephole rule fired (with -O):\n");
+    printf("    $ babyc -O --peephole-stats foo.c\n");
+    printf("To compile several files on N threads, to foo.s, bar.s etc:\n");
+    printf("    $ babyc -j N foo.c bar.c baz.c\n");
     printf("To print this message:\n");
     printf("    $ babyc --help\n\n");
     printf("For more information, see https://github.com/Wilfred/babyc\n");
 }
 
-extern Stack *syntax_stack;
-
-extern int yyparse(void);
-extern FILE *yyin;
-
-typedef enum {
-    MACRO_EXPAND,
-    PARSE,
-    EMIT_ASM,
-} stage_t;
-
 int main(int argc, char *argv[]) {
     ++argv, --argc; /* Skip over program name. */
 
-    stage_t terminate_at = EMIT_ASM;
+    CompileOptions options;
+    compile_options_init(&options);
+    options.include_paths = list_new();
+
+    List *file_names = list_new();
+    // With -j, or several files, we compile each file to its own .s.
+    bool batch = false;
+    int thread_count = 1;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            print_help();
+            return 0;
+        } else if (strcmp(argv[i], "--dump-expansion") == 0) {
+            options.terminate_at = MACRO_EXPAND;
+        } else if (strcmp(argv[i], "--dump-ast") == 0) {
+            options.terminate_at = PARSE;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.terminate_at = LOWER;
+        } else if (strcmp(argv[i], "--arena-stats") == 0) {
+            options.print_arena_stats = true;
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+            options.inline_threshold = atoi(argv[i] + 19);
+        } else if (strcmp(argv[i], "--fastcall") == 0) {
+            options.use_fastcall = true;
+        } else if (strncmp(argv[i], "--target=", 9) == 0) {
+            options.target = target_find(argv[i] + 9);
+            if (options.target == NULL) {
+                errx(1, "Unknown target '%s', expected i386 or x86_64",
+                     argv[i] + 9);
+            }
+        } else if (strcmp(argv[i], "--lexer=flex") == 0) {
+            options.lexer = LEXER_FLEX;
+        } else if (strcmp(argv[i], "--lexer=hand-written") == 0) {
+            options.lexer = LEXER_HAND_WRITTEN;
+        } else if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+            list_append(options.include_paths, argv[i] + 2);
+        } else if (strcmp(argv[i], "--frame-stats") == 0) {
+            options.print_frames = true;
+        } else if (strcmp(argv[i], "--peephole-stats") == 0) {
+            options.print_peephole = true;
+        } else if (strcmp(argv[i], "--flat") == 0) {
+            options.use_flat_syntax = true;
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            options.optimisation_level = 0;
+        } else if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "-O1") == 0) {
+            options.optimisation_level = 1;
+        } else if (strcmp(argv[i], "-O2") == 0) {
+            options.optimisation_level = 2;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            batch = true;
+            thread_count = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            batch = true;
+            thread_count = atoi(argv[i] + 2);
+        } else if (argv[i][0] == '-') {
+            print_help();
+            return 1;
+        } else {
+            list_append(file_names, argv[i]);
+        }
+    }
 
-    char *file_name;
-    if (argc == 1 && strcmp(argv[0], "--help") == 0) {
-        print_help();
-        return 0;
-    } else if (argc == 1) {
-        file_name = argv[0];
-    } else if (argc == 2 && strcmp(argv[0], "--dump-expansion") == 0) {
-        terminate_at = MACRO_EXPAND;
-        file_name = argv[1];
-    } else if (argc == 2 && strcmp(argv[0], "--dump-ast") == 0) {
-        terminate_at = PARSE;
-        file_name = argv[1];
-    } else {
+    int file_count = list_length(file_names);
+    if (file_count == 0) {
         print_help();
         return 1;
     }
 
-    int result;
-
-    // TODO: create a proper temporary file from the preprocessor.
-    char command[1024] = {0};
-    snprintf(command, 1024, "gcc -E %s > .expanded.c", file_name);
-    result = system(command);
-    if (result != 0) {
-        puts("Macro expansion failed!");
-        return result;
+    if (options.target != &target_i386 &&
+        (options.use_flat_syntax || options.use_fastcall)) {
+        errx(1, "--flat and --fastcall are only supported on i386");
     }
 
-    yyin = fopen(".expanded.c", "r");
-
-    if (terminate_at == MACRO_EXPAND) {
-        int c;
-        while ((c = getc(yyin)) != EOF) {
-            putchar(c);
+    int result;
+    if (file_count == 1 && !batch) {
+        Compilation *compilation =
+            compilation_new(list_get(file_names, 0), "out.s", &options);
+        result = compile(compilation);
+        compilation_free(compilation);
+    } else {
+        if (options.terminate_at != EMIT_ASM || options.print_arena_stats ||
+            options.print_frames || options.print_peephole) {
+            errx(1, "--dump-* and --*-stats only work on a single file");
         }
-        goto cleanup_file;
-    }
-
-    if (yyin == NULL) {
-        // TODO: work out what the error was.
-        // TODO: Unit test this.
-        printf("Could not open file: '%s'\n", file_name);
-        result = 2;
-        goto cleanup_file;
-    }
-
-    syntax_stack = stack_new();
-
-    result = yyparse();
-    if (result != 0) {
-        printf("\n");
-        goto cleanup_syntax;
-    }
-
-    Syntax *complete_syntax = stack_pop(syntax_stack);
-    if (syntax_stack->size > 0) {
-        warnx("Did not consume the whole syntax stack during parsing! Remaining:");
-
-        while(syntax_stack->size > 0) {
-            fprintf(stderr, "%s", syntax_type_name(stack_pop(syntax_stack)));
+        if (thread_count < 1) {
+            errx(1, "-j expects a positive number of threads");
         }
-    }
 
-    if (terminate_at == PARSE) {
-        print_syntax(complete_syntax);
-    } else {
-        write_assembly(complete_syntax);
-        syntax_free(complete_syntax);
-
-        printf("Written out.s.\n");
-        printf("Build it with:\n");
-        printf("    $ as out.s -o out.o\n");
-        printf("    $ ld -s -o out out.o\n");
-    }
-
-cleanup_syntax:
-    /* TODO: if we exit early from syntactically invalid code, we will
-       need to free multiple Syntax structs on this stack.
-     */
-    stack_free(syntax_stack);
-cleanup_file:
-    if (yyin != NULL) {
-        fclose(yyin);
+        char **files = malloc(sizeof(char *) * file_count);
+        for (int i = 0; i < file_count; i++) {
+            files[i] = list_get(file_names, i);
+        }
+        result = compile_batch(files, file_count, &options, thread_count) != 0;
+        if (result == 0) {
+            printf("Written %d assembly files.\n", file_count);
+        }
+        free(files);
     }
-
-    unlink(".expanded.c");
+    list_free(file_names);
+    list_free(options.include_paths);
 
     return result;
 }
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <err.h>
+#include "optimise.h"
+#include "syntax.h"
+#include "list.h"
+#include "environment.h"
+#include "errors.h"
+
+/* Folding discards syntax before lowering sees it, so we check
+ * variable names as we go, scoped as lower.c does. Otherwise -O would
+ * accept a program like `return y * 0;` that -O0 rejects.
+ */
+typedef struct Folding {
+    // The variables in scope. Only whether a name is bound matters.
+    Environment *env;
+    // For error messages.
+    char *file_name;
+} Folding;
+
+static void check_variable(Folding *folding, char *var_name) {
+    if (environment_get(folding->env, var_name) == -1) {
+        compile_error("%s: undefined variable %s", folding->file_name,
+                      var_name);
+    }
+}
+
+/* Does evaluating SYNTAX do anything other than produce a value? If
+ * not, we can discard it when its value isn't needed.
+ */
+bool syntax_has_side_effects(Syntax *syntax) {
+    if (syntax->type == IMMEDIATE || syntax->type == VARIABLE) {
+        return false;
+    } else if (syntax->type == UNARY_OPERATOR) {
+        return syntax_has_side_effects(syntax->unary_expression->expression);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return syntax_has_side_effects(syntax->binary_expression->left) ||
+               syntax_has_side_effects(syntax->binary_expression->right);
+    }
+
+    // Assignments and function calls.
+    return true;
+}
+
+static bool is_immediate(Syntax *syntax, int value) {
+    return syntax->type == IMMEDIATE && syntax->immediate->value == value;
+}
+
+/* Compute the value of a binary operator applied to LEFT and RIGHT,
+ * as the generated code would at runtime. We do arithmetic on
+ * unsigned values so overflow wraps around (it's undefined behaviour
+ * on signed ints, and babyc itself is built with -ftrapv).
+ */
+static int evaluate_binary(BinaryExpressionType binary_type, int left,
+                           int right) {
+    unsigned int left_bits = left, right_bits = right;
+
+    if (binary_type == ADDITION) {
+        return (int)(left_bits + right_bits);
+    } else if (binary_type == SUBTRACTION) {
+        return (int)(left_bits - right_bits);
+    } else if (binary_type == MULTIPLICATION) {
+        return (int)(left_bits * right_bits);
+    } else if (binary_type == LESS_THAN) {
+        return left < right;
+    } else if (binary_type == LESS_THAN_OR_EQUAL) {
+        return left <= right;
+    }
+
+    errx(1, "Can't evaluate unknown binary operator %d", binary_type);
+}
+
+static Syntax *fold_expression(Folding *folding, Syntax *syntax) {
+    if (syntax->type == VARIABLE) {
+        check_variable(folding, syntax->variable->var_name);
+
+    } else if (syntax->type == UNARY_OPERATOR) {
+        UnaryExpression *unary_syntax = syntax->unary_expression;
+        Syntax *expression = fold_expression(folding, unary_syntax->expression);
+        unary_syntax->expression = expression;
+
+        // We reuse the operand's node for the result, so folding
+        // doesn't allocate.
+        if (expression->type == IMMEDIATE) {
+            int value = expression->immediate->value;
+            if (unary_syntax->unary_type == BITWISE_NEGATION) {
+                expression->immediate->value = ~value;
+            } else {
+                expression->immediate->value = !value;
+            }
+            return expression;
+        }
+
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+        Syntax *left = fold_expression(folding, binary_syntax->left);
+        Syntax *right = fold_expression(folding, binary_syntax->right);
+        binary_syntax->left = left;
+        binary_syntax->right = right;
+
+        BinaryExpressionType binary_type = binary_syntax->binary_type;
+
+        if (left->type == IMMEDIATE && right->type == IMMEDIATE) {
+            left->immediate->value = evaluate_binary(
+                binary_type, left->immediate->value, right->immediate->value);
+            return left;
+        }
+
+        if (binary_type == ADDITION) {
+            // x + 0 and 0 + x
+            if (is_immediate(right, 0)) {
+                return left;
+            } else if (is_immediate(left, 0)) {
+                return right;
+            }
+        } else if (binary_type == SUBTRACTION) {
+            // x - 0
+            if (is_immediate(right, 0)) {
+                return left;
+            }
+        } else if (binary_type == MULTIPLICATION) {
+            // x * 1 and 1 * x
+            if (is_immediate(right, 1)) {
+                return left;
+            } else if (is_immediate(left, 1)) {
+                return right;
+            }
+
+            // x * 0 and 0 * x, as long as we don't need to evaluate x.
+            if (is_immediate(right, 0) && !syntax_has_side_effects(left)) {
+                return right;
+            } else if (is_immediate(left, 0) &&
+                       !syntax_has_side_effects(right)) {
+                return left;
+            }
+        }
+
+    } else if (syntax->type == ASSIGNMENT) {
+        check_variable(folding, syntax->assignment->var_name);
+        syntax->assignment->expression =
+            fold_expression(folding, syntax->assignment->expression);
+
+    } else if (syntax->type == FUNCTION_CALL) {
+        List *arguments =
+            syntax->function_call->function_arguments->function_arguments
+                ->arguments;
+        for (int i = 0; i < list_length(arguments); i++) {
+            arguments->items[i] =
+                fold_expression(folding, list_get(arguments, i));
+        }
+    }
+
+    return syntax;
+}
+
+/* Fold an expression whose value we only test against zero, so we
+ * can discard double negations.
+ */
+static Syntax *fold_condition(Folding *folding, Syntax *syntax) {
+    syntax = fold_expression(folding, syntax);
+
+    // !!x is zero exactly when x is.
+    while (syntax->type == UNARY_OPERATOR &&
+           syntax->unary_expression->unary_type == LOGICAL_NEGATION) {
+        Syntax *inner = syntax->unary_expression->expression;
+        if (inner->type != UNARY_OPERATOR ||
+            inner->unary_expression->unary_type != LOGICAL_NEGATION) {
+            break;
+        }
+        syntax = inner->unary_expression->expression;
+    }
+
+    return syntax;
+}
+
+/* Fold SYNTAX, returning the statement to use in its place, or NULL
+ * if it can be removed entirely.
+ */
+static Syntax *fold_statement(Folding *folding, Syntax *syntax) {
+    if (syntax->type == IF_STATEMENT) {
+        IfStatement *if_statement = syntax->if_statement;
+        if_statement->condition =
+            fold_condition(folding, if_statement->condition);
+        if_statement->then = fold_statement(folding, if_statement->then);
+
+        if (if_statement->condition->type == IMMEDIATE) {
+            if (if_statement->condition->immediate->value == 0) {
+                return NULL;
+            }
+            // The then block still gets its own scope.
+            return if_statement->then;
+        }
+
+    } else if (syntax->type == WHILE_SYNTAX) {
+        WhileStatement *while_statement = syntax->while_statement;
+        while_statement->condition =
+            fold_condition(folding, while_statement->condition);
+        while_statement->body = fold_statement(folding, while_statement->body);
+
+        if (is_immediate(while_statement->condition, 0)) {
+            return NULL;
+        }
+        // A loop with a constant non-zero condition is left in place
+        // and write_syntax omits the test.
+
+    } else if (syntax->type == RETURN_STATEMENT) {
+        syntax->return_statement->expression =
+            fold_expression(folding, syntax->return_statement->expression);
+
+    } else if (syntax->type == DEFINE_VAR) {
+        DefineVarStatement *define_var_statement = syntax->define_var_statement;
+        define_var_statement->init_value =
+            fold_expression(folding, define_var_statement->init_value);
+        environment_set(folding->env, define_var_statement->var_name, 0);
+
+    } else if (syntax->type == BLOCK) {
+        environment_push_scope(folding->env);
+
+        // Compact the statements in place, dropping removed ones.
+        List *statements = syntax->block->statements;
+        int kept = 0;
+        for (int i = 0; i < list_length(statements); i++) {
+            Syntax *statement =
+                fold_statement(folding, list_get(statements, i));
+            if (statement != NULL) {
+                statements->items[kept++] = statement;
+            }
+        }
+        statements->size = kept;
+
+        environment_pop_scope(folding->env);
+
+    } else if (syntax->type == FUNCTION) {
+        environment_reset(folding->env);
+        List *parameters = syntax->function->parameters;
+        for (int i = 0; i < list_length(parameters); i++) {
+            Parameter *parameter = list_get(parameters, i);
+            environment_set(folding->env, parameter->name, 0);
+        }
+
+        fold_statement(folding, syntax->function->root_block);
+
+    } else if (syntax->type == TOP_LEVEL) {
+        List *declarations = syntax->top_level->declarations;
+        for (int i = 0; i < list_length(declarations); i++) {
+            fold_statement(folding, list_get(declarations, i));
+        }
+
+    } else {
+        // An expression statement.
+        syntax = fold_expression(folding, syntax);
+
+        if (!syntax_has_side_effects(syntax)) {
+            return NULL;
+        }
+    }
+
+    return syntax;
+}
+
+/* Evaluate constant subexpressions at compile time, simplify
+ * arithmetic identities and remove if and while statements whose
+ * conditions are always false. This modifies SYNTAX, parsed from
+ * FILE_NAME, in place.
+ */
+Syntax *fold_constants(Syntax *syntax, char *file_name) {
+    Folding folding = {environment_new(), file_name};
+    Syntax *result = fold_statement(&folding, syntax);
+    environment_free(folding.env);
+    if (result == NULL) {
+        return syntax;
+    }
+
+    return result;
+}
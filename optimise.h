@@ -0,0 +1,10 @@
+#include "syntax.h"
+
+#ifndef BABYC_OPTIMISE_HEADER
+#define BABYC_OPTIMISE_HEADER
+
+Syntax *fold_constants(Syntax *syntax, char *file_name);
+
+bool syntax_has_side_effects(Syntax *syntax);
+
+#endif
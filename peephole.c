@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "peephole.h"
+#include "emitter.h"
+#include "assembly.h"
+
+/* A peephole optimiser over the assembly we've generated. Code
+ * generation works one node or IR instruction at a time, so it leaves
+ * redundant sequences at the boundaries, such as storing a value and
+ * immediately loading it again.
+ *
+ * We parse the text back into lines, slide a window over the
+ * instructions of each basic block, and apply the rules in
+ * peephole_rules until nothing changes.
+ */
+
+static bool is_mnemonic(AsmLine *line, char *mnemonic) {
+    return strcmp(line->mnemonic, mnemonic) == 0;
+}
+
+static bool is_move(AsmLine *line) {
+    return (is_mnemonic(line, "mov") || is_mnemonic(line, "movl")) &&
+           line->operand_count == 2;
+}
+
+static bool is_register(char *operand) { return operand[0] == '%'; }
+
+static bool is_immediate(char *operand) { return operand[0] == '$'; }
+
+static bool is_memory(char *operand) {
+    return !is_register(operand) && !is_immediate(operand);
+}
+
+static bool operands_equal(char *left, char *right) {
+    return strcmp(left, right) == 0;
+}
+
+/* Does this instruction transfer control, so nothing after it in the
+ * window is in the same basic block?
+ */
+static bool is_control_flow(AsmLine *line) {
+    return line->mnemonic[0] == 'j' || is_mnemonic(line, "ret") ||
+           is_mnemonic(line, "leave");
+}
+
+static bool is_stack_pointer(char *operand) {
+    return operands_equal(operand, "%esp") || operands_equal(operand, "%rsp");
+}
+
+/* Does this instruction read or change the stack pointer? A call
+ * pushes its return address, and the callee may rely on the stack's
+ * alignment at the call, so we never move an adjustment past one.
+ */
+static bool uses_stack_pointer(AsmLine *line) {
+    if (strncmp(line->mnemonic, "push", 4) == 0 ||
+        strncmp(line->mnemonic, "pop", 3) == 0 ||
+        strncmp(line->mnemonic, "call", 4) == 0 || is_control_flow(line)) {
+        return true;
+    }
+
+    for (int i = 0; i < line->operand_count; i++) {
+        if (strstr(line->operands[i], "%esp") != NULL ||
+            strstr(line->operands[i], "%rsp") != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Parse an immediate operand such as $8. */
+static bool immediate_value(char *operand, int *value) {
+    if (!is_immediate(operand)) {
+        return false;
+    }
+
+    char *end;
+    long parsed = strtol(operand + 1, &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
+
+    *value = (int)parsed;
+    return true;
+}
+
+/* Format VALUE as an immediate operand of LINE. */
+static char *immediate_operand(AsmLine *line, int value) {
+    snprintf(line->immediate, sizeof(line->immediate), "$%d", value);
+    return line->immediate;
+}
+
+/* mov %eax, -8(%ebp)
+ * mov -8(%ebp), %eax   <- already there, so delete it
+ */
+static bool rewrite_redundant_move(AsmLine **window, int count) {
+    (void)count;
+    AsmLine *first = window[0], *second = window[1];
+    if (!is_move(first) || !is_move(second)) {
+        return false;
+    }
+
+    char *source = first->operands[0], *dest = first->operands[1];
+    bool reversed = operands_equal(second->operands[0], dest) &&
+                    operands_equal(second->operands[1], source);
+    // Repeating the same move is redundant too, unless the first move
+    // changed a register that the source depends on.
+    bool repeated = operands_equal(second->operands[0], source) &&
+                    operands_equal(second->operands[1], dest) &&
+                    strstr(source, dest) == NULL;
+
+    if (reversed || repeated) {
+        second->deleted = true;
+        return true;
+    }
+    return false;
+}
+
+/* mov %eax, -8(%ebp)
+ * mov -8(%ebp), %ecx   =>   mov %eax, %ecx
+ */
+static bool rewrite_forward_store(AsmLine **window, int count) {
+    (void)count;
+    AsmLine *store = window[0], *load = window[1];
+    if (!is_move(store) || !is_move(load)) {
+        return false;
+    }
+
+    char *value = store->operands[0], *slot = store->operands[1];
+    if (!is_memory(slot) || is_memory(value) ||
+        !operands_equal(load->operands[0], slot) ||
+        !is_register(load->operands[1])) {
+        return false;
+    }
+
+    load->mnemonic = "mov";
+    load->operands[0] = value;
+    return true;
+}
+
+/* mov %ecx, %ecx   =>   (nothing) */
+static bool rewrite_self_move(AsmLine **window, int count) {
+    (void)count;
+    AsmLine *move = window[0];
+    if (!is_move(move) ||
+        !operands_equal(move->operands[0], move->operands[1])) {
+        return false;
+    }
+
+    move->deleted = true;
+    return true;
+}
+
+/* add $0, %ecx   =>   (nothing)
+ *
+ * This changes the flags, but we always set the flags immediately
+ * before using them.
+ */
+static bool rewrite_zero_arithmetic(AsmLine **window, int count) {
+    (void)count;
+    AsmLine *line = window[0];
+    if (!(is_mnemonic(line, "add") || is_mnemonic(line, "addl") ||
+          is_mnemonic(line, "sub") || is_mnemonic(line, "subl")) ||
+        line->operand_count != 2) {
+        return false;
+    }
+
+    int value;
+    if (!immediate_value(line->operands[0], &value) || value != 0) {
+        return false;
+    }
+
+    line->deleted = true;
+    return true;
+}
+
+typedef struct ConditionJump {
+    char *set_mnemonic;
+    // The jump taken when the condition is true, and when it's false.
+    char *jump_if_true;
+    char *jump_if_false;
+} ConditionJump;
+
+static ConditionJump condition_jumps[] = {
+    {"setl", "jl", "jge"}, {"setle", "jle", "jg"}, {"sete", "je", "jne"},
+    {"setz", "jz", "jnz"}, {"setg", "jg", "jle"},  {"setge", "jge", "jl"},
+    {"setne", "jne", "je"},
+};
+
+static const int CONDITION_JUMP_COUNT =
+    sizeof(condition_jumps) / sizeof(ConditionJump);
+
+/* setl   %al
+ * movzbl %al, %eax
+ * test   %eax, %eax
+ * jz     .if_end_1   =>   jge .if_end_1
+ *
+ * %eax is our scratch register (and the accumulator on the flat
+ * path), so its value isn't needed after a conditional jump.
+ */
+static bool rewrite_compare_branch(AsmLine **window, int count) {
+    (void)count;
+    AsmLine *set = window[0], *extend = window[1], *test = window[2],
+            *jump = window[3];
+
+    if (set->operand_count != 1 || !operands_equal(set->operands[0], "%al") ||
+        !is_mnemonic(extend, "movzbl") || extend->operand_count != 2 ||
+        !operands_equal(extend->operands[0], "%al") ||
+        !operands_equal(extend->operands[1], "%eax") ||
+        !is_mnemonic(test, "test") || test->operand_count != 2 ||
+        !operands_equal(test->operands[0], "%eax") ||
+        !operands_equal(test->operands[1], "%eax")) {
+        return false;
+    }
+
+    bool jump_if_zero = is_mnemonic(jump, "jz");
+    if (!jump_if_zero && !is_mnemonic(jump, "jnz")) {
+        return false;
+    }
+
+    for (int i = 0; i < CONDITION_JUMP_COUNT; i++) {
+        ConditionJump *condition = &condition_jumps[i];
+        if (is_mnemonic(set, condition->set_mnemonic)) {
+            // jz jumps when the condition was false.
+            jump->mnemonic = jump_if_zero ? condition->jump_if_false
+                                          : condition->jump_if_true;
+            set->deleted = true;
+            extend->deleted = true;
+            test->deleted = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* sub $4, %esp
+ * mov $1, %eax
+ * sub $4, %esp   =>   sub $8, %esp
+ *                     mov $1, %eax
+ *
+ * Reserving stack space earlier is always safe, provided nothing in
+ * between depends on %esp.
+ */
+static bool rewrite_merge_stack_adjust(AsmLine **window, int count) {
+    AsmLine *first = window[0];
+    int first_size;
+    if (!is_mnemonic(first, "sub") || first->operand_count != 2 ||
+        !is_stack_pointer(first->operands[1]) ||
+        !immediate_value(first->operands[0], &first_size)) {
+        return false;
+    }
+
+    for (int i = 1; i < count; i++) {
+        AsmLine *line = window[i];
+        int size;
+
+        if (is_mnemonic(line, "sub") && line->operand_count == 2 &&
+            operands_equal(line->operands[1], first->operands[1]) &&
+            immediate_value(line->operands[0], &size)) {
+            first->operands[0] = immediate_operand(first, first_size + size);
+            line->deleted = true;
+            return true;
+        }
+
+        if (uses_stack_pointer(line)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static PeepholeRule peephole_rules[] = {
+    {"redundant-move", 2, rewrite_redundant_move},
+    {"forward-store", 2, rewrite_forward_store},
+    {"self-move", 1, rewrite_self_move},
+    {"zero-arithmetic", 1, rewrite_zero_arithmetic},
+    {"compare-branch", 4, rewrite_compare_branch},
+    {"merge-stack-adjust", 2, rewrite_merge_stack_adjust},
+};
+
+_Static_assert(sizeof(peephole_rules) / sizeof(PeepholeRule) ==
+                   PEEPHOLE_RULE_COUNT,
+               "PEEPHOLE_RULE_COUNT must match peephole_rules");
+
+/* Split LINE, which must be writable, into an AsmLine. */
+static void parse_line(char *line, AsmLine *result) {
+    result->text = line;
+    result->mnemonic = NULL;
+    result->operand_count = 0;
+    result->deleted = false;
+
+    if (line[0] == '\0') {
+        result->kind = ASM_BLANK;
+        return;
+    }
+
+    if (line[0] != ' ') {
+        size_t length = strlen(line);
+        result->kind = line[length - 1] == ':' ? ASM_LABEL : ASM_OTHER;
+        return;
+    }
+
+    char *start = line;
+    while (*start == ' ') {
+        start++;
+    }
+    if (*start == '.' || *start == '\0') {
+        result->kind = ASM_OTHER;
+        return;
+    }
+
+    // We need the original text intact for directives, but for
+    // instructions we can split it in place.
+    result->kind = ASM_INSTRUCTION;
+    result->mnemonic = start;
+
+    char *end = start;
+    while (*end != ' ' && *end != '\0') {
+        end++;
+    }
+    if (*end == '\0') {
+        return;
+    }
+    *end = '\0';
+
+    char *operands = end + 1;
+    while (*operands == ' ') {
+        operands++;
+    }
+    if (*operands == '\0') {
+        return;
+    }
+
+    result->operands[0] = operands;
+    result->operand_count = 1;
+
+    char *separator = strstr(operands, ", ");
+    if (separator != NULL) {
+        *separator = '\0';
+        result->operands[1] = separator + 2;
+        result->operand_count = 2;
+    }
+}
+
+static void emit_line(Emitter *out, AsmLine *line) {
+    if (line->kind != ASM_INSTRUCTION) {
+        emit_string(out, line->text);
+    } else if (line->operand_count == 0) {
+        emit_bytes(out, "    ", 4);
+        emit_string(out, line->mnemonic);
+    } else {
+        emit_mnemonic(out, line->mnemonic);
+        emit_string(out, line->operands[0]);
+        if (line->operand_count == 2) {
+            emit_bytes(out, ", ", 2);
+            emit_string(out, line->operands[1]);
+        }
+    }
+    emit_bytes(out, "\n", 1);
+}
+
+/* Collect the instructions from LINES[START] onwards that are in the
+ * same basic block, skipping blank and deleted lines.
+ */
+static int fill_window(AsmLine *lines, int line_count, int start,
+                       AsmLine **window) {
+    int count = 0;
+    for (int i = start; i < line_count && count < PEEPHOLE_MAX_WINDOW; i++) {
+        AsmLine *line = &lines[i];
+        if (line->kind == ASM_BLANK || line->deleted) {
+            continue;
+        }
+        if (line->kind != ASM_INSTRUCTION) {
+            break;
+        }
+
+        window[count++] = line;
+        if (is_control_flow(line)) {
+            break;
+        }
+    }
+    return count;
+}
+
+/* Optimise the assembly in TEXT (LENGTH bytes, ending with a
+ * newline) and write the result to OUT, counting the rules that fired
+ * in STATS.
+ */
+void peephole_optimise(char *text, size_t length, Emitter *out,
+                       PeepholeStats *stats) {
+    char *copy = malloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    int line_count = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (copy[i] == '\n') {
+            line_count++;
+        }
+    }
+
+    AsmLine *lines = malloc(line_count * sizeof(AsmLine));
+    char *line_start = copy;
+    for (int i = 0; i < line_count; i++) {
+        char *newline = strchr(line_start, '\n');
+        *newline = '\0';
+        parse_line(line_start, &lines[i]);
+        line_start = newline + 1;
+    }
+
+    AsmLine *window[PEEPHOLE_MAX_WINDOW];
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 0; i < line_count; i++) {
+            if (lines[i].kind != ASM_INSTRUCTION || lines[i].deleted) {
+                continue;
+            }
+
+            // Apply rules at this position until none match, so each
+            // rewrite can enable another.
+            bool rewritten = true;
+            while (rewritten && !lines[i].deleted) {
+                rewritten = false;
+                int count = fill_window(lines, line_count, i, window);
+
+                for (int j = 0; j < PEEPHOLE_RULE_COUNT; j++) {
+                    PeepholeRule *rule = &peephole_rules[j];
+                    if (count >= rule->window_size &&
+                        rule->rewrite(window, count)) {
+                        stats->hits[j]++;
+                        rewritten = true;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < line_count; i++) {
+        if (!lines[i].deleted) {
+            emit_line(out, &lines[i]);
+        }
+    }
+
+    free(lines);
+    free(copy);
+}
+
+/* Print how often each rule fired, across every call to
+ * peephole_optimise with STATS.
+ */
+void print_peephole_stats(PeepholeStats *stats) {
+    for (int i = 0; i < PEEPHOLE_RULE_COUNT; i++) {
+        printf("%-20s %d\n", peephole_rules[i].name, stats->hits[i]);
+    }
+}
@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include "emitter.h"
+
+#ifndef BABYC_PEEPHOLE_HEADER
+#define BABYC_PEEPHOLE_HEADER
+
+typedef enum {
+    ASM_INSTRUCTION,
+    ASM_LABEL,
+    // Directives and anything else we don't understand.
+    ASM_OTHER,
+    ASM_BLANK,
+} AsmLineKind;
+
+/* One line of assembly. Instructions are split into their mnemonic
+ * and operands, so rules can match on them.
+ */
+typedef struct AsmLine {
+    AsmLineKind kind;
+    // The whole line, for lines that aren't instructions.
+    char *text;
+    char *mnemonic;
+    char *operands[2];
+    int operand_count;
+    bool deleted;
+    // Room for an immediate operand that a rule computes, so rules
+    // don't allocate.
+    char immediate[16];
+} AsmLine;
+
+#define PEEPHOLE_MAX_WINDOW 32
+
+/* A peephole rule looks at a window of consecutive instructions within
+ * a basic block, and returns true if it rewrote them. WINDOW[0] is
+ * always present, and COUNT is at least the rule's window_size.
+ */
+typedef bool (*PeepholeRewrite)(AsmLine **window, int count);
+
+typedef struct PeepholeRule {
+    char *name;
+    int window_size;
+    PeepholeRewrite rewrite;
+} PeepholeRule;
+
+#define PEEPHOLE_RULE_COUNT 6
+
+/* How many times each rule has fired, in the order of peephole_rules.
+ * Each compilation keeps its own.
+ */
+typedef struct PeepholeStats {
+    int hits[PEEPHOLE_RULE_COUNT];
+} PeepholeStats;
+
+void peephole_optimise(char *text, size_t length, Emitter *out,
+                       PeepholeStats *stats);
+
+void print_peephole_stats(PeepholeStats *stats);
+
+#endif
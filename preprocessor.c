@@ -0,0 +1,1308 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include "preprocessor.h"
+#include "arena.h"
+#include "list.h"
+#include "intern.h"
+#include "source.h"
+#include "errors.h"
+
+/* A preprocessor for the subset of C that babyc compiles: #include,
+ * object-like and function-like macros (with # and ##), #undef, and
+ * #if, #ifdef, #ifndef, #elif, #else and #endif.
+ *
+ * We split each file into logical lines of tokens once, and keep them
+ * until we're done, so including a header again doesn't read or
+ * tokenise it again. A header wrapped in an include guard, or marked
+ * with #pragma once, isn't even looked at again.
+ *
+ * That cache only lasts for one call to preprocess, i.e. one
+ * translation unit, even when `babyc -j` compiles many files that
+ * include the same headers. Identifier tokens are interned in the
+ * compilation's own Interner, and macros are looked up by those
+ * pointers, so sharing tokens between compilations would need a
+ * shared, locked interner.
+ *
+ * Text lines between directives are macro expanded together, so an
+ * invocation may span lines. A macro isn't expanded within its own
+ * expansion. Unlike a full C preprocessor, a function-like macro at
+ * the end of an expansion can't take its arguments from the text that
+ * follows the expansion.
+ */
+
+#define MAX_INCLUDE_DEPTH 200
+#define INITIAL_MACRO_CAPACITY 64
+#define INITIAL_TOKEN_CAPACITY 64
+#define INITIAL_OUTPUT_CAPACITY 4096
+
+typedef enum {
+    PP_IDENTIFIER,
+    PP_NUMBER,
+    // String and character literals.
+    PP_STRING,
+    // <foo.h> after #include.
+    PP_HEADER_NAME,
+    PP_PUNCTUATOR,
+    // A string, character or header name without its closing quote,
+    // which runs to the end of the line. That's only an error outside
+    // skipped groups, as text such as `#if 0 ... don't ... #endif`
+    // must still lex.
+    PP_UNTERMINATED,
+} PpTokenKind;
+
+typedef struct PpToken {
+    PpTokenKind kind;
+    // Identifiers are interned, and so are terminated. Other tokens
+    // point into their file, or into the arena if we made them by
+    // pasting or stringifying.
+    char *text;
+    int length;
+    // Whether whitespace came before this token. We keep it, so that
+    // tokens stay apart in the output.
+    bool space_before;
+    // The first token on a source line.
+    bool line_start;
+} PpToken;
+
+typedef struct PpLine {
+    PpToken *tokens;
+    int token_count;
+    // For error messages.
+    int number;
+    // The first PP_UNTERMINATED token on the line, or NULL.
+    PpToken *unterminated;
+} PpLine;
+
+typedef struct SourceFile {
+    char *path;
+    // Tokens other than identifiers point into the mapped file.
+    SourceBuffer *source;
+    PpLine *lines;
+    int line_count;
+    // If the whole file is inside `#ifndef GUARD`, the interned GUARD.
+    char *guard;
+    // Set by #pragma once.
+    bool once;
+    bool included;
+} SourceFile;
+
+typedef struct Macro {
+    char *name;
+    // False after #undef.
+    bool defined;
+    bool function_like;
+    bool variadic;
+    // Interned. A variadic macro's last parameter is __VA_ARGS__.
+    char **parameters;
+    int parameter_count;
+    PpToken *body;
+    int body_count;
+    // Set while we expand this macro, so it doesn't expand itself.
+    bool expanding;
+} Macro;
+
+typedef struct TokenBuffer {
+    PpToken *tokens;
+    int count;
+    int capacity;
+} TokenBuffer;
+
+typedef struct Preprocessor {
+    // Files, lines, tokens and macros, which we keep until we're done.
+    Arena *arena;
+    // Where we intern identifiers, shared with the parser.
+    Interner *names;
+    List *include_paths;
+    // Every file we've read.
+    List *files;
+    // Open addressing on the interned name, with linear probing.
+    Macro **macros;
+    size_t macro_capacity;
+    size_t macro_count;
+    // Text lines that we haven't expanded and written yet.
+    TokenBuffer pending;
+    int include_depth;
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+} Preprocessor;
+
+/* Where we are, for error messages. */
+typedef struct Location {
+    SourceFile *file;
+    int line;
+} Location;
+
+static void token_buffer_append(TokenBuffer *buffer, PpToken token) {
+    if (buffer->count == buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? INITIAL_TOKEN_CAPACITY
+                                                 : buffer->capacity * 2;
+        buffer->tokens =
+            realloc(buffer->tokens, buffer->capacity * sizeof(PpToken));
+    }
+    buffer->tokens[buffer->count++] = token;
+}
+
+static bool token_equals(PpToken *token, char *text) {
+    return strncmp(token->text, text, token->length) == 0 &&
+           text[token->length] == '\0';
+}
+
+static bool is_punctuator(PpToken *token, char *text) {
+    return token->kind == PP_PUNCTUATOR && token_equals(token, text);
+}
+
+static bool is_identifier(PpToken *token, char *name) {
+    return token->kind == PP_IDENTIFIER && token_equals(token, name);
+}
+
+/* The name of the directive on LINE, e.g. "define", or NULL if it
+ * isn't a directive.
+ */
+static char *directive_name(PpLine *line) {
+    if (line->token_count == 0 || !is_punctuator(&line->tokens[0], "#")) {
+        return NULL;
+    }
+    if (line->token_count == 1 || line->tokens[1].kind != PP_IDENTIFIER) {
+        // A null directive, or something we'll complain about later.
+        return "";
+    }
+    return line->tokens[1].text;
+}
+
+/* The length of the punctuator at P, such as <<= or ##. */
+static int punctuator_length(char *p) {
+    char first = p[0], second = p[1];
+    if ((first == '<' || first == '>') && second == first) {
+        return p[2] == '=' ? 3 : 2;
+    }
+    if (first == '.' && second == '.' && p[2] == '.') {
+        return 3;
+    }
+    if (second == '=' && strchr("<>=!+-*/%&|^", first) != NULL) {
+        return 2;
+    }
+    if (second == first && strchr("#&|+-", first) != NULL) {
+        return 2;
+    }
+    if (first == '-' && second == '>') {
+        return 2;
+    }
+    return 1;
+}
+
+/* Skip whitespace, comments and escaped newlines from P, but not the
+ * end of the line. Newlines inside comments and escaped newlines
+ * don't end the logical line, but still count towards LINE_NUMBER.
+ */
+static char *skip_space(char *p, char *path, int *line_number) {
+    while (true) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' ||
+            *p == '\v') {
+            p++;
+        } else if (p[0] == '\\' && p[1] == '\n') {
+            p += 2;
+            (*line_number)++;
+        } else if (p[0] == '/' && p[1] == '/') {
+            while (*p != '\n' && *p != '\0') {
+                p++;
+            }
+        } else if (p[0] == '/' && p[1] == '*') {
+            char *end = strstr(p + 2, "*/");
+            if (end == NULL) {
+                compile_error("%s:%d: unterminated comment", path,
+                              *line_number);
+            }
+            for (; p < end; p++) {
+                if (*p == '\n') {
+                    (*line_number)++;
+                }
+            }
+            p = end + 2;
+        } else {
+            return p;
+        }
+    }
+}
+
+/* Read the token at P into TOKEN, returning the position after it.
+ * AFTER_INCLUDE is set when the token follows `#include`, where
+ * <foo.h> is a single token.
+ */
+static char *lex_token(Preprocessor *pp, char *p, PpToken *token,
+                       bool after_include) {
+    char *start = p;
+
+    if (isalpha((unsigned char)*p) || *p == '_') {
+        while (isalnum((unsigned char)*p) || *p == '_') {
+            p++;
+        }
+        token->kind = PP_IDENTIFIER;
+        token->text = intern(pp->names, start, p - start);
+        token->length = p - start;
+        return p;
+    }
+
+    if (isdigit((unsigned char)*p) ||
+        (*p == '.' && isdigit((unsigned char)p[1]))) {
+        // A preprocessing number, which includes suffixes and
+        // exponents such as 1e+5.
+        while (isalnum((unsigned char)*p) || *p == '_' || *p == '.' ||
+               ((*p == '+' || *p == '-') && strchr("eEpP", p[-1]))) {
+            p++;
+        }
+        token->kind = PP_NUMBER;
+    } else if (*p == '"' || *p == '\'' || (*p == '<' && after_include)) {
+        char close = *p == '<' ? '>' : *p;
+        p++;
+        while (*p != close && *p != '\n' && *p != '\0') {
+            if (*p == '\\' && close != '>' && p[1] != '\0') {
+                p++;
+            }
+            p++;
+        }
+
+        if (*p == close) {
+            p++;
+            token->kind = *start == '<' ? PP_HEADER_NAME : PP_STRING;
+        } else {
+            token->kind = PP_UNTERMINATED;
+        }
+    } else {
+        token->kind = PP_PUNCTUATOR;
+        p += punctuator_length(p);
+    }
+
+    token->text = start;
+    token->length = p - start;
+    return p;
+}
+
+/* If FILE is entirely inside #ifndef GUARD ... #endif, record GUARD,
+ * so we can skip the file when GUARD is defined.
+ */
+static void find_include_guard(SourceFile *file) {
+    if (file->line_count < 2) {
+        return;
+    }
+
+    PpLine *first = &file->lines[0];
+    char *name = directive_name(first);
+    if (name == NULL || strcmp(name, "ifndef") != 0 ||
+        first->token_count != 3 || first->tokens[2].kind != PP_IDENTIFIER) {
+        return;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < file->line_count; i++) {
+        name = directive_name(&file->lines[i]);
+        if (name == NULL) {
+            continue;
+        }
+
+        if (strcmp(name, "if") == 0 || strcmp(name, "ifdef") == 0 ||
+            strcmp(name, "ifndef") == 0) {
+            depth++;
+        } else if (depth == 1 &&
+                   (strcmp(name, "else") == 0 || strcmp(name, "elif") == 0)) {
+            return;
+        } else if (strcmp(name, "endif") == 0) {
+            depth--;
+            if (depth == 0 && i != file->line_count - 1) {
+                return;
+            }
+        }
+    }
+
+    file->guard = first->tokens[2].text;
+}
+
+/* Split TEXT into lines of tokens. */
+static void lex_file(Preprocessor *pp, SourceFile *file, char *text) {
+    int max_lines = 1;
+    for (char *c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            max_lines++;
+        }
+    }
+    file->lines = arena_alloc(pp->arena, max_lines * sizeof(PpLine));
+    file->line_count = 0;
+
+    TokenBuffer tokens = {NULL, 0, 0};
+    char *p = text;
+    int line_number = 1;
+    while (*p != '\0') {
+        int first_line_number = line_number;
+        tokens.count = 0;
+
+        while (true) {
+            char *start = skip_space(p, file->path, &line_number);
+            bool space_before = start != p;
+            p = start;
+            if (*p == '\n' || *p == '\0') {
+                break;
+            }
+
+            bool after_include =
+                tokens.count == 2 && is_punctuator(&tokens.tokens[0], "#") &&
+                is_identifier(&tokens.tokens[1], "include");
+
+            PpToken token;
+            p = lex_token(pp, p, &token, after_include);
+            token.space_before = space_before || tokens.count == 0;
+            token.line_start = tokens.count == 0;
+            token_buffer_append(&tokens, token);
+        }
+        if (*p == '\n') {
+            p++;
+            line_number++;
+        }
+
+        if (tokens.count > 0) {
+            PpLine *line = &file->lines[file->line_count++];
+            line->number = first_line_number;
+            line->token_count = tokens.count;
+            line->tokens =
+                arena_alloc(pp->arena, tokens.count * sizeof(PpToken));
+            memcpy(line->tokens, tokens.tokens, tokens.count * sizeof(PpToken));
+
+            line->unterminated = NULL;
+            for (int i = 0; i < tokens.count; i++) {
+                if (line->tokens[i].kind == PP_UNTERMINATED) {
+                    line->unterminated = &line->tokens[i];
+                    break;
+                }
+            }
+        }
+    }
+    free(tokens.tokens);
+
+    find_include_guard(file);
+}
+
+/* Find the file at PATH, reading it if we haven't already. Returns
+ * NULL if there's no such file.
+ */
+static SourceFile *load_file(Preprocessor *pp, char *path) {
+    for (int i = 0; i < list_length(pp->files); i++) {
+        SourceFile *file = list_get(pp->files, i);
+        if (strcmp(file->path, path) == 0) {
+            return file;
+        }
+    }
+
+    SourceBuffer *source = source_map(path);
+    if (source == NULL) {
+        return NULL;
+    }
+
+    SourceFile *file = arena_alloc(pp->arena, sizeof(SourceFile));
+    file->path = arena_strdup(pp->arena, path);
+    file->guard = NULL;
+    file->once = false;
+    file->included = false;
+    file->source = source;
+
+    lex_file(pp, file, source->text);
+    list_append(pp->files, file);
+    return file;
+}
+
+static size_t macro_slot(Preprocessor *pp, char *name) {
+    // Names are interned, so we can hash the pointer.
+    size_t slot = ((size_t)name >> 3) & (pp->macro_capacity - 1);
+    while (pp->macros[slot] != NULL && pp->macros[slot]->name != name) {
+        slot = (slot + 1) & (pp->macro_capacity - 1);
+    }
+    return slot;
+}
+
+static Macro *find_macro(Preprocessor *pp, char *name) {
+    Macro *macro = pp->macros[macro_slot(pp, name)];
+    if (macro == NULL || !macro->defined) {
+        return NULL;
+    }
+    return macro;
+}
+
+/* The macro called NAME, creating an undefined one if needed. */
+static Macro *macro_entry(Preprocessor *pp, char *name) {
+    if (2 * (pp->macro_count + 1) > pp->macro_capacity) {
+        Macro **old_macros = pp->macros;
+        size_t old_capacity = pp->macro_capacity;
+
+        pp->macro_capacity *= 2;
+        pp->macros = calloc(pp->macro_capacity, sizeof(Macro *));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_macros[i] != NULL) {
+                pp->macros[macro_slot(pp, old_macros[i]->name)] = old_macros[i];
+            }
+        }
+        free(old_macros);
+    }
+
+    size_t slot = macro_slot(pp, name);
+    if (pp->macros[slot] == NULL) {
+        Macro *macro = arena_alloc(pp->arena, sizeof(Macro));
+        memset(macro, 0, sizeof(Macro));
+        macro->name = name;
+        pp->macros[slot] = macro;
+        pp->macro_count++;
+    }
+    return pp->macros[slot];
+}
+
+static void define_macro(Preprocessor *pp, PpLine *line, Location location) {
+    if (line->token_count < 3 || line->tokens[2].kind != PP_IDENTIFIER) {
+        compile_error("%s:%d: macro names must be identifiers",
+                      location.file->path, location.line);
+    }
+
+    Macro *macro = macro_entry(pp, line->tokens[2].text);
+    macro->defined = true;
+    macro->function_like = false;
+    macro->variadic = false;
+    macro->parameter_count = 0;
+
+    int body_start = 3;
+    if (line->token_count > 3 && is_punctuator(&line->tokens[3], "(") &&
+        !line->tokens[3].space_before) {
+        macro->function_like = true;
+        macro->parameters =
+            arena_alloc(pp->arena, line->token_count * sizeof(char *));
+
+        int i = 4;
+        while (i < line->token_count && !is_punctuator(&line->tokens[i], ")")) {
+            PpToken *parameter = &line->tokens[i];
+            if (is_punctuator(parameter, "...")) {
+                macro->variadic = true;
+                macro->parameters[macro->parameter_count++] =
+                    intern_string(pp->names, "__VA_ARGS__");
+            } else if (parameter->kind == PP_IDENTIFIER && !macro->variadic) {
+                macro->parameters[macro->parameter_count++] = parameter->text;
+            } else {
+                compile_error("%s:%d: expected a parameter name in macro %s",
+                              location.file->path, location.line, macro->name);
+            }
+
+            i++;
+            if (i < line->token_count && is_punctuator(&line->tokens[i], ",")) {
+                i++;
+            }
+        }
+        if (i == line->token_count) {
+            compile_error("%s:%d: missing ')' in macro parameter list",
+                          location.file->path, location.line);
+        }
+        body_start = i + 1;
+    }
+
+    macro->body = line->tokens + body_start;
+    macro->body_count = line->token_count - body_start;
+}
+
+static void output_bytes(Preprocessor *pp, char *bytes, size_t length) {
+    // Leave room for the two NULs that a SourceBuffer ends with.
+    while (pp->output_length + length + 2 > pp->output_capacity) {
+        pp->output_capacity *= 2;
+        pp->output = realloc(pp->output, pp->output_capacity);
+    }
+    memcpy(pp->output + pp->output_length, bytes, length);
+    pp->output_length += length;
+}
+
+static void output_token(Preprocessor *pp, PpToken *token) {
+    if (token->line_start) {
+        if (pp->output_length > 0) {
+            output_bytes(pp, "\n", 1);
+        }
+    } else if (token->space_before) {
+        output_bytes(pp, " ", 1);
+    }
+    output_bytes(pp, token->text, token->length);
+}
+
+static void expand(Preprocessor *pp, PpToken *tokens, int count,
+                   TokenBuffer *out, Location location);
+
+static int parameter_index(Macro *macro, PpToken *token) {
+    if (token->kind != PP_IDENTIFIER) {
+        return -1;
+    }
+    for (int i = 0; i < macro->parameter_count; i++) {
+        if (macro->parameters[i] == token->text) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Turn the tokens of an argument into a string literal, for #. */
+static PpToken stringify(Preprocessor *pp, PpToken *tokens, int count) {
+    size_t length = 2;
+    for (int i = 0; i < count; i++) {
+        length += 2 * tokens[i].length + 1;
+    }
+
+    char *text = arena_alloc(pp->arena, length + 1);
+    char *p = text;
+    *p++ = '"';
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && tokens[i].space_before) {
+            *p++ = ' ';
+        }
+        for (int j = 0; j < tokens[i].length; j++) {
+            char c = tokens[i].text[j];
+            if (tokens[i].kind == PP_STRING && (c == '"' || c == '\\')) {
+                *p++ = '\\';
+            }
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    *p = '\0';
+
+    PpToken token = {PP_STRING, text, p - text, true, false};
+    return token;
+}
+
+/* Join LEFT and RIGHT into one token, for ##. */
+static PpToken paste(Preprocessor *pp, PpToken *left, PpToken *right) {
+    int length = left->length + right->length;
+    char *text = arena_alloc(pp->arena, length + 1);
+    memcpy(text, left->text, left->length);
+    memcpy(text + left->length, right->text, right->length);
+    text[length] = '\0';
+
+    PpToken token = *left;
+    token.text = text;
+    token.length = length;
+    if (isalpha((unsigned char)text[0]) || text[0] == '_') {
+        token.kind = PP_IDENTIFIER;
+        token.text = intern(pp->names, text, length);
+    } else if (isdigit((unsigned char)text[0])) {
+        token.kind = PP_NUMBER;
+    }
+    return token;
+}
+
+/* Replace the parameters in MACRO's body with ARGUMENTS, where
+ * ARGUMENTS[i] starts at tokens[starts[i]] and ends before
+ * tokens[ends[i]].
+ */
+static void substitute(Preprocessor *pp, Macro *macro, PpToken *tokens,
+                       int *starts, int *ends, TokenBuffer *out,
+                       Location location) {
+    for (int i = 0; i < macro->body_count; i++) {
+        PpToken *token = &macro->body[i];
+
+        if (is_punctuator(token, "#") && i + 1 < macro->body_count &&
+            parameter_index(macro, &macro->body[i + 1]) >= 0) {
+            int parameter = parameter_index(macro, &macro->body[i + 1]);
+            PpToken string =
+                stringify(pp, tokens + starts[parameter],
+                          ends[parameter] - starts[parameter]);
+            string.space_before = token->space_before;
+            token_buffer_append(out, string);
+            i++;
+            continue;
+        }
+
+        if (is_punctuator(token, "##") && out->count > 0 &&
+            i + 1 < macro->body_count) {
+            PpToken *right = &macro->body[i + 1];
+            int parameter = parameter_index(macro, right);
+            int right_count = 1;
+            if (parameter >= 0) {
+                right = tokens + starts[parameter];
+                right_count = ends[parameter] - starts[parameter];
+            }
+
+            // Pasting an empty argument leaves the left side alone.
+            if (right_count > 0) {
+                PpToken *left = &out->tokens[out->count - 1];
+                *left = paste(pp, left, right);
+                for (int j = 1; j < right_count; j++) {
+                    token_buffer_append(out, right[j]);
+                }
+            }
+            i++;
+            continue;
+        }
+
+        int parameter = parameter_index(macro, token);
+        if (parameter < 0) {
+            token_buffer_append(out, *token);
+            continue;
+        }
+
+        PpToken *argument = tokens + starts[parameter];
+        int argument_count = ends[parameter] - starts[parameter];
+        int first = out->count;
+        if (i + 1 < macro->body_count &&
+            is_punctuator(&macro->body[i + 1], "##")) {
+            // Operands of ## aren't expanded.
+            for (int j = 0; j < argument_count; j++) {
+                token_buffer_append(out, argument[j]);
+            }
+        } else {
+            expand(pp, argument, argument_count, out, location);
+        }
+        if (out->count > first) {
+            out->tokens[first].space_before = token->space_before;
+            out->tokens[first].line_start = false;
+        }
+    }
+}
+
+/* Expand the function-like MACRO, whose name is at TOKENS[0] and which
+ * must be followed by its arguments. Returns the number of tokens
+ * used, or 0 if there's no argument list, in which case the name
+ * isn't an invocation.
+ */
+static int expand_invocation(Preprocessor *pp, Macro *macro, PpToken *tokens,
+                             int count, TokenBuffer *out, Location location) {
+    if (count < 2 || !is_punctuator(&tokens[1], "(")) {
+        return 0;
+    }
+
+    int slots = macro->parameter_count + 1;
+    int *starts = malloc(slots * sizeof(int));
+    int *ends = malloc(slots * sizeof(int));
+    int argument_count = 0;
+
+    int depth = 0;
+    int i = 2;
+    starts[0] = i;
+    for (; i < count; i++) {
+        PpToken *token = &tokens[i];
+        if (is_punctuator(token, "(")) {
+            depth++;
+        } else if (is_punctuator(token, ")")) {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        } else if (is_punctuator(token, ",") && depth == 0) {
+            // The variadic argument swallows any remaining commas.
+            bool last = macro->variadic &&
+                        argument_count == macro->parameter_count - 1;
+            if (!last) {
+                if (argument_count + 1 >= slots) {
+                    compile_error("%s:%d: too many arguments to macro %s",
+                                  location.file->path, location.line,
+                                  macro->name);
+                }
+                ends[argument_count++] = i;
+                starts[argument_count] = i + 1;
+            }
+        }
+    }
+    if (i == count) {
+        compile_error("%s:%d: unterminated argument list invoking macro %s",
+                      location.file->path, location.line, macro->name);
+    }
+    ends[argument_count++] = i;
+
+    // F() passes no arguments, rather than one empty one.
+    if (macro->parameter_count == 0 && argument_count == 1 &&
+        starts[0] == ends[0]) {
+        argument_count = 0;
+    }
+    // A variadic macro may be given no variadic arguments.
+    if (macro->variadic && argument_count == macro->parameter_count - 1) {
+        starts[argument_count] = ends[argument_count] = i;
+        argument_count++;
+    }
+    if (argument_count != macro->parameter_count) {
+        compile_error("%s:%d: macro %s takes %d arguments, but was given %d",
+                      location.file->path, location.line, macro->name,
+                      macro->parameter_count, argument_count);
+    }
+
+    TokenBuffer substituted = {NULL, 0, 0};
+    substitute(pp, macro, tokens, starts, ends, &substituted, location);
+    free(starts);
+    free(ends);
+
+    int first = out->count;
+    macro->expanding = true;
+    expand(pp, substituted.tokens, substituted.count, out, location);
+    macro->expanding = false;
+    free(substituted.tokens);
+
+    if (out->count > first) {
+        out->tokens[first].space_before = tokens[0].space_before;
+        out->tokens[first].line_start = tokens[0].line_start;
+    }
+    return i + 1;
+}
+
+/* Macro expand COUNT TOKENS, appending the result to OUT. */
+static void expand(Preprocessor *pp, PpToken *tokens, int count,
+                   TokenBuffer *out, Location location) {
+    for (int i = 0; i < count; i++) {
+        PpToken *token = &tokens[i];
+        Macro *macro = NULL;
+        if (token->kind == PP_IDENTIFIER) {
+            macro = find_macro(pp, token->text);
+        }
+
+        if (macro == NULL || macro->expanding) {
+            token_buffer_append(out, *token);
+            continue;
+        }
+
+        if (macro->function_like) {
+            int used = expand_invocation(pp, macro, tokens + i, count - i, out,
+                                         location);
+            if (used == 0) {
+                token_buffer_append(out, *token);
+            } else {
+                i += used - 1;
+            }
+            continue;
+        }
+
+        int first = out->count;
+        macro->expanding = true;
+        expand(pp, macro->body, macro->body_count, out, location);
+        macro->expanding = false;
+
+        if (out->count > first) {
+            out->tokens[first].space_before = token->space_before;
+            out->tokens[first].line_start = token->line_start;
+        }
+    }
+}
+
+/* Expand and write the text lines since the last directive. */
+static void flush_pending(Preprocessor *pp, Location location) {
+    if (pp->pending.count == 0) {
+        return;
+    }
+
+    TokenBuffer expanded = {NULL, 0, 0};
+    expand(pp, pp->pending.tokens, pp->pending.count, &expanded, location);
+    for (int i = 0; i < expanded.count; i++) {
+        output_token(pp, &expanded.tokens[i]);
+    }
+    free(expanded.tokens);
+    pp->pending.count = 0;
+}
+
+/* Evaluating #if expressions. Values are 64 bit, and we wrap rather
+ * than overflow. LIVE is false in the operands that && || and ?: skip,
+ * where we don't complain about dividing by zero.
+ */
+typedef struct Expression {
+    PpToken *tokens;
+    int count;
+    int position;
+    Location location;
+} Expression;
+
+static long long evaluate(Expression *e, bool live);
+
+static PpToken *peek_token(Expression *e) {
+    if (e->position == e->count) {
+        return NULL;
+    }
+    return &e->tokens[e->position];
+}
+
+static bool accept(Expression *e, char *punctuator) {
+    PpToken *token = peek_token(e);
+    if (token != NULL && is_punctuator(token, punctuator)) {
+        e->position++;
+        return true;
+    }
+    return false;
+}
+
+static void expression_error(Expression *e, char *message) {
+    compile_error("%s:%d: %s in #if", e->location.file->path, e->location.line,
+                  message);
+}
+
+static long long character_value(PpToken *token) {
+    char *c = token->text + 1;
+    if (*c != '\\') {
+        return *c;
+    }
+
+    switch (c[1]) {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case '0':
+        return 0;
+    default:
+        return c[1];
+    }
+}
+
+static long long evaluate_unary(Expression *e, bool live) {
+    PpToken *token = peek_token(e);
+    if (token == NULL) {
+        expression_error(e, "missing operand");
+    }
+    e->position++;
+
+    if (token->kind == PP_NUMBER) {
+        char *end;
+        unsigned long long value = strtoull(token->text, &end, 0);
+        while (end < token->text + token->length &&
+               strchr("uUlL", *end) != NULL) {
+            end++;
+        }
+        if (end != token->text + token->length) {
+            expression_error(e, "invalid integer");
+        }
+        return (long long)value;
+    }
+    if (token->kind == PP_STRING && token->text[0] == '\'') {
+        return character_value(token);
+    }
+    if (token->kind == PP_IDENTIFIER) {
+        // Anything left after macro expansion is 0.
+        return 0;
+    }
+
+    if (is_punctuator(token, "(")) {
+        long long value = evaluate(e, live);
+        if (!accept(e, ")")) {
+            expression_error(e, "missing ')'");
+        }
+        return value;
+    }
+    if (is_punctuator(token, "!")) {
+        return !evaluate_unary(e, live);
+    }
+    if (is_punctuator(token, "~")) {
+        return ~evaluate_unary(e, live);
+    }
+    if (is_punctuator(token, "-")) {
+        return (long long)(0ULL - (unsigned long long)evaluate_unary(e, live));
+    }
+    if (is_punctuator(token, "+")) {
+        return evaluate_unary(e, live);
+    }
+
+    expression_error(e, "unexpected token");
+    return 0;
+}
+
+typedef struct BinaryOperator {
+    char *text;
+    int precedence;
+} BinaryOperator;
+
+static BinaryOperator binary_operators[] = {
+    {"*", 10},  {"/", 10}, {"%", 10}, {"+", 9},  {"-", 9},  {"<<", 8},
+    {">>", 8},  {"<", 7},  {"<=", 7}, {">", 7},  {">=", 7}, {"==", 6},
+    {"!=", 6},  {"&", 5},  {"^", 4},  {"|", 3},  {"&&", 2}, {"||", 1},
+    {NULL, 0},
+};
+
+static BinaryOperator *peek_binary_operator(Expression *e) {
+    PpToken *token = peek_token(e);
+    if (token == NULL || token->kind != PP_PUNCTUATOR) {
+        return NULL;
+    }
+    for (int i = 0; binary_operators[i].text != NULL; i++) {
+        if (token_equals(token, binary_operators[i].text)) {
+            return &binary_operators[i];
+        }
+    }
+    return NULL;
+}
+
+static long long apply_binary(Expression *e, char *op, long long left,
+                              long long right, bool live) {
+    unsigned long long u_left = left, u_right = right;
+
+    if (strcmp(op, "*") == 0) {
+        return (long long)(u_left * u_right);
+    } else if (strcmp(op, "/") == 0 || strcmp(op, "%") == 0) {
+        if (right == 0) {
+            if (live) {
+                expression_error(e, "division by zero");
+            }
+            return 0;
+        }
+        if (right == -1) {
+            // Avoid overflowing on LLONG_MIN / -1.
+            return op[0] == '/' ? (long long)(0ULL - u_left) : 0;
+        }
+        return op[0] == '/' ? left / right : left % right;
+    } else if (strcmp(op, "+") == 0) {
+        return (long long)(u_left + u_right);
+    } else if (strcmp(op, "-") == 0) {
+        return (long long)(u_left - u_right);
+    } else if (strcmp(op, "<<") == 0) {
+        return (long long)(u_left << (u_right & 63));
+    } else if (strcmp(op, ">>") == 0) {
+        return left >> (u_right & 63);
+    } else if (strcmp(op, "<") == 0) {
+        return left < right;
+    } else if (strcmp(op, "<=") == 0) {
+        return left <= right;
+    } else if (strcmp(op, ">") == 0) {
+        return left > right;
+    } else if (strcmp(op, ">=") == 0) {
+        return left >= right;
+    } else if (strcmp(op, "==") == 0) {
+        return left == right;
+    } else if (strcmp(op, "!=") == 0) {
+        return left != right;
+    } else if (strcmp(op, "&") == 0) {
+        return left & right;
+    } else if (strcmp(op, "^") == 0) {
+        return left ^ right;
+    } else if (strcmp(op, "|") == 0) {
+        return left | right;
+    } else if (strcmp(op, "&&") == 0) {
+        return left && right;
+    }
+    return left || right;
+}
+
+/* Precedence climbing: evaluate operators of at least MIN_PRECEDENCE. */
+static long long evaluate_binary(Expression *e, int min_precedence,
+                                 bool live) {
+    long long left = evaluate_unary(e, live);
+
+    BinaryOperator *op;
+    while ((op = peek_binary_operator(e)) != NULL &&
+           op->precedence >= min_precedence) {
+        e->position++;
+
+        bool right_live = live;
+        if (strcmp(op->text, "&&") == 0) {
+            right_live = live && left;
+        } else if (strcmp(op->text, "||") == 0) {
+            right_live = live && !left;
+        }
+
+        long long right = evaluate_binary(e, op->precedence + 1, right_live);
+        left = apply_binary(e, op->text, left, right, right_live);
+    }
+    return left;
+}
+
+static long long evaluate(Expression *e, bool live) {
+    long long condition = evaluate_binary(e, 1, live);
+    if (!accept(e, "?")) {
+        return condition;
+    }
+
+    long long if_true = evaluate(e, live && condition);
+    if (!accept(e, ":")) {
+        expression_error(e, "missing ':'");
+    }
+    long long if_false = evaluate(e, live && !condition);
+    return condition ? if_true : if_false;
+}
+
+/* Evaluate the condition of an #if or #elif on LINE. */
+static bool evaluate_condition(Preprocessor *pp, PpLine *line,
+                               Location location) {
+    // Replace `defined X` and `defined(X)` before expanding macros.
+    TokenBuffer replaced = {NULL, 0, 0};
+    for (int i = 2; i < line->token_count; i++) {
+        PpToken *token = &line->tokens[i];
+        if (!is_identifier(token, "defined")) {
+            token_buffer_append(&replaced, *token);
+            continue;
+        }
+
+        bool parenthesised = i + 1 < line->token_count &&
+                             is_punctuator(&line->tokens[i + 1], "(");
+        int name = parenthesised ? i + 2 : i + 1;
+        if (name >= line->token_count ||
+            line->tokens[name].kind != PP_IDENTIFIER ||
+            (parenthesised && (name + 1 >= line->token_count ||
+                               !is_punctuator(&line->tokens[name + 1], ")")))) {
+            compile_error("%s:%d: expected a macro name after defined",
+                          location.file->path, location.line);
+        }
+
+        PpToken value = {PP_NUMBER, "0", 1, true, false};
+        if (find_macro(pp, line->tokens[name].text) != NULL) {
+            value.text = "1";
+        }
+        token_buffer_append(&replaced, value);
+        i = parenthesised ? name + 1 : name;
+    }
+
+    TokenBuffer expanded = {NULL, 0, 0};
+    expand(pp, replaced.tokens, replaced.count, &expanded, location);
+
+    Expression e = {expanded.tokens, expanded.count, 0, location};
+    if (expanded.count == 0) {
+        expression_error(&e, "missing expression");
+    }
+    long long value = evaluate(&e, true);
+    if (e.position != e.count) {
+        expression_error(&e, "unexpected token");
+    }
+
+    free(replaced.tokens);
+    free(expanded.tokens);
+    return value != 0;
+}
+
+static char *directory_of(char *path) {
+    char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        return strdup(".");
+    }
+    return strndup(path, slash - path);
+}
+
+/* Find the header named by TOKEN, included from FROM. */
+static SourceFile *find_header(Preprocessor *pp, PpToken *token,
+                               SourceFile *from) {
+    char *name = strndup(token->text + 1, token->length - 2);
+    SourceFile *file = NULL;
+    char path[4096];
+
+    if (name[0] == '/') {
+        file = load_file(pp, name);
+    }
+
+    // "foo.h" is also looked up next to the including file.
+    if (file == NULL && token->kind == PP_STRING) {
+        char *directory = directory_of(from->path);
+        snprintf(path, sizeof(path), "%s/%s", directory, name);
+        free(directory);
+        file = load_file(pp, path);
+    }
+
+    for (int i = 0; file == NULL && i < list_length(pp->include_paths); i++) {
+        snprintf(path, sizeof(path), "%s/%s",
+                 (char *)list_get(pp->include_paths, i), name);
+        file = load_file(pp, path);
+    }
+
+    free(name);
+    return file;
+}
+
+typedef struct Conditional {
+    // Are we in a group that we're including?
+    bool active;
+    // Has one of this conditional's groups been included?
+    bool taken;
+    bool seen_else;
+    // Whether the enclosing group is included.
+    bool parent_active;
+} Conditional;
+
+static void process_file(Preprocessor *pp, SourceFile *file);
+
+static void include_file(Preprocessor *pp, PpLine *line, Location location) {
+    if (line->token_count != 3 || (line->tokens[2].kind != PP_HEADER_NAME &&
+                                   (line->tokens[2].kind != PP_STRING ||
+                                    line->tokens[2].text[0] != '"'))) {
+        compile_error("%s:%d: #include expects \"FILENAME\" or <FILENAME>",
+                      location.file->path, location.line);
+    }
+
+    SourceFile *header = find_header(pp, &line->tokens[2], location.file);
+    if (header == NULL) {
+        compile_error("%s:%d: %.*s: No such file", location.file->path,
+                      location.line, line->tokens[2].length,
+                      line->tokens[2].text);
+    }
+
+    if ((header->once && header->included) ||
+        (header->guard != NULL && find_macro(pp, header->guard) != NULL)) {
+        return;
+    }
+
+    if (pp->include_depth == MAX_INCLUDE_DEPTH) {
+        compile_error("%s:%d: #include nested too deeply", location.file->path,
+                      location.line);
+    }
+    pp->include_depth++;
+    process_file(pp, header);
+    pp->include_depth--;
+}
+
+static void process_file(Preprocessor *pp, SourceFile *file) {
+    file->included = true;
+
+    int conditional_count = 0, conditional_capacity = 8;
+    Conditional *conditionals =
+        malloc(conditional_capacity * sizeof(Conditional));
+    bool active = true;
+
+    for (int i = 0; i < file->line_count; i++) {
+        PpLine *line = &file->lines[i];
+        Location location = {file, line->number};
+        char *name = directive_name(line);
+
+        if (active && line->unterminated != NULL) {
+            char open = line->unterminated->text[0];
+            compile_error("%s:%d: missing terminating %c character",
+                          file->path, line->number, open == '<' ? '>' : open);
+        }
+
+        if (name == NULL) {
+            if (active) {
+                for (int j = 0; j < line->token_count; j++) {
+                    token_buffer_append(&pp->pending, line->tokens[j]);
+                }
+            }
+            continue;
+        }
+
+        // The text so far must be expanded with the macros defined
+        // before this directive.
+        if (active) {
+            flush_pending(pp, location);
+        }
+
+        if (strcmp(name, "if") == 0 || strcmp(name, "ifdef") == 0 ||
+            strcmp(name, "ifndef") == 0) {
+            if (conditional_count == conditional_capacity) {
+                conditional_capacity *= 2;
+                conditionals = realloc(conditionals, conditional_capacity *
+                                                         sizeof(Conditional));
+            }
+
+            bool condition = false;
+            if (active && strcmp(name, "if") == 0) {
+                condition = evaluate_condition(pp, line, location);
+            } else if (active) {
+                if (line->token_count < 3 ||
+                    line->tokens[2].kind != PP_IDENTIFIER) {
+                    compile_error("%s:%d: #%s expects a macro name", file->path,
+                                  line->number, name);
+                }
+                bool defined = find_macro(pp, line->tokens[2].text) != NULL;
+                condition = strcmp(name, "ifdef") == 0 ? defined : !defined;
+            }
+
+            Conditional conditional = {active && condition, condition, false,
+                                       active};
+            conditionals[conditional_count++] = conditional;
+            active = conditional.active;
+            continue;
+        }
+
+        if (strcmp(name, "elif") == 0 || strcmp(name, "else") == 0 ||
+            strcmp(name, "endif") == 0) {
+            if (conditional_count == 0) {
+                compile_error("%s:%d: #%s without #if", file->path,
+                              line->number, name);
+            }
+
+            Conditional *conditional = &conditionals[conditional_count - 1];
+            if (strcmp(name, "endif") == 0) {
+                active = conditional->parent_active;
+                conditional_count--;
+                continue;
+            }
+
+            if (conditional->seen_else) {
+                compile_error("%s:%d: #%s after #else", file->path,
+                              line->number, name);
+            }
+
+            bool condition = false;
+            if (conditional->parent_active && !conditional->taken) {
+                condition = strcmp(name, "else") == 0 ||
+                            evaluate_condition(pp, line, location);
+            }
+            conditional->seen_else = strcmp(name, "else") == 0;
+            conditional->active = condition;
+            conditional->taken = conditional->taken || condition;
+            active = condition;
+            continue;
+        }
+
+        if (!active) {
+            continue;
+        }
+
+        if (strcmp(name, "define") == 0) {
+            define_macro(pp, line, location);
+        } else if (strcmp(name, "undef") == 0) {
+            if (line->token_count < 3 ||
+                line->tokens[2].kind != PP_IDENTIFIER) {
+                compile_error("%s:%d: #undef expects a macro name", file->path,
+                              line->number);
+            }
+            macro_entry(pp, line->tokens[2].text)->defined = false;
+        } else if (strcmp(name, "include") == 0) {
+            include_file(pp, line, location);
+        } else if (strcmp(name, "pragma") == 0) {
+            if (line->token_count > 2 &&
+                is_identifier(&line->tokens[2], "once")) {
+                file->once = true;
+            }
+        } else if (strcmp(name, "error") == 0) {
+            compile_error("%s:%d: #error", file->path, line->number);
+        } else if (strcmp(name, "line") != 0 && strcmp(name, "") != 0) {
+            compile_error("%s:%d: invalid preprocessing directive #%s",
+                          file->path, line->number, name);
+        }
+    }
+
+    if (conditional_count > 0) {
+        compile_error("%s: unterminated conditional directive", file->path);
+    }
+    free(conditionals);
+
+    // Anything pending belongs to this file, and an #include mustn't
+    // join its last line to the includer's next one.
+    Location end = {file, file->line_count};
+    flush_pending(pp, end);
+}
+
+SourceBuffer *preprocess(char *file_name, List *include_paths,
+                         Interner *names) {
+    Preprocessor pp;
+    pp.arena = arena_new();
+    pp.names = names;
+    pp.include_paths = include_paths;
+    pp.files = list_new();
+    pp.macro_capacity = INITIAL_MACRO_CAPACITY;
+    pp.macro_count = 0;
+    pp.macros = calloc(pp.macro_capacity, sizeof(Macro *));
+    pp.pending.tokens = NULL;
+    pp.pending.count = 0;
+    pp.pending.capacity = 0;
+    pp.include_depth = 0;
+    pp.output_capacity = INITIAL_OUTPUT_CAPACITY;
+    pp.output_length = 0;
+    pp.output = malloc(pp.output_capacity);
+
+    SourceFile *file = load_file(&pp, file_name);
+    if (file == NULL) {
+        compile_error("Could not open file: '%s': %s", file_name,
+                      strerror(errno));
+    }
+    process_file(&pp, file);
+    output_bytes(&pp, "\n", 1);
+
+    for (int i = 0; i < list_length(pp.files); i++) {
+        source_free(((SourceFile *)list_get(pp.files, i))->source);
+    }
+    free(pp.pending.tokens);
+    free(pp.macros);
+    list_free(pp.files);
+    arena_free(pp.arena);
+
+    return source_from_memory(pp.output, pp.output_length);
+}
@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include "list.h"
+#include "source.h"
+#include "intern.h"
+
+#ifndef BABYC_PREPROCESSOR_HEADER
+#define BABYC_PREPROCESSOR_HEADER
+
+/* Expand the #includes, macros and conditionals in FILE_NAME, in the
+ * same way as `gcc -E` but without starting another process. Headers
+ * are looked up next to the file that includes them, then in each
+ * directory in INCLUDE_PATHS. Identifiers are interned in NAMES.
+ *
+ * Returns the expansion, which the caller must free with source_free.
+ * Errors are fatal.
+ */
+SourceBuffer *preprocess(char *file_name, List *include_paths,
+                         Interner *names);
+
+#endif
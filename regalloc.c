@@ -0,0 +1,484 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <err.h>
+#include "regalloc.h"
+#include "ir.h"
+
+/* The name of the 32-bit register REG. Every value is an int, so this
+ * is the name we use on x86-64 too.
+ */
+char *register_name(Register reg) {
+    static char *names[] = {"%eax", "%ebx", "%ecx",  "%edx",  "%esi",
+                            "%edi", "%r8d", "%r9d",  "%r10d", "%r11d",
+                            "%r12d", "%r13d", "%r14d", "%r15d"};
+    return names[reg];
+}
+
+/* The name of the low byte of REG. %esi and %edi don't have one on
+ * i386, so we don't use one on x86-64 either.
+ */
+char *register_byte_name(Register reg) {
+    static char *names[] = {"%al",   "%bl",   "%cl",   "%dl",   NULL,
+                            NULL,    "%r8b",  "%r9b",  "%r10b", "%r11b",
+                            "%r12b", "%r13b", "%r14b", "%r15b"};
+    return names[reg];
+}
+
+/* The name of the whole 64-bit register REG, for saving and restoring
+ * it on x86-64.
+ */
+char *register_quad_name(Register reg) {
+    static char *names[] = {"%rax", "%rbx", "%rcx", "%rdx", "%rsi",
+                            "%rdi", "%r8",  "%r9",  "%r10", "%r11",
+                            "%r12", "%r13", "%r14", "%r15"};
+    return names[reg];
+}
+
+/* Leaves can be used directly as an instruction operand, without
+ * being evaluated into a register first.
+ */
+bool syntax_is_leaf(Syntax *syntax) {
+    return syntax->type == IMMEDIATE || syntax->type == VARIABLE;
+}
+
+/* The number of registers needed to evaluate SYNTAX without spilling,
+ * given REGISTER_COUNT registers. If we evaluate the operand with the
+ * larger number first, we need at most max(left, right) registers
+ * (or one more if they're equal).
+ *
+ * See https://en.wikipedia.org/wiki/Sethi%E2%80%93Ullman_algorithm
+ */
+int sethi_ullman_number(Syntax *syntax, int register_count) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return sethi_ullman_number(syntax->unary_expression->expression,
+                                   register_count);
+    } else if (syntax->type == ASSIGNMENT) {
+        return sethi_ullman_number(syntax->assignment->expression,
+                                   register_count);
+    } else if (syntax->type == FUNCTION_CALL) {
+        // A call clobbers every caller-saved register, so it's best
+        // evaluated before anything else.
+        return register_count;
+    } else if (syntax->type == BINARY_OPERATOR) {
+        BinaryExpression *binary_syntax = syntax->binary_expression;
+
+        int left = sethi_ullman_number(binary_syntax->left, register_count);
+        if (syntax_is_leaf(binary_syntax->right)) {
+            // The right operand can be used directly from memory.
+            return left;
+        }
+
+        int right = sethi_ullman_number(binary_syntax->right, register_count);
+        if (left == right) {
+            return left + 1;
+        }
+        return left > right ? left : right;
+    }
+
+    return 1;
+}
+
+// Liveness sets are bitsets over vregs.
+typedef uint32_t *VregSet;
+
+#define VREG_SET_BITS 32
+
+static int vreg_set_words(int vreg_count) {
+    return (vreg_count + VREG_SET_BITS - 1) / VREG_SET_BITS;
+}
+
+static bool vreg_set_contains(VregSet set, IrVreg vreg) {
+    return set[vreg / VREG_SET_BITS] & (1u << (vreg % VREG_SET_BITS));
+}
+
+static void vreg_set_add(VregSet set, IrVreg vreg) {
+    set[vreg / VREG_SET_BITS] |= 1u << (vreg % VREG_SET_BITS);
+}
+
+static void extend_interval(LiveInterval *interval, int position) {
+    if (interval->start == -1 || position < interval->start) {
+        interval->start = position;
+    }
+    if (position > interval->end) {
+        interval->end = position;
+    }
+}
+
+/* Compute the live interval of every vreg in FUNCTION, returning a
+ * List indexed by vreg. Vregs that are never used have a start of -1.
+ *
+ * Instructions are numbered in layout order, and the instruction at
+ * index k reads its operands at position 2k and writes its dest at
+ * 2k + 1. An operand that dies at an instruction can therefore share
+ * a register with the instruction's dest.
+ *
+ * Liveness is computed with the usual backwards dataflow over the
+ * CFG, so a variable used around a loop stays live for all of it.
+ * Each interval is a single range covering every position the vreg is
+ * live at, which is conservative but simple.
+ */
+List *ir_live_intervals(IrFunction *function) {
+    int vreg_count = function->vreg_count;
+    int words = vreg_set_words(vreg_count);
+    List *blocks = function->blocks;
+    int block_count = list_length(blocks);
+
+    VregSet *uses = malloc(block_count * sizeof(VregSet));
+    VregSet *defs = malloc(block_count * sizeof(VregSet));
+    VregSet *live_in = malloc(block_count * sizeof(VregSet));
+    VregSet *live_out = malloc(block_count * sizeof(VregSet));
+
+    for (int i = 0; i < block_count; i++) {
+        uses[i] = calloc(words + 1, sizeof(uint32_t));
+        defs[i] = calloc(words + 1, sizeof(uint32_t));
+        live_in[i] = calloc(words + 1, sizeof(uint32_t));
+        live_out[i] = calloc(words + 1, sizeof(uint32_t));
+
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                if (operand->kind == IR_OPERAND_VREG &&
+                    !vreg_set_contains(defs[i], operand->value)) {
+                    vreg_set_add(uses[i], operand->value);
+                }
+            }
+            if (instruction->dest != IR_NO_VREG) {
+                vreg_set_add(defs[i], instruction->dest);
+            }
+        }
+    }
+
+    // live_out = union of successors' live_in
+    // live_in = uses + (live_out - defs)
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = block_count - 1; i >= 0; i--) {
+            IrBlock *block = list_get(blocks, i);
+
+            for (int w = 0; w < words; w++) {
+                uint32_t out = 0;
+                for (int j = 0; j < block->successor_count; j++) {
+                    out |= live_in[block->successors[j]->index][w];
+                }
+                uint32_t in = uses[i][w] | (out & ~defs[i][w]);
+
+                if (out != live_out[i][w] || in != live_in[i][w]) {
+                    changed = true;
+                }
+                live_out[i][w] = out;
+                live_in[i][w] = in;
+            }
+        }
+    }
+
+    List *intervals = list_new();
+    for (int vreg = 0; vreg < vreg_count; vreg++) {
+        LiveInterval *interval = malloc(sizeof(LiveInterval));
+        interval->start = -1;
+        interval->end = -1;
+        interval->reg = NO_REGISTER;
+        interval->stack_offset = 0;
+        interval->crosses_call = false;
+        interval->spill_cost = 0;
+        list_append(intervals, interval);
+    }
+
+    // Estimate how deeply nested in loops each block is. Lowering
+    // lays out each loop contiguously, so a back edge from block i to
+    // block h means blocks h..i are in the loop.
+    int *loop_depths = calloc(block_count, sizeof(int));
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(blocks, i);
+        for (int j = 0; j < block->successor_count; j++) {
+            int header = block->successors[j]->index;
+            if (header <= i) {
+                for (int k = header; k <= i; k++) {
+                    loop_depths[k]++;
+                }
+            }
+        }
+    }
+
+    List *call_positions = list_new();
+
+    int index = 0;
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(blocks, i);
+        if (block->instruction_count == 0) {
+            continue;
+        }
+
+        int block_start = 2 * index;
+        int block_end = 2 * (index + block->instruction_count - 1) + 1;
+
+        for (int w = 0; w < words; w++) {
+            uint32_t live = live_in[i][w] | live_out[i][w];
+            while (live != 0) {
+                int bit = __builtin_ctz(live);
+                live &= live - 1;
+
+                IrVreg vreg = w * VREG_SET_BITS + bit;
+                if (vreg_set_contains(live_in[i], vreg)) {
+                    extend_interval(list_get(intervals, vreg), block_start);
+                }
+                if (vreg_set_contains(live_out[i], vreg)) {
+                    extend_interval(list_get(intervals, vreg), block_end);
+                }
+            }
+        }
+
+        // Each use or definition in a loop costs more if spilled.
+        int weight = 1;
+        for (int depth = 0; depth < loop_depths[i] && depth < 4; depth++) {
+            weight *= 10;
+        }
+
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrInstruction *instruction = &block->instructions[j];
+            int position = 2 * index;
+
+            for (int k = 0; k < ir_operand_count(instruction); k++) {
+                IrOperand *operand = ir_operand(instruction, k);
+                if (operand->kind == IR_OPERAND_VREG) {
+                    LiveInterval *interval =
+                        list_get(intervals, operand->value);
+                    extend_interval(interval, position);
+                    interval->spill_cost += weight;
+                }
+            }
+            if (instruction->dest != IR_NO_VREG) {
+                LiveInterval *interval = list_get(intervals, instruction->dest);
+                extend_interval(interval, position + 1);
+                interval->spill_cost += weight;
+            }
+            if (instruction->opcode == IR_CALL) {
+                list_append(call_positions, (void *)(intptr_t)position);
+            }
+
+            index++;
+        }
+    }
+
+    // Note which intervals are live across a call, and so would be
+    // clobbered if they were in a caller-saved register.
+    int call_count = list_length(call_positions);
+    for (int vreg = 0; vreg < vreg_count; vreg++) {
+        LiveInterval *interval = list_get(intervals, vreg);
+        if (interval->start == -1) {
+            continue;
+        }
+
+        // Find the first call after the interval starts. Positions are
+        // in increasing order.
+        int low = 0, high = call_count;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if ((intptr_t)list_get(call_positions, middle) <= interval->start) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        if (low < call_count &&
+            interval->end > (intptr_t)list_get(call_positions, low) + 1) {
+            interval->crosses_call = true;
+        }
+    }
+
+    list_free(call_positions);
+    free(loop_depths);
+    for (int i = 0; i < block_count; i++) {
+        free(uses[i]);
+        free(defs[i]);
+        free(live_in[i]);
+        free(live_out[i]);
+    }
+    free(uses);
+    free(defs);
+    free(live_in);
+    free(live_out);
+
+    return intervals;
+}
+
+/* Is INTERVAL live across the instruction at INDEX, i.e. live both
+ * before it reads its operands and after it writes its result?
+ */
+bool interval_live_across(LiveInterval *interval, int index) {
+    return interval->start != -1 && interval->start < 2 * index &&
+           interval->end > 2 * index + 1;
+}
+
+static double spill_weight(LiveInterval *interval) {
+    return (double)interval->spill_cost / (interval->end - interval->start + 1);
+}
+
+static int compare_interval_starts(const void *a, const void *b) {
+    LiveInterval *left = *(LiveInterval **)a;
+    LiveInterval *right = *(LiveInterval **)b;
+    return left->start - right->start;
+}
+
+/* Assign REGISTERS to INTERVALS. When we run out of registers, we
+ * spill whichever interval has the lowest spill cost per position.
+ * Registers are handed out in the order given, except that intervals
+ * live across a call prefer the registers in CALLEE_SAVED.
+ *
+ * See Poletto and Sarkar, "Linear Scan Register Allocation".
+ */
+void linear_scan(List *intervals, Register *registers, int register_count,
+                 unsigned int callee_saved) {
+    // Sort by start position, ignoring unused vregs.
+    int count = 0;
+    LiveInterval **sorted =
+        malloc(list_length(intervals) * sizeof(LiveInterval *));
+    for (int i = 0; i < list_length(intervals); i++) {
+        LiveInterval *interval = list_get(intervals, i);
+        interval->reg = NO_REGISTER;
+        if (interval->start != -1) {
+            sorted[count++] = interval;
+        }
+    }
+    qsort(sorted, count, sizeof(LiveInterval *), compare_interval_starts);
+
+    // Active intervals, sorted by increasing end position.
+    LiveInterval **active = malloc(register_count * sizeof(LiveInterval *));
+    int active_count = 0;
+
+    unsigned int free_registers = 0;
+    for (int i = 0; i < register_count; i++) {
+        free_registers |= REGISTER_BIT(registers[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        LiveInterval *current = sorted[i];
+
+        // Expire intervals that ended before this one starts.
+        int kept = 0;
+        for (int j = 0; j < active_count; j++) {
+            if (active[j]->end < current->start) {
+                free_registers |= REGISTER_BIT(active[j]->reg);
+            } else {
+                active[kept++] = active[j];
+            }
+        }
+        active_count = kept;
+
+        Register chosen = NO_REGISTER;
+        for (int j = 0; j < register_count; j++) {
+            Register reg = registers[j];
+            if (!(free_registers & REGISTER_BIT(reg))) {
+                continue;
+            }
+            if (chosen == NO_REGISTER) {
+                chosen = reg;
+            }
+            if (!current->crosses_call ||
+                (callee_saved & REGISTER_BIT(reg))) {
+                chosen = reg;
+                break;
+            }
+        }
+
+        if (chosen != NO_REGISTER) {
+            free_registers &= ~REGISTER_BIT(chosen);
+        } else {
+            // Spill whichever of CURRENT and the active intervals is
+            // cheapest to keep in memory, relative to how long it
+            // would occupy a register, preferring the one that ends
+            // last.
+            int spilled = -1;
+            LiveInterval *cheapest = current;
+            for (int j = 0; j < active_count; j++) {
+                double weight = spill_weight(active[j]);
+                double cheapest_weight = spill_weight(cheapest);
+                if (weight < cheapest_weight ||
+                    (weight == cheapest_weight &&
+                     active[j]->end > cheapest->end)) {
+                    cheapest = active[j];
+                    spilled = j;
+                }
+            }
+
+            if (spilled == -1) {
+                continue;
+            }
+
+            chosen = cheapest->reg;
+            cheapest->reg = NO_REGISTER;
+            for (int j = spilled; j < active_count - 1; j++) {
+                active[j] = active[j + 1];
+            }
+            active_count--;
+        }
+        current->reg = chosen;
+
+        // Insert CURRENT, keeping ACTIVE sorted by end.
+        int j = active_count;
+        while (j > 0 && active[j - 1]->end > current->end) {
+            active[j] = active[j - 1];
+            j--;
+        }
+        active[j] = current;
+        active_count++;
+    }
+
+    free(active);
+    free(sorted);
+}
+
+/* Give every spilled interval in INTERVALS a stack slot, starting at
+ * FIRST_OFFSET from %ebp and growing down in SLOT_SIZE steps.
+ * Intervals that don't overlap share a slot, so this is linear scan
+ * again, with an unlimited supply of slots. Returns the number of
+ * bytes needed.
+ */
+int allocate_stack_slots(List *intervals, int first_offset, int slot_size) {
+    int count = 0;
+    LiveInterval **sorted =
+        malloc(list_length(intervals) * sizeof(LiveInterval *));
+    for (int i = 0; i < list_length(intervals); i++) {
+        LiveInterval *interval = list_get(intervals, i);
+        if (interval->start != -1 && interval->reg == NO_REGISTER) {
+            sorted[count++] = interval;
+        }
+    }
+    qsort(sorted, count, sizeof(LiveInterval *), compare_interval_starts);
+
+    // The end position of the last interval in each slot.
+    int *slot_ends = malloc((count + 1) * sizeof(int));
+    int slot_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        LiveInterval *current = sorted[i];
+
+        int slot = 0;
+        while (slot < slot_count && slot_ends[slot] >= current->start) {
+            slot++;
+        }
+        if (slot == slot_count) {
+            slot_count++;
+        }
+
+        slot_ends[slot] = current->end;
+        current->stack_offset = first_offset - slot * slot_size;
+    }
+
+    free(slot_ends);
+    free(sorted);
+
+    return slot_count * slot_size;
+}
+
+void live_intervals_free(List *intervals) {
+    for (int i = 0; i < list_length(intervals); i++) {
+        free(list_get(intervals, i));
+    }
+    list_free(intervals);
+}
@@ -0,0 +1,67 @@
+#include <stdbool.h>
+#include "syntax.h"
+#include "list.h"
+#include "ir.h"
+
+#ifndef BABYC_REGALLOC_HEADER
+#define BABYC_REGALLOC_HEADER
+
+typedef enum {
+    REG_EAX,
+    REG_EBX,
+    REG_ECX,
+    REG_EDX,
+    REG_ESI,
+    REG_EDI,
+    // Only on x86-64.
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    NO_REGISTER
+} Register;
+
+#define REGISTER_BIT(reg) (1u << (reg))
+
+char *register_name(Register reg);
+
+char *register_byte_name(Register reg);
+
+char *register_quad_name(Register reg);
+
+/* The range of positions in which a variable's value is needed. */
+typedef struct LiveInterval {
+    int start;
+    int end;
+    // The register assigned by linear_scan, or NO_REGISTER if the
+    // variable lives on the stack.
+    Register reg;
+    int stack_offset;
+    // Is the value needed after a call that clobbers caller-saved
+    // registers?
+    bool crosses_call;
+    // An estimate of the extra memory accesses if we spill this
+    // interval: its uses and definitions, weighted by loop depth.
+    int spill_cost;
+} LiveInterval;
+
+bool syntax_is_leaf(Syntax *syntax);
+
+int sethi_ullman_number(Syntax *syntax, int register_count);
+
+List *ir_live_intervals(IrFunction *function);
+
+bool interval_live_across(LiveInterval *interval, int index);
+
+void linear_scan(List *intervals, Register *registers, int register_count,
+                 unsigned int callee_saved);
+
+int allocate_stack_slots(List *intervals, int first_offset, int slot_size);
+
+void live_intervals_free(List *intervals);
+
+#endif
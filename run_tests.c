@@ -5,6 +5,7 @@
 #include <dirent.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 bool is_test_program(char *file_name) {
     // A test program is simply one that contains two consecutive underscores.
@@ -23,11 +24,32 @@ bool is_test_program(char *file_name) {
     return false;
 }
 
-int run_test(char *test_program_name) {
+/* A program named NAME__error.c must fail to compile. */
+bool is_error_test(char *file_name) {
+    return strstr(file_name, "__error") != NULL;
+}
+
+int run_test(char *test_program_name, char *babyc_flags) {
     // We blindly assume that our test programs never have a file name
     // longer than 1024 bytes minus the name of the compiler executable.
     char *command = malloc(1024);
 
+    if (is_error_test(test_program_name)) {
+        snprintf(command, 1024,
+                 "./build/babyc%s test_programs/%s >/dev/null 2>&1",
+                 babyc_flags, test_program_name);
+        int result = system(command);
+        free(command);
+        system("rm -f out.s");
+
+        if (result == 0) {
+            printf("[%s] Compiled, but should have failed!\n",
+                   test_program_name);
+            return 1;
+        }
+        return 0;
+    }
+
     // If it contains a 'return_NUMBER' file name, extract it.
     int expected_return = -1;
     char *return_position = strstr(test_program_name, "return_");
@@ -37,8 +59,8 @@ int run_test(char *test_program_name) {
         expected_return = atoi(return_position);
     }
 
-    snprintf(command, 1024, "./build/babyc test_programs/%s >/dev/null",
-             test_program_name);
+    snprintf(command, 1024, "./build/babyc%s test_programs/%s >/dev/null",
+             babyc_flags, test_program_name);
     int result = system(command);
     free(command);
 
@@ -47,12 +69,17 @@ int run_test(char *test_program_name) {
         return result;
     }
 
-    if ((result = system("as out.s -o out.o --32")) != 0) {
+    // babyc writes i386 assembly unless we asked for x86-64.
+    bool x86_64 = strstr(babyc_flags, "--target=x86_64") != NULL;
+
+    if ((result = system(x86_64 ? "as out.s -o out.o --64"
+                                : "as out.s -o out.o --32")) != 0) {
         printf("[%s] Assembling failed!\n", test_program_name);
         return result;
     }
 
-    if ((result = system("ld -m elf_i386 -s -o out out.o")) != 0) {
+    if ((result = system(x86_64 ? "ld -m elf_x86_64 -s -o out out.o"
+                                : "ld -m elf_i386 -s -o out out.o")) != 0) {
         printf("[%s] Linking failed!\n", test_program_name);
         return result;
     }
@@ -70,7 +97,121 @@ int run_test(char *test_program_name) {
     }
 }
 
-int main() {
+bool files_equal(char *path1, char *path2) {
+    FILE *file1 = fopen(path1, "r");
+    FILE *file2 = fopen(path2, "r");
+    bool equal = file1 != NULL && file2 != NULL;
+
+    while (equal) {
+        int c = fgetc(file1);
+        equal = c == fgetc(file2);
+        if (c == EOF) {
+            break;
+        }
+    }
+
+    if (file1 != NULL) {
+        fclose(file1);
+    }
+    if (file2 != NULL) {
+        fclose(file2);
+    }
+    return equal;
+}
+
+/* Compile every test program at once with `babyc -j 4`, along with a
+ * program that doesn't compile. babyc should still write foo.s for
+ * each test program foo.c that compiles, identical to the out.s from
+ * compiling it alone, and exit with 1.
+ */
+int run_batch_tests(char *babyc_flags) {
+    char bad_path[] = "/tmp/babyc_batch_error_XXXXXX.c";
+    int fd = mkstemps(bad_path, 2);
+    if (fd < 0) {
+        printf("Could not create a temporary file!\n");
+        return 1;
+    }
+    FILE *bad = fdopen(fd, "w");
+    fprintf(bad, "int main() { return undefined; }\n");
+    fclose(bad);
+
+    char command[1024];
+    snprintf(command, sizeof(command),
+             "./build/babyc%s -j 4 test_programs/*.c %s >/dev/null 2>&1",
+             babyc_flags, bad_path);
+    int result = system(command);
+    unlink(bad_path);
+
+    int failures = 0;
+    if (WEXITSTATUS(result) != 1) {
+        printf("[batch] Expected babyc -j to exit with 1, but got %d!\n",
+               WEXITSTATUS(result));
+        failures++;
+    }
+
+    DIR *test_dir = opendir("test_programs");
+    if (test_dir == NULL) {
+        printf("Could not open test_programs directory!");
+        return 1;
+    }
+
+    int tests_run = 0;
+    struct dirent *file;
+    while ((file = readdir(test_dir)) != NULL) {
+        char *file_name = file->d_name;
+        size_t length = strlen(file_name);
+        if (!is_test_program(file_name) || is_error_test(file_name) ||
+            length < 2 ||
+            strcmp(file_name + length - 2, ".c") != 0) {
+            continue;
+        }
+
+        char batch_output[1024];
+        snprintf(batch_output, sizeof(batch_output), "test_programs/%.*s.s",
+                 (int)length - 2, file_name);
+
+        snprintf(command, sizeof(command),
+                 "./build/babyc%s test_programs/%s >/dev/null", babyc_flags,
+                 file_name);
+        bool passed = system(command) == 0 &&
+                      files_equal("out.s", batch_output);
+
+        tests_run++;
+        if (passed) {
+            printf(".");
+        } else {
+            printf("F");
+            printf("\n[%s] Batch output differs from out.s!\n", file_name);
+            failures++;
+        }
+        unlink(batch_output);
+    }
+    closedir(test_dir);
+    unlink("out.s");
+
+    printf("\n\n%d batch outputs checked, %d failed. (babyc%s -j 4)\n",
+           tests_run, failures, babyc_flags);
+    return failures;
+}
+
+/* Any arguments are passed on to babyc when compiling each test
+ * program, e.g. `run_tests --flat`. With `run_tests --batch`, we
+ * check `babyc -j` against compiling each file alone instead.
+ */
+int main(int argc, char *argv[]) {
+    bool batch = argc > 1 && strcmp(argv[1], "--batch") == 0;
+
+    char babyc_flags[512] = {0};
+    for (int i = batch ? 2 : 1; i < argc; i++) {
+        strcat(babyc_flags, " ");
+        strncat(babyc_flags, argv[i],
+                sizeof(babyc_flags) - strlen(babyc_flags) - 1);
+    }
+
+    if (batch) {
+        return run_batch_tests(babyc_flags);
+    }
+
     DIR *test_dir = opendir("test_programs");
 
     if (test_dir == NULL) {
@@ -87,7 +228,7 @@ int main() {
         file_name = file->d_name;
 
         if (is_test_program(file_name)) {
-            test_result = run_test(file_name);
+            test_result = run_test(file_name, babyc_flags);
 
             tests_run++;
             if (test_result == 0) {
@@ -98,8 +239,12 @@ int main() {
             }
         }
     }
-    printf("\n\n%d tests run, %d passed, %d failed.\n", tests_run, tests_passed,
+    printf("\n\n%d tests run, %d passed, %d failed.", tests_run, tests_passed,
            tests_run - tests_passed);
+    if (argc > 1) {
+        printf(" (babyc%s)", babyc_flags);
+    }
+    printf("\n");
 
     closedir(test_dir);
 
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+#include "intern.h"
+
+/* Map the file at PATH into memory, returning NULL if we can't open
+ * it. We don't copy it, unless its size doesn't leave room for the
+ * NULs after it in its last page.
+ */
+SourceBuffer *source_map(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    SourceBuffer *source = malloc(sizeof(SourceBuffer));
+    source->length = info.st_size;
+    source->mapped = false;
+
+    // The rest of the last page reads as zeroes, so a mapping is
+    // terminated if there are at least two bytes left over.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t spare = (page_size - source->length % page_size) % page_size;
+    if (source->length > 0 && spare >= 2) {
+        // Private and writable, as flex briefly writes a NUL after
+        // each token. Only the pages it touches are copied.
+        void *mapping = mmap(NULL, source->length, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            source->text = mapping;
+            source->mapped = true;
+        }
+    }
+
+    if (!source->mapped) {
+        source->text = malloc(source->length + 2);
+        size_t read_so_far = 0;
+        while (read_so_far < source->length) {
+            ssize_t result = read(fd, source->text + read_so_far,
+                                  source->length - read_so_far);
+            if (result <= 0) {
+                break;
+            }
+            read_so_far += result;
+        }
+        source->length = read_so_far;
+        source->text[source->length] = '\0';
+        source->text[source->length + 1] = '\0';
+    }
+
+    close(fd);
+    return source;
+}
+
+/* Wrap TEXT, which must be malloc'd with room for two bytes after
+ * LENGTH. The buffer takes ownership of it.
+ */
+SourceBuffer *source_from_memory(char *text, size_t length) {
+    SourceBuffer *source = malloc(sizeof(SourceBuffer));
+    source->text = text;
+    source->length = length;
+    source->mapped = false;
+
+    text[length] = '\0';
+    text[length + 1] = '\0';
+    return source;
+}
+
+void source_free(SourceBuffer *source) {
+    if (source->mapped) {
+        munmap(source->text, source->length);
+    } else {
+        free(source->text);
+    }
+    free(source);
+}
+
+/* The name of the identifier at SLICE of SOURCE, interned in NAMES. */
+char *slice_name(SourceBuffer *source, Interner *names, TokenSlice slice) {
+    return intern(names, source->text + slice.offset, slice.length);
+}
+
+/* The value of the number at SLICE of SOURCE, wrapping like the int
+ * it will be stored in.
+ */
+int slice_value(SourceBuffer *source, TokenSlice slice) {
+    char *digits = source->text + slice.offset;
+    unsigned int value = 0;
+    for (uint32_t i = 0; i < slice.length; i++) {
+        value = value * 10 + (digits[i] - '0');
+    }
+    return (int)value;
+}
@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "intern.h"
+
+#ifndef BABYC_SOURCE_HEADER
+#define BABYC_SOURCE_HEADER
+
+/* Text that we lex, either a file mapped into memory or a buffer
+ * such as the preprocessor's output. TEXT is always followed by two
+ * NUL bytes that aren't counted in LENGTH, which is what flex needs
+ * to scan a buffer in place.
+ */
+typedef struct SourceBuffer {
+    char *text;
+    size_t length;
+    // Whether TEXT is mmap'd, rather than malloc'd.
+    bool mapped;
+} SourceBuffer;
+
+SourceBuffer *source_map(char *path);
+
+SourceBuffer *source_from_memory(char *text, size_t length);
+
+void source_free(SourceBuffer *source);
+
+/* An identifier or number, as a position in the buffer being lexed.
+ * We only copy it when the syntax tree needs its own copy.
+ */
+typedef struct TokenSlice {
+    uint32_t offset;
+    uint32_t length;
+} TokenSlice;
+
+char *slice_name(SourceBuffer *source, Interner *names, TokenSlice slice);
+
+int slice_value(SourceBuffer *source, TokenSlice slice);
+
+#endif
@@ -0,0 +1,538 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include "ssa.h"
+#include "ir.h"
+#include "list.h"
+
+/* Static single assignment form: every vreg is assigned exactly once.
+ * Where different definitions of a variable meet, a phi instruction
+ * selects the right one.
+ *
+ * We convert with the classic algorithm from Cytron et al, "Efficiently
+ * Computing Static Single Assignment Form and the Control Dependence
+ * Graph", placing phis at the iterated dominance frontier of each
+ * definition. Dominators are computed with Cooper, Harvey and Kennedy's
+ * "A Simple, Fast Dominance Algorithm".
+ *
+ * All blocks must be reachable, see ir_remove_unreachable_blocks.
+ */
+
+static void postorder_visit(IrFunction *function, IrBlock **postorder,
+                            int *count, bool *visited) {
+    // An explicit stack, as functions can be long chains of blocks.
+    int block_count = list_length(function->blocks);
+    IrBlock **stack = malloc(block_count * sizeof(IrBlock *));
+    int *next_successor = calloc(block_count, sizeof(int));
+    int stack_size = 0;
+
+    IrBlock *entry = list_get(function->blocks, 0);
+    stack[stack_size++] = entry;
+    visited[entry->index] = true;
+
+    while (stack_size > 0) {
+        IrBlock *block = stack[stack_size - 1];
+        if (next_successor[block->index] < block->successor_count) {
+            IrBlock *successor =
+                block->successors[next_successor[block->index]++];
+            if (!visited[successor->index]) {
+                visited[successor->index] = true;
+                stack[stack_size++] = successor;
+            }
+        } else {
+            postorder[(*count)++] = block;
+            stack_size--;
+        }
+    }
+
+    free(stack);
+    free(next_successor);
+}
+
+static int intersect(Dominators *dominators, int left, int right) {
+    int *numbers = dominators->postorder_numbers;
+    while (left != right) {
+        while (numbers[left] < numbers[right]) {
+            left = dominators->idoms[left];
+        }
+        while (numbers[right] < numbers[left]) {
+            right = dominators->idoms[right];
+        }
+    }
+    return left;
+}
+
+Dominators *compute_dominators(IrFunction *function) {
+    ir_renumber_blocks(function);
+    int block_count = list_length(function->blocks);
+
+    Dominators *dominators = malloc(sizeof(Dominators));
+    dominators->block_count = block_count;
+    dominators->idoms = malloc(block_count * sizeof(int));
+    dominators->postorder_numbers = malloc(block_count * sizeof(int));
+    dominators->reverse_postorder = malloc(block_count * sizeof(IrBlock *));
+
+    IrBlock **postorder = malloc(block_count * sizeof(IrBlock *));
+    bool *visited = calloc(block_count, sizeof(bool));
+    int count = 0;
+    postorder_visit(function, postorder, &count, visited);
+    if (count != block_count) {
+        errx(1, "Can't compute dominators with unreachable blocks in %s",
+             function->name);
+    }
+
+    // We number blocks so that the entry has the highest number, and
+    // a block's idom always has a higher number than the block.
+    for (int i = 0; i < count; i++) {
+        dominators->postorder_numbers[postorder[i]->index] = i;
+        dominators->reverse_postorder[count - 1 - i] = postorder[i];
+        dominators->idoms[i] = -1;
+    }
+
+    IrBlock *entry = list_get(function->blocks, 0);
+    dominators->idoms[entry->index] = entry->index;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (int i = 1; i < count; i++) {
+            IrBlock *block = dominators->reverse_postorder[i];
+
+            int new_idom = -1;
+            for (int j = 0; j < list_length(block->predecessors); j++) {
+                IrBlock *predecessor = list_get(block->predecessors, j);
+                if (dominators->idoms[predecessor->index] == -1) {
+                    continue;
+                }
+
+                if (new_idom == -1) {
+                    new_idom = predecessor->index;
+                } else {
+                    new_idom =
+                        intersect(dominators, predecessor->index, new_idom);
+                }
+            }
+
+            if (dominators->idoms[block->index] != new_idom) {
+                dominators->idoms[block->index] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    free(postorder);
+    free(visited);
+
+    return dominators;
+}
+
+/* Does block DOMINATOR dominate BLOCK? Both are block indexes. */
+bool dominates(Dominators *dominators, int dominator, int block) {
+    while (true) {
+        if (block == dominator) {
+            return true;
+        }
+
+        int idom = dominators->idoms[block];
+        if (idom == block) {
+            return false;
+        }
+        block = idom;
+    }
+}
+
+void dominators_free(Dominators *dominators) {
+    free(dominators->idoms);
+    free(dominators->postorder_numbers);
+    free(dominators->reverse_postorder);
+    free(dominators);
+}
+
+/* Compute the dominance frontier of every block: the blocks where its
+ * dominance ends. Returns an array of Lists of IrBlocks.
+ */
+static List **dominance_frontiers(IrFunction *function,
+                                  Dominators *dominators) {
+    int block_count = dominators->block_count;
+    List **frontiers = malloc(block_count * sizeof(List *));
+    for (int i = 0; i < block_count; i++) {
+        frontiers[i] = list_new();
+    }
+
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        if (list_length(block->predecessors) < 2) {
+            continue;
+        }
+
+        for (int j = 0; j < list_length(block->predecessors); j++) {
+            IrBlock *predecessor = list_get(block->predecessors, j);
+
+            int runner = predecessor->index;
+            while (runner != dominators->idoms[i]) {
+                List *frontier = frontiers[runner];
+                int length = list_length(frontier);
+                if (length == 0 || list_get(frontier, length - 1) != block) {
+                    list_append(frontier, block);
+                }
+                runner = dominators->idoms[runner];
+            }
+        }
+    }
+
+    return frontiers;
+}
+
+/* Insert phis for every vreg in VARIABLES (a bitmap of vregs with more
+ * than one definition that are live across blocks), at the iterated
+ * dominance frontier of their definitions.
+ */
+static void insert_phis(IrProgram *program, IrFunction *function,
+                        List **frontiers, bool *variables,
+                        List **definition_blocks) {
+    int block_count = list_length(function->blocks);
+
+    // has_phi[block] is the last vreg we placed a phi for in block, so
+    // we don't need to clear it between vregs.
+    int *has_phi = malloc(block_count * sizeof(int));
+    int *in_worklist = malloc(block_count * sizeof(int));
+    for (int i = 0; i < block_count; i++) {
+        has_phi[i] = -1;
+        in_worklist[i] = -1;
+    }
+    IrBlock **worklist = malloc(block_count * sizeof(IrBlock *));
+
+    for (IrVreg vreg = 0; vreg < function->vreg_count; vreg++) {
+        if (!variables[vreg]) {
+            continue;
+        }
+
+        int worklist_size = 0;
+        List *definitions = definition_blocks[vreg];
+        for (int i = 0; i < list_length(definitions); i++) {
+            IrBlock *block = list_get(definitions, i);
+            if (in_worklist[block->index] != vreg) {
+                in_worklist[block->index] = vreg;
+                worklist[worklist_size++] = block;
+            }
+        }
+
+        while (worklist_size > 0) {
+            IrBlock *block = worklist[--worklist_size];
+            List *frontier = frontiers[block->index];
+
+            for (int i = 0; i < list_length(frontier); i++) {
+                IrBlock *frontier_block = list_get(frontier, i);
+                if (has_phi[frontier_block->index] == vreg) {
+                    continue;
+                }
+                has_phi[frontier_block->index] = vreg;
+
+                // Every argument starts as the original vreg, and
+                // renaming replaces it with the reaching definition.
+                int argument_count = list_length(frontier_block->predecessors);
+                IrInstruction *phi =
+                    ir_insert(program, frontier_block, 0, IR_PHI, vreg);
+                phi->arguments = arena_alloc(
+                    program->arena, argument_count * sizeof(IrOperand));
+                phi->argument_count = argument_count;
+                for (int j = 0; j < argument_count; j++) {
+                    phi->arguments[j] = ir_vreg_operand(vreg);
+                }
+
+                if (in_worklist[frontier_block->index] != vreg) {
+                    in_worklist[frontier_block->index] = vreg;
+                    worklist[worklist_size++] = frontier_block;
+                }
+            }
+        }
+    }
+
+    free(has_phi);
+    free(in_worklist);
+    free(worklist);
+}
+
+typedef struct RenameUndo {
+    IrVreg vreg;
+    IrVreg previous;
+} RenameUndo;
+
+typedef struct Renamer {
+    IrProgram *program;
+    IrFunction *function;
+    // Indexed by vreg, for the vregs that existed before renaming.
+    bool *variables;
+    int variable_count;
+    // The current SSA name of each original vreg, or IR_NO_VREG if no
+    // definition reaches here.
+    IrVreg *current;
+    RenameUndo *undo;
+    int undo_size;
+    int undo_capacity;
+} Renamer;
+
+static void rename_definition(Renamer *renamer, IrInstruction *instruction) {
+    IrVreg vreg = instruction->dest;
+    if (vreg == IR_NO_VREG || !renamer->variables[vreg]) {
+        return;
+    }
+
+    if (renamer->undo_size == renamer->undo_capacity) {
+        renamer->undo_capacity *= 2;
+        renamer->undo = realloc(renamer->undo,
+                                renamer->undo_capacity * sizeof(RenameUndo));
+    }
+    RenameUndo undo = {vreg, renamer->current[vreg]};
+    renamer->undo[renamer->undo_size++] = undo;
+
+    IrVreg renamed = ir_vreg_new(renamer->program, renamer->function,
+                                 renamer->function->vreg_names[vreg]);
+    renamer->current[vreg] = renamed;
+    instruction->dest = renamed;
+}
+
+static IrOperand renamed_operand(Renamer *renamer, IrOperand operand) {
+    if (operand.kind != IR_OPERAND_VREG ||
+        operand.value >= renamer->variable_count ||
+        !renamer->variables[operand.value]) {
+        return operand;
+    }
+
+    IrVreg current = renamer->current[operand.value];
+    if (current == IR_NO_VREG) {
+        // The variable is undefined on this path, so any value will do.
+        return ir_constant_operand(0);
+    }
+    return ir_vreg_operand(current);
+}
+
+static void rename_block(Renamer *renamer, IrBlock *block) {
+    for (int i = 0; i < block->instruction_count; i++) {
+        IrInstruction *instruction = &block->instructions[i];
+
+        if (instruction->opcode != IR_PHI) {
+            for (int j = 0; j < ir_operand_count(instruction); j++) {
+                IrOperand *operand = ir_operand(instruction, j);
+                *operand = renamed_operand(renamer, *operand);
+            }
+        }
+        rename_definition(renamer, instruction);
+    }
+
+    // Fill in the arguments of successors' phis for the edges from
+    // this block.
+    for (int i = 0; i < block->successor_count; i++) {
+        IrBlock *successor = block->successors[i];
+        if (i == 1 && block->successors[0] == successor) {
+            break;
+        }
+
+        for (int j = 0; j < list_length(successor->predecessors); j++) {
+            if (list_get(successor->predecessors, j) != block) {
+                continue;
+            }
+
+            for (int k = 0; k < successor->instruction_count; k++) {
+                IrInstruction *phi = &successor->instructions[k];
+                if (phi->opcode != IR_PHI) {
+                    break;
+                }
+                phi->arguments[j] = renamed_operand(renamer, phi->arguments[j]);
+            }
+        }
+    }
+}
+
+/* Walk the dominator tree in preorder, renaming every definition of a
+ * variable to a fresh vreg and every use to the definition that
+ * reaches it.
+ */
+static void rename_variables(Renamer *renamer, Dominators *dominators) {
+    IrFunction *function = renamer->function;
+    int block_count = dominators->block_count;
+
+    // Build the dominator tree's child lists.
+    List **children = malloc(block_count * sizeof(List *));
+    for (int i = 0; i < block_count; i++) {
+        children[i] = list_new();
+    }
+    for (int i = 1; i < block_count; i++) {
+        IrBlock *block = dominators->reverse_postorder[i];
+        list_append(children[dominators->idoms[block->index]], block);
+    }
+
+    // An explicit stack of (block, undo position) so deep dominator
+    // trees don't overflow the C stack.
+    IrBlock **stack = malloc(block_count * sizeof(IrBlock *));
+    int *undo_positions = malloc(block_count * sizeof(int));
+    int *next_child = calloc(block_count, sizeof(int));
+    int stack_size = 0;
+
+    IrBlock *entry = list_get(function->blocks, 0);
+    undo_positions[stack_size] = renamer->undo_size;
+    stack[stack_size++] = entry;
+    rename_block(renamer, entry);
+
+    while (stack_size > 0) {
+        IrBlock *block = stack[stack_size - 1];
+        List *block_children = children[block->index];
+
+        if (next_child[block->index] < list_length(block_children)) {
+            IrBlock *child =
+                list_get(block_children, next_child[block->index]++);
+            undo_positions[stack_size] = renamer->undo_size;
+            stack[stack_size++] = child;
+            rename_block(renamer, child);
+        } else {
+            // Leaving the block, so its definitions no longer reach.
+            stack_size--;
+            while (renamer->undo_size > undo_positions[stack_size]) {
+                RenameUndo undo = renamer->undo[--renamer->undo_size];
+                renamer->current[undo.vreg] = undo.previous;
+            }
+        }
+    }
+
+    for (int i = 0; i < block_count; i++) {
+        list_free(children[i]);
+    }
+    free(children);
+    free(stack);
+    free(undo_positions);
+    free(next_child);
+}
+
+/* Convert FUNCTION to SSA form. */
+void ssa_construct(IrProgram *program, IrFunction *function) {
+    int vreg_count = function->vreg_count;
+    int block_count = list_length(function->blocks);
+
+    // Find vregs that are defined more than once (i.e. variables that
+    // are assigned to), and which blocks define them. Vregs with a
+    // single definition are already in SSA form, since lowering only
+    // defines a variable before its uses.
+    int *definition_counts = calloc(vreg_count, sizeof(int));
+    List **definition_blocks = calloc(vreg_count, sizeof(List *));
+    for (int i = 0; i < block_count; i++) {
+        IrBlock *block = list_get(function->blocks, i);
+        for (int j = 0; j < block->instruction_count; j++) {
+            IrVreg dest = block->instructions[j].dest;
+            if (dest == IR_NO_VREG) {
+                continue;
+            }
+
+            definition_counts[dest]++;
+            if (definition_blocks[dest] == NULL) {
+                definition_blocks[dest] = list_new();
+            }
+            List *blocks = definition_blocks[dest];
+            if (list_length(blocks) == 0 ||
+                list_get(blocks, list_length(blocks) - 1) != block) {
+                list_append(blocks, block);
+            }
+        }
+    }
+
+    bool *variables = calloc(vreg_count, sizeof(bool));
+    for (IrVreg vreg = 0; vreg < vreg_count; vreg++) {
+        variables[vreg] = definition_counts[vreg] > 1;
+    }
+
+    Dominators *dominators = compute_dominators(function);
+    List **frontiers = dominance_frontiers(function, dominators);
+
+    insert_phis(program, function, frontiers, variables, definition_blocks);
+
+    Renamer renamer;
+    renamer.program = program;
+    renamer.function = function;
+    renamer.variables = variables;
+    renamer.variable_count = vreg_count;
+    renamer.current = malloc(vreg_count * sizeof(IrVreg));
+    for (IrVreg vreg = 0; vreg < vreg_count; vreg++) {
+        renamer.current[vreg] = IR_NO_VREG;
+    }
+    renamer.undo_size = 0;
+    renamer.undo_capacity = 64;
+    renamer.undo = malloc(renamer.undo_capacity * sizeof(RenameUndo));
+
+    rename_variables(&renamer, dominators);
+
+    free(renamer.current);
+    free(renamer.undo);
+
+    for (int i = 0; i < block_count; i++) {
+        list_free(frontiers[i]);
+    }
+    free(frontiers);
+    for (IrVreg vreg = 0; vreg < vreg_count; vreg++) {
+        if (definition_blocks[vreg] != NULL) {
+            list_free(definition_blocks[vreg]);
+        }
+    }
+    free(definition_blocks);
+    free(definition_counts);
+    free(variables);
+    dominators_free(dominators);
+}
+
+/* Convert FUNCTION out of SSA form, replacing each phi with copies.
+ *
+ * Each phi gets a fresh temporary: every predecessor copies its
+ * argument to the temporary just before its terminator, and the phi
+ * becomes a copy from the temporary. As the temporaries aren't live
+ * anywhere else, this avoids the "lost copy" and "swap" problems
+ * without splitting critical edges.
+ */
+void ssa_destruct(IrProgram *program, IrFunction *function) {
+    for (int i = 0; i < list_length(function->blocks); i++) {
+        IrBlock *block = list_get(function->blocks, i);
+
+        for (int j = 0; j < block->instruction_count; j++) {
+            // Optimisations may have replaced some phis with copies,
+            // so phis aren't necessarily contiguous.
+            IrInstruction *phi = &block->instructions[j];
+            if (phi->opcode != IR_PHI) {
+                continue;
+            }
+
+            IrVreg temporary = ir_vreg_new(program, function, NULL);
+            int argument_count = phi->argument_count;
+            IrOperand *arguments = phi->arguments;
+
+            phi->opcode = IR_COPY;
+            phi->operands[0] = ir_vreg_operand(temporary);
+            phi->arguments = NULL;
+            phi->argument_count = 0;
+
+            for (int k = 0; k < argument_count; k++) {
+                IrBlock *predecessor = list_get(block->predecessors, k);
+
+                // A block may branch to the same successor twice, but
+                // the argument is the same for both edges.
+                bool duplicate = false;
+                for (int m = 0; m < k; m++) {
+                    if (list_get(block->predecessors, m) == predecessor) {
+                        duplicate = true;
+                    }
+                }
+                if (duplicate) {
+                    continue;
+                }
+
+                IrInstruction *copy =
+                    ir_insert(program, predecessor,
+                              predecessor->instruction_count - 1, IR_COPY,
+                              temporary);
+                copy->operands[0] = arguments[k];
+            }
+
+            // A block that is its own predecessor now has an extra
+            // instruction, but it's before the terminator so it can't
+            // be a phi we haven't visited yet.
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#include "ir.h"
+
+#ifndef BABYC_SSA_HEADER
+#define BABYC_SSA_HEADER
+
+/* The dominator tree of a function: idoms[i] is the index of the
+ * immediate dominator of block i. The entry block is its own
+ * immediate dominator.
+ */
+typedef struct Dominators {
+    int *idoms;
+    int block_count;
+    // Blocks in reverse postorder, and each block's position in it.
+    IrBlock **reverse_postorder;
+    int *postorder_numbers;
+} Dominators;
+
+Dominators *compute_dominators(IrFunction *function);
+
+bool dominates(Dominators *dominators, int dominator, int block);
+
+void dominators_free(Dominators *dominators);
+
+void ssa_construct(IrProgram *program, IrFunction *function);
+
+void ssa_destruct(IrProgram *program, IrFunction *function);
+
+#endif
@@ -7,36 +7,37 @@
 Stack *stack_new() {
     Stack *stack = malloc(sizeof(Stack));
     stack->size = 0;
-    stack->content = 0;
+    stack->capacity = 0;
+    stack->content = NULL;
 
     return stack;
 }
 
 void stack_free(Stack *stack) {
-    if (stack->size > 0) {
-        free(stack->content);
-    }
+    free(stack->content);
     free(stack);
 }
 
 void stack_push(Stack *stack, void *item) {
-    stack->size++;
+    // When we run out of space, we double the memory allocated, so
+    // pushing is amortised O(1).
+    if (stack->size == stack->capacity) {
+        stack->capacity =
+            stack->capacity == 0 ? INITIAL_STACK_SIZE : stack->capacity * 2;
+        stack->content =
+            realloc(stack->content, stack->capacity * sizeof *stack->content);
+    }
 
-    // We expand the memory allocated by one word, then write the new
-    // value to the end.
-    stack->content =
-        realloc(stack->content, stack->size * sizeof *stack->content);
-    stack->content[stack->size - 1] = item;
+    stack->content[stack->size] = item;
+    stack->size++;
 }
 
 void *stack_pop(Stack *stack) {
     assert(stack->size >= 1);
     stack->size--;
 
-    void *item = stack->content[stack->size];
-    stack->content =
-        realloc(stack->content, stack->size * sizeof *stack->content);
-    return item;
+    // We keep the memory, the stack will probably grow again.
+    return stack->content[stack->size];
 }
 
 void *stack_peek(Stack *stack) {
@@ -5,9 +5,12 @@
 
 typedef struct Stack {
     int size;
+    int capacity;
     void **content;
 } Stack;
 
+#define INITIAL_STACK_SIZE 32
+
 Stack *stack_new();
 
 void stack_free(Stack *stack);
@@ -3,361 +3,315 @@
 #include <err.h>
 #include "syntax.h"
 #include "list.h"
+#include "arena.h"
+
+/* All syntax nodes, their payloads and their lists live in the arena
+ * passed to their constructor, so the whole tree is freed at once when
+ * compilation ends.
+ */
+static void *syntax_alloc(Arena *arena, size_t size) {
+    return arena_alloc(arena, size);
+}
+
+static Syntax *syntax_node_alloc(Arena *arena) {
+    arena->node_count++;
+    return arena_alloc(arena, sizeof(Syntax));
+}
 
-Syntax *immediate_new(int value) {
-    Immediate *immediate = malloc(sizeof(Immediate));
+Syntax *immediate_new(Arena *arena, int value) {
+    Immediate *immediate = syntax_alloc(arena, sizeof(Immediate));
     immediate->value = value;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = IMMEDIATE;
     syntax->immediate = immediate;
 
     return syntax;
 }
 
-Syntax *variable_new(char *var_name) {
-    Variable *variable = malloc(sizeof(Variable));
+Syntax *variable_new(Arena *arena, char *var_name) {
+    Variable *variable = syntax_alloc(arena, sizeof(Variable));
     variable->var_name = var_name;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = VARIABLE;
     syntax->variable = variable;
 
     return syntax;
 }
 
-Syntax *bitwise_negation_new(Syntax *expression) {
-    UnaryExpression *unary_syntax = malloc(sizeof(UnaryExpression));
+Syntax *bitwise_negation_new(Arena *arena, Syntax *expression) {
+    UnaryExpression *unary_syntax =
+        syntax_alloc(arena, sizeof(UnaryExpression));
     unary_syntax->unary_type = BITWISE_NEGATION;
     unary_syntax->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = UNARY_OPERATOR;
     syntax->unary_expression = unary_syntax;
 
     return syntax;
 }
 
-Syntax *logical_negation_new(Syntax *expression) {
-    UnaryExpression *unary_syntax = malloc(sizeof(UnaryExpression));
+Syntax *logical_negation_new(Arena *arena, Syntax *expression) {
+    UnaryExpression *unary_syntax =
+        syntax_alloc(arena, sizeof(UnaryExpression));
     unary_syntax->unary_type = LOGICAL_NEGATION;
     unary_syntax->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = UNARY_OPERATOR;
     syntax->unary_expression = unary_syntax;
 
     return syntax;
 }
 
-Syntax *addition_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+Syntax *addition_new(Arena *arena, Syntax *left, Syntax *right) {
+    BinaryExpression *binary_syntax =
+        syntax_alloc(arena, sizeof(BinaryExpression));
     binary_syntax->binary_type = ADDITION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *subtraction_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+Syntax *subtraction_new(Arena *arena, Syntax *left, Syntax *right) {
+    BinaryExpression *binary_syntax =
+        syntax_alloc(arena, sizeof(BinaryExpression));
     binary_syntax->binary_type = SUBTRACTION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *multiplication_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+Syntax *multiplication_new(Arena *arena, Syntax *left, Syntax *right) {
+    BinaryExpression *binary_syntax =
+        syntax_alloc(arena, sizeof(BinaryExpression));
     binary_syntax->binary_type = MULTIPLICATION;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *less_than_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+Syntax *less_than_new(Arena *arena, Syntax *left, Syntax *right) {
+    BinaryExpression *binary_syntax =
+        syntax_alloc(arena, sizeof(BinaryExpression));
     binary_syntax->binary_type = LESS_THAN;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *less_or_equal_new(Syntax *left, Syntax *right) {
-    BinaryExpression *binary_syntax = malloc(sizeof(BinaryExpression));
+Syntax *less_or_equal_new(Arena *arena, Syntax *left, Syntax *right) {
+    BinaryExpression *binary_syntax =
+        syntax_alloc(arena, sizeof(BinaryExpression));
     binary_syntax->binary_type = LESS_THAN_OR_EQUAL;
     binary_syntax->left = left;
     binary_syntax->right = right;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BINARY_OPERATOR;
     syntax->binary_expression = binary_syntax;
 
     return syntax;
 }
 
-Syntax *function_call_new(char *function_name, Syntax *func_args) {
-    FunctionCall *function_call = malloc(sizeof(FunctionCall));
+Syntax *function_call_new(Arena *arena, char *function_name,
+                          Syntax *func_args) {
+    FunctionCall *function_call = syntax_alloc(arena, sizeof(FunctionCall));
     function_call->function_name = function_name;
     function_call->function_arguments = func_args;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = FUNCTION_CALL;
     syntax->function_call = function_call;
 
     return syntax;
 }
 
-Syntax *function_arguments_new() {
-    FunctionArguments *func_args = malloc(sizeof(FunctionArguments));
-    func_args->arguments = list_new();
+Syntax *function_arguments_new(Arena *arena) {
+    FunctionArguments *func_args =
+        syntax_alloc(arena, sizeof(FunctionArguments));
+    func_args->arguments = list_new_in(arena);
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = FUNCTION_ARGUMENTS;
     syntax->function_arguments = func_args;
 
     return syntax;
 }
 
-Syntax *assignment_new(char *var_name, Syntax *expression) {
-    Assignment *assignment = malloc(sizeof(Assignment));
+Syntax *assignment_new(Arena *arena, char *var_name, Syntax *expression) {
+    Assignment *assignment = syntax_alloc(arena, sizeof(Assignment));
     assignment->var_name = var_name;
     assignment->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = ASSIGNMENT;
     syntax->assignment = assignment;
 
     return syntax;
 }
 
-Syntax *return_statement_new(Syntax *expression) {
-    ReturnStatement *return_statement = malloc(sizeof(ReturnStatement));
+Syntax *return_statement_new(Arena *arena, Syntax *expression) {
+    ReturnStatement *return_statement =
+        syntax_alloc(arena, sizeof(ReturnStatement));
     return_statement->expression = expression;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = RETURN_STATEMENT;
     syntax->return_statement = return_statement;
 
     return syntax;
 }
 
-Syntax *block_new(List *statements) {
-    Block *block = malloc(sizeof(Block));
+Syntax *block_new(Arena *arena, List *statements) {
+    Block *block = syntax_alloc(arena, sizeof(Block));
     block->statements = statements;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = BLOCK;
     syntax->block = block;
 
     return syntax;
 }
 
-Syntax *if_new(Syntax *condition, Syntax *then) {
-    IfStatement *if_statement = malloc(sizeof(IfStatement));
+Syntax *if_new(Arena *arena, Syntax *condition, Syntax *then) {
+    IfStatement *if_statement = syntax_alloc(arena, sizeof(IfStatement));
     if_statement->condition = condition;
     if_statement->then = then;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = IF_STATEMENT;
     syntax->if_statement = if_statement;
 
     return syntax;
 }
 
-Syntax *define_var_new(char *var_name, Syntax *init_value) {
+Syntax *define_var_new(Arena *arena, char *var_name, Syntax *init_value) {
     DefineVarStatement *define_var_statement =
-        malloc(sizeof(DefineVarStatement));
+        syntax_alloc(arena, sizeof(DefineVarStatement));
     define_var_statement->var_name = var_name;
     define_var_statement->init_value = init_value;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = DEFINE_VAR;
     syntax->define_var_statement = define_var_statement;
 
     return syntax;
 }
 
-Syntax *while_new(Syntax *condition, Syntax *body) {
-    WhileStatement *while_statement = malloc(sizeof(WhileStatement));
+Syntax *while_new(Arena *arena, Syntax *condition, Syntax *body) {
+    WhileStatement *while_statement =
+        syntax_alloc(arena, sizeof(WhileStatement));
     while_statement->condition = condition;
     while_statement->body = body;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = WHILE_SYNTAX;
     syntax->while_statement = while_statement;
 
     return syntax;
 }
 
-Syntax *function_new(char *name, Syntax *root_block) {
-    Function *function = malloc(sizeof(Function));
+Parameter *parameter_new(Arena *arena, char *name) {
+    Parameter *parameter = syntax_alloc(arena, sizeof(Parameter));
+    parameter->name = name;
+
+    return parameter;
+}
+
+Syntax *function_new(Arena *arena, char *name, List *parameters,
+                     Syntax *root_block) {
+    Function *function = syntax_alloc(arena, sizeof(Function));
     function->name = name;
-    function->parameters = NULL;
+    function->parameters = parameters;
     function->root_block = root_block;
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = FUNCTION;
     syntax->function = function;
 
     return syntax;
 }
 
-Syntax *top_level_new() {
-    TopLevel *top_level = malloc(sizeof(TopLevel));
-    top_level->declarations = list_new();
+Syntax *top_level_new(Arena *arena) {
+    TopLevel *top_level = syntax_alloc(arena, sizeof(TopLevel));
+    top_level->declarations = list_new_in(arena);
 
-    Syntax *syntax = malloc(sizeof(Syntax));
+    Syntax *syntax = syntax_node_alloc(arena);
     syntax->type = TOP_LEVEL;
     syntax->top_level = top_level;
 
     return syntax;
 }
 
-void syntax_list_free(List *syntaxes) {
-    if (syntaxes == NULL) {
-        return;
-    }
-
-    for (int i = 0; i < list_length(syntaxes); i++) {
-        syntax_free(list_get(syntaxes, i));
-    }
-
-    list_free(syntaxes);
-}
-
-void syntax_free(Syntax *syntax) {
-    if (syntax->type == IMMEDIATE) {
-        free(syntax->immediate);
-
-    } else if (syntax->type == VARIABLE) {
-        free(syntax->variable->var_name);
-        free(syntax->variable);
-
-    } else if (syntax->type == UNARY_OPERATOR) {
-        syntax_free(syntax->unary_expression->expression);
-        free(syntax->unary_expression);
-
-    } else if (syntax->type == BINARY_OPERATOR) {
-        syntax_free(syntax->binary_expression->left);
-        syntax_free(syntax->binary_expression->right);
-        free(syntax->binary_expression);
-
-    } else if (syntax->type == FUNCTION_CALL) {
-        syntax_free(syntax->function_call->function_arguments);
-        free(syntax->function_call->function_name);
-        free(syntax->function_call);
-
-    } else if (syntax->type == FUNCTION_ARGUMENTS) {
-        syntax_list_free(syntax->function_arguments->arguments);
-        free(syntax->function_arguments);
-
-    } else if (syntax->type == IF_STATEMENT) {
-        syntax_free(syntax->if_statement->condition);
-        syntax_free(syntax->if_statement->then);
-
-    } else if (syntax->type == RETURN_STATEMENT) {
-        syntax_free(syntax->return_statement->expression);
-        free(syntax->return_statement);
-
-    } else if (syntax->type == DEFINE_VAR) {
-        free(syntax->define_var_statement->var_name);
-        syntax_free(syntax->define_var_statement->init_value);
-        free(syntax->define_var_statement);
-
-    } else if (syntax->type == BLOCK) {
-        syntax_list_free(syntax->block->statements);
-        free(syntax->block);
-
-    } else if (syntax->type == FUNCTION) {
-        free(syntax->function->name);
-        syntax_free(syntax->function->root_block);
-
-        free(syntax->function);
-
-    } else if (syntax->type == ASSIGNMENT) {
-        free(syntax->assignment->var_name);
-        syntax_free(syntax->assignment->expression);
-
-        free(syntax->assignment);
-
-    } else if (syntax->type == WHILE_SYNTAX) {
-        syntax_free(syntax->while_statement->condition);
-        syntax_free(syntax->while_statement->body);
-
-    } else if (syntax->type == TOP_LEVEL) {
-        syntax_list_free(syntax->top_level->declarations);
-        free(syntax->top_level);
-    } else {
-        warnx("Could not free syntax tree with type: %s",
-              syntax_type_name(syntax));
-    }
-
-    free(syntax);
-}
-
-char *syntax_type_name(Syntax *syntax) {
-    if (syntax->type == IMMEDIATE) {
+/* The name of a syntax node of type TYPE. OPERATOR_TYPE is the
+ * UnaryExpressionType or BinaryExpressionType of operator nodes, and
+ * is ignored otherwise.
+ */
+char *syntax_kind_name(SyntaxType type, int operator_type) {
+    if (type == IMMEDIATE) {
         return "IMMEDIATE";
-    } else if (syntax->type == VARIABLE) {
+    } else if (type == VARIABLE) {
         return "VARIABLE";
-    } else if (syntax->type == UNARY_OPERATOR) {
-        if (syntax->unary_expression->unary_type == BITWISE_NEGATION) {
+    } else if (type == UNARY_OPERATOR) {
+        if (operator_type == BITWISE_NEGATION) {
             return "UNARY BITWISE_NEGATION";
-        } else if (syntax->unary_expression->unary_type == LOGICAL_NEGATION) {
+        } else if (operator_type == LOGICAL_NEGATION) {
             return "UNARY BITWISE_NEGATION";
         }
-    } else if (syntax->type == BINARY_OPERATOR) {
-        if (syntax->binary_expression->binary_type == ADDITION) {
+    } else if (type == BINARY_OPERATOR) {
+        if (operator_type == ADDITION) {
             return "ADDITION";
-        } else if (syntax->binary_expression->binary_type == SUBTRACTION) {
+        } else if (operator_type == SUBTRACTION) {
             return "SUBTRACTION";
-        } else if (syntax->binary_expression->binary_type == MULTIPLICATION) {
+        } else if (operator_type == MULTIPLICATION) {
             return "MULTIPLICATION";
-        } else if (syntax->binary_expression->binary_type == LESS_THAN) {
+        } else if (operator_type == LESS_THAN) {
             return "LESS THAN";
-        } else if (syntax->binary_expression->binary_type ==
-                   LESS_THAN_OR_EQUAL) {
+        } else if (operator_type == LESS_THAN_OR_EQUAL) {
             return "LESS THAN OR EQUAL";
         }
-    } else if (syntax->type == FUNCTION_CALL) {
+    } else if (type == FUNCTION_CALL) {
         return "FUNCTION CALL";
-    } else if (syntax->type == FUNCTION_ARGUMENTS) {
+    } else if (type == FUNCTION_ARGUMENTS) {
         return "FUNCTION ARGUMENTS";
-    } else if (syntax->type == IF_STATEMENT) {
+    } else if (type == IF_STATEMENT) {
         return "IF";
-    } else if (syntax->type == RETURN_STATEMENT) {
+    } else if (type == RETURN_STATEMENT) {
         return "RETURN";
-    } else if (syntax->type == DEFINE_VAR) {
+    } else if (type == DEFINE_VAR) {
         return "DEFINE VARIABLE";
-    } else if (syntax->type == BLOCK) {
+    } else if (type == BLOCK) {
         return "BLOCK";
-    } else if (syntax->type == FUNCTION) {
+    } else if (type == FUNCTION) {
         return "FUNCTION";
-    } else if (syntax->type == ASSIGNMENT) {
+    } else if (type == ASSIGNMENT) {
         return "ASSIGNMENT";
-    } else if (syntax->type == WHILE_SYNTAX) {
+    } else if (type == WHILE_SYNTAX) {
         return "WHILE";
-    } else if (syntax->type == TOP_LEVEL) {
+    } else if (type == TOP_LEVEL) {
         return "TOP LEVEL";
     }
 
@@ -365,6 +319,17 @@ char *syntax_type_name(Syntax *syntax) {
     return "??? UNKNOWN SYNTAX";
 }
 
+char *syntax_type_name(Syntax *syntax) {
+    if (syntax->type == UNARY_OPERATOR) {
+        return syntax_kind_name(syntax->type,
+                                syntax->unary_expression->unary_type);
+    } else if (syntax->type == BINARY_OPERATOR) {
+        return syntax_kind_name(syntax->type,
+                                syntax->binary_expression->binary_type);
+    }
+    return syntax_kind_name(syntax->type, 0);
+}
+
 void print_syntax_indented(Syntax *syntax, int indent) {
     for (int i = 0; i < indent; i++) {
         printf(" ");
@@ -444,6 +409,16 @@ void print_syntax_indented(Syntax *syntax, int indent) {
 
     } else if (syntax->type == FUNCTION) {
         printf("%s '%s'\n", syntax_type_string, syntax->function->name);
+
+        List *parameters = syntax->function->parameters;
+        for (int i = 0; i < list_length(parameters); i++) {
+            Parameter *parameter = list_get(parameters, i);
+            for (int j = 0; j < indent + 4; j++) {
+                printf(" ");
+            }
+            printf("PARAMETER '%s'\n", parameter->name);
+        }
+
         print_syntax_indented(syntax->function->root_block, indent + 4);
 
     } else if (syntax->type == ASSIGNMENT) {
@@ -451,8 +426,15 @@ void print_syntax_indented(Syntax *syntax, int indent) {
         print_syntax_indented(syntax->assignment->expression, indent + 4);
 
     } else if (syntax->type == WHILE_SYNTAX) {
-        printf("%s\n", syntax_type_string);
-        print_syntax_indented(syntax->assignment->expression, indent + 4);
+        printf("%s CONDITION\n", syntax_type_string);
+        print_syntax_indented(syntax->while_statement->condition, indent + 4);
+
+        for (int i = 0; i < indent; i++) {
+            printf(" ");
+        }
+
+        printf("%s BODY\n", syntax_type_string);
+        print_syntax_indented(syntax->while_statement->body, indent + 4);
 
     } else if (syntax->type == TOP_LEVEL) {
         printf("%s\n", syntax_type_string);
@@ -1,4 +1,5 @@
 #include "list.h"
+#include "arena.h"
 
 #ifndef BABYC_SYNTAX_HEADER
 #define BABYC_SYNTAX_HEADER
@@ -32,6 +33,9 @@ typedef enum {
 struct Syntax;
 typedef struct Syntax Syntax;
 
+// All names (variables, functions) in the syntax tree are interned,
+// see intern.h.
+
 typedef struct Immediate { int value; } Immediate;
 
 typedef struct Variable {
@@ -83,6 +87,7 @@ typedef struct Block { List *statements; } Block;
 
 typedef struct Function {
     char *name;
+    // Parameters, in order.
     List *parameters;
     Syntax *root_block;
 } Function;
@@ -127,45 +132,48 @@ struct Syntax {
     };
 };
 
-Syntax *immediate_new(int value);
+Syntax *immediate_new(Arena *arena, int value);
+
+Syntax *variable_new(Arena *arena, char *var_name);
 
-Syntax *variable_new(char *var_name);
+Syntax *bitwise_negation_new(Arena *arena, Syntax *expression);
 
-Syntax *bitwise_negation_new(Syntax *expression);
+Syntax *logical_negation_new(Arena *arena, Syntax *expression);
 
-Syntax *logical_negation_new(Syntax *expression);
+Syntax *addition_new(Arena *arena, Syntax *left, Syntax *right);
 
-Syntax *addition_new(Syntax *left, Syntax *right);
+Syntax *subtraction_new(Arena *arena, Syntax *left, Syntax *right);
 
-Syntax *subtraction_new(Syntax *left, Syntax *right);
+Syntax *multiplication_new(Arena *arena, Syntax *left, Syntax *right);
 
-Syntax *multiplication_new(Syntax *left, Syntax *right);
+Syntax *less_than_new(Arena *arena, Syntax *left, Syntax *right);
 
-Syntax *less_than_new(Syntax *left, Syntax *right);
+Syntax *less_or_equal_new(Arena *arena, Syntax *left, Syntax *right);
 
-Syntax *less_or_equal_new(Syntax *left, Syntax *right);
+Syntax *function_call_new(Arena *arena, char *function_name, Syntax *func_args);
 
-Syntax *function_call_new(char *function_name, Syntax *func_args);
+Syntax *function_arguments_new(Arena *arena);
 
-Syntax *function_arguments_new();
+Syntax *assignment_new(Arena *arena, char *var_name, Syntax *expression);
 
-Syntax *assignment_new(char *var_name, Syntax *expression);
+Syntax *return_statement_new(Arena *arena, Syntax *expression);
 
-Syntax *return_statement_new(Syntax *expression);
+Syntax *block_new(Arena *arena, List *statements);
 
-Syntax *block_new(List *statements);
+Syntax *if_new(Arena *arena, Syntax *condition, Syntax *then);
 
-Syntax *if_new(Syntax *condition, Syntax *then);
+Syntax *define_var_new(Arena *arena, char *var_name, Syntax *init_value);
 
-Syntax *define_var_new(char *var_name, Syntax *init_value);
+Syntax *while_new(Arena *arena, Syntax *condition, Syntax *body);
 
-Syntax *while_new(Syntax *condition, Syntax *body);
+Parameter *parameter_new(Arena *arena, char *name);
 
-Syntax *function_new(char *name, Syntax *root_block);
+Syntax *function_new(Arena *arena, char *name, List *parameters,
+                     Syntax *root_block);
 
-Syntax *top_level_new();
+Syntax *top_level_new(Arena *arena);
 
-void syntax_free(Syntax *syntax);
+char *syntax_kind_name(SyntaxType type, int operator_type);
 
 char *syntax_type_name(Syntax *syntax);
 
@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tail_calls.h"
+#include "ir.h"
+#include "list.h"
+
+/* Compile `return f()` without growing the stack. A call to the
+ * function we're in becomes a jump back to its start, so tail
+ * recursion runs as a loop. A call to anything else becomes an
+ * IR_TAIL_CALL, which the backend writes as a frame teardown followed
+ * by a jmp, so the callee returns straight to our caller.
+ */
+
+/* Does BLOCK, in FUNCTION, end by returning the result of a call it
+ * has just made, which we can make without a new frame?
+ */
+static bool ends_in_tail_call(IrProgram *program, IrFunction *function,
+                              IrBlock *block) {
+    if (block->instruction_count < 2) {
+        return false;
+    }
+
+    IrInstruction *call = &block->instructions[block->instruction_count - 2];
+    IrInstruction *ret = &block->instructions[block->instruction_count - 1];
+    if (call->opcode != IR_CALL || ret->opcode != IR_RETURN ||
+        ret->operands[0].kind != IR_OPERAND_VREG ||
+        ret->operands[0].value != call->dest) {
+        return false;
+    }
+
+    // Arguments on the stack overwrite our own, so they have to fit in
+    // the space our caller gave us.
+    CallingConvention convention =
+        ir_callee_convention(program, call->function_name);
+    return ir_stack_argument_count(convention, call->argument_count) <=
+           ir_stack_argument_count(function->convention,
+                                   function->parameter_count);
+}
+
+/* Replace the tail call to FUNCTION at the end of BLOCK with
+ * assignments to its parameters and a jump to HEADER. We copy every
+ * argument before assigning any parameter, as an argument may read
+ * another parameter, e.g. f(b, a).
+ */
+static void loop_tail_call(IrProgram *program, IrFunction *function,
+                           IrBlock *block, IrVreg *parameters,
+                           IrBlock *header) {
+    IrInstruction call = block->instructions[block->instruction_count - 2];
+    block->instruction_count -= 2;
+
+    IrVreg *temporaries = malloc(call.argument_count * sizeof(IrVreg));
+    for (int i = 0; i < call.argument_count; i++) {
+        temporaries[i] = ir_vreg_new(program, function, NULL);
+        IrInstruction *copy =
+            ir_append(program, block, IR_COPY, temporaries[i]);
+        copy->operands[0] = call.arguments[i];
+    }
+
+    for (int i = 0; i < call.argument_count; i++) {
+        if (i >= function->parameter_count || parameters[i] == IR_NO_VREG) {
+            continue;
+        }
+        IrInstruction *copy = ir_append(program, block, IR_COPY, parameters[i]);
+        copy->operands[0] = ir_vreg_operand(temporaries[i]);
+    }
+
+    free(temporaries);
+    ir_jump(program, block, header);
+}
+
+/* Move the IR_PARAMETER instructions at the start of FUNCTION's entry
+ * block into a new entry block, which falls through to the old one.
+ * The old entry becomes a loop header that tail calls can jump back
+ * to, and SSA construction still sees an entry block without
+ * predecessors. Returns the old entry block, and sets PARAMETERS to
+ * the vreg of each parameter (or IR_NO_VREG if it's unused and has
+ * been removed).
+ */
+static IrBlock *add_loop_header(IrProgram *program, IrFunction *function,
+                                IrVreg *parameters) {
+    IrBlock *header = list_get(function->blocks, 0);
+    IrBlock *entry = ir_block_new(program, function);
+    list_pop(function->blocks);
+    list_push(function->blocks, entry);
+
+    for (int i = 0; i < function->parameter_count; i++) {
+        parameters[i] = IR_NO_VREG;
+    }
+
+    int count = 0;
+    while (count < header->instruction_count &&
+           header->instructions[count].opcode == IR_PARAMETER) {
+        IrInstruction *parameter = &header->instructions[count];
+        parameters[parameter->parameter] = parameter->dest;
+
+        IrInstruction *moved = ir_append(program, entry, IR_PARAMETER,
+                                         parameter->dest);
+        moved->parameter = parameter->parameter;
+        count++;
+    }
+
+    header->instruction_count -= count;
+    memmove(header->instructions, &header->instructions[count],
+            header->instruction_count * sizeof(IrInstruction));
+
+    ir_jump(program, entry, header);
+    return header;
+}
+
+/* Rewrite the tail calls in every function in PROGRAM. Returns the
+ * number of calls rewritten.
+ */
+int eliminate_tail_calls(IrProgram *program) {
+    int eliminated = 0;
+
+    for (int i = 0; i < list_length(program->functions); i++) {
+        IrFunction *function = list_get(program->functions, i);
+        IrBlock *header = NULL;
+        IrVreg *parameters =
+            malloc((function->parameter_count + 1) * sizeof(IrVreg));
+
+        for (int j = 0; j < list_length(function->blocks); j++) {
+            IrBlock *block = list_get(function->blocks, j);
+            if (!ends_in_tail_call(program, function, block)) {
+                continue;
+            }
+
+            IrInstruction *call =
+                &block->instructions[block->instruction_count - 2];
+            if (strcmp(call->function_name, function->name) == 0) {
+                if (header == NULL) {
+                    header = add_loop_header(program, function, parameters);
+                }
+                loop_tail_call(program, function, block, parameters, header);
+            } else {
+                call->opcode = IR_TAIL_CALL;
+                call->dest = IR_NO_VREG;
+                block->instruction_count--;
+            }
+            eliminated++;
+        }
+
+        if (header != NULL) {
+            ir_renumber_blocks(function);
+            ir_compute_predecessors(program, function);
+        }
+        free(parameters);
+    }
+
+    return eliminated;
+}
@@ -0,0 +1,8 @@
+#include "ir.h"
+
+#ifndef BABYC_TAIL_CALLS_HEADER
+#define BABYC_TAIL_CALLS_HEADER
+
+int eliminate_tail_calls(IrProgram *program);
+
+#endif
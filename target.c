@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "target.h"
+#include "regalloc.h"
+
+static Register i386_allocatable[] = {REG_ECX, REG_EDX, REG_EBX, REG_ESI,
+                                      REG_EDI};
+static Register i386_callee_saved[] = {REG_EBX, REG_ESI, REG_EDI};
+static Register i386_caller_saved[] = {REG_ECX, REG_EDX};
+
+Target target_i386 = {
+    "i386",
+    4,
+    4,
+    "%esp",
+    "%ebp",
+    "pushl",
+    i386_allocatable,
+    5,
+    i386_callee_saved,
+    3,
+    i386_caller_saved,
+    2,
+    CALLING_CONVENTION_CDECL,
+    "--32",
+    "elf_i386",
+};
+
+static Register x86_64_allocatable[] = {
+    REG_ECX, REG_EDX, REG_ESI, REG_EDI, REG_R8,  REG_R9,  REG_R10,
+    REG_R11, REG_EBX, REG_R12, REG_R13, REG_R14, REG_R15};
+static Register x86_64_callee_saved[] = {REG_EBX, REG_R12, REG_R13, REG_R14,
+                                         REG_R15};
+static Register x86_64_caller_saved[] = {REG_ECX, REG_EDX, REG_ESI, REG_EDI,
+                                         REG_R8,  REG_R9,  REG_R10, REG_R11};
+
+Target target_x86_64 = {
+    "x86_64",
+    8,
+    16,
+    "%rsp",
+    "%rbp",
+    "pushq",
+    x86_64_allocatable,
+    13,
+    x86_64_callee_saved,
+    5,
+    x86_64_caller_saved,
+    8,
+    CALLING_CONVENTION_SYSV,
+    "--64",
+    "elf_x86_64",
+};
+
+/* The target called NAME, or NULL if we don't support it. */
+Target *target_find(char *name) {
+    if (strcmp(name, "i386") == 0) {
+        return &target_i386;
+    } else if (strcmp(name, "x86_64") == 0) {
+        return &target_x86_64;
+    }
+    return NULL;
+}
+
+/* The name of all of REG, as we push and pop it. */
+char *target_register_name(Target *target, Register reg) {
+    if (target->word_size == 8) {
+        return register_quad_name(reg);
+    }
+    return register_name(reg);
+}
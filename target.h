@@ -0,0 +1,56 @@
+#include "ir.h"
+#include "regalloc.h"
+
+#ifndef BABYC_TARGET_HEADER
+#define BABYC_TARGET_HEADER
+
+/* The machine we're writing assembly for. The backend only differs
+ * between targets in the registers it may use, how it calls functions
+ * and the sizes of things it pushes. Values are 32-bit ints on every
+ * target.
+ */
+typedef struct Target {
+    char *name;
+
+    // The size of a pointer, and so of everything we push: return
+    // addresses, saved registers and stack arguments.
+    int word_size;
+    // The stack pointer must be a multiple of this at every call.
+    int stack_alignment;
+
+    char *stack_pointer;
+    char *frame_pointer;
+    // The mnemonic for pushing a word, which the assembler can't
+    // infer from an immediate or memory operand.
+    char *push;
+
+    // Registers we allocate to vregs. The caller-saved ones come
+    // first, so values that aren't live across a call don't cost us a
+    // save and restore in the prologue and epilogue.
+    Register *allocatable_registers;
+    int allocatable_register_count;
+    // Callee-saved registers, in the order we save them.
+    Register *callee_saved_registers;
+    int callee_saved_register_count;
+    // Caller-saved registers that we allocate, so must save around
+    // calls.
+    Register *caller_saved_registers;
+    int caller_saved_register_count;
+
+    // How every function is called, unless overridden by --fastcall.
+    CallingConvention convention;
+
+    // Flags for as and ld.
+    char *assembler_flag;
+    char *linker_emulation;
+} Target;
+
+extern Target target_i386;
+
+extern Target target_x86_64;
+
+Target *target_find(char *name);
+
+char *target_register_name(Target *target, Register reg);
+
+#endif
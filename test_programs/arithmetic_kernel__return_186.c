@@ -0,0 +1,14 @@
+int main() {
+    int a = 3;
+    int b = 4;
+    int c = 5;
+    int total = 0;
+    int i = 0;
+
+    while (i < 10) {
+        total = total + a * b * c + b * c * a - a * c + b * b * b - c * a;
+        i = i + 1;
+    }
+
+    return total - 1354;
+}
@@ -0,0 +1,19 @@
+int main() {
+    int x = 2 * 3 + 4;
+    int y = x * 1 + 0 - 0;
+    int z = 2147483647 + 1 - 2147483647;
+
+    if (0) {
+        return 1;
+    }
+    while (0) {
+        return 2;
+    }
+    if (!!y) {
+        y = y * 0 + y;
+    }
+
+    while (1) {
+        return y * z;
+    }
+}
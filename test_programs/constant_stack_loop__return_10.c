@@ -0,0 +1,18 @@
+int one() {
+    return 1;
+}
+
+int main() {
+    int i = 0;
+    int total = 0;
+
+    // Leaking even one word per iteration would overflow the stack
+    // before we're done.
+    while (i < 3000000) {
+        int step = one() + i * 2 - i * 2;
+        total = total + step;
+        i = i + 1;
+    }
+
+    return total - 2999990;
+}
@@ -0,0 +1,25 @@
+int main() {
+    int x = 5;
+    int y = 1;
+    int unused = 3;
+
+    // Dead stores.
+    x = 2;
+    unused = unused + 1;
+
+    if (y) {
+        x = x + 10;
+    }
+    if (!y) {
+        x = 0;
+    }
+
+    while (y < 1) {
+        x = 99;
+    }
+
+    return x;
+
+    x = 1;
+    return x;
+}
@@ -0,0 +1,15 @@
+int subtract(int a, int b) {
+    return a - b;
+}
+
+int combine(int a, int b, int c, int d) {
+    int sum = a + b;
+    return sum * c - d;
+}
+
+int main() {
+    int x = 5;
+    // Arguments are evaluated before the call, and may be calls
+    // themselves.
+    return combine(subtract(x, 2), 1, subtract(10, 4), x - 6);
+}
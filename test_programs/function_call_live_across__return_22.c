@@ -0,0 +1,18 @@
+int seven() {
+    int a = 3;
+    int b = 4;
+    return a + b;
+}
+
+int main() {
+    int a = 1;
+    int b = 2;
+    int c = 3;
+    int d = 4;
+    int e = 5;
+
+    // More values are live across this call than there are
+    // callee-saved registers.
+    int f = seven();
+    return a + b + c + d + e + f;
+}
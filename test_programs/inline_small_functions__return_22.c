@@ -0,0 +1,25 @@
+int three() {
+    return 3;
+}
+
+int four() {
+    int x = three();
+    if (x < 5) {
+        return x + 1;
+    }
+    return 0;
+}
+
+int sum_to_four() {
+    int i = 0;
+    int total = 0;
+    while (i < four()) {
+        i = i + 1;
+        total = total + i;
+    }
+    return total;
+}
+
+int main() {
+    return sum_to_four() + four() * three();
+}
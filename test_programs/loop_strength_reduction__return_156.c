@@ -0,0 +1,20 @@
+int sum(int n, int scale, int offset) {
+    int total = 0;
+    int i = 0;
+    while (i < n) {
+        // scale * offset is loop invariant, i * scale is strength reduced.
+        total = total + i * scale + scale * offset;
+        i = i + 2;
+    }
+    return total;
+}
+
+int main() {
+    int result = 0;
+    int j = 1;
+    while (j < 4) {
+        result = result + sum(10, j, 3) - j * 9;
+        j = j + 1;
+    }
+    return result;
+}
@@ -0,0 +1,16 @@
+// More arguments than x86-64 passes in registers, so the last two go
+// on the stack.
+int weigh(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a * 1 + b * 2 + c * 3 - d + e - f + g * 4 - h;
+}
+
+int rotate(int a, int b, int c, int d, int e, int f, int g, int h) {
+    // Each argument comes from another parameter's register.
+    return weigh(b, c, d, e, f, g, h, a);
+}
+
+int main() {
+    int kept = 3;
+    int weighed = rotate(1, 2, 3, 4, 5, 6, 7, 8);
+    return weighed - kept;
+}
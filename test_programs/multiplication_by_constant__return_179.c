@@ -0,0 +1,17 @@
+int scale(int x, int y) {
+    // Constant multipliers become shifts, lea or a three operand imul.
+    int total = x * 2 + 3 * y + x * 5 + y * 9 + 16 * x + y * 7;
+    // Immediates on the left of subtractions and comparisons.
+    total = total + 10 - x;
+    if (3 < y) {
+        total = total + 100;
+    }
+    if (y <= 2) {
+        total = total + 1000;
+    }
+    return total;
+}
+
+int main() {
+    return scale(2, 4) - scale(1, 1) + 1000;
+}
@@ -0,0 +1,8 @@
+#ifndef PREPROCESSOR_MACROS_H
+#define PREPROCESSOR_MACROS_H
+
+#define LIMIT 10
+#define SQUARE(x) x * x
+#define ADD(a, b) a + b
+
+#endif
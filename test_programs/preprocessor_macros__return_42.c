@@ -0,0 +1,33 @@
+#include "preprocessor_macros.h"
+// Included twice, but the include guard skips it.
+#include "preprocessor_macros.h"
+
+#define CONCAT(a, b) a##b
+#define VERSION 2
+
+#if VERSION >= 2 && defined(LIMIT)
+#define STEP 3
+#elif VERSION == 1
+#define STEP 2
+#else
+#define STEP 1
+#endif
+
+#ifdef UNDEFINED_MACRO
+int broken(
+#endif
+
+int main() {
+    int CONCAT(total, 1) = 0;
+    int i = 0;
+    while (i < LIMIT) {
+        total1 = ADD(total1,
+                     STEP);
+        i = i + 1;
+    }
+#undef STEP
+#ifndef STEP
+    total1 = total1 + SQUARE(VERSION) + 8;
+#endif
+    return total1;
+}
@@ -0,0 +1,12 @@
+// Skipped groups only have to lex as far as finding directives, so
+// unterminated quotes in them are fine, as they are for gcc.
+#if 0
+This isn't code.
+#error don't stop here
+#endif
+
+#ifdef NOT_DEFINED
+int main() { return "unterminated; }
+#else
+int main() { return 7; }
+#endif
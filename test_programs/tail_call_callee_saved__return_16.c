@@ -0,0 +1,32 @@
+int nine() {
+    return 9;
+}
+
+int tail() {
+    int a = 1;
+    int b = 2;
+    int c = 3;
+    int d = 4;
+    int e = 5;
+    int h = 6;
+    int i = 0;
+    while (i < 3) {
+        a = a + b * c;
+        b = b + d;
+        c = c * e + h;
+        i = i + 1;
+    }
+
+    // This function uses callee-saved registers, so it has to restore
+    // them before jumping to nine.
+    if (a < 0) {
+        return a + b + c + d + e + h;
+    }
+    return nine();
+}
+
+int main() {
+    int x = 7;
+    int y = tail();
+    return x + y;
+}
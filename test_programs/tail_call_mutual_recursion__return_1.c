@@ -0,0 +1,18 @@
+int is_even(int n) {
+    if (n < 1) {
+        return 1;
+    }
+    return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+    if (n < 1) {
+        return 0;
+    }
+    return is_even(n - 1);
+}
+
+int main() {
+    // A million calls deep, each a tail call to the other function.
+    return is_even(1000000);
+}
@@ -0,0 +1,12 @@
+// Without tail calls, a million frames would overflow the stack.
+int count(int n, int total) {
+    if (n < 1) {
+        return total;
+    }
+    return count(n - 1, total + 1);
+}
+
+int main() {
+    // 1000000 is 64 mod 256.
+    return count(1000000, 0);
+}
@@ -0,0 +1,12 @@
+// Each call swaps its arguments, so they must all be read before any
+// parameter is updated.
+int swap(int a, int b, int n) {
+    if (n < 1) {
+        return a - b;
+    }
+    return swap(b, a, n - 1);
+}
+
+int main() {
+    return swap(10, 3, 1000000);
+}
@@ -0,0 +1,11 @@
+// Statements that -O removes must still only use defined variables.
+int main() {
+    foo;
+    if (0) {
+        bar = 1;
+    }
+    while (0) {
+        baz;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+// With -O, y * 0 folds to 0, but y must still be defined.
+int main() {
+    return y * 0;
+}
@@ -0,0 +1,7 @@
+// x is only in scope inside the if, even when -O removes the if.
+int main() {
+    if (1) {
+        int x = 1;
+    }
+    return x * 0;
+}
@@ -0,0 +1,4 @@
+// Characters that no token starts with are errors with both lexers.
+int main() {
+    return @1;
+}
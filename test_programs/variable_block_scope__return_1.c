@@ -0,0 +1,8 @@
+int main() {
+    int x = 1;
+    if (1) {
+        int x = 2;
+        x = x + 5;
+    }
+    return x;
+}
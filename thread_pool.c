@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <err.h>
+#include "thread_pool.h"
+
+/* A work-stealing pool. Each thread starts with its own contiguous
+ * share of the tasks, and takes them from the front of its queue.
+ * When it runs out, it steals from the back of another thread's
+ * queue, so a few slow tasks don't leave the other threads idle. No
+ * tasks are added once we've started, so when every queue is empty
+ * we're done.
+ */
+typedef struct WorkQueue {
+    pthread_mutex_t lock;
+    // The tasks still to run are NEXT up to, but not including, END.
+    int next;
+    int end;
+} WorkQueue;
+
+typedef struct ThreadPool {
+    WorkQueue *queues;
+    int thread_count;
+    void (*run)(void *argument, int task);
+    void *argument;
+} ThreadPool;
+
+typedef struct Worker {
+    ThreadPool *pool;
+    int index;
+} Worker;
+
+static bool take_task(WorkQueue *queue, bool steal, int *task) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->next < queue->end;
+    if (found) {
+        *task = steal ? --queue->end : queue->next++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void *worker_run(void *argument) {
+    Worker *worker = argument;
+    ThreadPool *pool = worker->pool;
+
+    int task;
+    while (true) {
+        bool found = take_task(&pool->queues[worker->index], false, &task);
+        // Try the other queues in turn, starting with our neighbour.
+        for (int i = 1; !found && i < pool->thread_count; i++) {
+            int victim = (worker->index + i) % pool->thread_count;
+            found = take_task(&pool->queues[victim], true, &task);
+        }
+        if (!found) {
+            break;
+        }
+
+        pool->run(pool->argument, task);
+    }
+    return NULL;
+}
+
+void thread_pool_run(int thread_count, int task_count,
+                     void (*run)(void *argument, int task), void *argument) {
+    if (thread_count > task_count) {
+        thread_count = task_count;
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+
+    ThreadPool pool = {malloc(sizeof(WorkQueue) * thread_count), thread_count,
+                       run, argument};
+    Worker *workers = malloc(sizeof(Worker) * thread_count);
+    pthread_t *threads = malloc(sizeof(pthread_t) * thread_count);
+
+    for (int i = 0; i < thread_count; i++) {
+        WorkQueue *queue = &pool.queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->next = (long)task_count * i / thread_count;
+        queue->end = (long)task_count * (i + 1) / thread_count;
+
+        workers[i].pool = &pool;
+        workers[i].index = i;
+    }
+
+    // The calling thread is worker 0.
+    for (int i = 1; i < thread_count; i++) {
+        int result = pthread_create(&threads[i], NULL, worker_run, &workers[i]);
+        if (result != 0) {
+            errx(1, "Could not start thread %d of %d", i + 1, thread_count);
+        }
+    }
+    worker_run(&workers[0]);
+    for (int i = 1; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    }
+    free(threads);
+    free(workers);
+    free(pool.queues);
+}
@@ -0,0 +1,11 @@
+#ifndef BABYC_THREAD_POOL_HEADER
+#define BABYC_THREAD_POOL_HEADER
+
+/* Call RUN(ARGUMENT, i) for each i from 0 to TASK_COUNT - 1, on
+ * THREAD_COUNT threads including the caller, and return once they've
+ * all finished. Tasks may run in any order.
+ */
+void thread_pool_run(int thread_count, int task_count,
+                     void (*run)(void *argument, int task), void *argument);
+
+#endif